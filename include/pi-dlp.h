@@ -82,6 +82,8 @@ extern "C" {
 #define PI_DLP_VERSION_MAJOR 1		/**< Major DLP protocol version we report to the device. */
 #define PI_DLP_VERSION_MINOR 4		/**< Minor DLP protocol version we report to the device. */
 
+#define PI_DLP_MAX_PIPELINE 16		/**< Maximum number of DLP requests that can be in flight on a socket (see dlp_submit()) */
+
 #ifndef SWIG
 	#define DLP_BUF_SIZE 0xffff	/**< Kept for compatibility, applications should avoid using this value. */
 #endif /* !SWIG */
@@ -116,6 +118,10 @@ extern "C" {
 
 typedef unsigned long FileRef;			/**< Type for file references when working with VFS files and directories. */
 
+/** @brief Callback used by dlp_ReadRecordsByIndex() to return each record it reads */
+typedef int (*dlp_record_func) PI_ARGS((int sd, int recindex, pi_buffer_t *record,
+	recordid_t recuid, int recattrs, int category, void *userdata));
+
 /** @brief Information retrieved by dlp_VFSDirEntryEnumerate() */
 struct VFSDirInfo {
 	unsigned long attr;			/**< File or directory attributes (see VSF File attribute definitions) */
@@ -593,6 +599,8 @@ struct dlpRequest {
 	enum dlpFunctions cmd;	/**< Command ID */
 	int argc;		/**< Number of arguments */
 	struct dlpArg **argv;	/**< Ptr to arguments */
+	unsigned char *frame;	/**< Request in wire format, the arguments data point into it (NULL if built by hand) */
+	size_t frame_len;	/**< Length of @a frame */
 };
 
 /** @brief Internal DLP command response structure */
@@ -601,6 +609,8 @@ struct dlpResponse {
 	enum dlpErrors err;	/**< DLP error (see #dlpErrors enum) */
 	int argc;		/**< Number of response arguments */
 	struct dlpArg **argv;	/**< Response arguments */
+	pi_buffer_t *buf;	/**< Receive buffer the arguments data point into (NULL if the arguments own their data) */
+	int sd;			/**< Socket the response was read from, @a buf is handed back to it when the response is freed */
 };
 
 #endif	/* !SWIG */
@@ -629,6 +639,31 @@ struct dlpResponse {
 	extern int dlp_exec PI_ARGS((int sd, struct dlpRequest *req,
 		struct dlpResponse **res));
 
+	/** @brief Send a DLP request without waiting for its response
+	 *
+	 * Up to #PI_SOCK_DLP_PIPELINE requests can be submitted before
+	 * their responses are read with dlp_complete(). The device answers
+	 * requests in order, so callers must complete them in the order
+	 * they were submitted, and must not call dlp_exec() while requests
+	 * are still in flight. The request must not be freed before it has
+	 * been passed to dlp_complete().
+	 *
+	 * @param sd Socket number
+	 * @param req Request to send
+	 * @return Number of bytes sent, negative on error. If the pipeline is full, returns #PI_ERR_GENERIC_ARGUMENT
+	 */
+	extern int dlp_submit PI_ARGS((int sd, struct dlpRequest *req));
+
+	/** @brief Read the response to the oldest request sent with dlp_submit()
+	 *
+	 * @param sd Socket number
+	 * @param req The request this response is expected for (the oldest one submitted)
+	 * @param res On return, the response (free it with dlp_response_free() even on error)
+	 * @return Same as dlp_exec()
+	 */
+	extern int dlp_complete PI_ARGS((int sd, struct dlpRequest *req,
+		struct dlpResponse **res));
+
 	extern char *dlp_errorlist[];
 	extern char *dlp_strerror(int error);
 
@@ -636,6 +671,31 @@ struct dlpResponse {
 	extern int dlp_RPC
 		PI_ARGS((int sd, struct RPC_params * p,
 			unsigned long *result));
+
+	/** @brief Send an RPC call without waiting for its reply
+	 *
+	 * Calls that expect a reply share the #PI_SOCK_DLP_PIPELINE depth
+	 * with dlp_submit(), and their replies must be read in order with
+	 * dlp_RPCComplete(). @p p and the buffers it points to must stay
+	 * valid until then.
+	 *
+	 * @param sd Socket number
+	 * @param p Call, built with PackRPC()
+	 * @return 0 on success, negative on error. If the pipeline is full, returns #PI_ERR_GENERIC_ARGUMENT
+	 */
+	extern int dlp_RPCSubmit
+		PI_ARGS((int sd, struct RPC_params * p));
+
+	/** @brief Read the reply to the oldest call sent with dlp_RPCSubmit()
+	 *
+	 * @param sd Socket number
+	 * @param p The call this reply is expected for
+	 * @param result On return, D0 or A0 as asked by the call's reply type (may be NULL)
+	 * @return Same as dlp_RPC()
+	 */
+	extern int dlp_RPCComplete
+		PI_ARGS((int sd, struct RPC_params * p,
+			unsigned long *result));
 #endif	/* !SWIG */
 /*@}*/
 
@@ -1259,6 +1319,26 @@ struct dlpResponse {
 		PI_ARGS((int sd, int dbhandle, int recindex, pi_buffer_t *retbuf,
 			recordid_t *recuid, int *recattrs, int *category));
 
+	/** @brief Read a range of records using their index
+	 *
+	 * Reads @p count records starting at index @p start and passes each
+	 * one to @p callback, in index order. When the socket allows several
+	 * DLP requests in flight (see #PI_SOCK_DLP_PIPELINE), the next
+	 * requests are sent while previous responses are being received,
+	 * which saves one round trip per record.
+	 *
+	 * @param sd Socket number
+	 * @param dbhandle Open database handle, obtained from dlp_OpenDB()
+	 * @param start Index of the first record to read (zero based)
+	 * @param count Number of records to read
+	 * @param callback Called for each record. Return a negative value to stop reading, which is then returned by this function
+	 * @param userdata Passed back to @p callback
+	 * @return A negative value if an error occured (see pi-error.h), the number of records read otherwise
+	 */
+	extern PI_ERR dlp_ReadRecordsByIndex
+		PI_ARGS((int sd, int dbhandle, int start, int count,
+			dlp_record_func callback, void *userdata));
+
 	/** @brief Iterate through modified records in database
 	 *
 	 * Return subsequent modified records on each call. Use dlp_ResetDBIndex()
@@ -0,0 +1,175 @@
+/*
+ * $Id$
+ *
+ * pi-event.h: event loop driving many sockets from a single thread
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/** @file pi-event.h
+ *  @brief Event loop for serving many handhelds from one thread
+ *
+ * An event loop watches any number of sockets and calls back the
+ * application when one of them becomes readable or writable. It uses
+ * epoll where the system has it and poll() elsewhere.
+ *
+ * A sync server registers its listening sockets, accepts each handheld
+ * with pi_accept_new() when the listener becomes readable, and registers
+ * the new connection with its own callback:
+ *
+ * @code
+ *	static void
+ *	on_listen(pi_event_loop_t *loop, int sd, int events, void *data)
+ *	{
+ *		int client = pi_accept_new(sd, NULL, NULL);
+ *
+ *		if (client >= 0)
+ *			pi_event_add(loop, client, PI_EVENT_READ,
+ *				on_client, new_session(client));
+ *	}
+ *
+ *	loop = pi_event_loop_new();
+ *	pi_event_add(loop, listen_sd, PI_EVENT_READ, on_listen, NULL);
+ *	pi_event_loop_run(loop);
+ * @endcode
+ *
+ * Readiness is reported on the socket's system descriptor. For USB
+ * through libusb, which reads in a thread of its own, that descriptor is
+ * a pipe kept readable while received data waits to be read. A callback
+ * should read and handle one complete packet or DLP transaction, then
+ * return to the loop; the protocol layers still read the rest of a
+ * packet whose first bytes have arrived. When the device has already
+ * read further packets, as a serial port's read-ahead may, the callback
+ * is run again with PI_EVENT_READ on the next dispatch, without waiting
+ * for the descriptor. Remove a socket from the loop
+ * before closing it.
+ */
+
+#ifndef _PILOT_EVENT_H_
+#define _PILOT_EVENT_H_
+
+#include "pi-args.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @name Event flags */
+/*@{*/
+#define PI_EVENT_READ		0x01	/**< Socket has data to read, or a handheld to accept */
+#define PI_EVENT_WRITE		0x02	/**< Socket can be written to without blocking */
+#define PI_EVENT_ERROR		0x04	/**< Error on the socket (reported only) */
+#define PI_EVENT_HANGUP		0x08	/**< Remote end hung up (reported only) */
+/*@}*/
+
+	typedef struct pi_event_loop pi_event_loop_t;
+
+	/** @brief Readiness callback
+	 *
+	 * @param loop Event loop
+	 * @param sd Socket descriptor that became ready
+	 * @param events Combination of PI_EVENT_* flags
+	 * @param data Value passed to pi_event_add()
+	 */
+	typedef void (*pi_event_callback_t)
+		PI_ARGS((pi_event_loop_t *loop, int sd, int events,
+			void *data));
+
+	/** @brief Create a new event loop
+	 *
+	 * Dispose of the loop with pi_event_loop_free()
+	 *
+	 * @return The new loop, or NULL if it could not be created
+	 */
+	extern pi_event_loop_t *pi_event_loop_new PI_ARGS((void));
+
+	/** @brief Dispose of an event loop
+	 *
+	 * Sockets still registered are left open.
+	 *
+	 * @param loop Event loop
+	 */
+	extern void pi_event_loop_free PI_ARGS((pi_event_loop_t *loop));
+
+	/** @brief Watch a socket
+	 *
+	 * @param loop Event loop
+	 * @param sd Socket descriptor, connected or listening
+	 * @param events PI_EVENT_READ and/or PI_EVENT_WRITE
+	 * @param callback Function called when the socket is ready
+	 * @param data Passed through to @a callback
+	 * @return Negative error code on error
+	 */
+	extern int pi_event_add
+		PI_ARGS((pi_event_loop_t *loop, int sd, int events,
+			pi_event_callback_t callback, void *data));
+
+	/** @brief Change the events watched on a socket
+	 *
+	 * @param loop Event loop
+	 * @param sd Socket descriptor previously passed to pi_event_add()
+	 * @param events PI_EVENT_READ and/or PI_EVENT_WRITE
+	 * @return Negative error code on error
+	 */
+	extern int pi_event_modify
+		PI_ARGS((pi_event_loop_t *loop, int sd, int events));
+
+	/** @brief Stop watching a socket
+	 *
+	 * Can be called from any callback, including the socket's own.
+	 *
+	 * @param loop Event loop
+	 * @param sd Socket descriptor
+	 * @return Negative error code on error
+	 */
+	extern int pi_event_remove
+		PI_ARGS((pi_event_loop_t *loop, int sd));
+
+	/** @brief Wait once for events and run the callbacks
+	 *
+	 * Also runs the socket watchdogs set with pi_watchdog() that are
+	 * due, and returns early when the next one is.
+	 *
+	 * @param loop Event loop
+	 * @param timeout Maximum time to wait in milliseconds, -1 to wait
+	 *	forever
+	 * @return Number of callbacks run (0 on timeout), or negative
+	 *	error code on error
+	 */
+	extern int pi_event_dispatch
+		PI_ARGS((pi_event_loop_t *loop, int timeout));
+
+	/** @brief Run the loop
+	 *
+	 * Dispatch events until pi_event_loop_stop() is called or no socket
+	 * is left in the loop.
+	 *
+	 * @param loop Event loop
+	 * @return 0 when stopped, or negative error code on error
+	 */
+	extern int pi_event_loop_run PI_ARGS((pi_event_loop_t *loop));
+
+	/** @brief Make pi_event_loop_run() return
+	 *
+	 * Takes effect once the callbacks of the current dispatch have run.
+	 *
+	 * @param loop Event loop
+	 */
+	extern void pi_event_loop_stop PI_ARGS((pi_event_loop_t *loop));
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -73,14 +73,19 @@ typedef struct pi_file {
 	int	num_entries_allocated;	/**< Number of entries allocated in the entries memory block */
 	int	rbuf_size;		/**< Size of the internal read buffer */
 	FILE 	*f;			/**< Actual on-disk file */
-	pi_buffer_t *tmpbuf;		/**< Temporary buffer for databases opened with pi_file_create() */
+	FILE	*spill;			/**< Record data of databases opened with pi_file_create(), kept in an unlinked temporary file until pi_file_close() */
 	char 	*file_name;		/**< Access path */
 	void 	*app_info;		/**< Pointer to the appInfo block or NULL */
 	void	*sort_info;		/**< Pointer to the sortInfo block or NULL */
 	void	*rbuf;			/**< Read buffer, used internally */
 	unsigned long unique_id_seed;	/**< Database file's unique ID seed as read from an existing file */
 	struct 	DBInfo info;		/**< Database information and attributes */
-	struct 	pi_file_entry *entries;	/**< Array of records / resources */
+	struct 	pi_file_entry *entries;	/**< Array of records / resources (NULL for files opened with pi_file_open_mapped()) */
+	void	*map;			/**< Whole file, for files opened with pi_file_open_mapped() */
+	size_t	map_size;		/**< Size of the mapped file */
+	int	*index;			/**< Hash of record unique IDs or resource types and IDs to entries, built by the first lookup */
+	int	index_size;		/**< Number of buckets in the index (a power of two) */
+	int	index_used;		/**< Number of entries in the index */
 } pi_file_t;
 
 /** @brief Transfer progress callback structure
@@ -141,9 +146,30 @@ enum piProgressType {
 	extern pi_file_t *pi_file_open
 		PI_ARGS((const char *name));
 
+	/** @brief Open a database for read-only access by mapping it
+	 *
+	 * Like pi_file_open(), but the file is mapped into memory instead
+	 * of being read through stdio. Records and resources returned by
+	 * pi_file_read_record() and pi_file_read_resource() point straight
+	 * into the mapping and stay valid until pi_file_close(), and the
+	 * record or resource index is decoded from the file as entries
+	 * are accessed rather than when the file is opened. On systems
+	 * without mmap(), the whole file is read into memory at once.
+	 *
+	 * The file must not be truncated or rewritten while it is open.
+	 *
+	 * @param name The access path to the database to open on the local machine
+	 * @return An initialized pi_file_t structure or NULL.
+	 */
+	extern pi_file_t *pi_file_open_mapped
+		PI_ARGS((const char *name));
+
 	/** @brief Create a new database file
 	 *
-	 * A new database file is created on the local machine.
+	 * A new database file is created on the local machine. Appended
+	 * records and resources are not kept in memory: their data goes to a
+	 * temporary file next to @a name, which is copied after the header
+	 * when the database is closed.
 	 *
 	 * @param name Access path of the new file to create
 	 * @param INPUT	Characteristics of the database to create
@@ -374,6 +400,32 @@ enum piProgressType {
 	    PI_ARGS((pi_file_t *pf, int socket, int cardno,
 			progress_func report_progress));
 
+	/** @brief Retrieve a record database, reusing an older local copy
+	 *
+	 * Like pi_file_retrieve(), but only the records the handheld flags
+	 * as modified (see dlp_ReadNextModifiedRec()) and the records missing
+	 * from @p old are transferred. The others are copied from @p old.
+	 * This relies on the dirty flags of the records not having been
+	 * reset since @p old was retrieved, which a HotSync with another
+	 * desktop does.
+	 *
+	 * The whole database is retrieved instead when it is a resource
+	 * database, when @p old is NULL or is not a copy of the same
+	 * database, when the database's modification number is lower than
+	 * that of @p old, or when the records on the handheld do not match
+	 * the list of modified records.
+	 *
+	 * @param pf A file open for write
+	 * @param old The older copy, opened with pi_file_open(), or NULL
+	 * @param socket Socket to the connected handheld
+	 * @param cardno Card number the file resides on (usually 0)
+	 * @param report_progress Progress function callback or NULL (see #pi_progress_t structure)
+	 * @return Negative code on error, otherwise the number of records read from the handheld
+	 */
+	extern int pi_file_retrieve_update
+	    PI_ARGS((pi_file_t *pf, pi_file_t *old, int socket, int cardno,
+			progress_func report_progress));
+
 	/** @brief Install a new file on the handheld
 	 *
 	 * You must first open the local file with pi_file_open()
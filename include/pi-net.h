@@ -46,6 +46,8 @@ extern "C" {
 		int split_writes;	/* set to 0 or <> 0 (see net_tx() function) */
 		size_t write_chunksize;	/* set to 0 or a chunk size value (i.e. 4096) (see net_tx() function) */
 		unsigned char txid;
+		pi_buffer_t *tx_buf;	/* frame staging buffer for lower layers that can't writev, allocated on first use */
+		pi_buffer_t *rx_header;	/* receive buffer for packet headers, allocated on first use */
 	} pi_net_data_t;
 
 	extern pi_protocol_t *net_protocol
@@ -29,6 +29,7 @@ extern "C" {
 
 #define PI_PADP_HEADER_LEN	4
 #define PI_PADP_MTU		1024
+#define PI_PADP_MAX_WINDOW	8	/**< Maximum value for the #PI_PADP_WINDOW sockopt */
 
 #define PI_PADP_OFFSET_TYPE	0
 #define PI_PADP_OFFSET_FLGS	1
@@ -57,12 +58,16 @@ extern "C" {
 		int last_type;
 		int freeze_txid;	/**< see #PI_PADP_FREEZE_TXID sockopt */
 		int use_long_format;	/**< set to != 0 if we want to transmit packets using the long size format */
+		int window;		/**< see #PI_PADP_WINDOW sockopt */
 
 		unsigned char txid;
 		unsigned next_txid;
 
 		unsigned char last_ack_txid;
 		struct padp last_ack_padp;
+
+		pi_buffer_t *tx_buf;	/**< fragment/ack buffer used by padp_tx(), allocated on first use */
+		pi_buffer_t *rx_buf;	/**< fragment buffer used by padp_rx(), allocated on first use */
 	} pi_padp_data_t;
 
 
@@ -30,6 +30,9 @@ extern "C" {
 
 #define PI_SERIAL_DEV     1
 
+/* Size of the read-ahead ring, a power of two */
+#define PI_SERIAL_RING    4096
+
 	struct pi_serial_impl {
 		int (*open) PI_ARGS((pi_socket_t *ps,
 			struct pi_sockaddr *addr, size_t addrlen));
@@ -46,7 +49,10 @@ extern "C" {
 	struct pi_serial_data {
 		struct pi_serial_impl impl;
 
-		unsigned char buf[256];
+		/* read-ahead ring: each read() takes whatever the port has
+		   available, which may be several SLP frames */
+		unsigned char buf[PI_SERIAL_RING];
+		size_t buf_start;
 		size_t buf_size;
 		
 		/* IO options */		
@@ -67,6 +67,9 @@ extern "C" {
 		
 		unsigned char txid;
 		unsigned char last_txid;
+
+		unsigned char *tx_buf;	/* frame being transmitted, allocated on first use */
+		pi_buffer_t *rx_buf;	/* frame being received, allocated on first use */
 	};
 	
 	struct slp {
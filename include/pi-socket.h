@@ -104,7 +104,8 @@ enum PiOptDevice {
 	PI_DEV_RATE,
 	PI_DEV_ESTRATE,
 	PI_DEV_HIGHRATE,
-	PI_DEV_TIMEOUT
+	PI_DEV_TIMEOUT,
+	PI_DEV_URBS		/**< USB: bulk-in transfers kept queued, where supported */
 };
 
 /** @brief Serial link protocol socket options (use pi_getsockopt() and pi_setsockopt()) */
@@ -124,7 +125,8 @@ enum PiOptPADP {
 	PI_PADP_TYPE,
 	PI_PADP_LASTTYPE,
 	PI_PADP_FREEZE_TXID,		/**< if set, don't increment txid when receiving a packet. Mainly used by dlp_VFSFileRead() */
-	PI_PADP_USE_LONG_FORMAT		/**< if set, use the long packet size format when transmitting */
+	PI_PADP_USE_LONG_FORMAT,	/**< if set, use the long packet size format when transmitting */
+	PI_PADP_WINDOW			/**< number of fragments of a packet that can be sent before waiting for their acks (1 to #PI_PADP_MAX_WINDOW, default 1) */
 };
 
 /** @brief CMP protocol socket options (use pi_getsockopt() and pi_setsockopt()) */
@@ -145,7 +147,8 @@ enum PiOptNet {
 /** @brief Socket level options (use pi_getsockopt() and pi_setsockopt()) */
 enum PiOptSock {
 	PI_SOCK_STATE,			/**< Socket state (listening, closed, etc.) */
-	PI_SOCK_HONOR_RX_TIMEOUT	/**< Set to 1 to honor timeouts when waiting for data. Set to 0 to disable timeout (i.e. during dlp_CallApplication) */
+	PI_SOCK_HONOR_RX_TIMEOUT,	/**< Set to 1 to honor timeouts when waiting for data. Set to 0 to disable timeout (i.e. during dlp_CallApplication) */
+	PI_SOCK_DLP_PIPELINE		/**< Maximum number of DLP requests in flight (see dlp_submit()), 1 to #PI_DLP_MAX_PIPELINE. Only honored on NET connections, reading it back returns the depth in effect */
 };
 
 struct	pi_protocol;			/* forward declaration */
@@ -167,6 +170,8 @@ typedef struct pi_socket {
 	int queue_len;			/**< Protocol queue length */
 	struct pi_protocol **cmd_queue;	/**< Ptr to the command queue */
 	int cmd_len;			/**< Command queue length */
+	struct pi_protocol *queue_level[PI_LEVEL_SOCK + 1];	/**< Protocol queue entries indexed by level */
+	struct pi_protocol *cmd_level[PI_LEVEL_SOCK + 1];	/**< Command queue entries indexed by level */
 	struct pi_device *device;	/**< Low-level device we're talking to */
 
 	int state;			/**< Current socket state (initially #PI_SOCK_CLOSE). Use pi_setsockopt() with #PI_SOCK_STATE to set the state. */
@@ -180,6 +185,13 @@ typedef struct pi_socket {
 
 	int last_error;			/**< error code returned by the last dlp_* command */
 	int palmos_error;		/**< Palm OS error code returned by the last transaction with the handheld */
+
+	int dlp_pipeline;		/**< Maximum number of DLP requests in flight. Use pi_setsockopt() with #PI_SOCK_DLP_PIPELINE to set it. */
+	int dlp_inflight;		/**< Number of requests sent with dlp_submit() whose response hasn't been read yet */
+	pi_buffer_t *dlp_rxbuf;		/**< Spare DLP receive buffer, reused by dlp_response_read() */
+	pi_buffer_t *sys_buf;		/**< Packet buffer reused by sys_ReadMemory() and sys_WriteMemory() */
+
+	struct pi_keepalive *keepalive;	/**< Keepalive timer set with pi_watchdog(), or NULL */
 } pi_socket_t;
 
 /** @brief Internal sockets chained list */
@@ -370,6 +382,25 @@ typedef struct pi_socket_list
 	    PI_ARGS((int pi_sd, struct sockaddr * remote_addr, size_t *namelen,
 		     int timeout));
 
+	/** @brief Accept a handheld on a new socket
+	 *
+	 * Unlike pi_accept(), which turns the listening socket into the
+	 * connection, this function returns the connection on a new socket
+	 * and leaves @a pi_sd listening, so that a single process can keep
+	 * accepting handhelds while serving the ones already connected
+	 * (see pi-event.h). Only network (@c net:) sockets support this;
+	 * on other ports, it fails with #PI_ERR_SOCK_LISTENER. The
+	 * listening socket stays open when an error occurs.
+	 *
+	 * @param pi_sd Listening socket descriptor
+	 * @param remote_addr Unused. Pass NULL.
+	 * @param namelen Unused. Pass NULL.
+	 * @return New socket descriptor, or negative error code on error
+	 */
+	extern int pi_accept_new
+	    PI_ARGS((int pi_sd, struct sockaddr * remote_addr,
+		     size_t *namelen));
+
 	/** @brief Close a socket
 	 *
 	 * This function closes a socket and disposes of all the internal
@@ -562,15 +593,36 @@ typedef struct pi_socket_list
 
 	/** @brief Set a watchdog that will call pi_tickle() at regular intervals
 	 *
-	 * The watchdog uses the unix SIGALRM to fire an alarm at regular
-	 * intervals. If the socket is still connected when the alarm fires,
-	 * pi_tickle() is called to keep the connection alive.
+	 * Each socket has its own watchdog. When the socket has been idle
+	 * for @a interval seconds, with no pi_send() or pi_recv() call on
+	 * it, and it is still connected, pi_tickle() is called to keep the
+	 * connection alive. A tickle is never sent while another thread is
+	 * in pi_send() or pi_recv() on the socket. Closing the socket stops
+	 * its watchdog.
+	 *
+	 * The watchdogs of all sockets share a timer wheel. In thread-safe
+	 * builds a background thread runs it. Otherwise SIGALRM runs it,
+	 * unless the application runs it from its own loop with
+	 * pi_keepalive_run().
 	 *
 	 * @param pi_sd Socket descriptor
-	 * @param interval Time interval in seconds between alarms
+	 * @param interval Idle time in seconds before a tickle, 0 to stop
+	 *	the watchdog
 	 * @return 0, or #PI_ERR_SOCK_INVALID if the socket wasn't found
 	 */
 	extern int pi_watchdog PI_ARGS((int pi_sd, int interval));
+
+	/** @brief Run the watchdogs that are due
+	 *
+	 * Tickles the idle sockets whose watchdog is due. An application
+	 * with its own event loop can call this instead of having SIGALRM
+	 * interrupt it: once it has been called, the library no longer sets
+	 * SIGALRM. pi_event_dispatch() calls it on each pass.
+	 *
+	 * @return Milliseconds until it should be called again, or -1 if no
+	 *	watchdog is set
+	 */
+	extern int pi_keepalive_run PI_ARGS((void));
 /*@}*/
 
 #ifdef __cplusplus
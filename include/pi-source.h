@@ -23,6 +23,7 @@
 
 # include <sys/ioctl.h>
 # include <sys/time.h>
+# include <sys/uio.h>
 # include <sys/errno.h>
 # include <time.h>
 # include <fcntl.h>
@@ -110,7 +111,13 @@ extern "C" {
 			PI_ARGS((pi_socket_t *ps, int level,
 				int option_name, const void *option_value,
 					size_t *option_len));
+		/* optional, NULL when the layer has no scatter-gather write */
+		ssize_t	(*writev)
+			PI_ARGS((pi_socket_t *ps, PI_CONST struct iovec *iov,
+				int iovcnt, int flags));
 		void *data;
+		struct pi_protocol *next;	/* layer below, NULL at the device */
+		struct pi_protocol *prev;	/* layer above, NULL at the top */
 	} pi_protocol_t;
 
 	typedef struct pi_device {
@@ -131,15 +138,31 @@ extern "C" {
 				size_t addrlen));
 		int (*close)
 			PI_ARGS((pi_socket_t *ps));
+		/* optional, NULL when the device carries a single connection */
+		struct pi_device *(*dup)
+			PI_ARGS((struct pi_device *dev));
+		/* optional, bytes already read from the descriptor that
+		   are waiting to be consumed */
+		int (*pending)
+			PI_ARGS((pi_socket_t *ps));
 		void *data;
 	} pi_device_t;
 	
 	/* internal functions */
-	extern pi_socket_list_t *pi_socket_recognize PI_ARGS((pi_socket_t *));
+	extern int pi_socket_recognize PI_ARGS((pi_socket_t *));
 	extern pi_socket_t *find_pi_socket PI_ARGS((int sd));
+	extern pi_protocol_t *protocol_queue_find
+		PI_ARGS((pi_socket_t *ps, int level));
+	extern pi_protocol_t *protocol_queue_find_next
+		PI_ARGS((pi_socket_t *ps, int level));
 	extern int crc16 PI_ARGS((unsigned char *ptr, int count));
 	extern char *printlong PI_ARGS((unsigned long val));
 	extern unsigned long makelong PI_ARGS((char *c));
+	extern void pi_keepalive_cancel PI_ARGS((pi_socket_t *ps));
+	extern void pi_keepalive_io_begin
+		PI_ARGS((struct pi_keepalive *keepalive));
+	extern void pi_keepalive_io_end
+		PI_ARGS((struct pi_keepalive *keepalive));
 
 	/* provide compatibility for old code. Code should now use
 	   pi_dumpline() and pi_dumpdata() */
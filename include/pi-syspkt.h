@@ -91,6 +91,20 @@ extern "C" {
 	    PI_ARGS((int sd, unsigned long addr, unsigned long len,
 		     void *buf));
 
+#define PI_SYS_MEM_CHUNK	256	/* largest read or write per packet */
+#define PI_SYS_MAX_PIPELINE	8	/* most memory requests kept outstanding */
+
+	/* Same as sys_ReadMemory() and sys_WriteMemory(), but up to depth
+	   requests are sent before waiting for the first reply. The
+	   debugger on the handheld reads its port between packets, so
+	   keep depth small on slow serial links. */
+	extern int sys_ReadMemoryPipelined
+	    PI_ARGS((int sd, unsigned long addr, unsigned long len,
+		     void *buf, int depth));
+	extern int sys_WriteMemoryPipelined
+	    PI_ARGS((int sd, unsigned long addr, unsigned long len,
+		     void *buf, int depth));
+
 	extern int sys_ToggleDbgBreaks PI_ARGS((int sd));
 
 	extern int sys_SetTrapBreaks PI_ARGS((int sd, int *traps));
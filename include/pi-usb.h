@@ -59,6 +59,8 @@ extern "C" {
 			int ep, void *data, int size, int timeout));
 	} pi_usb_impl_t;
 
+#define PI_USB_DEFAULT_URBS	16	/**< Default for the PI_DEV_URBS option */
+
 #define USB_INIT_NONE		(1<<0)
 #define USB_INIT_TAPWAVE	(1<<1)
 #define USB_INIT_VISOR		(1<<2)
@@ -87,6 +89,7 @@ extern "C" {
 		int establishhighrate;		/**< Boolean: try to establish rate higher than the device publishes */
 
 		int timeout;
+		int urbs;			/**< Bulk-in transfers to keep queued (0 for one synchronous read at a time) */
 	} pi_usb_data_t;
 
 	extern pi_device_t *pi_usb_device PI_ARGS((int type));
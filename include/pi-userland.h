@@ -24,6 +24,8 @@
 
 #include <popt.h>
 #include "pi-appinfo.h"
+#include "pi-dlp.h"
+#include "pi-file.h"
 
 /*
  * This file defines general stuff for conduits -- common option processing,
@@ -143,6 +145,15 @@ typedef struct {
  */
 extern int plu_getromversion(int sd, plu_romversion_t *d);
 
+/*
+ * Call after clearing the modified flags of databases with
+ * dlp_ResetSyncFlags() outside a HotSync: moves the last sync date to
+ * now, as a HotSync would, so that backups made before are no longer
+ * trusted by pilot-xfer --incremental. Other conduits see the date
+ * change too. Returns -1 on failure, 0 otherwise.
+ */
+extern int plu_note_flags_reset(int sd);
+
 
 /***********************************************************************
  *
@@ -167,6 +178,166 @@ extern int plu_getromversion(int sd, plu_romversion_t *d);
  */
 int plu_protect_files(char *name, const char *extension, const size_t namelength);
 
+
+/***********************************************************************
+ *
+ * Batch extraction.
+ *
+ ***********************************************************************/
+
+/*
+ * A pipeline overlaps fetching, decoding and writing a series of items,
+ * such as the pictures in an image database. The caller fetches each
+ * item's records (over DLP or from a file) into an item of its own and
+ * hands it to plu_pipeline_submit(). A pool of threads runs the decode
+ * callback on the items, and one more thread runs the write callback on
+ * them, in the order they were submitted, with the result of the decode.
+ * The write callback owns the item and frees it.
+ *
+ * Only the write callback may pick output file names or print progress,
+ * since it is the only stage that sees the items in order. The decode
+ * callback must not touch the socket or global state.
+ *
+ * With jobs == 1, or where the library was built without threads, every
+ * item is decoded and written by plu_pipeline_submit() itself. A jobs
+ * value of 0 or less uses one thread per online processor.
+ */
+typedef struct plu_pipeline plu_pipeline_t;
+
+typedef int (*plu_decode_t)(void *item);
+typedef void (*plu_write_t)(void *item, int decoded);
+
+extern plu_pipeline_t *plu_pipeline_new(int jobs, plu_decode_t decode,
+	plu_write_t write);
+
+/*
+ * Queue an item; waits while too many items are queued already, which
+ * bounds the memory held by fetched and decoded items.
+ */
+extern void plu_pipeline_submit(plu_pipeline_t *p, void *item);
+
+/*
+ * Wait until every item has been written, then dispose of the pipeline.
+ */
+extern void plu_pipeline_finish(plu_pipeline_t *p);
+
+/***********************************************************************
+ *
+ * Database catalogue.
+ *
+ ***********************************************************************/
+
+/*
+ * A catalogue holds the database list of a card, read with as few
+ * dlp_ReadDBList() requests as the handheld allows, together with views
+ * of it sorted by name, by creator then type then name, and by
+ * modification number. Databases listed more than once (a RAM copy
+ * shadowing a ROM one) keep the order the handheld listed them in.
+ */
+typedef struct {
+	struct DBInfo	*info;		/* in the order the handheld lists them */
+	int	count,
+		exchanges;		/* dlp_ReadDBList() requests it took */
+	struct DBInfo	**by_name,
+			**by_creator,
+			**by_modnum;
+} plu_catalog_t;
+
+/*
+ * Read the catalogue of card @p cardno; @p flags is dlpDBListRAM,
+ * dlpDBListROM or both. Returns NULL on error.
+ */
+extern plu_catalog_t *plu_catalog_read(int sd, int cardno, int flags);
+
+/*
+ * Return the database called @p name, or NULL if there is none.
+ */
+extern struct DBInfo *plu_catalog_find(const plu_catalog_t *cat,
+	const char *name);
+
+/*
+ * Find the databases with creator @p creator and type @p type (any type
+ * if 0). Returns the index of the first one in by_creator, the others
+ * follow it, or -1 if there is none. Sets @p count to how many there are.
+ */
+extern int plu_catalog_find_creator(const plu_catalog_t *cat,
+	unsigned long creator, unsigned long type, int *count);
+
+extern void plu_catalog_free(plu_catalog_t *cat);
+
+/***********************************************************************
+ *
+ * Backup store.
+ *
+ ***********************************************************************/
+
+/*
+ * A store keeps snapshots of backed up databases in a directory. Each
+ * record, resource, appInfo and sortInfo block is kept once, named after
+ * its MD5, however many databases and snapshots hold it. Each database
+ * is described by a manifest listing its header and blocks, itself
+ * stored as a block, and a snapshot is an index of the manifests of its
+ * databases. Files are renamed into place once written, so that several
+ * processes may add to one store at the same time.
+ */
+typedef struct {
+	char	*name;			/* file name of the database */
+	char	hash[33];		/* its manifest */
+	size_t	size;
+} plu_store_entry_t;
+
+typedef struct {
+	char	*dir,
+		*snapshot,
+		*index;			/* path of the snapshot index */
+	plu_store_entry_t *entries;
+	int	count,
+		allocated,
+		dirty;
+	unsigned long	blobs,		/* blocks written */
+			bytes,
+			shared,		/* blocks the store had already */
+			shared_bytes;
+} plu_store_t;
+
+/*
+ * Open snapshot @p snapshot of the store in @p dir; the name may contain
+ * '/' to group snapshots, but no part of it may be empty or start with a
+ * dot. With @p create set, a snapshot that does not
+ * exist yet is started, creating directories as needed; otherwise NULL
+ * is returned for it.
+ */
+extern plu_store_t *plu_store_open(const char *dir, const char *snapshot,
+	int create);
+
+/*
+ * Add database @p pf, opened with pi_file_open(), to the snapshot under
+ * the file name @p name, replacing any database of that name. Returns 0,
+ * or -1 on error.
+ */
+extern int plu_store_add(plu_store_t *store, pi_file_t *pf,
+	const char *name);
+
+/*
+ * Write the snapshot index, which makes the databases added since it
+ * was opened part of the snapshot. Returns 0, or -1 on error.
+ */
+extern int plu_store_commit(plu_store_t *store);
+
+/*
+ * Rebuild database @p name of the snapshot into @p filename. Returns 0,
+ * or -1 if it is not in the snapshot or one of its blocks is missing or
+ * damaged.
+ */
+extern int plu_store_extract(plu_store_t *store, const char *name,
+	const char *filename);
+
+/*
+ * Dispose of the store; databases added since the last
+ * plu_store_commit() are dropped from the snapshot.
+ */
+extern void plu_store_close(plu_store_t *store);
+
 /*
  * We need to be able to refer to the table of common options.
  */
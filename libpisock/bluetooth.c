@@ -246,6 +246,7 @@ pi_bluetooth_protocol_dup (pi_protocol_t *prot)
 		new_prot->flush		= prot->flush;
 		new_prot->getsockopt 	= prot->getsockopt;
 		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->writev 	= prot->writev;
 		new_prot->data 		= NULL;
 	}
 
@@ -303,6 +304,7 @@ pi_bluetooth_protocol (pi_device_t *dev)
 		prot->flush		= pi_bluetooth_flush;
 		prot->getsockopt 	= pi_bluetooth_getsockopt;
 		prot->setsockopt 	= pi_bluetooth_setsockopt;
+		prot->writev 		= NULL;
 		prot->data 		= NULL;
 	}
 
@@ -450,6 +452,8 @@ pi_bluetooth_device (int type)
 	dev->accept     = pi_bluetooth_accept;
 	dev->connect    = pi_bluetooth_connect;
 	dev->close      = pi_bluetooth_close;
+	dev->dup        = NULL;
+	dev->pending    = NULL;
 
 	data->timeout   = 0;
 	dev->data       = data;
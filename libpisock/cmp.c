@@ -78,6 +78,7 @@ cmp_protocol_dup (pi_protocol_t *prot)
 		new_prot->flush		= prot->flush;
 		new_prot->getsockopt 	= prot->getsockopt;
 		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->writev 	= prot->writev;
 
 		data = (struct pi_cmp_data *)prot->data;
 		new_data->type 		= data->type;
@@ -150,6 +151,7 @@ cmp_protocol (void)
 		prot->flush		= cmp_flush;
 		prot->getsockopt 	= cmp_getsockopt;
 		prot->setsockopt 	= cmp_setsockopt;
+		prot->writev 		= NULL;
 
 		data->type 	= 0;
 		data->flags 	= 0;
@@ -190,7 +192,7 @@ cmp_rx_handshake(pi_socket_t *ps, int establishrate,
 	pi_buffer_t *buf;
 	int bytes;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -255,7 +257,7 @@ cmp_tx_handshake(pi_socket_t *ps)
 	struct 	pi_cmp_data *data;
 	int result;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -304,12 +306,12 @@ cmp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 	struct 	pi_cmp_data *data;
 	unsigned char cmp_buf[PI_CMP_HEADER_LEN];
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_cmp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_CMP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_CMP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -354,12 +356,12 @@ cmp_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	LOG((PI_DBG_CMP, PI_DBG_LVL_DEBUG, "CMP RX len=%d flags=0x%02x\n",
 		len, flags));
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_cmp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_CMP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_CMP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -394,11 +396,11 @@ cmp_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_CMP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_CMP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -422,7 +424,7 @@ cmp_init(pi_socket_t *ps, int baudrate)
 	pi_protocol_t *prot;
 	struct 	pi_cmp_data *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_cmp_data *)prot->data;
@@ -453,7 +455,7 @@ cmp_abort(pi_socket_t *ps, int reason)
 	pi_protocol_t *prot;
 	struct 	pi_cmp_data *data;
 	
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -483,7 +485,7 @@ cmp_wakeup(pi_socket_t *ps, int maxbaud)
 	pi_protocol_t *prot;
 	struct 	pi_cmp_data *data;
 	
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -517,7 +519,7 @@ cmp_getsockopt(pi_socket_t *ps, int level, int option_name,
 
 	(void) level;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_CMP);
+	prot = protocol_queue_find(ps, PI_LEVEL_CMP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_cmp_data *)prot->data;
@@ -584,7 +586,7 @@ cmp_setsockopt(pi_socket_t *ps, int level, int option_name,
 
 	(void) level;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = protocol_queue_find(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_padp_data *)prot->data;
@@ -277,28 +277,125 @@ dlp_arg_free (struct dlpArg *arg)
  * Returns:     aggregate length or -1 on error
  *
  ***************************************************************************/
+static size_t
+dlp_arg_header_len (int argid, size_t len)
+{
+	/* FIXME: shapiro: should these be < or <= ??? */
+	if (len < PI_DLP_ARG_TINY_LEN &&
+	    (argid & (PI_DLP_ARG_FLAG_SHORT | PI_DLP_ARG_FLAG_LONG)) == 0)
+		return 2;
+	if (len < PI_DLP_ARG_SHORT_LEN &&
+	    (argid & PI_DLP_ARG_FLAG_LONG) == 0)
+		return 4;
+	return 6;
+}
+
 int
 dlp_arg_len (int argc, struct dlpArg **argv)
 {
 	int i, len = 0;
 
+	for (i = 0; i < argc; i++)
+		len += dlp_arg_header_len (argv[i]->id_, argv[i]->len) + argv[i]->len;
+
+	return len;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_arg_header_write
+ *
+ * Summary:	writes the header of a dlpArg in wire format
+ *
+ * Parameters:	destination, dlpArg*
+ *
+ * Returns:     header length
+ *
+ ***************************************************************************/
+static size_t
+dlp_arg_header_write (unsigned char *buf, struct dlpArg *arg)
+{
+	short argid = arg->id_;
+	size_t header_len = dlp_arg_header_len (argid, arg->len);
+
+	if (header_len == 2) {
+		set_byte(&buf[0], argid | PI_DLP_ARG_FLAG_TINY);
+		set_byte(&buf[1], arg->len);
+	} else if (header_len == 4) {
+		set_byte(&buf[0], argid | PI_DLP_ARG_FLAG_SHORT);
+		set_byte(&buf[1], 0);
+		set_short(&buf[2], arg->len);
+	} else {
+		set_byte (&buf[0], argid | PI_DLP_ARG_FLAG_LONG);
+		set_byte(&buf[1], 0);
+		set_long (&buf[2], arg->len);
+	}
+
+	return header_len;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_request_alloc
+ *
+ * Summary:	creates a new dlpRequest instance in a single memory block.
+ *		The request is laid out in wire format at the end of the
+ *		block and each argument's data points to its final place
+ *		in it, so dlp_request_write() can send it as is.
+ *
+ * Parameters:	dlpFunction command, first argid, number of dlpArgs,
+ *		lengths of dlpArgs data member
+ *
+ * Returns:     dlpRequest* or NULL if failure
+ *
+ ***************************************************************************/
+static struct dlpRequest*
+dlp_request_alloc (enum dlpFunctions cmd, int argid, int argc, va_list ap)
+{
+	struct dlpRequest *req;
+	struct dlpArg *args;
+	unsigned char *buf;
+	size_t	lens[256],
+		frame_len = PI_DLP_OFFSET_ARGV;
+	int 	i;
+
+	if (argc < 0 || argc > 255)
+		return NULL;
+
 	for (i = 0; i < argc; i++) {
-		struct dlpArg *arg = argv[i];
-		
-		/* FIXME: shapiro: should these be < or <= ??? */
-		if (arg->len < PI_DLP_ARG_TINY_LEN &&
-		    (arg->id_ & (PI_DLP_ARG_FLAG_SHORT | PI_DLP_ARG_FLAG_LONG)) == 0)
-			len += 2;
-		else if (arg->len < PI_DLP_ARG_SHORT_LEN &&
-		         (arg->id_ & PI_DLP_ARG_FLAG_LONG) == 0)
-			len += 4;
-		else
-			len += 6;
+		lens[i] = va_arg (ap, size_t);
+		frame_len += dlp_arg_header_len (argid + i, lens[i]) + lens[i];
+	}
 
-		len += arg->len;
+	req = (struct dlpRequest *) malloc (sizeof (struct dlpRequest)
+		+ argc * (sizeof (struct dlpArg *) + sizeof (struct dlpArg))
+		+ frame_len);
+	if (req == NULL)
+		return NULL;
+
+	req->cmd = cmd;
+	req->argc = argc;
+	req->argv = argc ? (struct dlpArg **)(req + 1) : NULL;
+	args = (struct dlpArg *)((struct dlpArg **)(req + 1) + argc);
+	req->frame = (unsigned char *)(args + argc);
+	req->frame_len = frame_len;
+
+	set_byte (&req->frame[PI_DLP_OFFSET_CMD], cmd);
+	set_byte (&req->frame[PI_DLP_OFFSET_ARGC], argc);
+
+	buf = &req->frame[PI_DLP_OFFSET_ARGV];
+	for (i = 0; i < argc; i++) {
+		args[i].id_ = argid + i;
+		args[i].len = lens[i];
+		buf += dlp_arg_header_write (buf, &args[i]);
+		args[i].data = (char *)buf;
+		buf += lens[i];
+		req->argv[i] = &args[i];
 	}
 
-	return len;
+	return req;
 }
 
 
@@ -319,43 +416,11 @@ dlp_request_new (enum dlpFunctions cmd, int argc, ...)
 {
 	struct dlpRequest *req;
 	va_list ap;
-	int 	i,
-		j;
-	
-	req = (struct dlpRequest *)malloc (sizeof (struct dlpRequest));
 
-	if (req != NULL) {
-		req->cmd = cmd;
-		req->argc = argc;
-		req->argv = NULL;
+	va_start (ap, argc);
+	req = dlp_request_alloc (cmd, PI_DLP_ARG_FIRST_ID, argc, ap);
+	va_end (ap);
 
-		if (argc) {
-			req->argv = (struct dlpArg **) malloc (sizeof (struct dlpArg *) * argc);
-			if (req->argv == NULL) {
-				free(req);
-				return NULL;
-			}
-		}
-	
-		va_start (ap, argc);
-		for (i = 0; i < argc; i++) {
-			size_t len;
-
-			len = va_arg (ap, size_t);
-			req->argv[i] = dlp_arg_new (PI_DLP_ARG_FIRST_ID + i,
-				len);
-			if (req->argv[i] == NULL) {
-				for (j = 0; j < i; j++)
-					dlp_arg_free(req->argv[j]);
-				free(req->argv);
-				free(req);
-				req = NULL;
-				break;
-			}
-		}
-		va_end (ap);
-	}
-	
 	return req;	
 }
 
@@ -377,41 +442,10 @@ dlp_request_new_with_argid (enum dlpFunctions cmd, int argid, int argc, ...)
 {
 	struct dlpRequest *req;
 	va_list ap;
-	int	i,
-		j;
-	
-	req = (struct dlpRequest *) malloc (sizeof (struct dlpRequest));
 
-	if (req != NULL) {
-		req->cmd = cmd;
-		req->argc = argc;
-		req->argv = NULL;
-
-		if (argc) {
-			req->argv = (struct dlpArg **) malloc (sizeof (struct dlpArg *) * argc);
-			if (req->argv == NULL) {
-				free(req);
-				return NULL;
-			}
-		}
-
-		va_start (ap, argc);
-		for (i = 0; i < argc; i++) {
-			size_t len;
-
-			len = va_arg (ap, size_t);
-			req->argv[i] = dlp_arg_new (argid + i, len);
-			if (req->argv[i] == NULL) {
-				for (j = 0; j < i; j++)
-					dlp_arg_free(req->argv[j]);
-				free(req->argv);
-				free(req);
-				req = NULL;
-				break;
-			}
-		}
-		va_end (ap);
-	}
+	va_start (ap, argc);
+	req = dlp_request_alloc (cmd, argid, argc, ap);
+	va_end (ap);
 
 	return req;
 }
@@ -441,6 +475,8 @@ struct dlpResponse
 		res->err = dlpErrNoError;
 		res->argc = argc;
 		res->argv = NULL;
+		res->buf = NULL;
+		res->sd = -1;
 
 		if (argc) {
 			res->argv = (struct dlpArg **) malloc (sizeof (struct dlpArg *) * argc);
@@ -463,7 +499,11 @@ struct dlpResponse
  *
  * Function:	dlp_response_read
  *
- * Summary:	reads dlp response
+ * Summary:	reads dlp response. The response is read into a buffer
+ *		owned by the socket and the arguments point into it instead
+ *		of holding a copy of their data. The buffer belongs to the
+ *		response until dlp_response_free() gives it back to the
+ *		socket for the next read.
  *
  * Parameters:	dlpResonse**, sd
  *
@@ -474,16 +514,25 @@ ssize_t
 dlp_response_read (struct dlpResponse **res, int sd)
 {
 	struct dlpResponse *response;
-	unsigned char *buf;
+	struct dlpArg *args;
+	unsigned char *buf, *end;
 	short argid;
-	int i;
+	int i, argc;
 	ssize_t bytes;
 	size_t len;
 	pi_buffer_t *dlp_buf;
-	
-	dlp_buf = pi_buffer_new (DLP_BUF_SIZE);
-	if (dlp_buf == NULL)
-		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	pi_socket_t *ps;
+
+	ps = find_pi_socket(sd);
+	if (ps != NULL && ps->dlp_rxbuf != NULL) {
+		dlp_buf = ps->dlp_rxbuf;
+		ps->dlp_rxbuf = NULL;
+		pi_buffer_clear (dlp_buf);
+	} else {
+		dlp_buf = pi_buffer_new (DLP_BUF_SIZE);
+		if (dlp_buf == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	}
 
 	bytes = pi_read (sd, dlp_buf, dlp_buf->allocated);      /* buffer will grow as needed */
 	if (bytes < 0) {
@@ -499,10 +548,15 @@ dlp_response_read (struct dlpResponse **res, int sd)
 		if (bytes)
 			pi_dumpdata(dlp_buf->data, (size_t)dlp_buf->used);
 #endif
+		pi_buffer_free (dlp_buf);
 		return pi_set_error(sd, PI_ERR_DLP_COMMAND);
 	}
 
-	response = dlp_response_new ((enum dlpFunctions)(dlp_buf->data[0] & 0x7f), dlp_buf->data[1]);
+	/* the response, its argv and the arguments are allocated as a
+	   single block */
+	argc = dlp_buf->data[1];
+	response = (struct dlpResponse *) malloc (sizeof (struct dlpResponse)
+		+ argc * (sizeof (struct dlpArg *) + sizeof (struct dlpArg)));
 	*res = response;
 
 	/* note that in case an error occurs, we do not deallocate the response
@@ -512,13 +566,23 @@ dlp_response_read (struct dlpResponse **res, int sd)
 		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
 	}
 
+	response->cmd = (enum dlpFunctions)(dlp_buf->data[0] & 0x7f);
 	response->err = (enum dlpErrors) get_short (&dlp_buf->data[2]);
+	response->argc = 0;
+	response->argv = argc ? (struct dlpArg **)(response + 1) : NULL;
+	response->buf = dlp_buf;
+	response->sd = sd;
+	args = (struct dlpArg *)((struct dlpArg **)(response + 1) + argc);
+
 	pi_set_palmos_error(sd, (int)response->err);
 
-	/* FIXME: add bounds checking to make sure we don't access past
-	 * the end of the buffer in case the data is corrupt */
+	/* argc only counts the arguments parsed so far, so that on error
+	   callers never see an argument running past the end of the data */
 	buf = dlp_buf->data + 4;
-	for (i = 0; i < response->argc; i++) {
+	end = dlp_buf->data + dlp_buf->used;
+	for (i = 0; i < argc; i++) {
+		if (end - buf < 2)
+			goto corrupt;
 		argid = get_byte (buf) & 0x3f;
 		if (get_byte(buf) & PI_DLP_ARG_FLAG_LONG) {
 			if (pi_version(sd) < 0x0104) {
@@ -530,12 +594,15 @@ dlp_response_read (struct dlpResponse **res, int sd)
 				   contents. We need to report that the data is too large
 				   to be transferred.
 				*/
-				pi_buffer_free (dlp_buf);
 				return pi_set_error(sd, PI_ERR_DLP_DATASIZE);
 			}
+			if (end - buf < 6)
+				goto corrupt;
 			len = get_long (&buf[2]);
 			buf += 6;
 		} else if (get_byte(buf) & PI_DLP_ARG_FLAG_SHORT) {
+			if (end - buf < 4)
+				goto corrupt;
 			len = get_short (&buf[2]);
 			buf += 4;
 		} else {
@@ -543,19 +610,25 @@ dlp_response_read (struct dlpResponse **res, int sd)
 			len = get_byte(&buf[1]);
 			buf += 2;
 		}
-		
-		response->argv[i] = dlp_arg_new (argid, len);
-		if (response->argv[i] == NULL) {
-			pi_buffer_free (dlp_buf);
-			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
-		}
-		memcpy (response->argv[i]->data, buf, len);
+
+		if (len > (size_t)(end - buf))
+			goto corrupt;
+
+		args[i].id_ = argid;
+		args[i].len = len;
+		args[i].data = (char *)buf;
+		response->argv[i] = &args[i];
+		response->argc++;
 		buf += len;
 	}
 
-	pi_buffer_free (dlp_buf);
-
 	return response->argc ? response->argv[0]->len : 0;
+
+corrupt:
+	LOG((PI_DBG_DLP, PI_DBG_LVL_ERR,
+		"dlp_response_read: argument %d runs past the end of the "
+		"response (%d bytes)\n", i, (int)dlp_buf->used));
+	return pi_set_error(sd, PI_ERR_DLP_COMMAND);
 }
 
 
@@ -576,46 +649,35 @@ dlp_request_write (struct dlpRequest *req, int sd)
 	unsigned char *exec_buf, *buf;
 	int i;
 	size_t len;
-	
-	len = dlp_arg_len (req->argc, req->argv) + 2;
-	exec_buf = (unsigned char *) malloc (sizeof (unsigned char) * len);
-	if (exec_buf == NULL)
-		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	pi_socket_t *ps;
 
-	set_byte (&exec_buf[PI_DLP_OFFSET_CMD], req->cmd);
-	set_byte (&exec_buf[PI_DLP_OFFSET_ARGC], req->argc);
+	if (req->frame != NULL) {
+		/* arguments were filled in place, the request is ready to go */
+		exec_buf = req->frame;
+		len = req->frame_len;
+	} else {
+		len = dlp_arg_len (req->argc, req->argv) + 2;
+		exec_buf = (unsigned char *) malloc (sizeof (unsigned char) * len);
+		if (exec_buf == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
 
-	buf = &exec_buf[PI_DLP_OFFSET_ARGV];	
-	for (i = 0; i < req->argc; i++) {
-		struct dlpArg *arg = req->argv[i];
-		short argid = arg->id_;
-		
-		if (arg->len < PI_DLP_ARG_TINY_LEN &&
-		    (argid & (PI_DLP_ARG_FLAG_SHORT | PI_DLP_ARG_FLAG_LONG)) == 0) {
-			set_byte(&buf[0], argid | PI_DLP_ARG_FLAG_TINY);
-			set_byte(&buf[1], arg->len);
-
-			memcpy(&buf[2], arg->data, arg->len);
-			buf += arg->len + 2;			
-		} else if (arg->len < PI_DLP_ARG_SHORT_LEN &&
-		           (argid & PI_DLP_ARG_FLAG_LONG) == 0) {
-			set_byte(&buf[0], argid | PI_DLP_ARG_FLAG_SHORT);
-			set_byte(&buf[1], 0);
-			set_short(&buf[2], arg->len);
-
-			memcpy (&buf[4], arg->data, arg->len);
-			buf += arg->len + 4;			
-		} else {
-			set_byte (&buf[0], argid | PI_DLP_ARG_FLAG_LONG);
-			set_byte(&buf[1], 0);
-			set_long (&buf[2], arg->len);
+		set_byte (&exec_buf[PI_DLP_OFFSET_CMD], req->cmd);
+		set_byte (&exec_buf[PI_DLP_OFFSET_ARGC], req->argc);
+
+		buf = &exec_buf[PI_DLP_OFFSET_ARGV];	
+		for (i = 0; i < req->argc; i++) {
+			struct dlpArg *arg = req->argv[i];
 
-			memcpy (&buf[6], arg->data, arg->len);
-			buf += arg->len + 6;
+			buf += dlp_arg_header_write (buf, arg);
+			memcpy (buf, arg->data, arg->len);
+			buf += arg->len;
 		}
 	}
 
-	pi_flush(sd, PI_FLUSH_INPUT);
+	/* don't throw away the responses to requests still in flight */
+	ps = find_pi_socket(sd);
+	if (ps == NULL || ps->dlp_inflight == 0)
+		pi_flush(sd, PI_FLUSH_INPUT);
 
 	if ((i = pi_write(sd, exec_buf, len)) < (ssize_t)len) {
 		errno = -EIO;
@@ -623,7 +685,8 @@ dlp_request_write (struct dlpRequest *req, int sd)
 			i = -1;
 	}
 
-	free (exec_buf);
+	if (exec_buf != req->frame)
+		free (exec_buf);
 
 	return i;
 }
@@ -648,7 +711,8 @@ dlp_request_free (struct dlpRequest *req)
 	if (req == NULL)
 		return;
 
-	if (req->argv != NULL) {
+	/* requests built by dlp_request_new() are a single block */
+	if (req->argv != NULL && req->frame == NULL) {
 		for (i = 0; i < req->argc; i++) {
 			if (req->argv[i] != NULL)
 				dlp_arg_free (req->argv[i]);
@@ -678,7 +742,20 @@ dlp_response_free (struct dlpResponse *res)
 
 	if (res == NULL)
 		return;
-	
+
+	if (res->buf != NULL) {
+		/* the arguments are views into the receive buffer, which
+		   goes back to the socket for the next dlp_response_read() */
+		pi_socket_t *ps = find_pi_socket(res->sd);
+
+		if (ps != NULL && ps->dlp_rxbuf == NULL)
+			ps->dlp_rxbuf = res->buf;
+		else
+			pi_buffer_free (res->buf);
+		free (res);
+		return;
+	}
+
 	if (res->argv != NULL) {
 		for (i = 0; i < res->argc; i++) {
 			if (res->argv[i] != NULL)
@@ -693,20 +770,35 @@ dlp_response_free (struct dlpResponse *res)
 
 /***************************************************************************
  *
- * Function:	dlp_exec
+ * Function:	dlp_submit
  *
- * Summary:	writes a dlp request and reads the response
+ * Summary:	writes a dlp request without waiting for the response
  *
- * Parameters:	dlpResponse*
+ * Parameters:	sd, dlpRequest*
  *
- * Returns:     the number of response bytes, or -1 on error
+ * Returns:     the number of bytes written, or negative on error
  *
  ***************************************************************************/
 int
-dlp_exec(int sd, struct dlpRequest *req, struct dlpResponse **res)
+dlp_submit(int sd, struct dlpRequest *req)
 {
-	int bytes, result;
-	*res = NULL;
+	int result;
+	pi_socket_t *ps;
+
+	if ((ps = find_pi_socket(sd)) == NULL) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	/* the device handles requests one at a time, we can only queue
+	   more than one on links that buffer them for us (NET) */
+	if (ps->dlp_inflight >= (ps->cmd == PI_CMD_NET ? ps->dlp_pipeline : 1)) {
+		LOG((PI_DBG_DLP, PI_DBG_LVL_ERR,
+			    "DLP sd:%i dlp_submit: %d requests already in flight\n",
+			    sd, ps->dlp_inflight));
+		errno = EBUSY;
+		return pi_set_error(sd, PI_ERR_GENERIC_ARGUMENT);
+	}
 
 	if ((result = dlp_request_write (req, sd)) < req->argc) {
 		LOG((PI_DBG_DLP, PI_DBG_LVL_ERR,
@@ -716,6 +808,42 @@ dlp_exec(int sd, struct dlpRequest *req, struct dlpResponse **res)
 		return result;
 	}
 
+	ps->dlp_inflight++;
+	return result;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_complete
+ *
+ * Summary:	reads the response to the oldest request sent with
+ *		dlp_submit()
+ *
+ * Parameters:	sd, dlpRequest*, dlpResponse**
+ *
+ * Returns:     the number of response bytes, or negative on error
+ *
+ ***************************************************************************/
+int
+dlp_complete(int sd, struct dlpRequest *req, struct dlpResponse **res)
+{
+	int bytes;
+	pi_socket_t *ps;
+
+	*res = NULL;
+
+	if ((ps = find_pi_socket(sd)) == NULL) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	if (ps->dlp_inflight == 0) {
+		errno = EINVAL;
+		return pi_set_error(sd, PI_ERR_GENERIC_ARGUMENT);
+	}
+	ps->dlp_inflight--;
+
 	if ((bytes = dlp_response_read (res, sd)) < 0) {
 		LOG((PI_DBG_DLP, PI_DBG_LVL_ERR,
 			    "DLP sd:%i dlp_response_read returned %i\n",
@@ -737,7 +865,7 @@ dlp_exec(int sd, struct dlpRequest *req, struct dlpResponse **res)
 			errno = -ENOMSG;
 
 			LOG((PI_DBG_DLP, PI_DBG_LVL_DEBUG,
-				"dlp_exec: result CMD 0x%02x doesn't match requested cmd 0x%02x\n",
+				"dlp_complete: result CMD 0x%02x doesn't match requested cmd 0x%02x\n",
 				(unsigned)((*res)->cmd), (unsigned)req->cmd));
 
 			return pi_set_error(sd, PI_ERR_DLP_COMMAND);
@@ -754,6 +882,41 @@ dlp_exec(int sd, struct dlpRequest *req, struct dlpResponse **res)
 	return bytes;
 }
 
+
+/***************************************************************************
+ *
+ * Function:	dlp_exec
+ *
+ * Summary:	writes a dlp request and reads the response
+ *
+ * Parameters:	dlpResponse*
+ *
+ * Returns:     the number of response bytes, or -1 on error
+ *
+ ***************************************************************************/
+int
+dlp_exec(int sd, struct dlpRequest *req, struct dlpResponse **res)
+{
+	int result;
+	pi_socket_t *ps;
+
+	*res = NULL;
+
+	/* a response read now would belong to an earlier request */
+	if ((ps = find_pi_socket(sd)) != NULL && ps->dlp_inflight > 0) {
+		LOG((PI_DBG_DLP, PI_DBG_LVL_ERR,
+			    "DLP sd:%i dlp_exec called with %d requests in flight\n",
+			    sd, ps->dlp_inflight));
+		errno = EBUSY;
+		return pi_set_error(sd, PI_ERR_GENERIC_ARGUMENT);
+	}
+
+	if ((result = dlp_submit (sd, req)) < req->argc)
+		return result;
+
+	return dlp_complete (sd, req, res);
+}
+
 /* These conversion functions are strictly for use within the DLP layer. 
    This particular date/time format does not occur anywhere else within the
    Palm or its communications. */
@@ -2160,22 +2323,121 @@ dlp_WriteNetSyncInfo(int sd, const struct NetSyncInfo *i)
 }
 
 #ifdef _PILOT_SYSPKT_H
-int
-dlp_RPC(int sd, struct RPC_params *p, unsigned long *result)
+/***************************************************************************
+ *
+ * Function:	dlp_rpc_length
+ *
+ * Summary:	size of the ProcessRPC packet for an RPC call; the reply
+ *		is two bytes longer
+ *
+ * Parameters:	RPC_params*
+ *
+ * Returns:     packet length in bytes
+ *
+ ***************************************************************************/
+static size_t
+dlp_rpc_length(struct RPC_params *p)
+{
+	int	i;
+	size_t	len = 16;
+
+	for (i = 0; i < p->args; i++)
+		len += 2 + ((p->param[i].size + 1) & ~(size_t)1);
+	return len;
+}
+
+static int
+dlp_rpc_read(int sd, struct RPC_params *p, unsigned long *result)
 {
 	int 	i,
+		l,
 		err = 0;
 	long 	D0 = 0,
 		A0 = 0;
 	unsigned char *c;
 	pi_buffer_t *dlp_buf;
 
-	Trace(dlp_RPC);
+	dlp_buf = pi_buffer_new (dlp_rpc_length(p) + 2);
+	if (dlp_buf == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	l = pi_read(sd, dlp_buf, dlp_rpc_length(p) + 2);
+	if (l < 0)
+		err = l;
+	else if (l < 6)
+		err = -1;
+	else if (dlp_buf->data[0] != 0xAD)
+		err = -2;
+	else if (get_short(dlp_buf->data + 2)) {
+		err = -get_short(dlp_buf->data + 2);
+		pi_set_palmos_error(sd, -err);
+	} else {
+		D0 = get_long(dlp_buf->data + 8);
+		A0 = get_long(dlp_buf->data + 12);
+		c = dlp_buf->data + 18;
+		for (i = p->args - 1; i >= 0; i--) {
+			if (p->param[i].byRef && p->param[i].data)
+				memcpy(p->param[i].data, c + 2,
+					   p->param[i].size);
+			c += 2 + ((p->param[i].size + 1) & 
+					(unsigned)~1);
+		}
+
+		/* byRef values came back in the device's byte order */
+		UninvertRPC(p);
+	}
+
+	pi_buffer_free (dlp_buf);
+
+	if (result) {
+		if (p->reply == RPC_PtrReply) {
+			*result = A0;
+		} else if (p->reply == RPC_IntReply) {
+			*result = D0;
+		}
+	}
+
+	return err;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_RPCSubmit
+ *
+ * Summary:	sends an RPC call without waiting for its reply
+ *
+ * Parameters:	sd, RPC_params*
+ *
+ * Returns:     0 on success, negative on error
+ *
+ ***************************************************************************/
+int
+dlp_RPCSubmit(int sd, struct RPC_params *p)
+{
+	int 	i,
+		err;
+	unsigned char *c;
+	pi_buffer_t *dlp_buf;
+	pi_socket_t *ps;
+
+	Trace(dlp_RPCSubmit);
 	pi_reset_errors(sd);
 
+	if ((ps = find_pi_socket(sd)) == NULL) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	/* same rules as dlp_submit() */
+	if (p->reply && ps->dlp_inflight >= (ps->cmd == PI_CMD_NET ? ps->dlp_pipeline : 1)) {
+		errno = EBUSY;
+		return pi_set_error(sd, PI_ERR_GENERIC_ARGUMENT);
+	}
+
 	/* RPC through DLP breaks all the rules and isn't well documented to
 	   boot */
-	dlp_buf = pi_buffer_new (DLP_BUF_SIZE);
+	dlp_buf = pi_buffer_new (dlp_rpc_length(p));
 	if (dlp_buf == NULL)
 		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
 
@@ -2187,8 +2449,8 @@ dlp_RPC(int sd, struct RPC_params *p, unsigned long *result)
 	InvertRPC(p);
 
 	set_short(dlp_buf->data + 4, p->trap);
-	set_long(dlp_buf->data + 6, D0);
-	set_long(dlp_buf->data + 10, A0);
+	set_long(dlp_buf->data + 6, 0);		/* D0 */
+	set_long(dlp_buf->data + 10, 0);	/* A0 */
 	set_short(dlp_buf->data + 14, p->args);
 
 	c = dlp_buf->data + 16;
@@ -2204,48 +2466,65 @@ dlp_RPC(int sd, struct RPC_params *p, unsigned long *result)
 			*c++ = 0;
 	}
 
-	if (pi_write(sd, dlp_buf->data, (size_t)(c - dlp_buf->data)) > 0) {
-		err = 0;
-		if (p->reply) {
-			int l = pi_read(sd, dlp_buf, (size_t)(c - dlp_buf->data + 2));
-
-			if (l < 0)
-				err = l;
-			else if (l < 6)
-				err = -1;
-			else if (dlp_buf->data[0] != 0xAD)
-				err = -2;
-			else if (get_short(dlp_buf->data + 2)) {
-				err = -get_short(dlp_buf->data + 2);
-				pi_set_palmos_error(sd, -err);
-			} else {
-				D0 = get_long(dlp_buf->data + 8);
-				A0 = get_long(dlp_buf->data + 12);
-				c = dlp_buf->data + 18;
-				for (i = p->args - 1; i >= 0; i--) {
-					if (p->param[i].byRef && p->param[i].data)
-						memcpy(p->param[i].data, c + 2,
-							   p->param[i].size);
-					c += 2 + ((p->param[i].size + 1) & 
-							(unsigned)~1);
-				}
-			}
-		}
-	}
+	UninvertRPC(p);
 
+	err = pi_write(sd, dlp_buf->data, (size_t)(c - dlp_buf->data));
 	pi_buffer_free (dlp_buf);
 
-	UninvertRPC(p);
+	if (err <= 0)
+		return err < 0 ? err : pi_set_error(sd, PI_ERR_SOCK_IO);
 
-	if (result) {
-		if (p->reply == RPC_PtrReply) {
-			*result = A0;
-		} else if (p->reply == RPC_IntReply) {
-			*result = D0;
-		}
+	if (p->reply)
+		ps->dlp_inflight++;
+	return 0;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_RPCComplete
+ *
+ * Summary:	reads the reply to the oldest call sent with
+ *		dlp_RPCSubmit()
+ *
+ * Parameters:	sd, RPC_params*, result
+ *
+ * Returns:     0 on success, negative on error
+ *
+ ***************************************************************************/
+int
+dlp_RPCComplete(int sd, struct RPC_params *p, unsigned long *result)
+{
+	pi_socket_t *ps;
+
+	Trace(dlp_RPCComplete);
+
+	if ((ps = find_pi_socket(sd)) == NULL) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
 	}
 
-	return err;
+	if (ps->dlp_inflight == 0 || !p->reply) {
+		errno = EINVAL;
+		return pi_set_error(sd, PI_ERR_GENERIC_ARGUMENT);
+	}
+	ps->dlp_inflight--;
+
+	return dlp_rpc_read(sd, p, result);
+}
+
+
+int
+dlp_RPC(int sd, struct RPC_params *p, unsigned long *result)
+{
+	int 	err;
+
+	Trace(dlp_RPC);
+
+	if ((err = dlp_RPCSubmit(sd, p)) < 0 || !p->reply)
+		return err;
+
+	return dlp_RPCComplete(sd, p, result);
 }
 
 
@@ -3668,18 +3947,21 @@ dlp_ReadRecordById(int sd, int dbhandle, recordid_t recuid, pi_buffer_t *buffer,
 	return result;
 }
 
-int
-dlp_ReadRecordByIndex(int sd, int dbhandle, int recindex, pi_buffer_t *buffer,
-	recordid_t * recuid, int *attr, int *category)
+/***************************************************************************
+ *
+ * Function:	dlp_read_record_by_index_request
+ *
+ * Summary:	builds the request for dlp_ReadRecordByIndex()
+ *
+ * Parameters:	sd, dbhandle, record index, nonzero to return the data
+ *
+ * Returns:     dlpRequest* or NULL if failure
+ *
+ ***************************************************************************/
+static struct dlpRequest *
+dlp_read_record_by_index_request(int sd, int dbhandle, int recindex, int with_data)
 {
-	int 	result,
-		large = 0;
 	struct dlpRequest *req;
-	struct dlpResponse *res;
-	int maxBufferSize = pi_maxrecsize(sd) - RECORD_READ_SAFEGUARD_SIZE;
-
-	TraceX(dlp_ReadRecordByIndex,"recindex=%d",recindex);
-	pi_reset_errors(sd);
 
 	/* TapWave (DLP 1.4) implements a 'large' version of dlpFuncReadRecord,
 	 * which can return records >64k
@@ -3687,80 +3969,242 @@ dlp_ReadRecordByIndex(int sd, int dbhandle, int recindex, pi_buffer_t *buffer,
 	if (pi_version(sd) >= 0x0104) {
 		req = dlp_request_new_with_argid(dlpFuncReadRecordEx, 0x21, 1, 12);
 		if (req == NULL)
-			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+			return NULL;
 
 		set_byte(DLP_REQUEST_DATA(req, 0, 0), dbhandle);
 		set_byte(DLP_REQUEST_DATA(req, 0, 1), 0x00);
 		set_short(DLP_REQUEST_DATA(req, 0, 2), recindex);
 		set_long(DLP_REQUEST_DATA(req, 0, 4), 0); /* Offset into record */
 		set_long(DLP_REQUEST_DATA(req, 0, 8), pi_maxrecsize(sd));	/* length to return */
-		large = 1;
 	} else {
 		req = dlp_request_new_with_argid(dlpFuncReadRecord, 0x21, 1, 8);
 		if (req == NULL)
-			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+			return NULL;
 
 		set_byte(DLP_REQUEST_DATA(req, 0, 0), dbhandle);
 		set_byte(DLP_REQUEST_DATA(req, 0, 1), 0x00);
 		set_short(DLP_REQUEST_DATA(req, 0, 2), recindex);
 		set_short(DLP_REQUEST_DATA(req, 0, 4), 0); /* Offset into record */
-		set_short(DLP_REQUEST_DATA(req, 0, 6), buffer ? maxBufferSize : 0);	/* length to return */
+		set_short(DLP_REQUEST_DATA(req, 0, 6), with_data ?
+			pi_maxrecsize(sd) - RECORD_READ_SAFEGUARD_SIZE : 0);	/* length to return */
 	}
+
+	return req;
+}
+
+
+/***************************************************************************
+ *
+ * Function:	dlp_read_record_by_index_response
+ *
+ * Summary:	decodes the response to a dlp_ReadRecordByIndex() request.
+ *		If the record had to be truncated (see
+ *		RECORD_READ_SAFEGUARD_SIZE), reads the remaining data with a
+ *		second request, so no other request may be in flight.
+ *
+ * Parameters:	sd, request, response, buffer (may be NULL), ptrs to
+ *		returned record UID, attributes and category (may be NULL)
+ *
+ * Returns:     record data length or negative on error
+ *
+ ***************************************************************************/
+static int
+dlp_read_record_by_index_response(int sd, struct dlpRequest *req,
+	struct dlpResponse *res, pi_buffer_t *buffer,
+	recordid_t *recuid, int *attr, int *category)
+{
+	int 	result,
+		large = (req->cmd == dlpFuncReadRecordEx),
+		recindex = get_short(DLP_REQUEST_DATA(req, 0, 2));
+	struct dlpRequest *tail_req;
+	struct dlpResponse *tail_res;
+	int maxBufferSize = pi_maxrecsize(sd) - RECORD_READ_SAFEGUARD_SIZE;
+
+	if (res->argc < 1 || res->argv[0]->len < (size_t)(large ? 14 : 10))
+		return pi_set_error(sd, PI_ERR_DLP_COMMAND);
+
+	result = res->argv[0]->len - (large ? 14 : 10);
+	if (recuid)
+		*recuid = get_long(DLP_RESPONSE_DATA(res, 0, 0));
+	if (attr)
+		*attr = get_byte(DLP_RESPONSE_DATA(res, 0, large ? 12 : 8));
+	if (category)
+		*category = get_byte(DLP_RESPONSE_DATA(res, 0, large ? 13 : 9));
+	if (buffer) {
+		pi_buffer_clear (buffer);
+		pi_buffer_append (buffer, DLP_RESPONSE_DATA(res, 0, large ? 14 : 10),
+			(size_t)result);
+
+		/* Some devices such as the Tungsten TX, Treo 650 and Treo 700p lock up if you try to read the entire record if the
+		** record is almost at the maximum record size. The following mitigates this and allows the record
+		** to be read in two chunks.
+		*/
+		if (result == maxBufferSize && !large) {
+			tail_req = dlp_request_new_with_argid(dlpFuncReadRecord, 0x21, 1, 8);
+			if (tail_req != NULL) {
+				set_byte(DLP_REQUEST_DATA(tail_req, 0, 0), get_byte(DLP_REQUEST_DATA(req, 0, 0)));
+				set_byte(DLP_REQUEST_DATA(tail_req, 0, 1), 0x00);
+				set_short(DLP_REQUEST_DATA(tail_req, 0, 2), recindex);
+				set_short(DLP_REQUEST_DATA(tail_req, 0, 4), maxBufferSize); /* Offset into record */
+				set_short(DLP_REQUEST_DATA(tail_req, 0, 6), RECORD_READ_SAFEGUARD_SIZE);	/* length to return */
+
+				result = dlp_exec(sd, tail_req, &tail_res);
+				dlp_request_free(tail_req);
+
+				if (result > 0) {
+					result = tail_res->argv[0]->len - 10;
+					pi_buffer_append (buffer, DLP_RESPONSE_DATA(tail_res, 0, 10),
+									  (size_t)result);
+					
+					result += maxBufferSize;
+				}
+				dlp_response_free(tail_res);
+			}
+		}
+	}
+
+	CHECK(PI_DBG_DLP, PI_DBG_LVL_DEBUG,
+		 record_dump(
+			get_long(DLP_RESPONSE_DATA(res, 0, 0)),			/* recUID */
+			get_short(DLP_RESPONSE_DATA(res, 0, 4)),		/* index */
+			get_byte(DLP_RESPONSE_DATA(res, 0, large ? 12 : 8)),	/* flags */
+			get_byte(DLP_RESPONSE_DATA(res, 0, large ? 13 : 9)),	/* catID */
+			DLP_RESPONSE_DATA(res, 0, large ? 14 : 10), result));
+
+	return result;
+}
+
+int
+dlp_ReadRecordByIndex(int sd, int dbhandle, int recindex, pi_buffer_t *buffer,
+	recordid_t * recuid, int *attr, int *category)
+{
+	int 	result;
+	struct dlpRequest *req;
+	struct dlpResponse *res;
+
+	TraceX(dlp_ReadRecordByIndex,"recindex=%d",recindex);
+	pi_reset_errors(sd);
+
+	req = dlp_read_record_by_index_request(sd, dbhandle, recindex, buffer != NULL);
+	if (req == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
 	result = dlp_exec(sd, req, &res);
+	
+	if (result > 0)
+		result = dlp_read_record_by_index_response(sd, req, res, buffer,
+			recuid, attr, category);
+
 	dlp_request_free(req);
+	dlp_response_free(res);
 	
-	if (result > 0) {
-		result = res->argv[0]->len - (large ? 14 : 10);
-		if (recuid)
-			*recuid = get_long(DLP_RESPONSE_DATA(res, 0, 0));
-		if (attr)
-			*attr = get_byte(DLP_RESPONSE_DATA(res, 0, large ? 12 : 8));
-		if (category)
-			*category = get_byte(DLP_RESPONSE_DATA(res, 0, large ? 13 : 9));
-		if (buffer) {
-			pi_buffer_clear (buffer);
-			pi_buffer_append (buffer, DLP_RESPONSE_DATA(res, 0, large ? 14 : 10),
-				(size_t)result);
+	return result;
+}
 
-			/* Some devices such as the Tungsten TX, Treo 650 and Treo 700p lock up if you try to read the entire record if the
-			** record is almost at the maximum record size. The following mitigates this and allows the record
-			** to be read in two chunks.
-			*/
-			if (result == maxBufferSize && !large) {
-				dlp_response_free(res);
-				req = dlp_request_new_with_argid(dlpFuncReadRecord, 0x21, 1, 8);
-				if (req != NULL) {
-					set_byte(DLP_REQUEST_DATA(req, 0, 0), dbhandle);
-					set_byte(DLP_REQUEST_DATA(req, 0, 1), 0x00);
-					set_short(DLP_REQUEST_DATA(req, 0, 2), recindex);
-					set_short(DLP_REQUEST_DATA(req, 0, 4), maxBufferSize); /* Offset into record */
-					set_short(DLP_REQUEST_DATA(req, 0, 6), buffer ? RECORD_READ_SAFEGUARD_SIZE : 0);	/* length to return */
+int
+dlp_ReadRecordsByIndex(int sd, int dbhandle, int start, int count,
+	dlp_record_func callback, void *userdata)
+{
+	int 	result = 0,
+		depth,
+		slot,
+		attr,
+		category,
+		submitted = start,
+		completed = start,
+		end = start + count;
+	size_t	size;
+	recordid_t recuid;
+	pi_buffer_t *buffer;
+	struct dlpRequest *reqs[PI_DLP_MAX_PIPELINE];
+	struct dlpResponse *res[PI_DLP_MAX_PIPELINE];
+
+	TraceX(dlp_ReadRecordsByIndex,"start=%d count=%d",start,count);
+	pi_reset_errors(sd);
 
-					result = dlp_exec(sd, req, &res);
-					dlp_request_free(req);
+	size = sizeof(depth);
+	if ((result = pi_getsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_DLP_PIPELINE,
+			&depth, &size)) < 0)
+		return result;
 
-					if (result > 0) {
-						result = res->argv[0]->len - (large ? 14 : 10);
-						pi_buffer_append (buffer, DLP_RESPONSE_DATA(res, 0, large ? 14 : 10),
-										  (size_t)result);
-						
-						result += maxBufferSize;
-					}
-				}
+	buffer = pi_buffer_new(DLP_BUF_SIZE);
+	if (buffer == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+
+	memset(reqs, 0, sizeof(reqs));
+	memset(res, 0, sizeof(res));
+
+	while (completed < end) {
+		/* keep the pipeline full */
+		while (submitted < end && submitted - completed < depth) {
+			slot = submitted % PI_DLP_MAX_PIPELINE;
+			reqs[slot] = dlp_read_record_by_index_request(sd, dbhandle, submitted, 1);
+			if (reqs[slot] == NULL) {
+				result = pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+				goto done;
+			}
+			if ((result = dlp_submit(sd, reqs[slot])) < 0) {
+				dlp_request_free(reqs[slot]);
+				reqs[slot] = NULL;
+				goto done;
 			}
+			submitted++;
 		}
 
-		CHECK(PI_DBG_DLP, PI_DBG_LVL_DEBUG,
-			 record_dump(
-				get_long(DLP_RESPONSE_DATA(res, 0, 0)),			/* recUID */
-				get_short(DLP_RESPONSE_DATA(res, 0, 4)),		/* index */
-				get_byte(DLP_RESPONSE_DATA(res, 0, large ? 12 : 8)),	/* flags */
-				get_byte(DLP_RESPONSE_DATA(res, 0, large ? 13 : 9)),	/* catID */
-				DLP_RESPONSE_DATA(res, 0, large ? 14 : 10), result));
+		slot = completed % PI_DLP_MAX_PIPELINE;
+		if (res[slot] == NULL) {
+			if ((result = dlp_complete(sd, reqs[slot], &res[slot])) < 0)
+				goto done;
+		}
+
+		/* reading the end of a truncated record needs another round
+		   trip, so collect whatever is still in flight first */
+		if (reqs[slot]->cmd == dlpFuncReadRecord && res[slot]->argc > 0
+			&& res[slot]->argv[0]->len ==
+				pi_maxrecsize(sd) - RECORD_READ_SAFEGUARD_SIZE + 10) {
+			int i;
+
+			for (i = completed + 1; i < submitted; i++) {
+				if (res[i % PI_DLP_MAX_PIPELINE] == NULL &&
+				    (result = dlp_complete(sd, reqs[i % PI_DLP_MAX_PIPELINE],
+						&res[i % PI_DLP_MAX_PIPELINE])) < 0)
+					goto done;
+			}
+		}
+
+		if ((result = dlp_read_record_by_index_response(sd, reqs[slot],
+				res[slot], buffer, &recuid, &attr, &category)) < 0)
+			goto done;
+
+		dlp_request_free(reqs[slot]);
+		dlp_response_free(res[slot]);
+		reqs[slot] = NULL;
+		res[slot] = NULL;
+
+		/* the slot is free now, whatever the callback says */
+		completed++;
+		if ((result = callback(sd, completed - 1, buffer, recuid, attr,
+				category, userdata)) < 0)
+			goto done;
 	}
 
-	dlp_response_free(res);
-	
+	result = count;
+
+done:
+	/* drain the responses to the requests we won't process, so the
+	   next command doesn't pick them up */
+	while (completed < submitted) {
+		slot = completed % PI_DLP_MAX_PIPELINE;
+		if (reqs[slot] != NULL && res[slot] == NULL
+		    && pi_socket_connected(sd))
+			dlp_complete(sd, reqs[slot], &res[slot]);
+		dlp_request_free(reqs[slot]);
+		dlp_response_free(res[slot]);
+		completed++;
+	}
+
+	pi_buffer_free(buffer);
+
 	return result;
 }
 
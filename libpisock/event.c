@@ -0,0 +1,570 @@
+/*
+ * $Id$
+ *
+ * event.c: event loop driving many sockets from a single thread
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <stdint.h>
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "pi-debug.h"
+#include "pi-source.h"
+#include "pi-event.h"
+
+/* Number of ready sockets fetched from epoll_wait() at a time */
+#define PI_EVENT_BATCH	64
+
+typedef struct pi_event_watch {
+	int	events;
+	unsigned int serial;	/* tells a reused descriptor apart */
+	pi_event_callback_t callback;
+	void	*data;
+	int	again;		/* queued in again[] */
+} pi_event_watch_t;
+
+struct pi_event_loop {
+	int	running;
+	int	count;			/* sockets in the loop */
+	int	size;			/* length of watch[] */
+	unsigned int serial;
+	pi_event_watch_t **watch;	/* indexed by socket descriptor */
+	int	*again,			/* sockets with data buffered by */
+		again_count,		/* the device, to call back */
+		again_size;		/* without waiting */
+#ifdef HAVE_SYS_EPOLL_H
+	int	epfd;
+#else
+	int	dirty;			/* pfd[] must be rebuilt */
+	struct pollfd *pfd;
+	unsigned int *pfd_serial;
+#endif
+};
+
+static pi_event_watch_t *
+event_watch(pi_event_loop_t *loop, int sd)
+{
+	if (sd < 0 || sd >= loop->size)
+		return NULL;
+	return loop->watch[sd];
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static int
+event_ctl(pi_event_loop_t *loop, int op, int sd, pi_event_watch_t *w)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	if (w != NULL) {
+		if (w->events & PI_EVENT_READ)
+			ev.events |= EPOLLIN;
+		if (w->events & PI_EVENT_WRITE)
+			ev.events |= EPOLLOUT;
+		ev.data.u64 = ((uint64_t) w->serial << 32) | (uint32_t) sd;
+	}
+
+	return epoll_ctl(loop->epfd, op, sd, &ev);
+}
+
+#endif
+
+pi_event_loop_t *
+pi_event_loop_new(void)
+{
+	pi_event_loop_t *loop;
+
+	loop = (pi_event_loop_t *) calloc(1, sizeof(pi_event_loop_t));
+	if (loop == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	if ((loop->epfd = epoll_create(PI_EVENT_BATCH)) < 0) {
+		int	err = errno;
+
+		free(loop);
+		errno = err;
+		return NULL;
+	}
+#endif
+
+	return loop;
+}
+
+void
+pi_event_loop_free(pi_event_loop_t *loop)
+{
+	int	i;
+
+	if (loop == NULL)
+		return;
+
+	for (i = 0; i < loop->size; i++)
+		if (loop->watch[i] != NULL)
+			free(loop->watch[i]);
+	free(loop->watch);
+	free(loop->again);
+
+#ifdef HAVE_SYS_EPOLL_H
+	close(loop->epfd);
+#else
+	free(loop->pfd);
+	free(loop->pfd_serial);
+#endif
+	free(loop);
+}
+
+int
+pi_event_add(pi_event_loop_t *loop, int sd, int events,
+	pi_event_callback_t callback, void *data)
+{
+	pi_socket_t *ps;
+	pi_event_watch_t *w;
+
+	if (loop == NULL || callback == NULL
+	    || (events & ~(PI_EVENT_READ | PI_EVENT_WRITE)))
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	if (!(ps = find_pi_socket(sd))) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	if (event_watch(loop, sd) != NULL) {
+		errno = EEXIST;
+		return PI_ERR_GENERIC_ARGUMENT;
+	}
+
+	if (sd >= loop->size) {
+		pi_event_watch_t **watch;
+		int	size = loop->size ? loop->size : 16;
+
+		while (size <= sd)
+			size *= 2;
+		watch = (pi_event_watch_t **) realloc(loop->watch,
+			size * sizeof(pi_event_watch_t *));
+		if (watch == NULL)
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+		memset(watch + loop->size, 0,
+			(size - loop->size) * sizeof(pi_event_watch_t *));
+		loop->watch = watch;
+		loop->size = size;
+	}
+
+	w = (pi_event_watch_t *) malloc(sizeof(pi_event_watch_t));
+	if (w == NULL)
+		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	w->events	= events;
+	w->serial	= ++loop->serial;
+	w->callback	= callback;
+	w->data		= data;
+	w->again	= 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (event_ctl(loop, EPOLL_CTL_ADD, ps->sd, w) < 0) {
+		free(w);
+		return pi_set_error(sd, PI_ERR_GENERIC_SYSTEM);
+	}
+#else
+	loop->dirty = 1;
+#endif
+
+	loop->watch[sd] = w;
+	loop->count++;
+
+	LOG((PI_DBG_SOCK, PI_DBG_LVL_DEBUG,
+		"EVENT add sd=%d events=0x%02x (%d sockets)\n",
+		sd, events, loop->count));
+
+	return 0;
+}
+
+int
+pi_event_modify(pi_event_loop_t *loop, int sd, int events)
+{
+	pi_event_watch_t *w;
+
+	if (loop == NULL || (events & ~(PI_EVENT_READ | PI_EVENT_WRITE)))
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	if ((w = event_watch(loop, sd)) == NULL) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	if (w->events == events)
+		return 0;
+	w->events = events;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (event_ctl(loop, EPOLL_CTL_MOD, sd, w) < 0)
+		return pi_set_error(sd, PI_ERR_GENERIC_SYSTEM);
+#else
+	loop->dirty = 1;
+#endif
+
+	return 0;
+}
+
+int
+pi_event_remove(pi_event_loop_t *loop, int sd)
+{
+	pi_event_watch_t *w;
+
+	if (loop == NULL)
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	if ((w = event_watch(loop, sd)) == NULL) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	/* fails harmlessly if the socket was closed first, which
+	   already took it out of the epoll set */
+	event_ctl(loop, EPOLL_CTL_DEL, sd, NULL);
+#else
+	loop->dirty = 1;
+#endif
+
+	loop->watch[sd] = NULL;
+	loop->count--;
+	free(w);
+
+	LOG((PI_DBG_SOCK, PI_DBG_LVL_DEBUG,
+		"EVENT remove sd=%d (%d sockets)\n", sd, loop->count));
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    event_pending
+ *
+ * Summary:     Tell if the device of a socket holds received data
+ *
+ * Parameters:  socket descriptor
+ *
+ * Returns:     1 if it does, 0 otherwise
+ *
+ ***********************************************************************/
+static int
+event_pending(int sd)
+{
+	pi_socket_t *ps = find_pi_socket(sd);
+
+	return ps != NULL && ps->device != NULL && ps->device->pending != NULL
+		&& ps->device->pending(ps) > 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    event_again
+ *
+ * Summary:     Queue a socket to be called back without waiting
+ *
+ * Parameters:  loop, socket descriptor, its watch
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+event_again(pi_event_loop_t *loop, int sd, pi_event_watch_t *w)
+{
+	if (loop->again_count == loop->again_size) {
+		int	size = loop->again_size ? loop->again_size * 2 : 16,
+			*again;
+
+		again = (int *) realloc(loop->again, size * sizeof(int));
+		if (again == NULL) {
+			/* the rest is read when more data arrives */
+			LOG((PI_DBG_SOCK, PI_DBG_LVL_ERR,
+				"EVENT no memory to call sd=%d again\n", sd));
+			return;
+		}
+		loop->again = again;
+		loop->again_size = size;
+	}
+
+	loop->again[loop->again_count++] = sd;
+	w->again = 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    event_run
+ *
+ * Summary:     call back the watch a ready descriptor belongs to
+ *
+ * Parameters:  loop, socket descriptor, serial of the watch the event
+ *		was registered for, PI_EVENT_* flags
+ *
+ * Returns:     1 if a callback ran, 0 otherwise
+ *
+ ***********************************************************************/
+static int
+event_run(pi_event_loop_t *loop, int sd, unsigned int serial, int events)
+{
+	pi_event_watch_t *w;
+
+	/* an earlier callback of the same batch may have removed the
+	   socket, or closed it and added another one on its descriptor */
+	w = event_watch(loop, sd);
+	if (w == NULL || w->serial != serial)
+		return 0;
+
+	events &= w->events | PI_EVENT_ERROR | PI_EVENT_HANGUP;
+	if (events == 0)
+		return 0;
+
+	w->callback(loop, sd, events, w->data);
+
+	/* a serial port may have read more than the packet handled into
+	   its read-ahead ring, which the descriptor will not report */
+	w = event_watch(loop, sd);
+	if (w != NULL && w->serial == serial && (w->events & PI_EVENT_READ)
+	    && !w->again && event_pending(sd))
+		event_again(loop, sd, w);
+
+	return 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    event_run_again
+ *
+ * Summary:     Call back the sockets whose device still holds data
+ *		after their last callback
+ *
+ * Parameters:  loop
+ *
+ * Returns:     number of callbacks run
+ *
+ ***********************************************************************/
+static int
+event_run_again(pi_event_loop_t *loop)
+{
+	int	i,
+		sd,
+		n	= loop->again_count,
+		ran	= 0;
+	pi_event_watch_t *w;
+
+	/* callbacks queue sockets again behind the ones taken here */
+	for (i = 0; i < n; i++) {
+		sd = loop->again[i];
+		w = event_watch(loop, sd);
+		if (w == NULL || !w->again)
+			continue;
+		w->again = 0;
+		if (event_pending(sd))
+			ran += event_run(loop, sd, w->serial, PI_EVENT_READ);
+	}
+
+	loop->again_count -= n;
+	memmove(loop->again, loop->again + n,
+		loop->again_count * sizeof(int));
+
+	return ran;
+}
+
+/***********************************************************************
+ *
+ * Function:    event_timeout
+ *
+ * Summary:     Run the socket watchdogs that are due and shorten the
+ *		wait so that the next ones run on time
+ *
+ * Parameters:  timeout in milliseconds, -1 for none
+ *
+ * Returns:     timeout to wait for
+ *
+ ***********************************************************************/
+static int
+event_timeout(int timeout)
+{
+	int	keepalive = pi_keepalive_run();
+
+	if (keepalive >= 0 && (timeout < 0 || keepalive < timeout))
+		return keepalive;
+	return timeout;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+int
+pi_event_dispatch(pi_event_loop_t *loop, int timeout)
+{
+	int	i,
+		n,
+		events,
+		ran = 0;
+	struct epoll_event ev[PI_EVENT_BATCH];
+
+	if (loop == NULL)
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	/* sockets with buffered data are called back right away */
+	ran = event_run_again(loop);
+	if (loop->again_count > 0)
+		timeout = 0;
+
+	n = epoll_wait(loop->epfd, ev, PI_EVENT_BATCH, event_timeout(timeout));
+	if (n < 0)
+		return (errno == EINTR) ? ran : PI_ERR_GENERIC_SYSTEM;
+
+	for (i = 0; i < n; i++) {
+		events = 0;
+		if (ev[i].events & EPOLLIN)
+			events |= PI_EVENT_READ;
+		if (ev[i].events & EPOLLOUT)
+			events |= PI_EVENT_WRITE;
+		if (ev[i].events & EPOLLERR)
+			events |= PI_EVENT_ERROR;
+		if (ev[i].events & EPOLLHUP)
+			events |= PI_EVENT_HANGUP;
+
+		ran += event_run(loop, (int) (uint32_t) ev[i].data.u64,
+			(unsigned int) (ev[i].data.u64 >> 32), events);
+	}
+
+	return ran;
+}
+
+#else
+
+int
+pi_event_dispatch(pi_event_loop_t *loop, int timeout)
+{
+	int	i,
+		n,
+		sd,
+		events,
+		ran = 0;
+
+	if (loop == NULL)
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	/* sockets with buffered data are called back right away, before
+	   the array is rebuilt for what their callbacks changed */
+	ran = event_run_again(loop);
+	if (loop->again_count > 0)
+		timeout = 0;
+
+	if (loop->dirty) {
+		struct pollfd *pfd;
+		unsigned int *pfd_serial;
+
+		pfd = (struct pollfd *) realloc(loop->pfd,
+			(loop->count + 1) * sizeof(struct pollfd));
+		if (pfd == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		loop->pfd = pfd;
+		pfd_serial = (unsigned int *) realloc(loop->pfd_serial,
+			(loop->count + 1) * sizeof(unsigned int));
+		if (pfd_serial == NULL)
+			return PI_ERR_GENERIC_MEMORY;
+		loop->pfd_serial = pfd_serial;
+
+		for (sd = 0, n = 0; sd < loop->size; sd++) {
+			pi_event_watch_t *w = loop->watch[sd];
+
+			if (w == NULL)
+				continue;
+			pfd[n].fd = sd;
+			pfd[n].events = 0;
+			if (w->events & PI_EVENT_READ)
+				pfd[n].events |= POLLIN;
+			if (w->events & PI_EVENT_WRITE)
+				pfd[n].events |= POLLOUT;
+			pfd_serial[n++] = w->serial;
+		}
+		loop->dirty = 0;
+	}
+
+	/* callbacks may add or remove sockets, which only marks the
+	   array dirty: walk the snapshot taken before polling */
+	n = loop->count;
+	if (poll(loop->pfd, (nfds_t) n, event_timeout(timeout)) < 0)
+		return (errno == EINTR) ? ran : PI_ERR_GENERIC_SYSTEM;
+
+	for (i = 0; i < n; i++) {
+		if (loop->pfd[i].revents == 0)
+			continue;
+
+		events = 0;
+		if (loop->pfd[i].revents & POLLIN)
+			events |= PI_EVENT_READ;
+		if (loop->pfd[i].revents & POLLOUT)
+			events |= PI_EVENT_WRITE;
+		if (loop->pfd[i].revents & (POLLERR | POLLNVAL))
+			events |= PI_EVENT_ERROR;
+		if (loop->pfd[i].revents & POLLHUP)
+			events |= PI_EVENT_HANGUP;
+
+		ran += event_run(loop, loop->pfd[i].fd,
+			loop->pfd_serial[i], events);
+	}
+
+	return ran;
+}
+
+#endif
+
+int
+pi_event_loop_run(pi_event_loop_t *loop)
+{
+	int	result;
+
+	if (loop == NULL)
+		return PI_ERR_GENERIC_ARGUMENT;
+
+	loop->running = 1;
+	while (loop->running && loop->count > 0) {
+		if ((result = pi_event_dispatch(loop, -1)) < 0) {
+			loop->running = 0;
+			return result;
+		}
+	}
+	loop->running = 0;
+
+	return 0;
+}
+
+void
+pi_event_loop_stop(pi_event_loop_t *loop)
+{
+	if (loop != NULL)
+		loop->running = 0;
+}
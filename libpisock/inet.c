@@ -45,6 +45,7 @@
 #include "pi-net.h"
 
 /* Declare prototypes */
+static pi_device_t* pi_inet_device_dup (pi_device_t *dev);
 static void pi_inet_device_free (pi_device_t *dev);
 static pi_protocol_t* pi_inet_protocol (pi_device_t *dev);
 static pi_protocol_t* pi_inet_protocol_dup (pi_protocol_t *prot);
@@ -56,6 +57,7 @@ static int pi_inet_listen(pi_socket_t *ps, int backlog);
 static int pi_inet_accept(pi_socket_t *ps, struct sockaddr *addr, size_t *addrlen);
 static ssize_t pi_inet_read(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags);
 static ssize_t pi_inet_write(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags);
+static ssize_t pi_inet_writev(pi_socket_t *ps, const struct iovec *iov, int iovcnt, int flags);
 static int pi_inet_getsockopt(pi_socket_t *ps, int level, int option_name, void *option_value, size_t *option_len);
 static int pi_inet_setsockopt(pi_socket_t *ps, int level, int option_name, const void *option_value, size_t *option_len);
 static int pi_inet_flush(pi_socket_t *ps, int flags);
@@ -85,6 +87,8 @@ pi_inet_device (int type)
 		dev->accept 	= pi_inet_accept;
 		dev->connect 	= pi_inet_connect;
 		dev->close 	= pi_inet_close;
+		dev->dup 	= pi_inet_device_dup;
+		dev->pending 	= NULL;
 
 		data->timeout 	= 0;
 		data->rx_bytes 	= 0;
@@ -97,6 +101,25 @@ pi_inet_device (int type)
 	return dev;
 }
 
+/* a listening inet socket can hand out any number of connections, so
+   pi_accept_new() needs a device of its own for each of them */
+static pi_device_t*
+pi_inet_device_dup (pi_device_t *dev)
+{
+	pi_device_t *new_dev;
+	pi_inet_data_t *data;
+
+	ASSERT (dev != NULL);
+
+	new_dev = pi_inet_device (PI_NET_DEV);
+	if (new_dev != NULL) {
+		data = (pi_inet_data_t *)new_dev->data;
+		data->timeout = ((pi_inet_data_t *)dev->data)->timeout;
+	}
+
+	return new_dev;
+}
+
 static void
 pi_inet_device_free (pi_device_t *dev)
 {
@@ -129,6 +152,7 @@ pi_inet_protocol (pi_device_t *dev)
 		prot->flush		= pi_inet_flush;
 		prot->getsockopt 	= pi_inet_getsockopt;
 		prot->setsockopt 	= pi_inet_setsockopt;
+		prot->writev 		= pi_inet_writev;
 		prot->data = NULL;
 	}
 	
@@ -153,6 +177,7 @@ pi_inet_protocol_dup (pi_protocol_t *prot)
 		new_prot->flush		= prot->flush;
 		new_prot->getsockopt 	= prot->getsockopt;
 		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->writev 	= prot->writev;
 		new_prot->data 		= NULL;
 	}
 
@@ -491,6 +516,91 @@ pi_inet_write(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
 	return len;
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_inet_writev
+ *
+ * Summary:     Write a message made of several pieces without first
+ *		copying them into a single buffer
+ *
+ * Parameters:  pi_socket_t*, iovec array, iovec count, flags
+ *
+ * Returns:     number of bytes written or negative on error
+ *
+ ***********************************************************************/
+static ssize_t
+pi_inet_writev(pi_socket_t *ps, const struct iovec *iov, int iovcnt, int flags)
+{
+	int 	i;
+	ssize_t	nwrote;
+	size_t	len = 0,
+		total;
+	struct 	iovec vec[8];
+	struct 	iovec *v = vec;
+	pi_inet_data_t *data = (pi_inet_data_t *)ps->device->data;
+	struct 	timeval t;
+	fd_set 	ready;
+
+	if (iovcnt <= 0 || iovcnt > (int)(sizeof(vec) / sizeof(vec[0]))) {
+		errno = EINVAL;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_ARGUMENT);
+	}
+
+	/* work on a copy, we advance it on partial writes */
+	for (i = 0; i < iovcnt; i++) {
+		vec[i] = iov[i];
+		len += iov[i].iov_len;
+	}
+
+	total = len;
+	while (total > 0) {
+		FD_ZERO(&ready);
+		FD_SET(ps->sd, &ready);
+		if (data->timeout == 0) {
+			if (select(ps->sd + 1, 0, &ready, 0, 0) < 0
+				&& errno == EINTR)
+				continue;
+		} else {
+			t.tv_sec 	= data->timeout / 1000;
+			t.tv_usec 	= (data->timeout % 1000) * 1000;
+			if (select(ps->sd + 1, 0, &ready, 0, &t) == 0)
+				return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
+		}
+		if (!FD_ISSET(ps->sd, &ready)) {
+			ps->state = PI_SOCK_CONN_BREAK;
+			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
+		}
+
+		nwrote = writev(ps->sd, v, iovcnt);
+		if (nwrote < 0) {
+			if (errno == EINTR)
+				continue;
+			/* test errno to properly set the socket error */
+			if (errno == EPIPE || errno == EBADF) {
+				ps->state = PI_SOCK_CONN_BREAK;
+				return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
+			}
+			return pi_set_error(ps->sd, PI_ERR_SOCK_IO);
+		}
+
+		total -= nwrote;
+		while (iovcnt > 0 && (size_t)nwrote >= v->iov_len) {
+			nwrote -= v->iov_len;
+			v++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			v->iov_base = (char *)v->iov_base + nwrote;
+			v->iov_len -= nwrote;
+		}
+	}
+	data->tx_bytes += len;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_INFO, "DEV TX Inet Bytes: %d\n", len));
+
+	return len;
+}
+
 static ssize_t
 pi_inet_read(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 {
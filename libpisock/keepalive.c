@@ -0,0 +1,566 @@
+/*
+ * $Id$
+ *
+ * keepalive.c: per-socket keepalive timers behind pi_watchdog()
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pi-debug.h"
+#include "pi-source.h"
+#include "pi-threadsafe.h"
+
+/* Timers live in a wheel of one second slots, hashed by the second they
+   expire in. A slot list is unsorted and may hold timers for later turns
+   of the wheel, so arming and cancelling are O(1) and each tick only
+   walks the timers hashed to that second. */
+#define PI_KEEPALIVE_SLOTS	256
+
+struct pi_keepalive {
+	struct pi_keepalive *next;
+	struct pi_keepalive *prev;
+	int	sd;
+	int	interval;		/* seconds */
+	time_t	expires;
+	volatile time_t last_io;	/* end of the last pi_send()/pi_recv() */
+	volatile sig_atomic_t busy;	/* inside pi_send()/pi_recv() */
+	int	running,		/* being expired, not in the wheel */
+		cancelled;		/* freed by pi_keepalive_cancel() */
+	PI_MUTEX_DECLARE(io_mutex);
+};
+
+static struct {
+	struct pi_keepalive *slot[PI_KEEPALIVE_SLOTS];
+	int	count;			/* armed timers */
+	time_t	now;			/* last second run */
+} wheel;
+
+/* With threads, the wheel is run by a background thread that sleeps until
+   the next timer is due. Without, SIGALRM is set for the next timer, as
+   the old watchdog did, until an event loop calls pi_keepalive_run(). The
+   wheel "lock" then keeps the signal out while the lists are changed. */
+#if HAVE_PTHREAD
+static PI_MUTEX_DEFINE(wheel_mutex);
+static pthread_cond_t wheel_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wheel_idle = PTHREAD_COND_INITIALIZER;
+static int wheel_thread_started = 0;
+#else
+static int wheel_external = 0;
+
+static void
+wheel_sigmask(int how)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	sigprocmask(how, &set, NULL);
+}
+#endif
+
+static void
+wheel_lock(void)
+{
+#if HAVE_PTHREAD
+	pi_mutex_lock(&wheel_mutex);
+#else
+	wheel_sigmask(SIG_BLOCK);
+#endif
+}
+
+static void
+wheel_unlock(void)
+{
+#if HAVE_PTHREAD
+	pi_mutex_unlock(&wheel_mutex);
+#else
+	wheel_sigmask(SIG_UNBLOCK);
+#endif
+}
+
+/***********************************************************************
+ *
+ * Function:    wheel_insert
+ *
+ * Summary:     Arm a timer, wheel locked
+ *
+ * Parameters:  timer, expiry time
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+wheel_insert(struct pi_keepalive *k, time_t expires)
+{
+	struct pi_keepalive **slot;
+
+	if (wheel.count == 0)
+		wheel.now = time(NULL);
+
+	/* never hash a timer into a second already run */
+	if (expires <= wheel.now)
+		expires = wheel.now + 1;
+
+	slot = &wheel.slot[expires % PI_KEEPALIVE_SLOTS];
+	k->expires = expires;
+	k->prev = NULL;
+	k->next = *slot;
+	if (*slot != NULL)
+		(*slot)->prev = k;
+	*slot = k;
+	wheel.count++;
+}
+
+/***********************************************************************
+ *
+ * Function:    wheel_unlink
+ *
+ * Summary:     Disarm a timer, wheel locked
+ *
+ * Parameters:  timer
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+wheel_unlink(struct pi_keepalive *k)
+{
+	if (k->prev != NULL)
+		k->prev->next = k->next;
+	else
+		wheel.slot[k->expires % PI_KEEPALIVE_SLOTS] = k->next;
+	if (k->next != NULL)
+		k->next->prev = k->prev;
+	k->next = k->prev = NULL;
+	wheel.count--;
+}
+
+/***********************************************************************
+ *
+ * Function:    wheel_next
+ *
+ * Summary:     Time until the next non-empty slot
+ *
+ * Parameters:  current time
+ *
+ * Returns:     Seconds to wait, or -1 if no timer is armed
+ *
+ ***********************************************************************/
+static int
+wheel_next(time_t now)
+{
+	int	i;
+
+	if (wheel.count == 0)
+		return -1;
+
+	for (i = 1; i < PI_KEEPALIVE_SLOTS; i++)
+		if (wheel.slot[(now + i) % PI_KEEPALIVE_SLOTS] != NULL)
+			return i;
+
+	return PI_KEEPALIVE_SLOTS;
+}
+
+/***********************************************************************
+ *
+ * Function:    keepalive_done
+ *
+ * Summary:     Re-arm a timer that has been expired, unless it was
+ *		cancelled meanwhile, wheel locked
+ *
+ * Parameters:  timer, expiry time
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+keepalive_done(struct pi_keepalive *k, time_t expires)
+{
+	k->running = 0;
+	if (k->cancelled) {
+#if HAVE_PTHREAD
+		pthread_cond_broadcast(&wheel_idle);
+#endif
+		return;
+	}
+	wheel_insert(k, expires);
+}
+
+/***********************************************************************
+ *
+ * Function:    keepalive_expire
+ *
+ * Summary:     Tickle the socket of an expired timer if it has been
+ *		idle for a whole interval, then re-arm the timer
+ *
+ * Parameters:  timer, current time
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+keepalive_expire(struct pi_keepalive *k, time_t now)
+{
+	pi_socket_t *ps;
+
+	if (k->cancelled) {
+		keepalive_done(k, now);
+		return;
+	}
+
+	/* pi_send() and pi_recv() only note the time; the timer catches
+	   up with them here. last_io is rounded down, so a whole interval
+	   has only passed once the second after it is over. */
+	if (k->last_io + k->interval >= now) {
+		keepalive_done(k, k->last_io + k->interval + 1);
+		return;
+	}
+
+	ps = find_pi_socket(k->sd);
+	if (ps == NULL || !(ps->state == PI_SOCK_CONN_INIT
+			|| ps->state == PI_SOCK_CONN_ACCEPT)) {
+		keepalive_done(k, now + k->interval);
+		return;
+	}
+
+	if (k->busy || pi_mutex_trylock(&k->io_mutex) != 0) {
+		LOG((PI_DBG_SOCK, PI_DBG_LVL_INFO,
+			"SOCKET Socket %d is busy during tickle\n", k->sd));
+		keepalive_done(k, now + 1);
+		return;
+	}
+
+	/* a tickle over a slow link may take seconds of retries; the
+	   other sockets' timers, pi_watchdog() and pi_close() must not
+	   wait for it. The running flag keeps the timer alive. */
+	k->busy = 1;
+#if HAVE_PTHREAD
+	wheel_unlock();
+#endif
+	if (pi_tickle(k->sd) < 0)
+		LOG((PI_DBG_SOCK, PI_DBG_LVL_INFO,
+			"SOCKET Tickle failed on socket %d\n", k->sd));
+	k->busy = 0;
+	pi_mutex_unlock(&k->io_mutex);
+#if HAVE_PTHREAD
+	wheel_lock();
+#endif
+
+	keepalive_done(k, now + k->interval);
+}
+
+/***********************************************************************
+ *
+ * Function:    wheel_run
+ *
+ * Summary:     Expire the timers due up to now, wheel locked
+ *
+ * Parameters:  current time
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+wheel_run(time_t now)
+{
+	int	ticks;
+	time_t	t;
+	struct pi_keepalive *k,
+		*next,
+		*due = NULL;
+
+	ticks = (int) (now - wheel.now);
+	if (wheel.count == 0 || ticks <= 0) {
+		if (wheel.count == 0)
+			wheel.now = now;
+		return;
+	}
+
+	/* after a long sleep, one turn of the wheel covers every slot */
+	if (ticks > PI_KEEPALIVE_SLOTS)
+		ticks = PI_KEEPALIVE_SLOTS;
+
+	/* gather first: a socket re-armed while its slot is being walked
+	   could otherwise be expired twice */
+	for (t = now - ticks + 1; t <= now; t++) {
+		for (k = wheel.slot[t % PI_KEEPALIVE_SLOTS]; k != NULL; k = next) {
+			next = k->next;
+			if (k->expires <= now) {
+				wheel_unlink(k);
+				k->running = 1;
+				k->next = due;
+				due = k;
+			}
+		}
+	}
+	wheel.now = now;
+
+	while ((k = due) != NULL) {
+		due = k->next;
+		k->next = NULL;
+		keepalive_expire(k, now);
+	}
+}
+
+#if HAVE_PTHREAD
+static void *
+wheel_thread(void *arg)
+{
+	int	next;
+	time_t	now;
+	struct timespec until;
+
+	pi_mutex_lock(&wheel_mutex);
+	for (;;) {
+		now = time(NULL);
+		wheel_run(now);
+
+		next = wheel_next(now);
+		if (next < 0) {
+			pthread_cond_wait(&wheel_cond, &wheel_mutex);
+		} else {
+			until.tv_sec = now + next;
+			until.tv_nsec = 0;
+			pthread_cond_timedwait(&wheel_cond, &wheel_mutex, &until);
+		}
+	}
+
+	return NULL;
+}
+#else
+static RETSIGTYPE
+onalarm(int signo)
+{
+	int	next;
+	time_t	now;
+
+	signal(signo, onalarm);
+
+	now = time(NULL);
+	wheel_run(now);
+
+	if (!wheel_external) {
+		next = wheel_next(now);
+		alarm(next > 0 ? (unsigned int) next : 0);
+	}
+}
+#endif
+
+/***********************************************************************
+ *
+ * Function:    wheel_changed
+ *
+ * Summary:     Make sure whatever drives the wheel wakes up in time for
+ *		a timer just armed, wheel locked
+ *
+ * Parameters:  None
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+wheel_changed(void)
+{
+#if HAVE_PTHREAD
+	pthread_t thread;
+
+	if (!wheel_thread_started) {
+		if (pthread_create(&thread, NULL, wheel_thread, NULL) == 0) {
+			pthread_detach(thread);
+			wheel_thread_started = 1;
+		}
+	} else
+		pthread_cond_signal(&wheel_cond);
+#else
+	int	next;
+
+	if (wheel_external)
+		return;
+
+	signal(SIGALRM, onalarm);
+	next = wheel_next(time(NULL));
+	alarm(next > 0 ? (unsigned int) next : 0);
+#endif
+}
+
+int
+pi_watchdog(int pi_sd, int interval)
+{
+	pi_socket_t *ps;
+	struct pi_keepalive *k;
+
+	if (!(ps = find_pi_socket(pi_sd))) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	if (interval <= 0) {
+		pi_keepalive_cancel(ps);
+		return 0;
+	}
+
+	wheel_lock();
+
+	k = ps->keepalive;
+	if (k == NULL) {
+		k = (struct pi_keepalive *) calloc(1, sizeof(struct pi_keepalive));
+		if (k == NULL) {
+			wheel_unlock();
+			errno = ENOMEM;
+			return pi_set_error(pi_sd, PI_ERR_GENERIC_MEMORY);
+		}
+#if HAVE_PTHREAD
+		pthread_mutex_init(&k->io_mutex, NULL);
+#endif
+		k->sd = pi_sd;
+		k->last_io = time(NULL);
+		ps->keepalive = k;
+	} else if (!k->running)
+		wheel_unlink(k);
+
+	/* a running timer is re-armed with the new interval once its
+	   tickle is over */
+	k->interval = interval;
+	if (!k->running) {
+		wheel_insert(k, time(NULL) + interval);
+		wheel_changed();
+	}
+
+	wheel_unlock();
+
+	return 0;
+}
+
+int
+pi_keepalive_run(void)
+{
+	int	next;
+	time_t	now;
+
+	wheel_lock();
+
+#if !HAVE_PTHREAD
+	if (!wheel_external) {
+		wheel_external = 1;
+		alarm(0);
+	}
+#endif
+
+	now = time(NULL);
+	wheel_run(now);
+	next = wheel_next(now);
+
+	wheel_unlock();
+
+	return (next < 0) ? -1 : next * 1000;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_keepalive_cancel
+ *
+ * Summary:     Stop the watchdog of a socket and free its timer
+ *
+ * Parameters:  pi_socket_t*
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+void
+pi_keepalive_cancel(pi_socket_t *ps)
+{
+	struct pi_keepalive *k;
+
+	wheel_lock();
+
+	k = ps->keepalive;
+	if (k != NULL) {
+		ps->keepalive = NULL;
+#if HAVE_PTHREAD
+		/* wait for a tickle of this socket to finish, which the
+		   wheel thread does without the wheel lock */
+		if (k->running) {
+			k->cancelled = 1;
+			while (k->running)
+				pthread_cond_wait(&wheel_idle, &wheel_mutex);
+		} else
+#endif
+			wheel_unlink(k);
+#if HAVE_PTHREAD
+		pthread_mutex_destroy(&k->io_mutex);
+#endif
+		free(k);
+	}
+
+	wheel_unlock();
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_keepalive_io_begin
+ *
+ * Summary:     Keep the watchdog from tickling a socket while
+ *		pi_send() or pi_recv() is using it
+ *
+ * Parameters:  timer
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+void
+pi_keepalive_io_begin(struct pi_keepalive *k)
+{
+	pi_mutex_lock(&k->io_mutex);
+	k->busy = 1;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_keepalive_io_end
+ *
+ * Summary:     Note the end of a pi_send() or pi_recv(), which pushes
+ *		the next tickle back a whole interval
+ *
+ * Parameters:  timer
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+void
+pi_keepalive_io_end(struct pi_keepalive *k)
+{
+	k->last_io = time(NULL);
+	k->busy = 0;
+	pi_mutex_unlock(&k->io_mutex);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* ex: set tabstop=4 expandtab: */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -25,6 +25,8 @@
 #endif
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <pthread.h>
@@ -45,6 +47,16 @@
 
 #include <usb.h>
 
+/* On Linux the bulk transfers can go through the device's usbfs node,
+   which lets us keep several of them queued. libusb 0.1 has no
+   asynchronous interface. */
+#ifdef HAVE_LINUX_USBDEVICE_FS_H
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#define USBFS_ASYNC	1
+#endif
+
 #if defined(sun) && defined(__SVR4)
 #define __FUNCTION__ __func__
 #endif
@@ -82,14 +94,130 @@ void pi_usb_impl_init (struct pi_usb_impl *impl)
 
 /***********************************************************************
  *
- * Start of the device identification code.
+ * Per-connection state. Each socket opened on a handheld owns one
+ * usb_connection_t, kept in pi_usb_data_t's ref, so that several
+ * handhelds can be served by the same process.
  *
  ***********************************************************************/
 
-static usb_dev_handle	*USB_handle;
-static int				USB_interface;
-static int				USB_in_endpoint;
-static int				USB_out_endpoint;
+#define MAX_READ_SIZE	16384
+#define AUTO_READ_SIZE	64		/* bulk packet size, reads are whole packets */
+#define RD_RING_SIZE	65536		/* power of two */
+#define RD_RING_MASK	(RD_RING_SIZE - 1)
+#define RD_WRITE_URBS	8		/* write URBs queued at once */
+#define RD_WRITE_SIZE	16384		/* largest usbfs transfer */
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define RD_barrier()	__sync_synchronize()
+#else
+#define RD_barrier()
+#endif
+
+typedef struct usb_connection_t
+{
+	struct usb_connection_t *next;		/* linked list of claimed devices */
+	char bus[LIBUSB_PATH_MAX];		/* identifies the device claimed */
+	char device[LIBUSB_PATH_MAX];
+
+	usb_dev_handle *handle;
+	int interface;
+	int in_endpoint;
+	int out_endpoint;
+
+	pthread_t reader;			/* thread filling the ring */
+	int reader_started;
+	volatile int running;
+	volatile size_t wanted;			/* bytes u_read_i() waits for, sizes the next read */
+
+	/* Receive ring. The reader thread only advances head and
+	   u_read_i() only advances tail: both count bytes since the ring
+	   was emptied and are masked into ring[]. Data moves without
+	   locking; the mutex and conditions only put an empty consumer
+	   or a full producer to sleep. */
+	volatile size_t head;
+	volatile size_t tail;
+	volatile int consumer_waiting;
+	volatile int producer_waiting;
+	pthread_mutex_t wait_mutex;
+	pthread_cond_t data_avail_cond;
+	pthread_cond_t space_avail_cond;
+
+	/* The socket's descriptor is the read end of this pipe, which
+	   holds a byte while the ring holds data or the device is gone,
+	   so that poll() and the event loop see the connection as
+	   readable. ready_set changes under wait_mutex. */
+	int ready[2];
+	volatile int ready_set;
+
+	unsigned char ring[RD_RING_SIZE];
+	unsigned char bounce[AUTO_READ_SIZE];	/* read target when the ring wraps within a packet */
+
+#ifdef USBFS_ASYNC
+	/* Queued transfers through usbfs. Each bulk-in URB is a single
+	   packet, so it completes as soon as the packet arrives however
+	   the handheld splits its transfers. The reader thread reaps all
+	   URBs, including those of u_write(). */
+	int fd;					/* usbfs node, -1 when libusb does the transfers */
+	int wake[2];				/* pipe waking the reader thread */
+	int urbs;				/* number of bulk-in URBs */
+	int in_flight;				/* bulk-in URBs submitted, reader thread only */
+	struct usbdevfs_urb *in_urb;
+	unsigned char *in_buf;
+	struct usbdevfs_urb out_urb[RD_WRITE_URBS];
+	int out_pending;			/* write URBs not reaped yet, under wait_mutex */
+	int out_status;
+	size_t out_written;
+	pthread_cond_t write_done_cond;
+#endif
+} usb_connection_t;
+
+static pthread_mutex_t usb_connections_mutex = PTHREAD_MUTEX_INITIALIZER;
+static usb_connection_t *usb_connections = NULL;
+
+static usb_connection_t *
+usb_connection_new (void)
+{
+	usb_connection_t *c;
+
+	c = (usb_connection_t *) calloc (1, sizeof (usb_connection_t));
+	if (c == NULL)
+		return NULL;
+
+	pthread_mutex_init (&c->wait_mutex, NULL);
+	pthread_cond_init (&c->data_avail_cond, NULL);
+	pthread_cond_init (&c->space_avail_cond, NULL);
+	c->ready[0] = c->ready[1] = -1;
+#ifdef USBFS_ASYNC
+	pthread_cond_init (&c->write_done_cond, NULL);
+	c->fd = c->wake[0] = c->wake[1] = -1;
+#endif
+
+	return c;
+}
+
+static void
+usb_connection_free (usb_connection_t *c)
+{
+	pthread_mutex_destroy (&c->wait_mutex);
+	pthread_cond_destroy (&c->data_avail_cond);
+	pthread_cond_destroy (&c->space_avail_cond);
+	/* the read end is the socket's descriptor, closed with it */
+	if (c->ready[1] >= 0)
+		close (c->ready[1]);
+#ifdef USBFS_ASYNC
+	pthread_cond_destroy (&c->write_done_cond);
+	free (c->in_urb);
+	free (c->in_buf);
+#endif
+	free (c);
+}
+
+
+/***********************************************************************
+ *
+ * Start of the device identification code.
+ *
+ ***********************************************************************/
 
 static int
 USB_open (pi_usb_data_t *data)
@@ -99,9 +227,22 @@ USB_open (pi_usb_data_t *data)
 	return 1;
 }
 
+static int
+USB_claimed (struct usb_bus *bus, struct usb_device *dev)
+{
+	usb_connection_t *c;
+
+	for (c = usb_connections; c != NULL; c = c->next)
+		if (!strcmp (c->bus, bus->dirname) && !strcmp (c->device, dev->filename))
+			return 1;
+
+	return 0;
+}
+
 static int
 USB_poll (pi_usb_data_t *data)
 {
+	usb_connection_t *c = (usb_connection_t *) data->ref;
 	struct usb_bus *bus;
 	struct usb_device *dev;
 	int ret;
@@ -110,6 +251,10 @@ USB_poll (pi_usb_data_t *data)
 	int first;
 #endif
 
+	/* a device claimed by another connection of ours must be left
+	   alone, and two connections must not race for the same one */
+	pthread_mutex_lock (&usb_connections_mutex);
+
 	usb_find_busses ();
 	usb_find_devices ();
 	CHECK (PI_DBG_DEV, PI_DBG_LVL_DEBUG, usb_set_debug (2));
@@ -117,7 +262,7 @@ USB_poll (pi_usb_data_t *data)
 	for (bus = usb_busses; bus; bus = bus->next) {
 		for (dev = bus->devices; dev; dev = dev->next) {
 			int i;
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: checking device %p\n", 
+			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: checking device %p\n",
 				__FILE__, dev));
 
 			if (dev->descriptor.bNumConfigurations < 1)
@@ -130,8 +275,10 @@ USB_poll (pi_usb_data_t *data)
 				continue;
 			if (dev->config[0].interface[0].altsetting[0].bNumEndpoints < 2)
 				continue;
+			if (USB_claimed (bus, dev))
+				continue;
 
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: %d, 0x%04x 0x%04x.\n", 
+			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: %d, 0x%04x 0x%04x.\n",
 				__FILE__, __LINE__, dev->descriptor.idVendor, dev->descriptor.idProduct));
 
 			if (USB_check_device (data, dev->descriptor.idVendor, dev->descriptor.idProduct))
@@ -140,23 +287,22 @@ USB_poll (pi_usb_data_t *data)
 			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: trying to open device %p\n",
 				__FILE__, dev));
 
-			USB_handle = usb_open(dev);
+			c->handle = usb_open(dev);
 
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: USB_handle=%p\n", 
-				__FILE__, USB_handle));
-
-			data->ref = USB_handle;
+			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: USB_handle=%p\n",
+				__FILE__, c->handle));
 
 			input_endpoint = output_endpoint = 0xFF;
-			USB_in_endpoint = USB_out_endpoint = 0xFF;
+			c->in_endpoint = c->out_endpoint = 0xFF;
 
 			ret = USB_configure_device (data, &input_endpoint, &output_endpoint);
 			if (ret < 0) {
-				LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, 
-					"%s: USB configure failed for familar device: 0x%04x 0x%04x. (LifeDrive issue?)\n", 
+				LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
+					"%s: USB configure failed for familar device: 0x%04x 0x%04x. (LifeDrive issue?)\n",
 					__FILE__, dev->descriptor.idVendor, dev->descriptor.idProduct));
 
-				usb_close(USB_handle);
+				usb_close(c->handle);
+				c->handle = NULL;
 				continue;
 			}
 
@@ -174,39 +320,40 @@ USB_poll (pi_usb_data_t *data)
 				if ((address & USB_ENDPOINT_DIR_MASK)) {
 					LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "In: 0x%x 0x%x.\n", address, input_endpoint));
 					if (input_endpoint == 0xFF)
-						USB_in_endpoint = address;
+						c->in_endpoint = address;
 					else if ((address & USB_ENDPOINT_ADDRESS_MASK) == input_endpoint)
-						USB_in_endpoint = address;
+						c->in_endpoint = address;
 				} else {
 					LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "Out: 0x%x 0x%x.\n", address, output_endpoint));
 					if (output_endpoint == 0xFF)
-						USB_out_endpoint = address;
+						c->out_endpoint = address;
 					else if ((address & USB_ENDPOINT_ADDRESS_MASK) == output_endpoint)
-						USB_out_endpoint = address;
+						c->out_endpoint = address;
 				}
 			}
 
-			if (USB_in_endpoint == 0xFF || USB_out_endpoint == 0xFF) {
-				usb_close (USB_handle);
+			if (c->in_endpoint == 0xFF || c->out_endpoint == 0xFF) {
+				usb_close (c->handle);
+				c->handle = NULL;
 				continue;
 			}
 
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, 
-				"Config: %d, 0x%x 0x%x | 0x%x 0x%x.\n", 
-				ret, input_endpoint, output_endpoint, USB_in_endpoint, USB_out_endpoint));
+			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
+				"Config: %d, 0x%x 0x%x | 0x%x 0x%x.\n",
+				ret, input_endpoint, output_endpoint, c->in_endpoint, c->out_endpoint));
 
-			USB_interface = dev->config[0].interface[0].altsetting[0].bInterfaceNumber;
+			c->interface = dev->config[0].interface[0].altsetting[0].bInterfaceNumber;
 #ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
 			first = 1;
 claim:
 #endif
-			i = usb_claim_interface (USB_handle, USB_interface);
+			i = usb_claim_interface (c->handle, c->interface);
 			if (i < 0) {
 				if (i == -EBUSY) {
 					LOG((PI_DBG_DEV, PI_DBG_LVL_ERR, "Unable to claim device: Busy.\n"));
 #ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
 					if (first) {
-						usb_detach_kernel_driver_np (USB_handle, USB_interface);
+						usb_detach_kernel_driver_np (c->handle, c->interface);
 						first = 0;
 						goto claim;
 					}
@@ -215,81 +362,312 @@ claim:
 					LOG((PI_DBG_DEV, PI_DBG_LVL_ERR, "Unable to claim device: No memory.\n"));
 				else
 					LOG((PI_DBG_DEV, PI_DBG_LVL_ERR, "Unable to claim device: %d.\n", i));
-				usb_close (USB_handle);
+				usb_close (c->handle);
+				c->handle = NULL;
 
+				pthread_mutex_unlock (&usb_connections_mutex);
 				errno = -i;
-				LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: %d.\n", 
+				LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: %d.\n",
 					__FILE__, __LINE__));
 
 				return 0;
 			}
 
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: %d.\n", 
+			strncpy (c->bus, bus->dirname, sizeof (c->bus) - 1);
+			strncpy (c->device, dev->filename, sizeof (c->device) - 1);
+			c->next = usb_connections;
+			usb_connections = c;
+			pthread_mutex_unlock (&usb_connections_mutex);
+
+			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s: %d.\n",
 				__FILE__, __LINE__));
 			return 1;
 		}
 	}
 
+	pthread_mutex_unlock (&usb_connections_mutex);
 	errno = ENODEV;
 	CHECK (PI_DBG_DEV, PI_DBG_LVL_DEBUG, usb_set_debug (0));
 	return 0;
 }
 
 static int
-USB_close (void)
+USB_close (usb_connection_t *c)
 {
-	if (!USB_handle)
+	usb_connection_t **link;
+
+	if (!c->handle)
 		return 0;
 
-	usb_release_interface (USB_handle, USB_interface);
-	usb_close (USB_handle);
-	USB_handle = NULL;
+	pthread_mutex_lock (&usb_connections_mutex);
+	for (link = &usb_connections; *link != NULL; link = &(*link)->next)
+		if (*link == c) {
+			*link = c->next;
+			break;
+		}
+	pthread_mutex_unlock (&usb_connections_mutex);
+
+#ifdef USBFS_ASYNC
+	if (c->fd >= 0) {
+		ioctl (c->fd, USBDEVFS_RELEASEINTERFACE, &c->interface);
+		close (c->fd);
+		close (c->wake[0]);
+		close (c->wake[1]);
+		c->fd = c->wake[0] = c->wake[1] = -1;
+	} else
+#endif
+	usb_release_interface (c->handle, c->interface);
+	usb_close (c->handle);
+	c->handle = NULL;
 	return 1;
 }
 
+#ifdef USBFS_ASYNC
+/***********************************************************************
+ *
+ * Function:    USB_async_open
+ *
+ * Summary:     Move the bulk transfers of a claimed device to its usbfs
+ *		node, so that several of them can be queued
+ *
+ * Parameters:  connection, number of bulk-in URBs to queue
+ *
+ * Returns:     1 if usbfs carries the transfers, 0 if libusb still does
+ *
+ ***********************************************************************/
+static int
+USB_async_open (usb_connection_t *c, int urbs)
+{
+	static const char *roots[] = { "/dev/bus/usb", "/proc/bus/usb" };
+	char	path[2 * LIBUSB_PATH_MAX + 16];
+	unsigned int i;
+	int	fd = -1;
+
+	if (urbs <= 0)
+		return 0;
+	if (urbs > RD_RING_SIZE / AUTO_READ_SIZE)
+		urbs = RD_RING_SIZE / AUTO_READ_SIZE;
+
+	for (i = 0; fd < 0 && i < sizeof (roots) / sizeof (roots[0]); i++) {
+		snprintf (path, sizeof (path), "%s/%s/%s", roots[i], c->bus, c->device);
+		fd = open (path, O_RDWR);
+	}
+	if (fd < 0)
+		return 0;
+
+	c->in_urb = (struct usbdevfs_urb *) calloc ((size_t) urbs, sizeof (struct usbdevfs_urb));
+	c->in_buf = (unsigned char *) malloc ((size_t) urbs * AUTO_READ_SIZE);
+	if (c->in_urb == NULL || c->in_buf == NULL || pipe (c->wake) < 0)
+		goto fail;
+	fcntl (c->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl (c->wake[1], F_SETFL, O_NONBLOCK);
+
+	/* only one open file can hold the interface */
+	usb_release_interface (c->handle, c->interface);
+	if (ioctl (fd, USBDEVFS_CLAIMINTERFACE, &c->interface) < 0) {
+		usb_claim_interface (c->handle, c->interface);
+		close (c->wake[0]);
+		close (c->wake[1]);
+		c->wake[0] = c->wake[1] = -1;
+		goto fail;
+	}
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "libusb: %d URBs queued through %s\n",
+		urbs, path));
+
+	c->fd = fd;
+	c->urbs = urbs;
+	c->in_flight = 0;
+	return 1;
+
+fail:
+	close (fd);
+	free (c->in_urb);
+	free (c->in_buf);
+	c->in_urb = NULL;
+	c->in_buf = NULL;
+	return 0;
+}
+#endif
+
 
 /***********************************************************************
  *
  * Start of the read thread code, please note that all of this runs
- * in a separate thread.
+ * in a separate thread, one per connection. The thread is only
+ * cancelled while blocked in usb_bulk_read() or waiting for room in
+ * the ring.
  *
  ***********************************************************************/
 
-#define MAX_READ_SIZE	16384
-#define AUTO_READ_SIZE	64
-static char		*RD_buffer = NULL;
-static size_t		RD_buffer_size;
-static size_t		RD_buffer_used;
-static pthread_mutex_t	RD_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t	RD_buffer_available_cond = PTHREAD_COND_INITIALIZER;
-static int		RD_wanted;
-static int		RD_running = 0;
-static char		RD_usb_buffer[MAX_READ_SIZE];
-static pthread_t	RD_thread = 0;
+static void
+RD_unlock (void *mutex)
+{
+	pthread_mutex_unlock ((pthread_mutex_t *) mutex);
+}
+
+static void
+RD_wait_space (usb_connection_t *c)
+{
+	pthread_mutex_lock (&c->wait_mutex);
+	pthread_cleanup_push (RD_unlock, &c->wait_mutex);
+
+	c->producer_waiting = 1;
+	RD_barrier ();
+	pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+	while (c->running && c->head - c->tail > RD_RING_SIZE - AUTO_READ_SIZE)
+		pthread_cond_wait (&c->space_avail_cond, &c->wait_mutex);
+	pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+	c->producer_waiting = 0;
+
+	pthread_cleanup_pop (1);
+}
+
+static void
+RD_set_ready (usb_connection_t *c)
+{
+	pthread_mutex_lock (&c->wait_mutex);
+	if (!c->ready_set) {
+		c->ready_set = 1;
+		while (write (c->ready[1], "", 1) < 0 && errno == EINTR)
+			;
+	}
+	pthread_mutex_unlock (&c->wait_mutex);
+}
 
+/* called by u_read_i() and u_flush() once they have emptied the ring */
 static void
-RD_do_read (int timeout)
+RD_clear_ready (usb_connection_t *c)
 {
-	int	bytes_read, read_size;
+	char	drain[16];
+
+	pthread_mutex_lock (&c->wait_mutex);
+	if (c->ready_set && c->head == c->tail) {
+		while (read (c->ready[0], drain, sizeof (drain)) > 0)
+			;
+		c->ready_set = 0;
+
+		/* the reader may have committed data after the test above
+		   and still seen the flag set */
+		RD_barrier ();
+		if (c->head != c->tail || !c->running) {
+			c->ready_set = 1;
+			while (write (c->ready[1], "", 1) < 0 && errno == EINTR)
+				;
+		}
+	}
+	pthread_mutex_unlock (&c->wait_mutex);
+}
+
+static void
+RD_wake_consumer (usb_connection_t *c)
+{
+	RD_barrier ();
+	if (!c->ready_set && c->ready[1] >= 0)
+		RD_set_ready (c);
+	if (c->consumer_waiting) {
+		pthread_mutex_lock (&c->wait_mutex);
+		pthread_cond_broadcast (&c->data_avail_cond);
+		pthread_mutex_unlock (&c->wait_mutex);
+	}
+}
+
+/* called by u_read_i() and u_flush() once they have freed room */
+static void
+RD_wake_producer (usb_connection_t *c)
+{
+	RD_barrier ();
+	if (c->producer_waiting) {
+#ifdef USBFS_ASYNC
+		if (c->fd >= 0) {
+			while (write (c->wake[1], "", 1) < 0 && errno == EINTR)
+				;
+			return;
+		}
+#endif
+		pthread_mutex_lock (&c->wait_mutex);
+		pthread_cond_signal (&c->space_avail_cond);
+		pthread_mutex_unlock (&c->wait_mutex);
+	}
+}
+
+static void
+RD_ring_commit (usb_connection_t *c, size_t len)
+{
+	/* publish the data before the new head */
+	RD_barrier ();
+	c->head += len;
+	RD_wake_consumer (c);
+}
+
+static void
+RD_ring_put (usb_connection_t *c, const unsigned char *data, size_t len)
+{
+	size_t	offset = c->head & RD_RING_MASK,
+		contiguous = RD_RING_SIZE - offset;
+
+	if (len <= contiguous)
+		memcpy (c->ring + offset, data, len);
+	else {
+		memcpy (c->ring + offset, data, contiguous);
+		memcpy (c->ring, data + contiguous, len - contiguous);
+	}
+	RD_ring_commit (c, len);
+}
 
-	read_size = RD_wanted - RD_buffer_used;
+static void
+RD_do_read (usb_connection_t *c, int timeout)
+{
+	int	bytes_read;
+	size_t	head = c->head,
+		used,
+		read_size,
+		contiguous;
+	unsigned char *target;
+
+	used = head - c->tail;
+	if (RD_RING_SIZE - used < AUTO_READ_SIZE) {
+		RD_wait_space (c);
+		return;
+	}
+
+	read_size = c->wanted > used ? c->wanted - used : 0;
 	if (read_size < AUTO_READ_SIZE)
 		read_size = AUTO_READ_SIZE;
 	else if (read_size > MAX_READ_SIZE)
 		read_size = MAX_READ_SIZE;
+	if (read_size > RD_RING_SIZE - used)
+		read_size = RD_RING_SIZE - used;
+
+	/* read straight into the ring, in whole packets */
+	contiguous = RD_RING_SIZE - (head & RD_RING_MASK);
+	if (read_size > contiguous)
+		read_size = contiguous;
+	read_size &= ~(size_t) (AUTO_READ_SIZE - 1);
+	if (read_size) {
+		target = c->ring + (head & RD_RING_MASK);
+	} else {
+		target = c->bounce;
+		read_size = AUTO_READ_SIZE;
+	}
 
 	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "Reading: len: %d, timeout: %d.\n", read_size, timeout));
-	bytes_read = usb_bulk_read (USB_handle, USB_in_endpoint, RD_usb_buffer, read_size, timeout);
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d\n", 
+	pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+	pthread_setcanceltype (PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	bytes_read = usb_bulk_read (c->handle, c->in_endpoint, (char *) target, (int) read_size, timeout);
+	pthread_setcanceltype (PTHREAD_CANCEL_DEFERRED, NULL);
+	pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d\n",
 		__FILE__, __LINE__, __FUNCTION__, bytes_read));
 	if (bytes_read < 0) {
 		if (bytes_read == -ENODEV) {
 			LOG((PI_DBG_DEV, PI_DBG_LVL_NONE, "Device went byebye!\n"));
-			RD_running = 0;
+			c->running = 0;
+			RD_wake_consumer (c);
 			return;
 #ifdef ELAST
 		} else if (bytes_read == -(ELAST + 1)) {
-			usb_clear_halt (USB_handle, USB_in_endpoint);
+			usb_clear_halt (c->handle, c->in_endpoint);
 			return;
 #endif
 		} else if (bytes_read == -ETIMEDOUT)
@@ -301,67 +679,274 @@ RD_do_read (int timeout)
 	if (!bytes_read)
 		return;
 
-	
-	pthread_mutex_lock (&RD_buffer_mutex);
-	if ((RD_buffer_used + bytes_read) > RD_buffer_size) {
-		RD_buffer_size = ((RD_buffer_used + bytes_read + 0xfffe) & ~0xffff) - 1;	/* 64k chunks. */
-		RD_buffer = realloc (RD_buffer, RD_buffer_size);
-	}
-
-	memcpy (RD_buffer + RD_buffer_used, RD_usb_buffer, bytes_read);
-	RD_buffer_used += bytes_read;
-	pthread_cond_broadcast (&RD_buffer_available_cond);
-	pthread_mutex_unlock (&RD_buffer_mutex);
+	if (target == c->bounce)
+		RD_ring_put (c, c->bounce, (size_t) bytes_read);
+	else
+		RD_ring_commit (c, (size_t) bytes_read);
 }
 
 static void *
-RD_main (void *foo)
+RD_main (void *arg)
 {
-	RD_buffer_used = 0;
-	RD_buffer = NULL;
-	RD_buffer_size = 0;
+	usb_connection_t *c = (usb_connection_t *) arg;
 
-	pthread_setcanceltype (PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
 
-	while (RD_running == 1) {
-		RD_do_read (0);
+	while (c->running == 1) {
+		RD_do_read (c, 0);
 	}
 
-	RD_running = 0;
+	c->running = 0;
 
 	return NULL;
 }
 
+#ifdef USBFS_ASYNC
+/***********************************************************************
+ *
+ * Function:    RD_async_submit
+ *
+ * Summary:     Queue every idle bulk-in URB the ring has room for
+ *
+ * Parameters:  connection
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+RD_async_submit (usb_connection_t *c)
+{
+	int	i;
+	struct usbdevfs_urb *u;
+
+	for (i = 0; i < c->urbs && c->running; i++) {
+		u = &c->in_urb[i];
+		if (u->usercontext != NULL)
+			continue;
+
+		/* room for this packet and every one already queued */
+		if (RD_RING_SIZE - (c->head - c->tail)
+		    < (size_t) (c->in_flight + 1) * AUTO_READ_SIZE) {
+			c->producer_waiting = 1;
+			RD_barrier ();
+			if (RD_RING_SIZE - (c->head - c->tail)
+			    < (size_t) (c->in_flight + 1) * AUTO_READ_SIZE)
+				return;
+		}
+
+		memset (u, 0, sizeof (*u));
+		u->type		 = USBDEVFS_URB_TYPE_BULK;
+		u->endpoint	 = (unsigned char) c->in_endpoint;
+		u->buffer	 = c->in_buf + i * AUTO_READ_SIZE;
+		u->buffer_length = AUTO_READ_SIZE;
+		u->usercontext	 = c;
+		if (ioctl (c->fd, USBDEVFS_SUBMITURB, u) < 0) {
+			LOG((PI_DBG_DEV, PI_DBG_LVL_ERR, "libusb: submitting URB failed, errno %d\n", errno));
+			u->usercontext = NULL;
+			c->running = 0;
+			RD_wake_consumer (c);
+			return;
+		}
+		c->in_flight++;
+	}
+	c->producer_waiting = 0;
+}
 
+static void
+RD_async_reap (usb_connection_t *c, struct usbdevfs_urb *u)
+{
+	unsigned int ep;
+
+	if (u >= c->out_urb && u < c->out_urb + RD_WRITE_URBS) {
+		pthread_mutex_lock (&c->wait_mutex);
+		if (u->status < 0) {
+			if (c->out_status == 0)
+				c->out_status = u->status;
+		} else
+			c->out_written += (size_t) u->actual_length;
+		c->out_pending--;
+		pthread_cond_broadcast (&c->write_done_cond);
+		pthread_mutex_unlock (&c->wait_mutex);
+		return;
+	}
+
+	u->usercontext = NULL;
+	c->in_flight--;
+
+	if (u->status == 0 && u->actual_length > 0)
+		RD_ring_put (c, (unsigned char *) u->buffer, (size_t) u->actual_length);
+	else if (u->status == -EPIPE) {
+		ep = (unsigned int) c->in_endpoint;
+		ioctl (c->fd, USBDEVFS_CLEAR_HALT, &ep);
+	} else if (u->status == -ENODEV || u->status == -ESHUTDOWN) {
+		LOG((PI_DBG_DEV, PI_DBG_LVL_NONE, "Device went byebye!\n"));
+		c->running = 0;
+		RD_wake_consumer (c);
+	}
+}
+
+static void *
+RD_async_main (void *arg)
+{
+	usb_connection_t *c = (usb_connection_t *) arg;
+	struct pollfd pfd[2];
+	struct usbdevfs_urb *u;
+	char	drain[64];
+	int	i;
+
+	pfd[0].fd = c->fd;
+	pfd[0].events = POLLOUT;		/* URBs to reap */
+	pfd[1].fd = c->wake[0];
+	pfd[1].events = POLLIN;
+
+	RD_async_submit (c);
+	while (c->running || c->in_flight > 0) {
+		if (!c->running)
+			for (i = 0; i < c->urbs; i++)
+				if (c->in_urb[i].usercontext != NULL)
+					ioctl (c->fd, USBDEVFS_DISCARDURB, &c->in_urb[i]);
+
+		if (poll (pfd, 2, -1) < 0 && errno != EINTR)
+			break;
+		while (read (c->wake[0], drain, sizeof (drain)) > 0)
+			;
+
+		while (ioctl (c->fd, USBDEVFS_REAPURBNDELAY, &u) == 0)
+			RD_async_reap (c, u);
+		if (errno == ENODEV) {
+			LOG((PI_DBG_DEV, PI_DBG_LVL_NONE, "Device went byebye!\n"));
+			c->running = 0;
+			RD_wake_consumer (c);
+			break;
+		}
+
+		RD_async_submit (c);
+	}
+
+	c->running = 0;
+
+	/* nobody is left to reap what u_write() is waiting for */
+	pthread_mutex_lock (&c->wait_mutex);
+	if (c->out_pending > 0) {
+		c->out_pending = 0;
+		if (c->out_status == 0)
+			c->out_status = -ENODEV;
+	}
+	pthread_cond_broadcast (&c->write_done_cond);
+	pthread_mutex_unlock (&c->wait_mutex);
+
+	return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    RD_async_write
+ *
+ * Summary:     Write through usbfs, queueing up to RD_WRITE_URBS
+ *		transfers at a time
+ *
+ * Parameters:  connection, data, length, timeout in ms (0 for none)
+ *
+ * Returns:     bytes written, or negative errno if nothing was
+ *
+ ***********************************************************************/
 static int
-RD_start (void)
+RD_async_write (usb_connection_t *c, const unsigned char *buf, size_t len, int timeout)
 {
-	if (RD_thread || RD_running)
-		return 0;
+	struct timespec when;
+	struct usbdevfs_urb *u;
+	size_t	sent = 0,
+		queued;
+	int	i,
+		n,
+		timed_out = 0;
+
+	if (timeout)
+		pi_timeout_to_timespec (timeout, &when);
+
+	pthread_mutex_lock (&c->wait_mutex);
+	c->out_status = 0;
+	while (sent < len && !timed_out && c->out_status == 0) {
+		c->out_written = 0;
+		for (n = 0, queued = sent; n < RD_WRITE_URBS && queued < len; n++) {
+			u = &c->out_urb[n];
+			memset (u, 0, sizeof (*u));
+			u->type		 = USBDEVFS_URB_TYPE_BULK;
+			u->endpoint	 = (unsigned char) c->out_endpoint;
+			u->buffer	 = (void *) (buf + queued);
+			u->buffer_length = (int) ((len - queued > RD_WRITE_SIZE) ? RD_WRITE_SIZE : len - queued);
+			if (ioctl (c->fd, USBDEVFS_SUBMITURB, u) < 0) {
+				c->out_status = -errno;
+				break;
+			}
+			c->out_pending++;
+			queued += (size_t) u->buffer_length;
+		}
 
-	RD_running = 1;
-	pthread_create (&RD_thread, NULL, RD_main, NULL);
+		while (c->out_pending > 0) {
+			if (timeout == 0 || timed_out)
+				pthread_cond_wait (&c->write_done_cond, &c->wait_mutex);
+			else if (pthread_cond_timedwait (&c->write_done_cond, &c->wait_mutex, &when) == ETIMEDOUT) {
+				timed_out = 1;
+				for (i = 0; i < n; i++)
+					ioctl (c->fd, USBDEVFS_DISCARDURB, &c->out_urb[i]);
+			}
+		}
+		sent += c->out_written;
+	}
+	pthread_mutex_unlock (&c->wait_mutex);
 
-	return 1;
+	if (sent == 0 && timed_out)
+		return -ETIMEDOUT;
+	if (sent == 0 && c->out_status < 0)
+		return c->out_status;
+	return (int) sent;
 }
+#endif
 
 static int
-RD_stop (void)
+RD_start (usb_connection_t *c)
 {
-	if (!RD_thread && !RD_running)
+	void	*(*reader) (void *) = RD_main;
+
+	if (c->reader_started || c->running)
 		return 0;
 
-	if (RD_running)
-		RD_running = 0;
+#ifdef USBFS_ASYNC
+	if (c->fd >= 0)
+		reader = RD_async_main;
+#endif
 
-	if (RD_thread) {
-		pthread_cancel(RD_thread);
-		RD_thread = 0;
+	c->head = c->tail = 0;
+	c->running = 1;
+	if (pthread_create (&c->reader, NULL, reader, c) != 0) {
+		c->running = 0;
+		return 0;
 	}
+	c->reader_started = 1;
 
-	if (RD_thread || RD_running)
+	return 1;
+}
+
+static int
+RD_stop (usb_connection_t *c)
+{
+	if (!c->reader_started)
 		return 0;
 
+	c->running = 0;
+#ifdef USBFS_ASYNC
+	/* the usbfs reader never blocks for long: it discards its URBs
+	   and returns once woken */
+	if (c->fd >= 0) {
+		c->producer_waiting = 1;
+		RD_wake_producer (c);
+	} else
+#endif
+	pthread_cancel (c->reader);
+	pthread_join (c->reader, NULL);
+	c->reader_started = 0;
+
 	return 1;
 }
 
@@ -377,16 +962,39 @@ static int
 u_open(struct pi_socket *ps, struct pi_sockaddr *addr, size_t addrlen)
 {
 	pi_usb_data_t *data = (pi_usb_data_t *)ps->device->data;
+	usb_connection_t *c;
 
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n", 
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n",
 		__FILE__, __LINE__, __FUNCTION__));
 
-	if (RD_running)
+	if (data->ref != NULL)
 		return -1;
 	if (!USB_open (data))
 		return -1;
+	if ((data->ref = usb_connection_new ()) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
 
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n", 
+	/* give the socket a descriptor that polls readable with data */
+	c = (usb_connection_t *) data->ref;
+	if (pipe (c->ready) < 0) {
+		usb_connection_free (c);
+		data->ref = NULL;
+		return -1;
+	}
+	fcntl (c->ready[0], F_SETFL, O_NONBLOCK);
+	fcntl (c->ready[1], F_SETFL, O_NONBLOCK);
+	if (pi_socket_setsd (ps, c->ready[0]) < 0) {
+		close (c->ready[0]);
+		c->ready[0] = -1;
+		usb_connection_free (c);
+		data->ref = NULL;
+		return -1;
+	}
+	c->ready[0] = ps->sd;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n",
 		__FILE__, __LINE__, __FUNCTION__));
 
 	return 1;
@@ -395,13 +1003,20 @@ u_open(struct pi_socket *ps, struct pi_sockaddr *addr, size_t addrlen)
 static int
 u_close(struct pi_socket *ps)
 {
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n", 
+	pi_usb_data_t *data = (pi_usb_data_t *)ps->device->data;
+	usb_connection_t *c = (usb_connection_t *)data->ref;
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n",
 		__FILE__, __LINE__, __FUNCTION__));
 
-	RD_stop ();
-	USB_close ();
+	if (c != NULL) {
+		RD_stop (c);
+		USB_close (c);
+		usb_connection_free (c);
+		data->ref = NULL;
+	}
 
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n", 
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n",
 		__FILE__, __LINE__, __FUNCTION__));
 
 	return close (ps->sd);
@@ -411,10 +1026,11 @@ static int
 u_wait_for_device(struct pi_socket *ps, int *timeout)
 {
 	pi_usb_data_t *data = (pi_usb_data_t *)ps->device->data;
+	usb_connection_t *c = (usb_connection_t *)data->ref;
 	struct timespec when;
 	int ret = 0;
 
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n", 
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n",
 		__FILE__, __LINE__, __FUNCTION__));
 
 	if (*timeout)
@@ -429,8 +1045,11 @@ u_wait_for_device(struct pi_socket *ps, int *timeout)
 				if (*timeout <= 0)
 					*timeout = 1;
 			}
-			if (!RD_start ()) {
-				USB_close ();
+#ifdef USBFS_ASYNC
+			USB_async_open (c, data->urbs);
+#endif
+			if (!RD_start (c)) {
+				USB_close (c);
 				return -1;
 			}
 			return ret;
@@ -452,7 +1071,7 @@ u_wait_for_device(struct pi_socket *ps, int *timeout)
 static int
 u_poll(struct pi_socket *ps, int timeout)
 {
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n", 
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n",
 		__FILE__, __LINE__, __FUNCTION__));
 
 	return u_read_i (ps, NULL, 1, PI_MSG_PEEK, timeout);
@@ -461,17 +1080,24 @@ u_poll(struct pi_socket *ps, int timeout)
 static ssize_t
 u_write(struct pi_socket *ps, const unsigned char *buf, size_t len, int flags)
 {
-	int timeout = ((struct pi_usb_data *)ps->device->data)->timeout;
+	pi_usb_data_t *data = (pi_usb_data_t *)ps->device->data;
+	usb_connection_t *c = (usb_connection_t *)data->ref;
+	int timeout = data->timeout;
 	int ret;
 
-	if (!RD_running)
+	if (c == NULL || !c->running)
 		return -1;
 
 	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "Writing: len: %d, flags: %d, timeout: %d.\n", len, flags, timeout));
 	if (len <= 0)
 		return 0;
 
-	ret = usb_bulk_write (USB_handle, USB_out_endpoint, buf, len, timeout);
+#ifdef USBFS_ASYNC
+	if (c->fd >= 0)
+		ret = RD_async_write (c, buf, len, timeout);
+	else
+#endif
+	ret = usb_bulk_write (c->handle, c->out_endpoint, (char *) buf, len, timeout);
 	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "Wrote: %d.\n", ret));
 	if (ret > 0)
 		CHECK (PI_DBG_DEV, PI_DBG_LVL_DEBUG, pi_dumpdata (buf, ret));
@@ -495,20 +1121,28 @@ u_read(struct pi_socket *ps, pi_buffer_t *buf, size_t len, int flags)
 static int
 u_read_i(struct pi_socket *ps, pi_buffer_t *buf, size_t len, int flags, int timeout)
 {
-	if (!RD_running)
+	usb_connection_t *c = (usb_connection_t *)((pi_usb_data_t *)ps->device->data)->ref;
+	size_t	used,
+		wait_for,
+		tail,
+		first;
+
+	if (c == NULL || !c->running)
 		return PI_ERR_SOCK_DISCONNECTED;
 
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d %d\n", 
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d %d\n",
 		__FILE__, __LINE__, __FUNCTION__, len, flags, timeout));
 
-	pthread_mutex_lock (&RD_buffer_mutex);
 	if (flags & PI_MSG_PEEK && len > 256)
 		len = 256;
 
-	if (RD_buffer_used < len) {
+	/* the reader stops when the ring is nearly full: callers read
+	   larger transfers in pieces */
+	wait_for = (len < RD_RING_SIZE / 2) ? len : RD_RING_SIZE / 2;
+
+	if (c->head - c->tail < wait_for) {
 		struct timeval now;
 		struct timespec when, nownow;
-		int last_used;
 		gettimeofday(&now, NULL);
 		when.tv_sec = now.tv_sec + timeout / 1000;
 		when.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) * 1000;
@@ -517,66 +1151,64 @@ u_read_i(struct pi_socket *ps, pi_buffer_t *buf, size_t len, int flags, int time
 			when.tv_sec++;
 		}
 
-		RD_wanted = len;
-		do {
-			last_used = RD_buffer_used;
-
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n", 
-				__FILE__, __LINE__, __FUNCTION__, len, RD_buffer_used));
+		c->wanted = len;
+		pthread_mutex_lock (&c->wait_mutex);
+		c->consumer_waiting = 1;
+		RD_barrier ();
+		while (c->running && c->head - c->tail < wait_for) {
+			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n",
+				__FILE__, __LINE__, __FUNCTION__, len, c->head - c->tail));
 
 			if (timeout) {
 				gettimeofday(&now, NULL);
 				nownow.tv_sec = now.tv_sec;
 				nownow.tv_nsec = now.tv_usec * 1000;
-				if ((nownow.tv_sec == when.tv_sec ? (nownow.tv_nsec > when.tv_nsec) : (nownow.tv_sec > when.tv_sec))) {
-					LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n", 
-						__FILE__, __LINE__, __FUNCTION__, len, RD_buffer_used));
+				if ((nownow.tv_sec == when.tv_sec ? (nownow.tv_nsec > when.tv_nsec) : (nownow.tv_sec > when.tv_sec)))
 					break;
-				}
-				LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n", 
-					__FILE__, __LINE__, __FUNCTION__, len, RD_buffer_used));
-				if (pthread_cond_timedwait (&RD_buffer_available_cond, &RD_buffer_mutex, &when) == ETIMEDOUT) {
-					LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n", 
-						__FILE__, __LINE__, __FUNCTION__, len, RD_buffer_used));
+				if (pthread_cond_timedwait (&c->data_avail_cond, &c->wait_mutex, &when) == ETIMEDOUT)
 					break;
-				}
 			} else
-				pthread_cond_wait (&RD_buffer_available_cond, &RD_buffer_mutex);
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n", 
-				__FILE__, __LINE__, __FUNCTION__, len, RD_buffer_used));
-		} while (RD_buffer_used < len);
-
-		RD_wanted = 0;
+				pthread_cond_wait (&c->data_avail_cond, &c->wait_mutex);
+		}
+		c->consumer_waiting = 0;
+		pthread_mutex_unlock (&c->wait_mutex);
+		c->wanted = 0;
 	}
 
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n", 
-		__FILE__, __LINE__, __FUNCTION__, len, RD_buffer_used));
-
-	if (!RD_running) {
-		pthread_mutex_unlock (&RD_buffer_mutex);
+	if (!c->running)
 		return PI_ERR_SOCK_DISCONNECTED;
-	}
 
-	if (RD_buffer_used < len)
-		len = RD_buffer_used;
-	
+	/* see the data published with the head */
+	used = c->head - c->tail;
+	RD_barrier ();
+
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s): %d %d.\n",
+		__FILE__, __LINE__, __FUNCTION__, len, used));
+
+	if (used < len)
+		len = used;
+
 	if (len && buf) {
-		pi_buffer_append (buf, RD_buffer, len);
+		tail = c->tail;
+		first = RD_RING_SIZE - (tail & RD_RING_MASK);
+		if (first >= len)
+			pi_buffer_append (buf, c->ring + (tail & RD_RING_MASK), len);
+		else {
+			pi_buffer_append (buf, c->ring + (tail & RD_RING_MASK), first);
+			pi_buffer_append (buf, c->ring, len - first);
+		}
+
 		if (!(flags & PI_MSG_PEEK)) {
-			RD_buffer_used -= len;
-			if (RD_buffer_used)
-				memmove (RD_buffer, RD_buffer + len, RD_buffer_used);
-
-			if ((RD_buffer_size - RD_buffer_used) > (1024 * 1024)) {
-				/* If we have more then 1M free in the buffer, shrink it. */
-				RD_buffer_size = ((RD_buffer_used + 0xfffe) & ~0xffff) - 1;
-				RD_buffer = realloc (RD_buffer, RD_buffer_size);
-			}
+			/* done with the data before giving its room back */
+			RD_barrier ();
+			c->tail = tail + len;
+			RD_wake_producer (c);
+			if (c->tail == c->head)
+				RD_clear_ready (c);
 		}
 	}
 
-	pthread_mutex_unlock (&RD_buffer_mutex);
-	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n", 
+	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG, "%s %d (%s).\n",
 		__FILE__, __LINE__, __FUNCTION__));
 	return len;
 }
@@ -584,11 +1216,13 @@ u_read_i(struct pi_socket *ps, pi_buffer_t *buf, size_t len, int flags, int time
 static int
 u_flush(pi_socket_t *ps, int flags)
 {
-	if (flags & PI_FLUSH_INPUT) {
-		/* clear internal buffer */
-		pthread_mutex_lock (&RD_buffer_mutex);
-		RD_buffer_used = 0;
-		pthread_mutex_unlock (&RD_buffer_mutex);
+	usb_connection_t *c = (usb_connection_t *)((pi_usb_data_t *)ps->device->data)->ref;
+
+	if (c != NULL && (flags & PI_FLUSH_INPUT)) {
+		/* drop what the reader has queued so far */
+		c->tail = c->head;
+		RD_wake_producer (c);
+		RD_clear_ready (c);
 	}
 	return 0;
 }
@@ -597,13 +1231,13 @@ static int
 u_control_request (pi_usb_data_t *usb_data, int request_type, int request,
 		int value, int control_index, void *data, int size, int timeout)
 {
-	return usb_control_msg (usb_data->ref, request_type, request, value, control_index, data, size, timeout);
+	return usb_control_msg (((usb_connection_t *)usb_data->ref)->handle, request_type, request, value, control_index, data, size, timeout);
 }
 
 static int
 u_interrupt_read (pi_usb_data_t *usb_data, int ep, void *data, int size, int timeout)
 {
-	return usb_interrupt_read(usb_data->ref, ep, data, size, timeout);
+	return usb_interrupt_read(((usb_connection_t *)usb_data->ref)->handle, ep, data, size, timeout);
 }
 
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
@@ -24,6 +24,7 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -198,17 +199,19 @@ u_write(pi_socket_t *ps, unsigned char *buf, size_t len, int flags)
 	struct 	timeval t;
 	fd_set 	ready;
 
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
-
+	/* hand the driver everything left in one call, so it can keep
+	   several transfers in flight, and carry on from where a short
+	   write stopped */
 	total = len;
 	while (total > 0) {
+		FD_ZERO(&ready);
+		FD_SET(ps->sd, &ready);
 		if (data->timeout == 0)
 			select(ps->sd + 1, 0, &ready, 0, 0);
 		else {
 			t.tv_sec 	= data->timeout / 1000;
 			t.tv_usec 	= (data->timeout % 1000) * 1000;
-			if (select(ps->sd + 1, 0, &ready, 0, &t))
+			if (select(ps->sd + 1, 0, &ready, 0, &t) == 0)
 				return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
 		}
 
@@ -217,8 +220,10 @@ u_write(pi_socket_t *ps, unsigned char *buf, size_t len, int flags)
 			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 		}
 
-		nwrote = write(ps->sd, buf, len);
+		nwrote = write(ps->sd, buf + (len - total), total);
 		if (nwrote < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
 			ps->state = PI_SOCK_CONN_BREAK;
 			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 		}
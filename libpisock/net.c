@@ -83,12 +83,15 @@ static pi_protocol_t
 		new_prot->flush		= prot->flush;
 		new_prot->getsockopt 	= prot->getsockopt;
 		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->writev 	= prot->writev;
 
 		data 			= (pi_net_data_t *)prot->data;
 		new_data->type 		= data->type;
 		new_data->split_writes	= data->split_writes;
 		new_data->write_chunksize	= data->write_chunksize;
 		new_data->txid 		= data->txid;
+		new_data->tx_buf	= NULL;
+		new_data->rx_header	= NULL;
 		new_prot->data 		= new_data;
 	}
 
@@ -113,8 +116,15 @@ void net_protocol_free (pi_protocol_t *prot)
 	ASSERT (prot != NULL);
 
 	if (prot != NULL) {
-		if (prot->data != NULL)
+		if (prot->data != NULL) {
+			pi_net_data_t *data = (pi_net_data_t *)prot->data;
+
+			if (data->tx_buf != NULL)
+				pi_buffer_free (data->tx_buf);
+			if (data->rx_header != NULL)
+				pi_buffer_free (data->rx_header);
 			free(prot->data);
+		}
 		free(prot);
 	}
 }
@@ -155,11 +165,14 @@ pi_protocol_t
 		prot->flush		= net_flush;
 		prot->getsockopt 	= net_getsockopt;
 		prot->setsockopt 	= net_setsockopt;
+		prot->writev 		= NULL;
 
 		data->type 		= PI_NET_TYPE_DATA;
 		data->split_writes	= 1;	    /* write packet header and data separately */
 		data->write_chunksize	= 4096;	    /* and push data in 4k chunks. Required for some USB devices */
 		data->txid 		= 0x00;
+		data->tx_buf		= NULL;
+		data->rx_header		= NULL;
 		prot->data 		= data;
 	}
 
@@ -279,11 +292,11 @@ net_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = protocol_queue_find(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_NET);
+	next = protocol_queue_find_next(ps, PI_LEVEL_NET);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -307,37 +320,39 @@ net_tx(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
 	int 	bytes,
 			offset,
 			remain,
-			tosend;
+			tosend,
+			iovcnt;
 	pi_protocol_t	*prot,
 			*next;
 	pi_net_data_t *data;
-	unsigned char *buf;
+	unsigned char header[PI_NET_HEADER_LEN];
+	struct iovec iov[2];
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = protocol_queue_find(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (pi_net_data_t *)prot->data;
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_NET);
+	next = protocol_queue_find_next(ps, PI_LEVEL_NET);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	/* Create the header */
-	buf = (unsigned char *) malloc(PI_NET_HEADER_LEN + len);
-	if (buf == NULL)
-		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
-	buf[PI_NET_OFFSET_TYPE] = data->type;
+	header[PI_NET_OFFSET_TYPE] = data->type;
 	if (data->type == PI_NET_TYPE_TCKL)
-		buf[PI_NET_OFFSET_TXID] = 0xff;
+		header[PI_NET_OFFSET_TXID] = 0xff;
 	else
-		buf[PI_NET_OFFSET_TXID] = data->txid;
-	set_long(&buf[PI_NET_OFFSET_SIZE], len);
-	memcpy(&buf[PI_NET_HEADER_LEN], msg, len);
+		header[PI_NET_OFFSET_TXID] = data->txid;
+	set_long(&header[PI_NET_OFFSET_SIZE], len);
 
 	/* Write the header and body, possibly in one write, or in two,
 	 * or in more, depending on the current options. Crucial options
 	 * here are `split_writes' and `write_chunksize' in this protocol's
-	 * data (use net_setsockopt() to set them).
+	 * data (use net_setsockopt() to set them). The body is written
+	 * straight from the caller's buffer: the header goes first on its
+	 * own, or along with the body in a single writev() when the lower
+	 * layer supports it. Only when it doesn't is the packet assembled
+	 * in the (reused) tx buffer.
 	 */
 	if (data->split_writes)
 	{
@@ -349,12 +364,9 @@ net_tx(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
 		 * (uses split writes and 4k chunks)
 		 * -- FP
 		 */
-		bytes = next->write(ps, buf, PI_NET_HEADER_LEN, flags);
+		bytes = next->write(ps, header, PI_NET_HEADER_LEN, flags);
 		if (bytes < PI_NET_HEADER_LEN)
-		{
-			free(buf);
 			return bytes;
-		}
 		offset = PI_NET_HEADER_LEN;
 		remain = len;
 	}
@@ -362,6 +374,17 @@ net_tx(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
 	{
 		offset = 0;
 		remain = PI_NET_HEADER_LEN + len;
+
+		if (next->writev == NULL) {
+			if (data->tx_buf == NULL)
+				data->tx_buf = pi_buffer_new (PI_NET_HEADER_LEN + len);
+			if (data->tx_buf == NULL)
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
+			pi_buffer_clear (data->tx_buf);
+			if (pi_buffer_append (data->tx_buf, header, PI_NET_HEADER_LEN) == NULL
+			    || pi_buffer_append (data->tx_buf, msg, len) == NULL)
+				return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
+		}
 	}
 
 	while (remain > 0)
@@ -371,20 +394,33 @@ net_tx(pi_socket_t *ps, const unsigned char *msg, size_t len, int flags)
 		else
 			tosend = remain;
 
-		bytes = next->write(ps, &buf[offset], tosend, flags);
+		if (offset >= PI_NET_HEADER_LEN) {
+			bytes = next->write(ps, &msg[offset - PI_NET_HEADER_LEN], tosend, flags);
+		} else if (next->writev == NULL) {
+			bytes = next->write(ps, &data->tx_buf->data[offset], tosend, flags);
+		} else {
+			/* this chunk starts in the header */
+			iov[0].iov_base = (char *)&header[offset];
+			iov[0].iov_len 	= PI_NET_HEADER_LEN - offset;
+			iovcnt = 1;
+			if (tosend < (int)iov[0].iov_len)
+				iov[0].iov_len = tosend;
+			else if (tosend > (int)iov[0].iov_len) {
+				iov[1].iov_base = (char *)msg;
+				iov[1].iov_len 	= tosend - iov[0].iov_len;
+				iovcnt = 2;
+			}
+			bytes = next->writev(ps, iov, iovcnt, flags);
+		}
 		if (bytes < tosend)
-		{
-			free(buf);
 			return bytes;
-		}
 		remain -= bytes;
 		offset += bytes;
 	}
 
-	CHECK(PI_DBG_NET, PI_DBG_LVL_INFO, net_dump_header(buf, 1, ps->sd));
+	CHECK(PI_DBG_NET, PI_DBG_LVL_INFO, net_dump_header(header, 1, ps->sd));
 	CHECK(PI_DBG_NET, PI_DBG_LVL_DEBUG, pi_dumpdata((char *)msg, len));
 	
-	free(buf);
 	return len;
 }
 
@@ -417,12 +453,12 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	pi_buffer_t *header;
 	pi_net_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = protocol_queue_find(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	
 	data = (pi_net_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_NET);
+	next = protocol_queue_find_next(ps, PI_LEVEL_NET);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -435,11 +471,14 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	pi_setsockopt(ps->sd, PI_LEVEL_DEV, PI_DEV_TIMEOUT, 
 		      &timeout, &size);
 
-	header = pi_buffer_new (PI_NET_HEADER_LEN);
+	if (data->rx_header == NULL)
+		data->rx_header = pi_buffer_new (PI_NET_HEADER_LEN);
+	header = data->rx_header;
 	if (header == NULL) {
 		errno = ENOMEM;
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 	}
+	pi_buffer_clear (header);
 
 	/* loop until we find a non-tickle packet (if the other end
 	   sends us a tickle, we would receive it prior to getting
@@ -450,10 +489,8 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 		if (data->txid == 0) {	
 			/* Peek to see if it is a headerless packet */
 			bytes = next->read(ps, header, 1, flags);
-			if (bytes <= 0) {
-				pi_buffer_free (header);
+			if (bytes <= 0)
 				return bytes;
-			}
 			
 			LOG ((PI_DBG_NET, PI_DBG_LVL_INFO,
 				  "NET RX (%i): Checking for headerless packet %d\n",
@@ -478,10 +515,8 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 		while (total_bytes < PI_NET_HEADER_LEN) {
 			bytes = next->read(ps, header,
 					(size_t)(PI_NET_HEADER_LEN - total_bytes), flags);
-			if (bytes <= 0) {
-				pi_buffer_free (header);
+			if (bytes <= 0)
 				return bytes;
-			}
 			total_bytes += bytes;
 		}
 		
@@ -494,7 +529,6 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 					LOG ((PI_DBG_NET, PI_DBG_LVL_ERR,
 						"NET RX (%i): tickle packet with non-zero length\n",
 						ps->sd));
-					pi_buffer_free(header);
 					return pi_set_error(ps->sd, PI_ERR_PROT_BADPACKET);
 				}
 				/* valid tickle packet; continue reading. */
@@ -514,7 +548,6 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 					"NET RX (%i): Unknown packet type\n",
 					ps->sd));
 				CHECK(PI_DBG_NET, PI_DBG_LVL_INFO, pi_dumpdata((char *)header->data, PI_NET_HEADER_LEN));
-				pi_buffer_free(header);
 				return pi_set_error(ps->sd, PI_ERR_PROT_BADPACKET);
 		}
 	}
@@ -527,7 +560,6 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 		/* we see an invalid packet */
 		next->flush(ps, PI_FLUSH_INPUT);
 		LOG ((PI_DBG_NET, PI_DBG_LVL_ERR, "NET RX (%i): Invalid packet length (%ld)\n", ps->sd, packet_len));
-		pi_buffer_free(header);
 		return pi_set_error(ps->sd, PI_ERR_PROT_BADPACKET);
 	}
 
@@ -535,10 +567,8 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 	while (total_bytes < packet_len) {
 		bytes = next->read(ps, msg,
 			(size_t)(packet_len - total_bytes), flags);
-		if (bytes < 0) {
-			pi_buffer_free (header);
+		if (bytes < 0)
 			return bytes;
-		}
 		total_bytes += bytes;
 	}
 
@@ -554,7 +584,6 @@ net_rx(pi_socket_t *ps, pi_buffer_t *msg, size_t len, int flags)
 			data->txid = 1;
 	}
 
-	pi_buffer_free (header);
 	return packet_len;
 }
 
@@ -576,7 +605,7 @@ net_getsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	pi_net_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = protocol_queue_find(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -616,7 +645,7 @@ net_setsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	pi_net_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_NET);
+	prot = protocol_queue_find(ps, PI_LEVEL_NET);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -49,6 +49,13 @@ static int padp_setsockopt(pi_socket_t *ps, int level, int option_name,
 				const void *option_value, size_t *option_len);
 static int padp_sendack(struct pi_socket *ps, struct pi_padp_data *data,
 				unsigned char txid, struct padp *padp, int flags);
+static int padp_tx_fragment(pi_socket_t *ps, pi_protocol_t *next,
+				pi_padp_data_t *data, pi_buffer_t *padp_buf,
+				const unsigned char *buf, size_t tlen, int fl,
+				size_t size_field, int flags);
+static ssize_t padp_tx_window(pi_socket_t *ps, pi_protocol_t *next,
+				pi_padp_data_t *data, pi_buffer_t *padp_buf,
+				const unsigned char *buf, size_t len, int flags);
 
 
 /***********************************************************************
@@ -84,9 +91,12 @@ padp_protocol_dup (pi_protocol_t *prot)
 			new_prot->flush	= prot->flush;
 			new_prot->getsockopt = prot->getsockopt;
 			new_prot->setsockopt = prot->setsockopt;
+			new_prot->writev = prot->writev;
 
 			data = (pi_padp_data_t *)prot->data;
 			memcpy(new_data, data, sizeof(pi_padp_data_t));
+			new_data->tx_buf = NULL;
+			new_data->rx_buf = NULL;
 			new_prot->data 	= new_data;
 		}
 	}
@@ -112,8 +122,15 @@ void padp_protocol_free (pi_protocol_t *prot)
 	ASSERT (prot != NULL);
 
 	if (prot != NULL) {
-		if (prot->data != NULL)
+		if (prot->data != NULL) {
+			pi_padp_data_t *data = (pi_padp_data_t *)prot->data;
+
+			if (data->tx_buf != NULL)
+				pi_buffer_free(data->tx_buf);
+			if (data->rx_buf != NULL)
+				pi_buffer_free(data->rx_buf);
 			free(prot->data);
+		}
 		free(prot);
 	}
 }
@@ -151,6 +168,7 @@ pi_protocol_t
 			prot->flush	= padp_flush;
 			prot->getsockopt = padp_getsockopt;
 			prot->setsockopt = padp_setsockopt;
+			prot->writev = NULL;
 
 			data->type 	= padData;
 			data->last_type = -1;
@@ -158,6 +176,9 @@ pi_protocol_t
 			data->next_txid = 0xff;
 			data->freeze_txid   = 0;
 			data->use_long_format = 0;
+			data->window	= 1;
+			data->tx_buf	= NULL;
+			data->rx_buf	= NULL;
 			prot->data 	= data;
 		}
 	}
@@ -165,6 +186,239 @@ pi_protocol_t
 	return prot;
 }
 
+/***********************************************************************
+ *
+ * Function:    padp_tx_fragment
+ *
+ * Summary:     Build and send one PADP data fragment
+ *
+ * Parameters:  pi_socket_t*, next protocol, padp data, scratch buffer,
+ *		fragment data, fragment length, PADP flags, size field,
+ *		flags
+ *
+ * Returns:     result of the lower layer write
+ *
+ ***********************************************************************/
+static int
+padp_tx_fragment(pi_socket_t *ps, pi_protocol_t *next, pi_padp_data_t *data,
+		pi_buffer_t *padp_buf, const unsigned char *buf, size_t tlen,
+		int fl, size_t size_field, int flags)
+{
+	int 	type,
+		socket,
+		timeout,
+		header_size;
+	size_t	size;
+
+	padp_buf->used = 0;
+
+	type 	= PI_SLP_TYPE_PADP;
+	socket 	= PI_SLP_SOCK_DLP;
+	timeout = PI_PADP_TX_TIMEOUT;
+
+	size 	= sizeof(type);
+	pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_TYPE, &type, &size);
+	pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_DEST, &socket, &size);
+	pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_SRC, &socket, &size);
+	size = sizeof(timeout);
+	pi_setsockopt(ps->sd, PI_LEVEL_DEV, PI_DEV_TIMEOUT, &timeout, &size);
+	size = sizeof(data->txid);
+	pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_TXID, &data->txid, &size);
+
+	header_size = data->use_long_format ? PI_PADP_HEADER_LEN+2 : PI_PADP_HEADER_LEN;
+
+	/* build the packet */
+	set_byte(&padp_buf->data[PI_PADP_OFFSET_TYPE], data->type);
+	set_byte(&padp_buf->data[PI_PADP_OFFSET_FLGS], fl |
+		 (data->use_long_format ? PADP_FL_LONG : 0));
+	if (data->use_long_format)
+		set_long(&padp_buf->data[PI_PADP_OFFSET_SIZE], size_field);
+	else
+		set_short(&padp_buf->data[PI_PADP_OFFSET_SIZE], size_field);
+	memcpy(padp_buf->data + header_size, buf, tlen);
+
+	CHECK(PI_DBG_PADP, PI_DBG_LVL_INFO, padp_dump_header(padp_buf->data, 1));
+	CHECK(PI_DBG_PADP, PI_DBG_LVL_DEBUG, padp_dump(padp_buf->data));
+
+	return next->write(ps, padp_buf->data, header_size + tlen, flags);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    padp_tx_window
+ *
+ * Summary:     Transmit a multi-fragment PADP packet keeping up to
+ *		data->window fragments waiting for their ack. All the
+ *		fragments share the packet's txid, acks are matched to
+ *		their fragment by the offset they echo back. On timeout,
+ *		only the fragments that weren't acked are sent again.
+ *
+ * Parameters:  pi_socket_t*, char* to buffer, buffer length, flags
+ *
+ * Returns:     Number of bytes transmitted or negative on error
+ *
+ ***********************************************************************/
+static ssize_t
+padp_tx_window(pi_socket_t *ps, pi_protocol_t *next, pi_padp_data_t *data,
+		pi_buffer_t *padp_buf, const unsigned char *buf, size_t len,
+		int flags)
+{
+	int 	fragments,
+		base 	= 0,
+		sent 	= 0,
+		retries = PI_PADP_TX_RETRIES,
+		result,
+		type,
+		index,
+		i;
+	size_t	size,
+		offset;
+	unsigned char txid,
+		*acked;
+	struct padp padp;
+
+	fragments = (int)((len + PI_PADP_MTU - 1) / PI_PADP_MTU);
+	acked = (unsigned char *) calloc ((size_t)fragments, 1);
+	if (acked == NULL)
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
+
+	while (base < fragments) {
+		/* fill the window */
+		while (sent < fragments && sent < base + data->window) {
+			offset = (size_t)sent * PI_PADP_MTU;
+			result = padp_tx_fragment(ps, next, data, padp_buf,
+				buf + offset,
+				(len - offset > PI_PADP_MTU) ? PI_PADP_MTU : len - offset,
+				(sent == 0 ? PADP_FL_FIRST : 0) |
+				(sent == fragments - 1 ? PADP_FL_LAST : 0),
+				sent == 0 ? len : offset, flags);
+			if (result == PI_ERR_SOCK_DISCONNECTED)
+				goto disconnected;
+			sent++;
+		}
+
+		LOG((PI_DBG_PADP, PI_DBG_LVL_DEBUG,
+			"PADP TX waiting for ACK (%d..%d of %d)\n",
+			base, sent - 1, fragments));
+		padp_buf->used = 0;
+		result = next->read(ps, padp_buf, PI_PADP_HEADER_LEN + 2 + PI_PADP_MTU, flags);
+		if (result == PI_ERR_SOCK_DISCONNECTED)
+			goto disconnected;
+
+		if (result <= 0) {
+			if (--retries == 0) {
+				/* Maximum failure: transmission
+				   failed, and the connection must be presumed dead */
+				LOG((PI_DBG_PADP, PI_DBG_LVL_ERR, "PADP TX too many retries"));
+				free (acked);
+				errno = ETIMEDOUT;
+				ps->state = PI_SOCK_CONN_BREAK;
+				return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
+			}
+
+			/* resend the fragments that weren't acked */
+			for (i = base; i < sent; i++) {
+				if (acked[i])
+					continue;
+				offset = (size_t)i * PI_PADP_MTU;
+				LOG((PI_DBG_PADP, PI_DBG_LVL_WARN,
+					"PADP TX resending fragment %d\n", i));
+				result = padp_tx_fragment(ps, next, data, padp_buf,
+					buf + offset,
+					(len - offset > PI_PADP_MTU) ? PI_PADP_MTU : len - offset,
+					(i == 0 ? PADP_FL_FIRST : 0) |
+					(i == fragments - 1 ? PADP_FL_LAST : 0),
+					i == 0 ? len : offset, flags);
+				if (result == PI_ERR_SOCK_DISCONNECTED)
+					goto disconnected;
+			}
+			continue;
+		}
+
+		padp.type = get_byte(&padp_buf->data[PI_PADP_OFFSET_TYPE]);
+		padp.flags = get_byte(&padp_buf->data[PI_PADP_OFFSET_FLGS]);
+		if (padp.flags & PADP_FL_LONG)
+			padp.size = get_long(&padp_buf->data[PI_PADP_OFFSET_SIZE]);
+		else
+			padp.size = get_short(&padp_buf->data[PI_PADP_OFFSET_SIZE]);
+
+		CHECK(PI_DBG_PADP, PI_DBG_LVL_INFO, padp_dump_header(padp_buf->data, 0));
+
+		size = sizeof(type);
+		pi_getsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_LASTTYPE, &type, &size);
+		size = sizeof(txid);
+		pi_getsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_LASTTXID, &txid, &size);
+
+		if (type == PI_SLP_TYPE_PADP
+			&& padp.type == (unsigned char)padData
+			&& txid == data->txid
+			&& sent == fragments
+			&& base == fragments - 1) {
+			/* the response to this transmission arrived before
+			   the ack for the last fragment: the ack was lost */
+			LOG((PI_DBG_PADP, PI_DBG_LVL_WARN,
+			    "PADP TX Missing Ack\n"));
+			break;
+		} else if (padp.type == (unsigned char)padTickle) {
+			/* Tickle to avoid timeout */
+			continue;
+		} else if (type      == PI_SLP_TYPE_PADP &&
+		           padp.type == (unsigned char)padAck &&
+		           txid      == data->txid) {
+			if (padp.flags & PADP_FL_MEMERROR) {
+				/* see padp_tx() */
+				LOG((PI_DBG_PADP, PI_DBG_LVL_WARN,
+				     "PADP TX Memory Error\n"));
+				free (acked);
+				errno = EMSGSIZE;
+				return -1;
+			}
+
+			/* the ack echoes the fragment's size field */
+			if (padp.flags & PADP_FL_FIRST)
+				index = 0;
+			else if (padp.size > 0 && padp.size % PI_PADP_MTU == 0)
+				index = padp.size / PI_PADP_MTU;
+			else
+				index = -1;
+
+			if (index >= 0 && index < sent && !acked[index]) {
+				acked[index] = 1;
+				retries = PI_PADP_TX_RETRIES;
+				while (base < fragments && acked[base])
+					base++;
+			}
+		} else if (type       == PI_SLP_TYPE_PADP &&
+		           padp.type  == data->last_ack_padp.type &&
+		           padp.flags == data->last_ack_padp.flags &&
+		           padp.size  == data->last_ack_padp.size &&
+		           txid       == data->last_ack_txid) {
+			/* A repeat of a packet we already received.  The
+			ack got lost, so resend it. */
+			LOG((PI_DBG_PADP, PI_DBG_LVL_WARN,
+				 "PADP TX resending lost ACK\n"));
+			padp_sendack(ps, data, txid, &padp, flags);
+		} else {
+			LOG((PI_DBG_PADP, PI_DBG_LVL_ERR,
+			    "PADP TX Unexpected packet "
+			    "(possible port speed problem? "
+			    "out of sync packet?)\n"));
+			free (acked);
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	free (acked);
+	return (ssize_t)len;
+
+disconnected:
+	free (acked);
+	return PI_ERR_SOCK_DISCONNECTED;
+}
+
+
 /***********************************************************************
  *
  * Function:    padp_tx
@@ -183,10 +437,7 @@ padp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 		count 	= 0,
 		retries,
 		result,
-		type,
-		socket,
-		timeout,
-		header_size;
+		type;
 	size_t	size,
 		tlen;
 	unsigned char txid;
@@ -195,12 +446,12 @@ padp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 	pi_buffer_t *padp_buf;
 	struct padp padp;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = protocol_queue_find(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_padp_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_PADP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -219,49 +470,30 @@ padp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 	if (data->type != padAck && ps->state == PI_SOCK_CONN_ACCEPT)
 		data->txid = data->next_txid;
 
-	padp_buf = pi_buffer_new (PI_PADP_HEADER_LEN + 2 + PI_PADP_MTU);
+	if (data->tx_buf == NULL)
+		data->tx_buf = pi_buffer_new (PI_PADP_HEADER_LEN + 2 + PI_PADP_MTU);
+	padp_buf = data->tx_buf;
 	if (padp_buf == NULL)
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 
 	pi_flush(ps->sd, PI_FLUSH_INPUT);
 
+	if (data->window > 1 && data->type == padData && len > PI_PADP_MTU) {
+		count = padp_tx_window(ps, next, data, padp_buf, buf, len, flags);
+		if (count == PI_ERR_SOCK_DISCONNECTED)
+			goto disconnected;
+		goto done;
+	}
+
 	do {
 		retries = PI_PADP_TX_RETRIES;
 		do {
-			padp_buf->used = 0;
-
-			type 	= PI_SLP_TYPE_PADP;
-			socket 	= PI_SLP_SOCK_DLP;
-			timeout = PI_PADP_TX_TIMEOUT;
-
-			size 	= sizeof(type);
-			pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_TYPE, &type, &size);
-			pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_DEST, &socket, &size);
-			pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_SRC, &socket, &size);
-			size = sizeof(timeout);
-			pi_setsockopt(ps->sd, PI_LEVEL_DEV, PI_DEV_TIMEOUT, &timeout, &size);
-			size = sizeof(data->txid);
-			pi_setsockopt(ps->sd, PI_LEVEL_SLP, PI_SLP_TXID, &data->txid, &size);
-
 			tlen = (len > PI_PADP_MTU) ? PI_PADP_MTU : len;
-			header_size = data->use_long_format ? PI_PADP_HEADER_LEN+2 : PI_PADP_HEADER_LEN;
-
-			/* build the packet */
-			set_byte(&padp_buf->data[PI_PADP_OFFSET_TYPE], data->type);
-			set_byte(&padp_buf->data[PI_PADP_OFFSET_FLGS], fl |
-				 (len == tlen ? PADP_FL_LAST : 0) |
-				 (data->use_long_format ? PADP_FL_LONG : 0));
-			if (data->use_long_format)
-				set_long(&padp_buf->data[PI_PADP_OFFSET_SIZE], (fl ? len : (size_t)count));
-			else
-				set_short(&padp_buf->data[PI_PADP_OFFSET_SIZE], (fl ? len : (size_t)count));
-			memcpy(padp_buf->data + header_size, buf, tlen);
-
-			CHECK(PI_DBG_PADP, PI_DBG_LVL_INFO, padp_dump_header(padp_buf->data, 1));
-			CHECK(PI_DBG_PADP, PI_DBG_LVL_DEBUG, padp_dump(padp_buf->data));
 
 			/* send the packet, check for disconnection (i.e. when running over USB) */
-			result = next->write(ps, padp_buf->data, header_size + tlen, flags);
+			result = padp_tx_fragment(ps, next, data, padp_buf, buf, tlen,
+				fl | (len == tlen ? PADP_FL_LAST : 0),
+				fl ? len : (size_t)count, flags);
 			if (result < 0) {
 				if (result == PI_ERR_SOCK_DISCONNECTED)
 					goto disconnected;
@@ -277,13 +509,10 @@ keepwaiting:
 			if (result > 0) {				
 				padp.type = get_byte(&padp_buf->data[PI_PADP_OFFSET_TYPE]);
 				padp.flags = get_byte(&padp_buf->data[PI_PADP_OFFSET_FLGS]);
-				if (padp.flags & PADP_FL_LONG) {
-					header_size = PI_PADP_HEADER_LEN + 2;
+				if (padp.flags & PADP_FL_LONG)
 					padp.size = get_long(&padp_buf->data[PI_PADP_OFFSET_SIZE]);
-				} else {
-					header_size = PI_PADP_HEADER_LEN;
+				else
 					padp.size = get_short(&padp_buf->data[PI_PADP_OFFSET_SIZE]);
-				}
 
 				CHECK(PI_DBG_PADP, PI_DBG_LVL_INFO, padp_dump_header(padp_buf->data, 0));
 				CHECK(PI_DBG_PADP, PI_DBG_LVL_DEBUG, padp_dump(padp_buf->data));
@@ -368,7 +597,6 @@ keepwaiting:
 			   failed, and the connection must be presumed dead */
 			LOG((PI_DBG_PADP, PI_DBG_LVL_ERR, "PADP TX too many retries"));
 			errno = ETIMEDOUT;
-			pi_buffer_free (padp_buf);
 			ps->state = PI_SOCK_CONN_BREAK;
 			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 		}
@@ -377,12 +605,10 @@ keepwaiting:
 done:
 	if (data->type != padAck && ps->state == PI_SOCK_CONN_INIT)
 		data->txid = data->next_txid;
-	pi_buffer_free (padp_buf);
 	return count;
 
 disconnected:
 	LOG((PI_DBG_PADP, PI_DBG_LVL_ERR, "PADP TX disconnected"));
-	pi_buffer_free(padp_buf);
 	ps->state = PI_SOCK_CONN_BREAK;
 	return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 }
@@ -421,12 +647,12 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 	LOG((PI_DBG_PADP, PI_DBG_LVL_DEBUG, "PADP RX expect=%d flags=0x%04x\n",
 		expect, flags));
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = protocol_queue_find(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_padp_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_PADP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -434,7 +660,9 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 	pi_getsockopt(ps->sd, PI_LEVEL_SOCK, PI_SOCK_HONOR_RX_TIMEOUT,
 		&honor_rx_timeout, &size);
 
-	padp_buf = pi_buffer_new (PI_PADP_HEADER_LEN + PI_PADP_MTU);
+	if (data->rx_buf == NULL)
+		data->rx_buf = pi_buffer_new (PI_PADP_HEADER_LEN + 2 + PI_PADP_MTU);
+	padp_buf = data->rx_buf;
 	if (padp_buf == NULL) {
 		errno = ENOMEM;
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
@@ -462,7 +690,6 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 			/* Bad timeout breaks connection */
 			errno 		= ETIMEDOUT;
 			ps->state 	= PI_SOCK_CONN_BREAK;
-			pi_buffer_free (padp_buf);
 			return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 		}
 
@@ -479,7 +706,6 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 				(size_t)header_size + PI_PADP_MTU - total_bytes, flags);
 			if (bytes < 0) {
 				LOG((PI_DBG_PADP, PI_DBG_LVL_ERR, "PADP RX Read Error\n"));
-				pi_buffer_free (padp_buf);
 				return bytes;
 			}
 			total_bytes += bytes;
@@ -576,7 +802,6 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 				ouroffset = -1;
 				/* Bad timeout breaks connection */
 				ps->state = PI_SOCK_CONN_BREAK;
-				pi_buffer_free (padp_buf);
 				return pi_set_error(ps->sd, PI_ERR_SOCK_DISCONNECTED);
 			}
 
@@ -593,7 +818,6 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 						header_size + PI_PADP_MTU - total_bytes,  flags);
 				if (bytes < 0) {
 					LOG((PI_DBG_PADP, PI_DBG_LVL_ERR, "PADP RX Read Error"));
-					pi_buffer_free (padp_buf);
 					return pi_set_error(ps->sd, bytes);
 				}
 				total_bytes += bytes;
@@ -662,7 +886,6 @@ padp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
 done:
 	data->txid = data->next_txid;
 
-	pi_buffer_free (padp_buf);
 
 	return ouroffset;
 }
@@ -684,11 +907,11 @@ padp_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = protocol_queue_find(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_PADP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -713,7 +936,7 @@ padp_getsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	pi_padp_data_t *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = protocol_queue_find(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (pi_padp_data_t *)prot->data;
@@ -742,6 +965,12 @@ padp_getsockopt(pi_socket_t *ps, int level, int option_name,
 				goto error;
 			memcpy (option_value, &data->use_long_format, sizeof(data->use_long_format));
 			break;
+
+		case PI_PADP_WINDOW:
+			if (*option_len != sizeof (data->window))
+				goto error;
+			memcpy (option_value, &data->window, sizeof(data->window));
+			break;
 	}
 
 	return 0;
@@ -771,7 +1000,7 @@ padp_setsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_padp_data_t *data;
 	int was_frozen;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_PADP);
+	prot = protocol_queue_find(ps, PI_LEVEL_PADP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (pi_padp_data_t *)prot->data;
@@ -800,6 +1029,14 @@ padp_setsockopt(pi_socket_t *ps, int level, int option_name,
 				goto error;
 			memcpy (&data->use_long_format, option_value, sizeof(data->use_long_format));
 			break;
+
+		case PI_PADP_WINDOW:
+			if (*option_len != sizeof (data->window)
+			    || *(const int *)option_value < 1
+			    || *(const int *)option_value > PI_PADP_MAX_WINDOW)
+				goto error;
+			memcpy (&data->window, option_value, sizeof(data->window));
+			break;
 	}
 
 	return 0;
@@ -837,7 +1074,7 @@ padp_sendack(struct pi_socket *ps,
 	struct pi_protocol
 		*next;
 	
-	next = pi_protocol_next(ps->sd, PI_LEVEL_PADP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_PADP);
 	if (next == NULL)
  	    return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
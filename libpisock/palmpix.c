@@ -29,6 +29,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #if HAVE_STDINT_H
 # include <stdint.h>
 #else
@@ -1116,377 +1120,415 @@ uint16_t huffTable[] =
  * Bias is based on the Fast Alternative to Perlin's Bias algorithm 
  * in Graphics Gems IV by
  * Christophe Schlick schlick@labri.u-bordeuax.fr
+ *
+ * It only depends on the pixel value, so it is worked out once for
+ * each of the 256 values.
  *****************************************************************/
   
-static void Bias( double bias, int width, int height, uint8_t *data )
+static void BiasTable( double bias, uint8_t *lut )
 {
    int i;
    double num, denom, t;
       
    fprintf( stderr, "Bias factor : %lf\n", bias );
    
-   for( i=0; i<width*height; i++ )
+   for( i=0; i<256; i++ )
      {
-	t = (double)data[i]/256.0;
+	t = (double)i/256.0;
 	num = t;
 	denom = (1.0/bias - 2) * (1.0 - t) + 1;
-	data[i] = num/denom * 256.0;     
+	lut[i] = num/denom * 256.0;     
      }
 }
 
 /***********************************************************************
- * Odd green rows and even green rows have a different histogram
+ * Colour correction and histogram stretch only look at the histogram of
+ * each channel, and both end up as a table mapping old values to new
+ * ones. The channel order in the tables below is red, greenR, greenB,
+ * blue.
  ***********************************************************************/
-int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b)
+static void ChannelHistogram( const uint8_t *data, int n, uint32_t *hist )
 {
-	/* uint8_t *tmpRow; */
-	uint8_t gbMin, gbMax, grMin, grMax, rMin, rMax, bMin, bMax;
-	float grInc, gbInc, rInc, bInc, grCur, gbCur, rCur, bCur;
-	float rMean = 0, grMean = 0, gbMean = 0, bMean = 0, maxMean;
-	uint16_t	width = picHdr->w/2;
-	uint16_t	height = picHdr->h/2;
+	/* two sets of counters, so runs of equal pixels don't wait on
+	   a single one */
+	uint32_t odd[256];
 	int i;
-    uint8_t red[256], greenB[256], greenR[256], blue[256];
-   
-	memset( red, 0, 256 * sizeof( uint8_t ));
-	memset( greenR, 0, 256 * sizeof( uint8_t ));
-	memset( greenB, 0, 256 * sizeof( uint8_t ));
-	memset( blue, 0, 256 * sizeof( uint8_t ));
- 
-	gbMin = grMin = rMin = bMin = 255;
-	gbMax = grMax = rMax = bMax = 0;
-		
-	for( i=0; i<width*height; i ++ )
+
+	memset( hist, 0, 256 * sizeof( uint32_t ));
+	memset( odd, 0, 256 * sizeof( uint32_t ));
+
+	for( i=0; i+1<n; i += 2 )
 	{
-		gbMin = min( gbMin, gb[i] );
-		grMin = min( grMin, gr[i] );
-		rMin = min( rMin, r[i] );
-		bMin = min( bMin, b[i] );
-
-	    gbMax = max( gbMax, gb[i] );
-		grMax = max( grMax, gr[i] );
-		rMax = max( rMax, r[i] );
-		bMax = max( bMax, b[i] );
-		
-		rMean += r[i];
-		gbMean += gb[i];
-		grMean += gr[i];
-		bMean += b[i];
-	}	
-	
-	rMean = rMean / ( width * height );
-	gbMean = gbMean / ( width * height );
-	grMean = grMean / ( width * height );
-	bMean = bMean / ( width * height );
-	
-	maxMean = max( max( gbMean-gbMin, grMean-grMin ), max( bMean-bMin, rMean-rMin ));
-		
-	rInc = maxMean / (rMean-rMin);
-   	grInc = maxMean / (grMean-grMin);
-   	gbInc = maxMean / (gbMean-gbMin);
-   	bInc = maxMean / (bMean-bMin);
-	
-   rCur = 0;
-   grCur = 0;
-   gbCur = 0;
-   bCur = 0;
-
-   for (i = 0; i<256; i++)
-	 {
-	 	if( i < rMin )
-		 	red[i] = 0;
-		else 
-		{
-			if( rCur < 255 )
-			  red[i] = rCur;
-			else
-			  red[i] = 255;
+		hist[data[i]]++;
+		odd[data[i+1]]++;
+	}
+	if( i < n )
+		hist[data[i]]++;
+
+	for( i=0; i<256; i++ )
+		hist[i] += odd[i];
+}
+
+static void ApplyTable( const uint8_t *lut, uint8_t *data, int n )
+{
+	int i;
+
+	for( i=0; i+4<=n; i += 4 )
+	{
+		data[i] = lut[data[i]];
+		data[i+1] = lut[data[i+1]];
+		data[i+2] = lut[data[i+2]];
+		data[i+3] = lut[data[i+3]];
+	}
+	for( ; i<n; i++ )
+		data[i] = lut[data[i]];
+}
+
+/* Odd green rows and even green rows have a different histogram */
+static void ColourCorrectTables( uint32_t hist[4][256], uint16_t width, uint16_t height,
+	uint8_t lut[4][256] )
+{
+	uint8_t chanMin[4];
+	float mean[4], inc, cur, maxMean;
+	uint32_t sum;
+	int c, i;
 
-			rCur += rInc;
+	for( c=0; c<4; c++ )
+	{
+		chanMin[c] = 255;
+		sum = 0;
+		for( i=255; i>=0; i-- )
+		{
+			if( hist[c][i] )
+				chanMin[c] = i;
+			sum += hist[c][i] * i;
 		}
+		mean[c] = (float)sum / ( width * height );
+	}
 
-		if( i < grMin )
-			greenR[i] = 0;
-		else
+	maxMean = max( max( mean[2]-chanMin[2], mean[1]-chanMin[1] ),
+		max( mean[3]-chanMin[3], mean[0]-chanMin[0] ));
+
+	for( c=0; c<4; c++ )
+	{
+		inc = maxMean / (mean[c]-chanMin[c]);
+		cur = 0;
+		for( i=0; i<256; i++ )
 		{
-			if( grCur < 255 )
-			  greenR[i] = grCur;
+			if( i < chanMin[c] )
+				lut[c][i] = 0;
 			else
-			  greenR[i] = 255;
+			{
+				if( cur < 255 )
+				  lut[c][i] = cur;
+				else
+				  lut[c][i] = 255;
 
-			grCur += grInc;
+				cur += inc;
+			}
 		}
-		
-		if( i < gbMin )
-			greenB[i] = 0;
-		else
+	}
+}
+
+static void HistogramTables( uint32_t hist[4][256], uint16_t width, uint16_t height,
+	uint8_t lut[4][256] )
+{
+	/* the values used once a channel reaches its ceiling are not
+	   always its own, but that is what the stretch has always done */
+	static const float ceiling[4] = { 254, 252, 252, 255 };
+	static const float saturated[4] = { 252, 252, 255, 255 };
+	uint8_t chanMin, chanMax;
+	uint32_t cum;
+	float inc, cur, clip;
+	int c, i;
+
+	clip = 0.05 * width * height;
+
+	for( c=0; c<4; c++ )
+	{
+		chanMin = 255;
+		chanMax = 0;
+
+		cum = 0;
+		for( i=0; i<256 && chanMin == 255; i++ )
 		{
-			if( gbCur < 255 )
-			  greenB[i] = gbCur;
-			else
-			  greenB[i] = 255;
+			cum += hist[c][i];
+			if( cum > clip )
+				chanMin = i;
+		}
 
-			gbCur += gbInc;
+		cum = 0;
+		for( i=255; i > 0 && chanMax == 0; i-- )
+		{
+			cum += hist[c][i];
+			if( cum > clip )
+				chanMax = i;
 		}
-		
-		if( i < bMin )
-			blue[i] = 0;
-		else
+
+		inc = ceiling[c] / (chanMax-chanMin);
+		cur = 0;
+		for( i=0; i<256; i++ )
 		{
-			if( bCur < 255 )
-			  blue[i] = bCur;
+			if( i < chanMin )
+				lut[c][i] = 0;
 			else
-			  blue[i] = 255;
+			{
+				if( cur < ceiling[c] )
+				  lut[c][i] = cur;
+				else
+				  lut[c][i] = saturated[c];
 
-			bCur += bInc;
+				cur += inc;
+			}
 		}
-	 }
-
-	for( i=0; i<width*height; i ++ )
-	{
-		gb[i] = greenB[gb[i]];
-		gr[i] = greenR[gr[i]];
-		b[i] = blue[b[i]];
-		r[i] = red[r[i]];
-	}	
-	
-	return( 1 );
+	}
 }
 
-int Histogram( const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b )
+/***********************************************************************
+ * Run the corrections selected in flags over the four channels. Every
+ * table is folded into one per channel, so each pixel is looked up once
+ * however many corrections are applied; the histogram stretch works
+ * from the histogram of the already corrected channel, which is the
+ * original histogram mapped through the tables so far.
+ ***********************************************************************/
+static void CorrectChannels( const struct PalmPixHeader *picHdr, int flags, int bias,
+	uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b )
 {
-	/* uint8_t *tmpRow; */
-	uint8_t gbMin, gbMax, grMin, grMax, rMin, rMax, bMin, bMax;
-    uint32_t rCum, grCum, gbCum, bCum;
-    uint32_t grC[256], gbC[256], rC[256], bC[256];
-	float grInc, gbInc, rInc, bInc, grCur, gbCur, rCur, bCur;
-	uint16_t	width = picHdr->w/2;
-	uint16_t	height = picHdr->h/2;
-	int i;
-    float clip;
-    uint8_t red[256], greenB[256], greenR[256], blue[256];
-   	float redCeiling = 254;
-   	float greenCeiling = 252;
-   	float blueCeiling = 255;
-   
-	memset( red, 0, 256 * sizeof( uint8_t ));
-	memset( greenR, 0, 256 * sizeof( uint8_t ));
-	memset( greenB, 0, 256 * sizeof( uint8_t ));
-	memset( blue, 0, 256 * sizeof( uint8_t ));
- 
-	memset( rC, 0, 256 * sizeof( uint32_t ));
-	memset( grC, 0, 256 * sizeof( uint32_t ));
-	memset( gbC, 0, 256 * sizeof( uint32_t ));
-	memset( bC, 0, 256 * sizeof( uint32_t ));
- 
-	gbMin = grMin = rMin = bMin = 255;
-	gbMax = grMax = rMax = bMax = 0;
-		
-	for( i=0; i<width*height; i ++ )
+	uint8_t *data[4];
+	uint8_t lut[4][256], step[4][256];
+	uint32_t hist[4][256], mapped[4][256];
+	uint16_t width = picHdr->w/2;
+	uint16_t height = picHdr->h/2;
+	int c, i;
+
+	if( !(flags & (PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH))
+		&& bias == 50 )
+		return;
+
+	data[0] = r;
+	data[1] = gr;
+	data[2] = gb;
+	data[3] = b;
+
+	for( c=0; c<4; c++ )
 	{
-	    rC[r[i]]++;
-	    grC[gr[i]]++;
-	    gbC[gb[i]]++;
-	    bC[b[i]]++;
-	}	
+		for( i=0; i<256; i++ )
+			lut[c][i] = i;
+		if( flags & (PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH) )
+			ChannelHistogram( data[c], width * height, hist[c] );
+	}
 
-    rCum = grCum = gbCum = bCum = 0;
-    
-    clip = 0.05 * width * height;
-   
-    for( i=0; i<256; i++ )
+	if( flags & PALMPIX_COLOUR_CORRECTION )
 	{
-	   rCum += rC[i];
-	   
-	   if( rMin == 255 &&  rCum > clip )
-			rMin = i;
+		ColourCorrectTables( hist, width, height, step );
+		for( c=0; c<4; c++ )
+			for( i=0; i<256; i++ )
+				lut[c][i] = step[c][lut[c][i]];
+	}
 
-	   grCum += grC[i];
-	   
-	   if( grMin == 255 && grCum > clip )
-			grMin = i;
+	if( bias != 50 )
+	{
+		BiasTable( (double)bias / 100.0, step[0] );
+		for( c=0; c<4; c++ )
+			for( i=0; i<256; i++ )
+				lut[c][i] = step[0][lut[c][i]];
+	}
 
-	   gbCum += gbC[i];
-	   
-	   if( gbMin == 255 && gbCum > clip )
-			gbMin = i;
+	if( flags & PALMPIX_HISTOGRAM_STRETCH )
+	{
+		memset( mapped, 0, sizeof( mapped ));
+		for( c=0; c<4; c++ )
+			for( i=0; i<256; i++ )
+				mapped[c][lut[c][i]] += hist[c][i];
 
-	   bCum += bC[i];
-	   
-	   if( bMin == 255 && bCum > clip )
-			bMin = i;
-	   
-	   if( rMin != 255 && grMin != 255 && gbMin != 255 && bMin != 255 )
-		 break;
+		HistogramTables( mapped, width, height, step );
+		for( c=0; c<4; c++ )
+			for( i=0; i<256; i++ )
+				lut[c][i] = step[c][lut[c][i]];
 	}
-   
-    rCum = grCum = gbCum = bCum = 0;
-    
-    for( i=255; i > 0; i-- )
-	{
-	   rCum += rC[i];
-	   
-	   if( rMax == 0 &&  rCum > clip )
-			rMax = i;
 
-	   grCum += grC[i];
-	   
-	   if( grMax == 0 && grCum > clip )
-			grMax = i;
+	for( c=0; c<4; c++ )
+		ApplyTable( lut[c], data[c], width * height );
+}
 
-	   gbCum += gbC[i];
-	   
-	   if( gbMax == 0 && gbCum > clip )
-			gbMax = i;
+int ColourCorrect (const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b)
+{
+	CorrectChannels( picHdr, PALMPIX_COLOUR_CORRECTION, 50, r, gr, gb, b );
+	return( 1 );
+}
 
-	   bCum += bC[i];
-	   
-	   if( bMax == 0 && bCum > clip )
-			bMax = i;
+int Histogram( const struct PalmPixHeader *picHdr, uint8_t *r, uint8_t *gr, uint8_t *gb, uint8_t *b )
+{
+	CorrectChannels( picHdr, PALMPIX_HISTOGRAM_STRETCH, 50, r, gr, gb, b );
+	return( 1 );
+}
 
-	   if( rMax != 0 && grMax != 0 && gbMax != 0 && bMax != 0 )
-		 break;
-	}
-   
-	rInc = redCeiling / (rMax-rMin);
-   	grInc = greenCeiling / (grMax-grMin);
-   	gbInc = greenCeiling / (gbMax-gbMin);
-   	bInc = blueCeiling / (bMax-bMin);
-	
-   rCur = 0;
-   grCur = 0;
-   gbCur = 0;
-   bCur = 0;
-
-   for (i = 0; i<256; i++)
-	 {
-	 	if( i < rMin )
-		 	red[i] = 0;
-		else 
-		{
-			if( rCur < redCeiling )
-			  red[i] = rCur;
-			else
-			  red[i] = greenCeiling;
+/*****************************************************************************
+ * Row kernels for Interpolate(). Each one fills n bytes with a truncated
+ * average, exactly as the scalar expressions do; with SSE2 they do 16
+ * pixels at a time.
+ *****************************************************************************/
+#ifdef __SSE2__
+#define LOAD(p)		_mm_loadu_si128((const __m128i *)(p))
+#define LO(v)		_mm_unpacklo_epi8((v), _mm_setzero_si128())
+#define HI(v)		_mm_unpackhi_epi8((v), _mm_setzero_si128())
+#endif
 
-			rCur += rInc;
-		}
+/* (a + b) >> 1 */
+static void Avg2( uint8_t *d, const uint8_t *a, const uint8_t *b, int n )
+{
+   int i = 0;
+#ifdef __SSE2__
+   __m128i va, vb;
 
-		if( i < grMin )
-			greenR[i] = 0;
-		else
-		{
-			if( grCur < greenCeiling )
-			  greenR[i] = grCur;
-			else
-			  greenR[i] = greenCeiling;
+   /* pavgb rounds up, take the carry back off */
+   for( ; i+16<=n; i += 16 )
+     {
+	va = LOAD( a+i );
+	vb = LOAD( b+i );
+	_mm_storeu_si128( (__m128i *)(d+i), _mm_sub_epi8( _mm_avg_epu8( va, vb ),
+		_mm_and_si128( _mm_xor_si128( va, vb ), _mm_set1_epi8( 1 ))));
+     }
+#endif
+   for( ; i<n; i++ )
+     d[i] = (a[i] + b[i])>>1;
+}
 
-			grCur += grInc;
-		}
-		
-		if( i < gbMin )
-			greenB[i] = 0;
-		else
-		{
-			if( gbCur < greenCeiling )
-			  greenB[i] = gbCur;
-			else
-			  greenB[i] = blueCeiling;
+/* (a + b + c + e) >> 2 */
+static void Avg4( uint8_t *d, const uint8_t *a, const uint8_t *b, const uint8_t *c,
+	const uint8_t *e, int n )
+{
+   int i = 0;
+#ifdef __SSE2__
+   __m128i va, vb, vc, ve, lo, hi;
 
-			gbCur += gbInc;
-		}
-		
-		if( i < bMin )
-			blue[i] = 0;
-		else
-		{
-			if( bCur < blueCeiling )
-			  blue[i] = bCur;
-			else
-			  blue[i] = blueCeiling;
+   for( ; i+16<=n; i += 16 )
+     {
+	va = LOAD( a+i );
+	vb = LOAD( b+i );
+	vc = LOAD( c+i );
+	ve = LOAD( e+i );
+	lo = _mm_add_epi16( _mm_add_epi16( LO( va ), LO( vb )), _mm_add_epi16( LO( vc ), LO( ve )));
+	hi = _mm_add_epi16( _mm_add_epi16( HI( va ), HI( vb )), _mm_add_epi16( HI( vc ), HI( ve )));
+	_mm_storeu_si128( (__m128i *)(d+i),
+		_mm_packus_epi16( _mm_srli_epi16( lo, 2 ), _mm_srli_epi16( hi, 2 )));
+     }
+#endif
+   for( ; i<n; i++ )
+     d[i] = (a[i] + b[i] + c[i] + e[i])>>2;
+}
 
-			bCur += bInc;
-		}
-	 }
+/* ((m << 2) + a + b + c + e) >> 3, a green in the middle of four others */
+static void AvgCentre( uint8_t *d, const uint8_t *m, const uint8_t *a, const uint8_t *b,
+	const uint8_t *c, const uint8_t *e, int n )
+{
+   int i = 0;
+#ifdef __SSE2__
+   __m128i vm, va, vb, vc, ve, lo, hi;
 
-	for( i=0; i<width*height; i ++ )
-	{
-		gb[i] = greenB[gb[i]];
-		gr[i] = greenR[gr[i]];
-		b[i] = blue[b[i]];
-		r[i] = red[r[i]];
-	}	
-	
-	return( 1 );
+   for( ; i+16<=n; i += 16 )
+     {
+	vm = LOAD( m+i );
+	va = LOAD( a+i );
+	vb = LOAD( b+i );
+	vc = LOAD( c+i );
+	ve = LOAD( e+i );
+	lo = _mm_add_epi16( _mm_add_epi16( LO( va ), LO( vb )), _mm_add_epi16( LO( vc ), LO( ve )));
+	hi = _mm_add_epi16( _mm_add_epi16( HI( va ), HI( vb )), _mm_add_epi16( HI( vc ), HI( ve )));
+	lo = _mm_add_epi16( lo, _mm_slli_epi16( LO( vm ), 2 ));
+	hi = _mm_add_epi16( hi, _mm_slli_epi16( HI( vm ), 2 ));
+	_mm_storeu_si128( (__m128i *)(d+i),
+		_mm_packus_epi16( _mm_srli_epi16( lo, 3 ), _mm_srli_epi16( hi, 3 )));
+     }
+#endif
+   for( ; i<n; i++ )
+     d[i] = (( m[i] << 2 ) + a[i] + b[i] + c[i] + e[i])>>3;
 }
 
+#ifdef __SSE2__
+#undef LOAD
+#undef LO
+#undef HI
+#endif
+
 /*****************************************************************************
  * The interpolation function looks a litte strange in that it uses 4 * the
  * green component when the green component is centered. This is to compensate
  * for a different intensity on odd and even green rows. All green 
  * interpolations have an equal number of pixels from a red row and blue row.
+ *
+ * Each output row is worked out a colour at a time for its even and its odd
+ * pixels, then interleaved into the pixmap.
  *****************************************************************************/
-static void Interpolate( const struct PalmPixHeader *pixHdr, uint8_t *red, uint8_t *greenR, uint8_t *greenB, uint8_t *blue, uint8_t *pp, int offset_r, int offset_g, int offset_b )
+static int Interpolate( const struct PalmPixHeader *pixHdr, uint8_t *red, uint8_t *greenR, uint8_t *greenB, uint8_t *blue, uint8_t *pp, int offset_r, int offset_g, int offset_b )
 {
-   int idx, offset, ppOff;
-   int x, y, rowOff;
-   uint8_t r, g, b;
+   int offset, prev, next, i, n, y;
    int rawWidth = pixHdr->w/2;
+   uint8_t *rows, *out;
+   const uint8_t *r0, *g0, *b0, *r1, *g1, *b1;
+   
+   /* pixels 2x and 2x+1 for x = 1 .. rawWidth-2 */
+   n = rawWidth - 2;
+   if( n <= 0 )
+     return 1;
+
+   rows = malloc( (size_t)(6 * n) );
+   if( rows == NULL )
+     return 0;
    
    for( y=1; y<pixHdr->h-1; y++ )
      {
-	
-	idx = y/2;
-	offset = idx * rawWidth;
-	ppOff = y * pixHdr->w;
+	offset = (y/2) * rawWidth;
 	
 	if( y%2 == 1 )
 	  {
-	     for( x=1; x<rawWidth-1; x++ )
-	       {
-		  
-		  rowOff = x*2;
-		  
-		  r = (red[offset+x-1] + red[offset + x] + red[offset + rawWidth + x -1] + red[offset + rawWidth + x])>>2;
-		  g = (greenR[offset+x] + greenR[offset+x+rawWidth] + greenB[offset + x - 1] + greenB[offset + x])>>2;
-		  b = blue[offset + x];
-		  pp[3 * (ppOff + rowOff) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff) + offset_b] = b;
-		  
-		  r = (red[offset + x] + red[offset + rawWidth + x])>>1;
-		  g = (( greenB[offset + x] << 2 ) + greenR[offset+x] + greenR[offset+x+1] + greenR[offset+x+rawWidth] + greenR[offset+x+rawWidth+1] )>>3;
-		  b = (blue[offset + x] + blue[offset + x + 1])>>1;
-		  pp[3 * (ppOff + rowOff + 1) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff + 1) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff + 1) + offset_b] = b;
-		  
-	       }
+	     next = offset + rawWidth;
+
+	     Avg4( rows, red+offset, red+offset+1, red+next, red+next+1, n );
+	     Avg4( rows+n, greenR+offset+1, greenR+next+1, greenB+offset, greenB+offset+1, n );
+	     Avg2( rows+3*n, red+offset+1, red+next+1, n );
+	     AvgCentre( rows+4*n, greenB+offset+1, greenR+offset+1, greenR+offset+2,
+		       greenR+next+1, greenR+next+2, n );
+	     Avg2( rows+5*n, blue+offset+1, blue+offset+2, n );
+
+	     r0 = rows;
+	     g0 = rows+n;
+	     b0 = blue+offset+1;
+	     r1 = rows+3*n;
 	  }
 	else
 	  {
-	     for( x=1; x<rawWidth-1; x++ )
-	       {
-		  rowOff = x*2;
-		  
-		  r = (red[offset + x - 1] + red[offset + x])>>1;
-		  g = (( greenR[offset + x] << 2 ) + greenB[offset-rawWidth+x-1] + greenB[offset-rawWidth+x] + greenB[offset+x-1] + greenB[offset+x] )>>3;
-		  b = (blue[offset-rawWidth+x] + blue[offset+x])>>1;
-		  pp[3 * (ppOff + rowOff) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff) + offset_b] = b;
-		  
-		  r = red[offset+x];
-		  g = (greenR[offset+x] + greenR[offset+x+1] + greenB[offset-rawWidth+x] + greenB[offset + x])>>2;
-		  b = (blue[offset+x-rawWidth] + blue[offset+x-rawWidth-1] + blue[offset+x] + blue[offset+x+1])>>2;
-		  pp[3 * (ppOff + rowOff + 1) + offset_r] = r;
-		  pp[3 * (ppOff + rowOff + 1) + offset_g] = g;
-		  pp[3 * (ppOff + rowOff + 1) + offset_b] = b;
-		  
-	       }
+	     prev = offset - rawWidth;
+
+	     Avg2( rows, red+offset, red+offset+1, n );
+	     AvgCentre( rows+n, greenR+offset+1, greenB+prev, greenB+prev+1,
+		       greenB+offset, greenB+offset+1, n );
+	     Avg2( rows+2*n, blue+prev+1, blue+offset+1, n );
+	     Avg4( rows+4*n, greenR+offset+1, greenR+offset+2, greenB+prev+1, greenB+offset+1, n );
+	     Avg4( rows+5*n, blue+prev+1, blue+prev, blue+offset+1, blue+offset+2, n );
+
+	     r0 = rows;
+	     g0 = rows+n;
+	     b0 = rows+2*n;
+	     r1 = red+offset+1;
+	  }
+	g1 = rows+4*n;
+	b1 = rows+5*n;
+
+	out = pp + 3 * (y * pixHdr->w + 2);
+	for( i=0; i<n; i++, out += 6 )
+	  {
+	     out[offset_r] = r0[i];
+	     out[offset_g] = g0[i];
+	     out[offset_b] = b0[i];
+	     out[3 + offset_r] = r1[i];
+	     out[3 + offset_g] = g1[i];
+	     out[3 + offset_b] = b1[i];
 	  }
      }
-   
+
+   free( rows );
+   return 1;
 }
 
 void DecodeRow( uint8_t *compData, uint8_t *lastRow, uint8_t *unCompData, uint32_t *offset, int32_t *firstWord, uint16_t *PPLutsW, uint8_t *PPLuts, uint16_t halfWidth )
@@ -1760,26 +1802,15 @@ int unpack_PalmPix (struct PalmPixState *s,
 		 
 	  }
 
-	if( s->flags & PALMPIX_COLOUR_CORRECTION )
-		  ColourCorrect ( h, chan[pixChannelR], chan[pixChannelGR], 
-				  chan[pixChannelGB], chan[pixChannelB] ); 
+	CorrectChannels ( h, s->flags, s->bias,
+			  chan[pixChannelR], chan[pixChannelGR],
+			  chan[pixChannelGB], chan[pixChannelB] );
 
-	if( s->bias != 50 ) 
-    {
-	   Bias ( (double)s->bias / 100.0, rawWidth, rawHeight, chan[pixChannelR]);
-	   Bias ( (double)s->bias / 100.0, rawWidth, rawHeight, chan[pixChannelGR]);
-	   Bias ( (double)s->bias / 100.0, rawWidth, rawHeight, chan[pixChannelGB]);
-	   Bias ( (double)s->bias / 100.0, rawWidth, rawHeight, chan[pixChannelB]);
-	}
-
-	if( s->flags & PALMPIX_HISTOGRAM_STRETCH )
-		  Histogram ( h, chan[pixChannelR], chan[pixChannelGR], 
-				  chan[pixChannelGB], chan[pixChannelB] ); 
-
-	Interpolate (h,
+	if (!Interpolate (h,
 		     chan[pixChannelR], chan[pixChannelGR],
 		     chan[pixChannelGB], chan[pixChannelB],
-		     s->pixmap, s->offset_r, s->offset_g, s->offset_b);
+		     s->pixmap, s->offset_r, s->offset_g, s->offset_b))
+	  goto failed;
 	   
 	failed = 0;
 	
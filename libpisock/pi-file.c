@@ -29,12 +29,24 @@
  * along with this library; if not, write to the Free Software Foundation,
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(HAVE_COPY_FILE_RANGE) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "pi-debug.h"
 #include "pi-source.h"
@@ -42,6 +54,10 @@
 #include "pi-error.h"
 
 #undef FILEDEBUG
+
+/* Chunk size for copying the spilled record data into the database */
+#define PI_FILE_COPY_CHUNK	65536
+
 #define pi_mktag(c1,c2,c3,c4) (((c1)<<24)|((c2)<<16)|((c3)<<8)|(c4))
 
 /*
@@ -95,12 +111,27 @@
 #define PI_RESOURCE_ENT_SIZE 10
 #define PI_RECORD_ENT_SIZE 8
 
+/* appInfo and sortInfo of a mapped file point into the mapping */
+#define pi_file_in_map(pf, ptr) \
+	((pf)->map != NULL && (unsigned char *)(ptr) >= (unsigned char *)(pf)->map \
+	 && (unsigned char *)(ptr) < (unsigned char *)(pf)->map + (pf)->map_size)
+
 /* Local prototypes */
 static int pi_file_close_for_write(pi_file_t *pf);
 static void pi_file_free(pi_file_t *pf);
 static int pi_file_find_resource_by_type_id(const pi_file_t *pf, unsigned long restype, int resid, int *resindex);
 static pi_file_entry_t *pi_file_append_entry(pi_file_t *pf);
 static int pi_file_set_rbuf_size(pi_file_t *pf, size_t size);
+static int pi_file_read_header(pi_file_t *pf, unsigned char *buf,
+	const char *name, off_t *app_info_offset, off_t *sort_info_offset);
+static int pi_file_info_sizes(pi_file_t *pf, off_t offset,
+	off_t app_info_offset, off_t sort_info_offset, off_t file_size,
+	const char *name);
+static int pi_file_entry_at(const pi_file_t *pf, int i,
+	pi_file_entry_t *entp);
+static int pi_file_index_find(const pi_file_t *pf, unsigned long type,
+	unsigned long id);
+static void pi_file_index_add(pi_file_t *pf, int i);
 
 /* this seems to work, but what about leap years? */
 /*#define PILOT_TIME_DELTA (((unsigned)(1970 - 1904) * 365 * 24 * 60 * 60) + 1450800)*/
@@ -146,7 +177,6 @@ pi_file_t
 		file_size;
 	
 	pi_file_t *pf;
-	struct 	DBInfo *ip;
 	pi_file_entry_t *entp;
 		
 	unsigned char buf[PI_HDR_SIZE];
@@ -169,64 +199,9 @@ pi_file_t
 		goto bad;
 	}
 
-	p 	= buf;
-	ip 	= &pf->info;
-
-	memcpy(ip->name, p, 32);
-	ip->flags 		= get_short(p + 32);
-	ip->miscFlags		= dlpDBMiscFlagRamBased;
-	ip->version 		= get_short(p + 34);
-	ip->createDate 		= pilot_time_to_unix_time(get_long(p + 36));
-	ip->modifyDate 		= pilot_time_to_unix_time(get_long(p + 40));
-	ip->backupDate 		= pilot_time_to_unix_time(get_long(p + 44));
-	ip->modnum 		= get_long(p + 48);
-	app_info_offset 	= get_long(p + 52);
-	sort_info_offset 	= get_long(p + 56);
-	ip->type 		= get_long(p + 60);
-	ip->creator 		= get_long(p + 64);
-	pf->unique_id_seed 	= get_long(p + 68);
-
-	/* record list header */
-	pf->next_record_list_id = get_long(p + 72);
-	pf->num_entries 	= get_short(p + 76);
-
-	LOG ((PI_DBG_API, PI_DBG_LVL_INFO,
-	     "FILE OPEN Name: '%s' Flags: 0x%4.4X Version: %d\n",
-	     ip->name, ip->flags, ip->version));
-	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
-	     "  Creation date: %s", ctime(&ip->createDate)));
-	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
-	     "  Modification date: %s", ctime(&ip->modifyDate)));
-	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
-	     "  Backup date: %s", ctime(&ip->backupDate)));
-	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
-	     "  Appinfo Size: %d Sortinfo Size: %d\n",
-	     pf->app_info_size, pf->sort_info_size));
-	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
-	     "  Type: '%s'", printlong(ip->type)));
-	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
-	     "  Creator: '%s' Seed: 0x%8.8lX\n", printlong(ip->creator),
-	     pf->unique_id_seed));
-
-	if (pf->next_record_list_id != 0) {
-		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
- 		     "FILE OPEN %s: this file is probably damaged\n", name));
-		goto bad;
-	}
-
-	if (ip->flags & dlpDBFlagResource) {
-		pf->resource_flag = 1;
-		pf->ent_hdr_size = PI_RESOURCE_ENT_SIZE;
-	} else {
-		pf->resource_flag = 0;
-		pf->ent_hdr_size = PI_RECORD_ENT_SIZE;
-	}
-
-	if (pf->num_entries < 0) {
-		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
- 		     "FILE OPEN %s: bad header\n", name));
+	if (pi_file_read_header(pf, buf, name, &app_info_offset,
+			&sort_info_offset) < 0)
 		goto bad;
-	}
 
 	offset = file_size;
 
@@ -285,28 +260,9 @@ pi_file_t
 		}
 	}
 
-	if (sort_info_offset) {
-		pf->sort_info_size = offset - sort_info_offset;
-		offset = sort_info_offset;
-	}
-
-	if (app_info_offset) {
-		pf->app_info_size = offset - app_info_offset;
-		offset = app_info_offset;
-	}
-
-	if (pf->app_info_size < 0 ||
-		(sort_info_offset + pf->sort_info_size) > file_size ||
-		pf->sort_info_size < 0 ||
-		(app_info_offset + pf->app_info_size) > file_size) {
-		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
- 		     "FILE OPEN %s: bad header "
-			 "(app_info @ %d size %d, "
-			 "sort_info @ %d size %d)\n", name,
-			 app_info_offset, pf->app_info_size,
-			 sort_info_offset, pf->sort_info_size));
+	if (pi_file_info_sizes(pf, offset, app_info_offset, sort_info_offset,
+			file_size, name) < 0)
 		goto bad;
-	}
 
 	if (pf->app_info_size == 0)
 		pf->app_info = NULL;
@@ -339,6 +295,228 @@ bad:
 	return NULL;
 }
 
+pi_file_t
+*pi_file_open_mapped(const char *name)
+{
+	int 	fd;
+	pi_file_t *pf;
+	struct 	stat st;
+	off_t offset, app_info_offset = 0, sort_info_offset = 0;
+
+	if ((pf = calloc(1, sizeof (pi_file_t))) == NULL)
+		return NULL;
+
+	if ((fd = open(name, O_RDONLY)) < 0)
+		goto bad;
+
+	if (fstat(fd, &st) < 0 || st.st_size < PI_HDR_SIZE
+	    || st.st_size > 0x7FFFFFFF) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
+ 		     "FILE OPEN %s: can't read header\n", name));
+		close(fd);
+		goto bad;
+	}
+
+#ifdef HAVE_MMAP
+	/* private and writable, so that a caller scribbling over a record
+	   gets a copy of the page rather than a crash */
+	pf->map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE, fd, 0);
+	if (pf->map == MAP_FAILED) {
+		pf->map = NULL;
+		close(fd);
+		goto bad;
+	}
+	pf->map_size = (size_t) st.st_size;
+#else
+	/* no mmap(): slurp the file in one go, which still gives stable
+	   pointers and a single read for the whole database */
+	if ((pf->map = malloc((size_t) st.st_size)) == NULL) {
+		close(fd);
+		goto bad;
+	}
+	pf->map_size = (size_t) st.st_size;
+	for (offset = 0; offset < st.st_size; ) {
+		ssize_t got = read(fd, (char *) pf->map + offset,
+			(size_t) (st.st_size - offset));
+
+		if (got <= 0) {
+			close(fd);
+			goto bad;
+		}
+		offset += got;
+	}
+#endif
+	close(fd);
+
+	if (pi_file_read_header(pf, pf->map, name, &app_info_offset,
+			&sort_info_offset) < 0)
+		goto bad;
+
+	if (PI_HDR_SIZE + (size_t) pf->num_entries * pf->ent_hdr_size
+	    > pf->map_size) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
+ 		     "FILE OPEN %s: bad header\n", name));
+		goto bad;
+	}
+
+	/* Entries are decoded from the mapping when they are accessed;
+	   only the first one is needed to size the appInfo and sortInfo
+	   blocks that precede the data. */
+	offset = (off_t) pf->map_size;
+	if (pf->num_entries) {
+		unsigned char *p = (unsigned char *) pf->map + PI_HDR_SIZE;
+
+		offset = get_long(pf->resource_flag ? p + 6 : p);
+		if (offset > (off_t) pf->map_size) {
+			LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
+			 "FILE OPEN %s: Entry 0 corrupt, giving up\n",
+				name));
+			goto bad;
+		}
+	}
+
+	if (pi_file_info_sizes(pf, offset, app_info_offset, sort_info_offset,
+			(off_t) pf->map_size, name) < 0)
+		goto bad;
+
+	if (pf->app_info_size)
+		pf->app_info = (unsigned char *) pf->map + app_info_offset;
+	if (pf->sort_info_size)
+		pf->sort_info = (unsigned char *) pf->map + sort_info_offset;
+
+	return pf;
+
+bad:
+	pi_file_close(pf);
+	return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_read_header
+ *
+ * Summary:     decode the database header shared by both open paths
+ *
+ * Parameters:  file handle, PI_HDR_SIZE bytes of header, file name for
+ *		logging, on return the appInfo and sortInfo offsets
+ *
+ * Returns:     0, or -1 if the header is damaged
+ *
+ ***********************************************************************/
+static int
+pi_file_read_header(pi_file_t *pf, unsigned char *buf, const char *name,
+	off_t *app_info_offset, off_t *sort_info_offset)
+{
+	unsigned char *p;
+	struct 	DBInfo *ip;
+
+	p 	= buf;
+	ip 	= &pf->info;
+
+	memcpy(ip->name, p, 32);
+	ip->flags 		= get_short(p + 32);
+	ip->miscFlags		= dlpDBMiscFlagRamBased;
+	ip->version 		= get_short(p + 34);
+	ip->createDate 		= pilot_time_to_unix_time(get_long(p + 36));
+	ip->modifyDate 		= pilot_time_to_unix_time(get_long(p + 40));
+	ip->backupDate 		= pilot_time_to_unix_time(get_long(p + 44));
+	ip->modnum 		= get_long(p + 48);
+	*app_info_offset 	= get_long(p + 52);
+	*sort_info_offset 	= get_long(p + 56);
+	ip->type 		= get_long(p + 60);
+	ip->creator 		= get_long(p + 64);
+	pf->unique_id_seed 	= get_long(p + 68);
+
+	/* record list header */
+	pf->next_record_list_id = get_long(p + 72);
+	pf->num_entries 	= get_short(p + 76);
+
+	LOG ((PI_DBG_API, PI_DBG_LVL_INFO,
+	     "FILE OPEN Name: '%s' Flags: 0x%4.4X Version: %d\n",
+	     ip->name, ip->flags, ip->version));
+	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
+	     "  Creation date: %s", ctime(&ip->createDate)));
+	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
+	     "  Modification date: %s", ctime(&ip->modifyDate)));
+	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
+	     "  Backup date: %s", ctime(&ip->backupDate)));
+	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
+	     "  Type: '%s'", printlong(ip->type)));
+	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
+	     "  Creator: '%s' Seed: 0x%8.8lX\n", printlong(ip->creator),
+	     pf->unique_id_seed));
+
+	if (pf->next_record_list_id != 0) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
+ 		     "FILE OPEN %s: this file is probably damaged\n", name));
+		return -1;
+	}
+
+	if (ip->flags & dlpDBFlagResource) {
+		pf->resource_flag = 1;
+		pf->ent_hdr_size = PI_RESOURCE_ENT_SIZE;
+	} else {
+		pf->resource_flag = 0;
+		pf->ent_hdr_size = PI_RECORD_ENT_SIZE;
+	}
+
+	if (pf->num_entries < 0) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
+ 		     "FILE OPEN %s: bad header\n", name));
+		return -1;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_info_sizes
+ *
+ * Summary:     size the appInfo and sortInfo blocks, which run up to
+ *		the next block in the file
+ *
+ * Parameters:  file handle, offset of the first record or resource,
+ *		appInfo and sortInfo offsets, file size, file name
+ *
+ * Returns:     0, or -1 if the blocks don't fit in the file
+ *
+ ***********************************************************************/
+static int
+pi_file_info_sizes(pi_file_t *pf, off_t offset, off_t app_info_offset,
+	off_t sort_info_offset, off_t file_size, const char *name)
+{
+	if (sort_info_offset) {
+		pf->sort_info_size = offset - sort_info_offset;
+		offset = sort_info_offset;
+	}
+
+	if (app_info_offset) {
+		pf->app_info_size = offset - app_info_offset;
+		offset = app_info_offset;
+	}
+
+	LOG ((PI_DBG_API, PI_DBG_LVL_DEBUG,
+	     "  Appinfo Size: %d Sortinfo Size: %d\n",
+	     pf->app_info_size, pf->sort_info_size));
+
+	if (pf->app_info_size < 0 ||
+		(sort_info_offset + pf->sort_info_size) > file_size ||
+		pf->sort_info_size < 0 ||
+		(app_info_offset + pf->app_info_size) > file_size) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
+ 		     "FILE OPEN %s: bad header "
+			 "(app_info @ %d size %d, "
+			 "sort_info @ %d size %d)\n", name,
+			 (int) app_info_offset, pf->app_info_size,
+			 (int) sort_info_offset, pf->sort_info_size));
+		return -1;
+	}
+
+	return 0;
+}
+
 int
 pi_file_close(pi_file_t *pf)
 {
@@ -404,7 +582,8 @@ pi_file_read_resource(pi_file_t *pf, int i,
 		      void **bufp, size_t *sizep, unsigned long *type,
 		      int *idp)
 {
-	pi_file_entry_t *entp;
+	pi_file_entry_t entry,
+		*entp = &entry;
 	int result;
 
 	if (pf->for_writing || !pf->resource_flag)
@@ -413,12 +592,15 @@ pi_file_read_resource(pi_file_t *pf, int i,
 	if (i < 0 || i >= pf->num_entries)
 		return PI_ERR_GENERIC_ARGUMENT;
 
-	entp = &pf->entries[i];
+	if ((result = pi_file_entry_at(pf, i, entp)) < 0)
+		return result;
 
-	if (bufp) {
+	if (bufp && pf->map) {
+		*bufp = (unsigned char *) pf->map + entp->offset;
+	} else if (bufp) {
 		if ((result = pi_file_set_rbuf_size(pf, (size_t) entp->size)) < 0)
 			return result;
-		fseek(pf->f, pf->entries[i].offset, SEEK_SET);
+		fseek(pf->f, entp->offset, SEEK_SET);
 		if (fread(pf->rbuf, 1, (size_t) entp->size, pf->f) !=
 				(size_t) entp->size)
 			return PI_ERR_FILE_ERROR;
@@ -441,7 +623,8 @@ pi_file_read_record(pi_file_t *pf, int recindex,
 		    recordid_t * recuid)
 {
 	int result;
-	pi_file_entry_t *entp;
+	pi_file_entry_t entry,
+		*entp = &entry;
 
 	if (pf->for_writing || pf->resource_flag)
 		return PI_ERR_FILE_INVALID;
@@ -449,16 +632,19 @@ pi_file_read_record(pi_file_t *pf, int recindex,
 	if (recindex < 0 || recindex >= pf->num_entries)
 		return PI_ERR_GENERIC_ARGUMENT;
 
-	entp = &pf->entries[recindex];
+	if ((result = pi_file_entry_at(pf, recindex, entp)) < 0)
+		return result;
 
-	if (bufp) {
+	if (bufp && pf->map) {
+		*bufp = (unsigned char *) pf->map + entp->offset;
+	} else if (bufp) {
 		if ((result = pi_file_set_rbuf_size(pf, (size_t) entp->size)) < 0) {
 			LOG((PI_DBG_API, PI_DBG_LVL_ERR,
 			    "FILE READ_RECORD Unable to set buffer size!\n"));
 			return result;
 		}
 
-		fseek(pf->f, pf->entries[recindex].offset, SEEK_SET);
+		fseek(pf->f, entp->offset, SEEK_SET);
 
 		if (fread(pf->rbuf, 1, (size_t) entp->size, pf->f) !=
 		    (size_t) entp->size) {
@@ -491,32 +677,126 @@ pi_file_read_record_by_id(pi_file_t *pf, recordid_t uid,
 			  int *catp)
 {
 	int 	i;
-	struct 	pi_file_entry *entp;
 
-	for (i = 0, entp = pf->entries; i < pf->num_entries;
-	     i++, entp++) {
-		if (entp->uid == uid) {
-			if (idxp)
-				*idxp = i;
-			return (pi_file_read_record
-				(pf, i, bufp, sizep, attrp, catp, &uid));
-		}
-	}
+	if (pf->resource_flag)
+		return PI_ERR_FILE_INVALID;
+
+	i = pi_file_index_find(pf, 0, uid);
+	if (i < 0)
+		return PI_ERR_FILE_NOT_FOUND;
 
-	return PI_ERR_FILE_NOT_FOUND;
+	if (idxp)
+		*idxp = i;
+	return pi_file_read_record(pf, i, bufp, sizep, attrp, catp, &uid);
 }
 
 int
 pi_file_id_used(const pi_file_t *pf, recordid_t uid)
 {
-	int 	i;
-	struct 	pi_file_entry *entp;
+	if (pf->resource_flag)
+		return 0;
 
-	for (i = 0, entp = pf->entries; i < pf->num_entries; i++, entp++) {
-		if (entp->uid == uid)
-			return 1;
+	return pi_file_index_find(pf, 0, uid) >= 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_spill_open
+ *
+ * Summary:     Open the temporary file that holds the record data of a
+ *		database being created
+ *
+ * Parameters:  access path of the database
+ *
+ * Returns:     the temporary file, or NULL on error
+ *
+ ***********************************************************************/
+static FILE *
+pi_file_spill_open(const char *name)
+{
+	char	*template;
+	int	fd = -1;
+	FILE	*f = NULL;
+
+	/* Keep it on the database's file system, so that the copy made on
+	   close can be done by the kernel; it is unlinked right away and
+	   disappears with the descriptor */
+	template = malloc(strlen(name) + 8);
+	if (template != NULL) {
+		sprintf(template, "%s.XXXXXX", name);
+		fd = mkstemp(template);
+		if (fd >= 0) {
+			unlink(template);
+			if ((f = fdopen(fd, "w+b")) == NULL)
+				close(fd);
+		}
+		free(template);
 	}
-	return 0;
+
+	if (f == NULL)
+		f = tmpfile();
+
+	return f;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_spill_copy
+ *
+ * Summary:     Append the spilled record data to the database file
+ *
+ * Parameters:  pi_file_t*, database file positioned after the header,
+ *		size of the record data
+ *
+ * Returns:     0 on success, -1 on error
+ *
+ ***********************************************************************/
+static int
+pi_file_spill_copy(pi_file_t *pf, FILE *f, size_t size)
+{
+	char	*chunk;
+	size_t	n;
+#ifdef HAVE_COPY_FILE_RANGE
+	loff_t	in = 0;
+	ssize_t	copied = 0;
+#endif
+
+	if (fflush(pf->spill) != 0)
+		return -1;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (fflush(f) != 0)
+		return -1;
+	while (size > 0) {
+		copied = copy_file_range(fileno(pf->spill), &in, fileno(f),
+			NULL, size, 0);
+		if (copied <= 0)
+			break;
+		size -= (size_t) copied;
+	}
+	if (size == 0)
+		return 0;
+
+	/* Only fall back to stdio when the kernel could not start, as
+	   across file systems on older kernels */
+	if (copied == 0 || in > 0)
+		return -1;
+#endif
+	if (fseek(pf->spill, 0L, SEEK_SET) != 0)
+		return -1;
+
+	if ((chunk = malloc(PI_FILE_COPY_CHUNK)) == NULL)
+		return -1;
+	while (size > 0) {
+		n = size < PI_FILE_COPY_CHUNK ? size : PI_FILE_COPY_CHUNK;
+		if (fread(chunk, n, 1, pf->spill) != 1
+		    || fwrite(chunk, n, 1, f) != 1)
+			break;
+		size -= n;
+	}
+	free(chunk);
+
+	return size == 0 ? 0 : -1;
 }
 
 pi_file_t *
@@ -541,8 +821,7 @@ pi_file_create(const char *name, const struct DBInfo *info)
 		pf->ent_hdr_size = PI_RECORD_ENT_SIZE;
 	}
 
-	pf->tmpbuf = pi_buffer_new(2048);
-	if (pf->tmpbuf == NULL)
+	if ((pf->spill = pi_file_spill_open(name)) == NULL)
 		goto bad;
 
 	return (pf);
@@ -573,8 +852,9 @@ pi_file_set_app_info(pi_file_t *pf, void *data, size_t size)
 	void 	*p;
 
 	if (!size) {
-		if (pf->app_info)
+		if (pf->app_info && !pi_file_in_map(pf, pf->app_info))
 			free(pf->app_info);
+		pf->app_info = NULL;
 		pf->app_info_size = 0;
 		return 0;
 	}
@@ -584,7 +864,7 @@ pi_file_set_app_info(pi_file_t *pf, void *data, size_t size)
 
 	memcpy(p, data, size);
 
-	if (pf->app_info)
+	if (pf->app_info && !pi_file_in_map(pf, pf->app_info))
 		free(pf->app_info);
 
 	pf->app_info = p;
@@ -599,8 +879,9 @@ pi_file_set_sort_info(pi_file_t *pf, void *data, size_t size)
 	void 	*p;
 
 	if (!size) {
-		if (pf->sort_info)
+		if (pf->sort_info && !pi_file_in_map(pf, pf->sort_info))
 			free(pf->sort_info);
+		pf->sort_info = NULL;
 		pf->sort_info_size = 0;
 		return 0;
 	}
@@ -610,7 +891,7 @@ pi_file_set_sort_info(pi_file_t *pf, void *data, size_t size)
 
 	memcpy(p, data, size);
 
-	if (pf->sort_info)
+	if (pf->sort_info && !pi_file_in_map(pf, pf->sort_info))
 		free(pf->sort_info);
 
 	pf->sort_info = p;
@@ -634,14 +915,15 @@ pi_file_append_resource(pi_file_t *pf, void *data, size_t size,
 	if (entp == NULL)
 		return PI_ERR_GENERIC_MEMORY;
 
-	if (size && pi_buffer_append(pf->tmpbuf, data, size) == NULL) {
+	if (size && fwrite(data, size, 1, pf->spill) != 1) {
 		pf->err = 1;
-		return PI_ERR_GENERIC_MEMORY;
+		return PI_ERR_FILE_ERROR;
 	}
 
 	entp->size 	= size;
 	entp->type 	= restype;
 	entp->resource_id 	= resid;
+	pi_file_index_add(pf, pf->num_entries - 1);
 
 	return size;
 }
@@ -661,14 +943,15 @@ pi_file_append_record(pi_file_t *pf, void *data, size_t size,
 	if (entp == NULL)
 		return PI_ERR_GENERIC_MEMORY;
 
-	if (size && pi_buffer_append(pf->tmpbuf, data, size) == NULL) {
+	if (size && fwrite(data, size, 1, pf->spill) != 1) {
 		pf->err = 1;
-		return PI_ERR_GENERIC_MEMORY;
+		return PI_ERR_FILE_ERROR;
 	}
 
 	entp->size 	= size;
 	entp->attrs 	= (recattrs & 0xf0) | (category & 0xf);
 	entp->uid 	= recuid;
+	pi_file_index_add(pf, pf->num_entries - 1);
 
 	return size;
 }
@@ -679,23 +962,76 @@ pi_file_get_entries(pi_file_t *pf, int *entries)
 	*entries = pf->num_entries;
 }
 
-int
-pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
+/* state shared with pi_file_retrieve_record() */
+struct pi_file_retrieve_ctx {
+	pi_file_t *pf;
+	pi_progress_t *progress;
+	progress_func report_progress;
+};
+
+/***********************************************************************
+ *
+ * Function:    pi_file_retrieve_record
+ *
+ * Summary:     dlp_ReadRecordsByIndex() callback for pi_file_retrieve()
+ *
+ * Parameters:  see dlp_record_func
+ *
+ * Returns:     0 to continue, negative on error
+ *
+ ***********************************************************************/
+static int
+pi_file_retrieve_record(int socket, int recindex, pi_buffer_t *buffer,
+	recordid_t recuid, int attr, int category, void *userdata)
+{
+	struct pi_file_retrieve_ctx *ctx = (struct pi_file_retrieve_ctx *)userdata;
+	int	result;
+
+	ctx->progress->transferred_bytes += buffer->used;
+	ctx->progress->data.db.transferred_records++;
+
+	if (ctx->report_progress
+		&& ctx->report_progress(socket,
+			ctx->progress) == PI_TRANSFER_STOP)
+		return pi_set_error(socket, PI_ERR_FILE_ABORTED);
+
+	/* There is no way to restore records with these
+	   attributes, so there is no use in backing them up
+	 */
+	if (attr &
+	    (dlpRecAttrArchived | dlpRecAttrDeleted))
+		return 0;
+	if ((result = pi_file_append_record(ctx->pf, buffer->data, buffer->used,
+			attr, category, recuid)) < 0)
+		return pi_set_error(socket, result);
+
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_retrieve_open
+ *
+ * Summary:     Open a database on the handheld for retrieval, set up
+ *		progress reporting and fetch its appInfo block
+ *
+ * Parameters:  pi_file_t*, socket, card number, database handle (set on
+ *		return), buffer, progress structure, progress callback
+ *
+ * Returns:     0 on success, negative on error
+ *
+ ***********************************************************************/
+static int
+pi_file_retrieve_open(pi_file_t *pf, int socket, int cardno, int *db,
+	pi_buffer_t *buffer, pi_progress_t *progress,
 	progress_func report_progress)
 {
-	int 	db = -1,
-		result,
+	int 	result,
 		old_device = 0;
 
-        unsigned int j;
-
 	struct DBInfo dbi;
-	struct DBSizeInfo size_info;
-
-	pi_buffer_t *buffer = NULL;
-	pi_progress_t progress;
+	struct DBSizeInfo size_info;
 
-	pi_reset_errors(socket);
 	memset(&size_info, 0, sizeof(size_info));
 	memset(&dbi, 0, sizeof(dbi));
 
@@ -709,31 +1045,25 @@ pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
 			NULL, NULL, &dbi, &size_info)) < 0)
 	{
 		if (result != PI_ERR_DLP_UNSUPPORTED)
-			goto fail;
+			return result;
 		old_device = 1;
 	}
 
 	if ((result = dlp_OpenDB (socket, cardno, dlpOpenRead | dlpOpenSecret,
-			pf->info.name, &db)) < 0)
-		goto fail;
-
-	buffer = pi_buffer_new (DLP_BUF_SIZE);
-	if (buffer == NULL) {
-		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
-		goto fail;
-	}
+			pf->info.name, db)) < 0)
+		return result;
 
 	if (old_device) {
 		int num_records;
-		if ((result = dlp_ReadOpenDBInfo(socket, db, &num_records)) < 0)
-				goto fail;
+		if ((result = dlp_ReadOpenDBInfo(socket, *db, &num_records)) < 0)
+				return result;
 		size_info.numRecords = num_records;
 	}
 
-	memset(&progress, 0, sizeof(progress));
-	progress.type = PI_PROGRESS_RECEIVE_DB;
-	progress.data.db.pf = pf;
-	progress.data.db.size = size_info;
+	memset(progress, 0, sizeof(*progress));
+	progress->type = PI_PROGRESS_RECEIVE_DB;
+	progress->data.db.pf = pf;
+	progress->data.db.size = size_info;
 
 	if (size_info.appBlockSize
 		|| (dbi.miscFlags & dlpDBMiscFlagRamBased)
@@ -756,18 +1086,46 @@ pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
 		 * 3. Therefore, we only try to read the appInfo block if we are
 		 *    working on a RAM file or we are sure that a ROM file has appInfo.
 		 */
-		result = dlp_ReadAppBlock(socket, db, 0, DLP_BUF_SIZE, buffer);
+		result = dlp_ReadAppBlock(socket, *db, 0, DLP_BUF_SIZE, buffer);
 		if (result > 0) {
 			pi_file_set_app_info(pf, buffer->data, (size_t)result);
-			progress.transferred_bytes += result;
+			progress->transferred_bytes += result;
 			if (report_progress && report_progress(socket,
-					&progress) == PI_TRANSFER_STOP) {
-				result = PI_ERR_FILE_ABORTED;
-				goto fail;
-			}
+					progress) == PI_TRANSFER_STOP)
+				return PI_ERR_FILE_ABORTED;
 		}
 	}
 
+	return 0;
+}
+
+int
+pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
+	progress_func report_progress)
+{
+	int 	db = -1,
+		result;
+
+        unsigned int j;
+
+	struct DBSizeInfo size_info;
+
+	pi_buffer_t *buffer = NULL;
+	pi_progress_t progress;
+
+	pi_reset_errors(socket);
+
+	buffer = pi_buffer_new (DLP_BUF_SIZE);
+	if (buffer == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto fail;
+	}
+
+	if ((result = pi_file_retrieve_open(pf, socket, cardno, &db, buffer,
+			&progress, report_progress)) < 0)
+		goto fail;
+	size_info = progress.data.db.size;
+
 	if (pf->info.flags & dlpDBFlagResource) {
 		for (j = 0; j < size_info.numRecords; j++) {
 			int 	resource_id;
@@ -792,36 +1150,17 @@ pi_file_retrieve(pi_file_t *pf, int socket, int cardno,
 				goto fail;
 			}
 		}
-	} else for (j = 0; j < size_info.numRecords; j++) {
-		int 	attr,
-			category;
-		unsigned long resource_id;
-
-		if ((result = dlp_ReadRecordByIndex(socket, db, j, buffer, &resource_id, &attr,
-				&category)) < 0)
-			goto fail;
-
-		progress.transferred_bytes += buffer->used;
-		progress.data.db.transferred_records++;
+	} else {
+		struct pi_file_retrieve_ctx ctx;
 
-		if (report_progress
-			&& report_progress(socket,
-				&progress) == PI_TRANSFER_STOP) {
-			result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
-			goto fail;
-		}
+		ctx.pf = pf;
+		ctx.progress = &progress;
+		ctx.report_progress = report_progress;
 
-		/* There is no way to restore records with these
-		   attributes, so there is no use in backing them up
-		 */
-		if (attr &
-		    (dlpRecAttrArchived | dlpRecAttrDeleted))
-			continue;
-		if ((result = pi_file_append_record(pf, buffer->data, buffer->used,
-				attr, category, resource_id)) < 0) {
-			pi_set_error(socket, result);
+		if ((result = dlp_ReadRecordsByIndex(socket, db, 0,
+				(int)size_info.numRecords,
+				pi_file_retrieve_record, &ctx)) < 0)
 			goto fail;
-		}
 	}
 
 	pi_buffer_free(buffer);
@@ -849,6 +1188,252 @@ fail:
 	return result;
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_file_reset_entries
+ *
+ * Summary:     Drop every record appended to a file being written
+ *
+ * Parameters:  pi_file_t*
+ *
+ * Returns:     0 on success, PI_ERR_FILE_ERROR if the spilled data
+ *		could not be discarded
+ *
+ ***********************************************************************/
+static int
+pi_file_reset_entries(pi_file_t *pf)
+{
+	pf->num_entries = 0;
+
+	if (pf->index != NULL) {
+		free(pf->index);
+		pf->index = NULL;
+	}
+	pf->index_size = 0;
+	pf->index_used = 0;
+
+	if (fflush(pf->spill) != 0 || ftruncate(fileno(pf->spill), 0) < 0) {
+		pf->err = 1;
+		return PI_ERR_FILE_ERROR;
+	}
+	rewind(pf->spill);
+
+	return 0;
+}
+
+/* Number of unique IDs asked for in each ReadRecordIDList request */
+#define PI_FILE_ID_CHUNK	1024
+
+/***********************************************************************
+ *
+ * Function:    pi_file_retrieve_changes
+ *
+ * Summary:     Rebuild a record database from the older copy and the
+ *		records modified on the handheld since
+ *
+ * Parameters:  pi_file_t* being written, pi_file_t* of the older copy,
+ *		socket, open database handle, number of records, buffer,
+ *		progress structure, progress callback
+ *
+ * Returns:     number of records read from the handheld,
+ *		PI_ERR_FILE_INVALID if the older copy cannot be used,
+ *		another negative error code on failure
+ *
+ ***********************************************************************/
+static int
+pi_file_retrieve_changes(pi_file_t *pf, pi_file_t *old, int socket,
+	int db, int num_records, pi_buffer_t *buffer,
+	pi_progress_t *progress, progress_func report_progress)
+{
+	int 	i,
+		n,
+		result,
+		fetched = 0,
+		mod_index,
+		mod_attr,
+		mod_category,
+		attr,
+		category;
+	size_t	size;
+	void	*data;
+	recordid_t	*uids,
+			mod_uid;
+	pi_buffer_t *modified;
+
+	if (num_records == 0)
+		return 0;
+
+	uids = malloc(num_records * sizeof(recordid_t));
+	modified = pi_buffer_new(DLP_BUF_SIZE);
+	if (uids == NULL || modified == NULL) {
+		result = pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+		goto done;
+	}
+
+	/* The unique IDs of all records, in index order: this is what
+	   tells us which records went away and which ones are new */
+	for (i = 0; i < num_records; i += n) {
+		n = num_records - i;
+		if (n > PI_FILE_ID_CHUNK)
+			n = PI_FILE_ID_CHUNK;
+		if ((result = dlp_ReadRecordIDList(socket, db, 0, i, n,
+				uids + i, &n)) < 0)
+			goto done;
+		if (n <= 0) {
+			result = PI_ERR_FILE_INVALID;
+			goto done;
+		}
+	}
+
+	/* Modified records come back in index order, so they can be
+	   merged with the unchanged ones as we go */
+	if ((result = dlp_ResetDBIndex(socket, db)) < 0)
+		goto done;
+
+	mod_index = -1;
+	for (i = 0; i < num_records; i++) {
+		if (mod_index < i) {
+			result = dlp_ReadNextModifiedRec(socket, db, modified,
+				&mod_uid, &mod_index, &mod_attr, &mod_category);
+			if (result == PI_ERR_DLP_PALMOS
+			    && pi_palmos_error(socket) == dlpErrNotFound)
+				mod_index = num_records;
+			else if (result < 0)
+				goto done;
+			else if (mod_index < i || mod_index >= num_records
+				 || uids[mod_index] != mod_uid) {
+				result = PI_ERR_FILE_INVALID;
+				goto done;
+			}
+			if (mod_index < num_records) {
+				fetched++;
+				progress->transferred_bytes += modified->used;
+			}
+		}
+
+		if (mod_index == i) {
+			data 	= modified->data;
+			size 	= modified->used;
+			attr 	= mod_attr;
+			category = mod_category;
+		} else if (uids[i] != 0
+			   && pi_file_read_record_by_id(old, uids[i], &data,
+				&size, NULL, &attr, &category) >= 0) {
+			/* not modified since, so not dirty any more */
+			attr &= ~dlpRecAttrDirty;
+		} else {
+			/* the older copy does not have it and the handheld
+			   no longer flags it as modified */
+			if ((result = dlp_ReadRecordById(socket, db, uids[i],
+					buffer, NULL, &attr, &category)) < 0)
+				goto done;
+			data 	= buffer->data;
+			size 	= buffer->used;
+			fetched++;
+			progress->transferred_bytes += buffer->used;
+		}
+
+		progress->data.db.transferred_records++;
+		if (report_progress && report_progress(socket,
+				progress) == PI_TRANSFER_STOP) {
+			result = pi_set_error(socket, PI_ERR_FILE_ABORTED);
+			goto done;
+		}
+
+		/* as in pi_file_retrieve_record() */
+		if (attr & (dlpRecAttrArchived | dlpRecAttrDeleted))
+			continue;
+		if ((result = pi_file_append_record(pf, data, size, attr,
+				category, uids[i])) < 0) {
+			pi_set_error(socket, result);
+			goto done;
+		}
+	}
+	result = fetched;
+
+done:
+	if (modified != NULL)
+		pi_buffer_free(modified);
+	free(uids);
+	return result;
+}
+
+int
+pi_file_retrieve_update(pi_file_t *pf, pi_file_t *old, int socket,
+	int cardno, progress_func report_progress)
+{
+	int 	db = -1,
+		result,
+		num_records;
+
+	pi_buffer_t *buffer = NULL;
+	pi_progress_t progress;
+
+	/* Only record databases keep track of modified records, and only
+	   an older copy of the same database, not restored or replaced
+	   since, can supply the unchanged ones */
+	if (old == NULL || old->for_writing || !pf->for_writing
+	    || pf->resource_flag || old->resource_flag
+	    || old->info.type != pf->info.type
+	    || old->info.creator != pf->info.creator
+	    || old->info.createDate != pf->info.createDate
+	    || old->info.modnum > pf->info.modnum)
+		goto full;
+
+	pi_reset_errors(socket);
+
+	buffer = pi_buffer_new (DLP_BUF_SIZE);
+	if (buffer == NULL)
+		return pi_set_error(socket, PI_ERR_GENERIC_MEMORY);
+
+	if ((result = pi_file_retrieve_open(pf, socket, cardno, &db, buffer,
+			&progress, report_progress)) < 0
+	    || (result = dlp_ReadOpenDBInfo(socket, db, &num_records)) < 0)
+		goto fail;
+	progress.data.db.size.numRecords = num_records;
+
+	result = pi_file_retrieve_changes(pf, old, socket, db, num_records,
+		buffer, &progress, report_progress);
+	if (result == PI_ERR_FILE_INVALID) {
+		/* the handheld's view does not add up, start over */
+		if ((result = pi_file_reset_entries(pf)) < 0)
+			goto fail;
+		dlp_CloseDB(socket, db);
+		pi_buffer_free(buffer);
+		goto full;
+	}
+	if (result < 0)
+		goto fail;
+
+	pi_buffer_free(buffer);
+	num_records = result;
+	if ((result = dlp_CloseDB(socket, db)) < 0)
+		return result;
+	return num_records;
+
+fail:
+	if (db != -1 && pi_socket_connected(socket)) {
+		int err = pi_error(socket);
+		int palmoserr = pi_palmos_error(socket);
+
+		dlp_CloseDB(socket, db);
+
+		pi_set_error(socket, err);
+		pi_set_palmos_error(socket, palmoserr);
+	}
+	pi_buffer_free(buffer);
+
+	if (result >= 0)
+		result = pi_set_error(socket, PI_ERR_FILE_ERROR);
+	return result;
+
+full:
+	if ((result = pi_file_retrieve(pf, socket, cardno,
+			report_progress)) < 0)
+		return result;
+	return pf->num_entries;
+}
+
 int
 pi_file_install(pi_file_t *pf, int socket, int cardno,
 	progress_func report_progress)
@@ -1271,7 +1856,8 @@ static int
 pi_file_close_for_write(pi_file_t *pf)
 {
 	int 	i,
-		offset;
+		offset,
+		data_offset;
 	FILE 	*f;
 	
 	struct 	DBInfo *ip;
@@ -1330,6 +1916,7 @@ pi_file_close_for_write(pi_file_t *pf)
 	if (fwrite(buf, PI_HDR_SIZE, 1, f) != 1)
 		goto bad;
 
+	data_offset = offset;
 	for (i = 0, entp = pf->entries; i < pf->num_entries; i++, entp++) {
 		entp->offset = offset;
 
@@ -1364,7 +1951,8 @@ pi_file_close_for_write(pi_file_t *pf)
 		goto bad;
 
 
-	fwrite(pf->tmpbuf->data, pf->tmpbuf->used, 1, f);
+	if (pi_file_spill_copy(pf, f, (size_t) (offset - data_offset)) < 0)
+		goto bad;
 	fflush(f);
 
 	if (ferror(f) || feof(f))
@@ -1397,14 +1985,25 @@ void pi_file_free(pi_file_t *pf)
 	if (pf->f != 0)
 		fclose(pf->f);
 	
-	if (pf->app_info != NULL)
+	if (pf->app_info != NULL && !pi_file_in_map(pf, pf->app_info))
 		free(pf->app_info);
 	
-	if (pf->sort_info != NULL)
+	if (pf->sort_info != NULL && !pi_file_in_map(pf, pf->sort_info))
 		free(pf->sort_info);
+
+	if (pf->map != NULL) {
+#ifdef HAVE_MMAP
+		munmap(pf->map, pf->map_size);
+#else
+		free(pf->map);
+#endif
+	}
 	
 	if (pf->entries != NULL)
 		free(pf->entries);
+
+	if (pf->index != NULL)
+		free(pf->index);
 	
 	if (pf->file_name != NULL)
 		free(pf->file_name);
@@ -1412,8 +2011,8 @@ void pi_file_free(pi_file_t *pf)
 	if (pf->rbuf != NULL)
 		free(pf->rbuf);
 	
-	if (pf->tmpbuf != NULL)
-		pi_buffer_free(pf->tmpbuf);
+	if (pf->spill != NULL)
+		fclose(pf->spill);
 
 	/* in case caller forgets the struct has been freed... */
 	memset(pf, 0, sizeof(pi_file_t));
@@ -1506,18 +2105,239 @@ pi_file_find_resource_by_type_id(const pi_file_t *pf,
 				 unsigned long restype, int resid, int *resindex)
 {
 	int 	i;
-	struct 	pi_file_entry *entp;
 
 	if (!pf->resource_flag)
 		return PI_ERR_FILE_INVALID;
 
-	for (i = 0, entp = pf->entries; i < pf->num_entries; i++, entp++) {
-		if (entp->type == restype && entp->resource_id == resid) {
-			if (resindex)
-				*resindex = i;
-			return 1;
+	i = pi_file_index_find(pf, restype, (unsigned long) resid);
+	if (i < 0)
+		return 0;
+	if (resindex)
+		*resindex = i;
+	return 1;
+}
+
+/* The entry index is an open addressing hash table of entry number + 1
+   (0 marks a free bucket), keyed on the unique ID of records or on the
+   type and ID of resources. It is built by the first lookup and kept up
+   to date by the append functions, and is never more than half full. */
+
+static unsigned long
+pi_file_index_hash(unsigned long type, unsigned long id)
+{
+	unsigned long h;
+
+	h = (type * 0x9E3779B1UL) ^ id;
+	h ^= h >> 15;
+	h *= 0x85EBCA6BUL;
+	h ^= h >> 13;
+	return h;
+}
+
+static int
+pi_file_entry_matches(const pi_file_t *pf, const pi_file_entry_t *entp,
+	unsigned long type, unsigned long id)
+{
+	if (pf->resource_flag)
+		return entp->type == type
+			&& (unsigned long) entp->resource_id == id;
+	return entp->uid == id;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_index_insert
+ *
+ * Summary:     add entry I to the index, unless an earlier entry has the
+ *		same key
+ *
+ * Parameters:  file handle, entry index
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+pi_file_index_insert(pi_file_t *pf, int i)
+{
+	pi_file_entry_t entry,
+		other;
+	unsigned long type,
+		id,
+		mask = (unsigned long) pf->index_size - 1,
+		slot;
+
+	if (pi_file_entry_at(pf, i, &entry) < 0)
+		return;
+	type 	= pf->resource_flag ? entry.type : 0;
+	id 	= pf->resource_flag ? (unsigned long) entry.resource_id
+			: entry.uid;
+
+	for (slot = pi_file_index_hash(type, id) & mask;
+	     pf->index[slot] != 0; slot = (slot + 1) & mask) {
+		if (pi_file_entry_at(pf, pf->index[slot] - 1, &other) == 0
+		    && pi_file_entry_matches(pf, &other, type, id))
+			return;
+	}
+	pf->index[slot] = i + 1;
+	pf->index_used++;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_index_build
+ *
+ * Summary:     (re)build the entry index with room for twice the
+ *		current number of entries
+ *
+ * Parameters:  file handle
+ *
+ * Returns:     0, or PI_ERR_GENERIC_MEMORY
+ *
+ ***********************************************************************/
+static int
+pi_file_index_build(pi_file_t *pf)
+{
+	int 	i,
+		size = 64;
+
+	while (size < 4 * pf->num_entries)
+		size *= 2;
+
+	if (pf->index != NULL)
+		free(pf->index);
+	pf->index_used 	= 0;
+	pf->index_size 	= size;
+	pf->index 	= calloc((size_t) size, sizeof *pf->index);
+	if (pf->index == NULL)
+		return PI_ERR_GENERIC_MEMORY;
+
+	for (i = 0; i < pf->num_entries; i++)
+		pi_file_index_insert(pf, i);
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_index_find
+ *
+ * Summary:     find the first entry with a record unique ID (TYPE 0) or
+ *		a resource type and ID
+ *
+ * Parameters:  file handle, type, id
+ *
+ * Returns:     entry index, or -1 if there is none
+ *
+ ***********************************************************************/
+static int
+pi_file_index_find(const pi_file_t *cpf, unsigned long type,
+	unsigned long id)
+{
+	/* the index is a cache, building it leaves the file unchanged */
+	pi_file_t *pf = (pi_file_t *) cpf;
+	pi_file_entry_t entry;
+	unsigned long mask,
+		slot;
+	int 	i;
+
+	if (pf->index == NULL && pi_file_index_build(pf) < 0) {
+		for (i = 0; i < pf->num_entries; i++)
+			if (pi_file_entry_at(pf, i, &entry) == 0
+			    && pi_file_entry_matches(pf, &entry, type, id))
+				return i;
+		return -1;
+	}
+
+	mask = (unsigned long) pf->index_size - 1;
+	for (slot = pi_file_index_hash(type, id) & mask;
+	     pf->index[slot] != 0; slot = (slot + 1) & mask) {
+		i = pf->index[slot] - 1;
+		if (pi_file_entry_at(pf, i, &entry) == 0
+		    && pi_file_entry_matches(pf, &entry, type, id))
+			return i;
+	}
+	return -1;
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_index_add
+ *
+ * Summary:     index an entry just appended, if the index exists
+ *
+ * Parameters:  file handle, entry index
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+pi_file_index_add(pi_file_t *pf, int i)
+{
+	if (pf->index == NULL)
+		return;
+
+	if (2 * (pf->index_used + 1) > pf->index_size) {
+		if (pi_file_index_build(pf) < 0) {
+			free(pf->index);
+			pf->index = NULL;
 		}
+		return;
+	}
+	pi_file_index_insert(pf, i);
+}
+
+/***********************************************************************
+ *
+ * Function:    pi_file_entry_at
+ *
+ * Summary:     fetch a record or resource entry. Files opened with
+ *		pi_file_open_mapped() have no entries array, so the
+ *		entry is decoded from the mapped entry table instead.
+ *
+ * Parameters:  file handle, entry index, entry to fill in
+ *
+ * Returns:     0, or PI_ERR_FILE_ERROR if the entry is corrupt
+ *
+ ***********************************************************************/
+static int
+pi_file_entry_at(const pi_file_t *pf, int i, pi_file_entry_t *entp)
+{
+	unsigned char *p;
+	unsigned long offset,
+		end;
+
+	if (pf->map == NULL) {
+		*entp = pf->entries[i];
+		return 0;
+	}
+
+	p = (unsigned char *) pf->map + PI_HDR_SIZE + i * pf->ent_hdr_size;
+	memset(entp, 0, sizeof *entp);
+	if (pf->resource_flag) {
+		entp->type 	= get_long(p);
+		entp->resource_id = get_short(p + 4);
+		offset 		= get_long(p + 6);
+	} else {
+		offset 		= get_long(p);
+		entp->attrs 	= get_byte(p + 4);
+		entp->uid 	= get_treble(p + 5);
+	}
+
+	/* each block ends where the next one starts */
+	if (i + 1 < pf->num_entries)
+		end = get_long(p + pf->ent_hdr_size +
+			(pf->resource_flag ? 6 : 0));
+	else
+		end = pf->map_size;
+
+	if (offset > end || end > pf->map_size) {
+		LOG ((PI_DBG_API, PI_DBG_LVL_ERR,
+		     "FILE Entry %d corrupt (@%lX, next @%lX)\n",
+		     i, offset, end));
+		return PI_ERR_FILE_ERROR;
 	}
+
+	entp->offset 	= (int) offset;
+	entp->size 	= (int) (end - offset);
 	return 0;
 }
 
@@ -68,6 +68,7 @@ static int pi_serial_setsockopt(pi_socket_t *ps, int level,
 			int option_name, const void *option_value,
 			size_t *option_len);
 static int pi_serial_close(pi_socket_t *ps);
+static int pi_serial_pending(pi_socket_t *ps);
 
 extern int pi_socket_init(pi_socket_t *ps);
 
@@ -102,6 +103,7 @@ pi_serial_protocol_dup (pi_protocol_t *prot)
 		new_prot->flush		= prot->flush;
 		new_prot->getsockopt 	= prot->getsockopt;
 		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->writev 	= prot->writev;
 		new_prot->data 		= NULL;
 	}
 
@@ -162,6 +164,7 @@ pi_serial_protocol (pi_device_t *dev)
 		prot->flush		= data->impl.flush;
 		prot->getsockopt 	= pi_serial_getsockopt;
 		prot->setsockopt 	= pi_serial_setsockopt;
+		prot->writev 		= NULL;
 		prot->data 		= NULL;
 	}
 	
@@ -225,6 +228,8 @@ pi_serial_device (int type)
 	dev->accept 	= pi_serial_accept;
 	dev->connect 	= pi_serial_connect;
 	dev->close 	= pi_serial_close;
+	dev->dup 	= NULL;
+	dev->pending 	= pi_serial_pending;
 
 	switch (type) {
 		case PI_SERIAL_DEV:
@@ -235,6 +240,7 @@ pi_serial_device (int type)
 			break;
 	}
 	
+	data->buf_start 	= 0;
 	data->buf_size 		= 0;
 	data->rate 		= -1;
 	data->establishrate 	= -1;
@@ -709,6 +715,27 @@ static int pi_serial_close(pi_socket_t *ps)
 	return 0;
 }
 
+
+/***********************************************************************
+ *
+ * Function:    pi_serial_pending
+ *
+ * Summary:     Bytes waiting in the read-ahead ring, which the port
+ *		will not report as readable again
+ *
+ * Parameters:  pi_socket*
+ *
+ * Returns:     number of bytes
+ *
+ ***********************************************************************/
+static int pi_serial_pending(pi_socket_t *ps)
+{
+	struct pi_serial_data *data =
+		(struct pi_serial_data *)ps->device->data;
+
+	return (int) data->buf_size;
+}
+
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
 /* ex: set tabstop=4 expandtab: */
 /* Local Variables: */
@@ -82,6 +82,7 @@ slp_protocol_dup (pi_protocol_t *prot)
 		new_prot->flush = prot->flush;
 		new_prot->getsockopt = prot->getsockopt;
 		new_prot->setsockopt = prot->setsockopt;
+		new_prot->writev = prot->writev;
 
 		data = (struct pi_slp_data *)prot->data;
 	
@@ -93,6 +94,8 @@ slp_protocol_dup (pi_protocol_t *prot)
 		new_data->last_type = data->last_type;
 		new_data->txid 	= data->txid;
 		new_data->last_txid = data->last_txid;
+		new_data->tx_buf = NULL;
+		new_data->rx_buf = NULL;
 
 		new_prot->data 	= new_data;
 
@@ -123,8 +126,15 @@ static void
 slp_protocol_free (pi_protocol_t *prot)
 {
 	if (prot != NULL) {
-		if (prot->data != NULL)
+		if (prot->data != NULL) {
+			struct pi_slp_data *data = (struct pi_slp_data *)prot->data;
+
+			if (data->tx_buf != NULL)
+				free(data->tx_buf);
+			if (data->rx_buf != NULL)
+				pi_buffer_free(data->rx_buf);
 			free(prot->data);
+		}
 		free(prot);
 	}
 }
@@ -159,6 +169,7 @@ slp_protocol (void)
 		prot->flush = slp_flush;
 		prot->getsockopt = slp_getsockopt;
 		prot->setsockopt = slp_setsockopt;
+		prot->writev = NULL;
 
 		data->dest = PI_SLP_SOCK_DLP;
 		data->last_dest	= -1;	
@@ -168,6 +179,8 @@ slp_protocol (void)
 		data->last_type	= -1;
 		data->txid = 0xfe;
 		data->last_txid	= 0xff;
+		data->tx_buf = NULL;
+		data->rx_buf = NULL;
 		prot->data = data;
 
 	} else if (prot != NULL) {
@@ -205,17 +218,19 @@ slp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 	unsigned int	i,
 			n;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = protocol_queue_find(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_slp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SLP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_SLP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	slp_buf = (unsigned char *) malloc (PI_SLP_HEADER_LEN +
-		PI_SLP_MTU + PI_SLP_FOOTER_LEN);
+	if (data->tx_buf == NULL)
+		data->tx_buf = (unsigned char *) malloc (PI_SLP_HEADER_LEN +
+			PI_SLP_MTU + PI_SLP_FOOTER_LEN);
+	slp_buf = data->tx_buf;
 	if (slp_buf == NULL)
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 
@@ -250,8 +265,6 @@ slp_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 		CHECK(PI_DBG_SLP, PI_DBG_LVL_INFO, slp_dump_header(slp_buf, 1));
 		CHECK(PI_DBG_SLP, PI_DBG_LVL_DEBUG, slp_dump(slp_buf));
 	}
-	
-	free (slp_buf);
 
 	return bytes;
 }
@@ -280,15 +293,12 @@ slp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	int 	i,
 		computed_crc,
 		received_crc,
-		b1, 
-		b2, 
-		b3,	
-		state,
-		expect 		= 0,
 		packet_len,
 		bytes;
+	size_t	frame_len;
 	unsigned char
-		header_checksum;
+		header_checksum,
+		*sig;
 	pi_protocol_t	*prot,
 			*next;
 	pi_buffer_t *slp_buf;
@@ -297,133 +307,120 @@ slp_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	LOG((PI_DBG_SLP, PI_DBG_LVL_DEBUG, "SLP RX len=%d flags=0x%04x\n",
 		len, flags));
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = protocol_queue_find(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (struct pi_slp_data *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SLP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_SLP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	slp_buf = pi_buffer_new (PI_SLP_HEADER_LEN + PI_SLP_MTU + PI_SLP_FOOTER_LEN);
+	if (data->rx_buf == NULL)
+		data->rx_buf = pi_buffer_new (PI_SLP_HEADER_LEN + PI_SLP_MTU + PI_SLP_FOOTER_LEN);
+	slp_buf = data->rx_buf;
 	if (slp_buf == NULL) {
 		errno = ENOMEM;
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 	}
+	pi_buffer_clear (slp_buf);
 
-	state 		= 0;
-	packet_len	= 0;
-
+	/* The device reads ahead into its own buffer, so asking for a
+	   whole header or a whole body at once costs a copy rather than
+	   a system call, and one read from the port can hold several
+	   frames. Nothing past the end of the frame is requested. */
+	frame_len = PI_SLP_HEADER_LEN;
 	for (;;) {
-		switch (state) {		
-		case 0:
-			expect = 3;
-			state++;
-			break;
-
-		case 1:
-			b1 = slp_buf->data[PI_SLP_OFFSET_SIG1];
-			b2 = slp_buf->data[PI_SLP_OFFSET_SIG2];
-			b3 = slp_buf->data[PI_SLP_OFFSET_SIG3];
-			if (b1 == PI_SLP_SIG_BYTE1 &&
-			    b2 == PI_SLP_SIG_BYTE2 &&
-			    b3 == PI_SLP_SIG_BYTE3) {
-				state++;
-				expect = PI_SLP_HEADER_LEN - 3;
-			} else {
-				slp_buf->data[PI_SLP_OFFSET_SIG1] = slp_buf->data[PI_SLP_OFFSET_SIG2];
-				slp_buf->data[PI_SLP_OFFSET_SIG2] = slp_buf->data[PI_SLP_OFFSET_SIG3];
-				expect = 1;
-				slp_buf->used = 2;
-				LOG((PI_DBG_SLP, PI_DBG_LVL_WARN,
-					"SLP RX Unexpected signature"
-					" 0x%.2x 0x%.2x 0x%.2x\n",
-					b1, b2, b3));
+		while (slp_buf->used < frame_len) {
+			bytes = next->read(ps, slp_buf,
+				frame_len - slp_buf->used, flags);
+			if (bytes < 0) {
+				LOG((PI_DBG_SLP, PI_DBG_LVL_ERR,
+				    "SLP RX Read Error %d\n",
+				    bytes));
+				return bytes;
 			}
+		}
+
+		if (frame_len > PI_SLP_HEADER_LEN)
 			break;
 
-		case 2:
-			/* Addition check sum for header */
-			for (header_checksum = i = 0; i < 9; i++)
-				header_checksum += slp_buf->data[i];
-
-			/* read in the whole SLP header. */
-			if (header_checksum == slp_buf->data[PI_SLP_OFFSET_SUM]) {
-				state++;
-				packet_len = get_short(&slp_buf->data[PI_SLP_OFFSET_SIZE]);
-				if (packet_len > (int)len) {
-					LOG((PI_DBG_SLP, PI_DBG_LVL_ERR,
-						"SLP RX Packet size exceed buffer\n"));
-					pi_buffer_free (slp_buf);
-					return pi_set_error(ps->sd, PI_ERR_PROT_BADPACKET);
-				}
-				expect = packet_len;
+		if (slp_buf->data[PI_SLP_OFFSET_SIG1] != PI_SLP_SIG_BYTE1 ||
+		    slp_buf->data[PI_SLP_OFFSET_SIG2] != PI_SLP_SIG_BYTE2 ||
+		    slp_buf->data[PI_SLP_OFFSET_SIG3] != PI_SLP_SIG_BYTE3) {
+			LOG((PI_DBG_SLP, PI_DBG_LVL_WARN,
+				"SLP RX Unexpected signature"
+				" 0x%.2x 0x%.2x 0x%.2x\n",
+				slp_buf->data[PI_SLP_OFFSET_SIG1],
+				slp_buf->data[PI_SLP_OFFSET_SIG2],
+				slp_buf->data[PI_SLP_OFFSET_SIG3]));
+
+			/* resync on the next possible start of a frame
+			   among the bytes already read */
+			sig = memchr(slp_buf->data + 1, PI_SLP_SIG_BYTE1,
+				slp_buf->used - 1);
+			if (sig == NULL) {
+				slp_buf->used = 0;
 			} else {
-				LOG((PI_DBG_SLP, PI_DBG_LVL_WARN,
-					"SLP RX Header checksum failed for header:\n"));
-				pi_dumpdata((const char *)slp_buf->data, PI_SLP_HEADER_LEN);
-				pi_buffer_free (slp_buf);
-				return 0;
+				slp_buf->used -= sig - slp_buf->data;
+				memmove(slp_buf->data, sig, slp_buf->used);
 			}
-			break;
+			continue;
+		}
 
-		case 3:
-			state++;
-			expect = PI_SLP_FOOTER_LEN;
-			break;
+		/* Addition check sum for header */
+		for (header_checksum = i = 0; i < 9; i++)
+			header_checksum += slp_buf->data[i];
 
-		case 4:
-			/* that should be the whole packet. */
-			computed_crc = crc16(slp_buf->data, PI_SLP_HEADER_LEN + packet_len);
-			received_crc = get_short(&slp_buf->data[PI_SLP_HEADER_LEN + packet_len]);
-			if (get_byte(&slp_buf->data[PI_SLP_OFFSET_TYPE]) == PI_SLP_TYPE_LOOP) {
-				/* Adjust because every tenth loopback
-				 * packet has a bogus check sum */
-				if (computed_crc != received_crc)
-					computed_crc |= 0x00e0;
-			}
-			if (computed_crc != received_crc) {
-				LOG((PI_DBG_SLP, PI_DBG_LVL_ERR,
-				    "SLP RX packet crc failed: "
-				    "computed=0x%.4x received=0x%.4x\n",
-				    computed_crc, received_crc));
-				pi_buffer_free (slp_buf);
-				return 0;
-			}
-			
-			/* Track the info so getsockopt will work */
-			data->last_dest = get_byte(&slp_buf->data[PI_SLP_OFFSET_DEST]);
-			data->last_src 	= get_byte(&slp_buf->data[PI_SLP_OFFSET_SRC]);
-			data->last_type = get_byte(&slp_buf->data[PI_SLP_OFFSET_TYPE]);
-			data->last_txid = get_byte(&slp_buf->data[PI_SLP_OFFSET_TXID]);
-
-			CHECK(PI_DBG_SLP, PI_DBG_LVL_INFO, slp_dump_header(slp_buf->data, 0));
-			CHECK(PI_DBG_SLP, PI_DBG_LVL_DEBUG, slp_dump(slp_buf->data));
-
-			if (pi_buffer_append (buf, &slp_buf->data[PI_SLP_HEADER_LEN], packet_len) == NULL) {
-				errno = ENOMEM;
-				return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
-			}
-			pi_buffer_free (slp_buf);
-			return packet_len;
+		if (header_checksum != slp_buf->data[PI_SLP_OFFSET_SUM]) {
+			LOG((PI_DBG_SLP, PI_DBG_LVL_WARN,
+				"SLP RX Header checksum failed for header:\n"));
+			pi_dumpdata((const char *)slp_buf->data, PI_SLP_HEADER_LEN);
+			return 0;
+		}
 
-		default:
-			break;
+		packet_len = get_short(&slp_buf->data[PI_SLP_OFFSET_SIZE]);
+		if (packet_len > (int)len) {
+			LOG((PI_DBG_SLP, PI_DBG_LVL_ERR,
+				"SLP RX Packet size exceed buffer\n"));
+			return pi_set_error(ps->sd, PI_ERR_PROT_BADPACKET);
 		}
-		
-		do {
-			bytes = next->read(ps, slp_buf, (size_t)expect, flags);
-			if (bytes < 0) {
-				LOG((PI_DBG_SLP, PI_DBG_LVL_ERR,
-				    "SLP RX Read Error %d\n",
-				    bytes));
-				pi_buffer_free (slp_buf);
-				return bytes;
-			}
-			expect -= bytes;
-		} while (expect > 0);
+
+		/* body and CRC in one go */
+		frame_len = PI_SLP_HEADER_LEN + packet_len + PI_SLP_FOOTER_LEN;
+	}
+
+	/* that should be the whole packet. */
+	computed_crc = crc16(slp_buf->data, PI_SLP_HEADER_LEN + packet_len);
+	received_crc = get_short(&slp_buf->data[PI_SLP_HEADER_LEN + packet_len]);
+	if (get_byte(&slp_buf->data[PI_SLP_OFFSET_TYPE]) == PI_SLP_TYPE_LOOP) {
+		/* Adjust because every tenth loopback
+		 * packet has a bogus check sum */
+		if (computed_crc != received_crc)
+			computed_crc |= 0x00e0;
+	}
+	if (computed_crc != received_crc) {
+		LOG((PI_DBG_SLP, PI_DBG_LVL_ERR,
+		    "SLP RX packet crc failed: "
+		    "computed=0x%.4x received=0x%.4x\n",
+		    computed_crc, received_crc));
+		return 0;
+	}
+	
+	/* Track the info so getsockopt will work */
+	data->last_dest = get_byte(&slp_buf->data[PI_SLP_OFFSET_DEST]);
+	data->last_src 	= get_byte(&slp_buf->data[PI_SLP_OFFSET_SRC]);
+	data->last_type = get_byte(&slp_buf->data[PI_SLP_OFFSET_TYPE]);
+	data->last_txid = get_byte(&slp_buf->data[PI_SLP_OFFSET_TXID]);
+
+	CHECK(PI_DBG_SLP, PI_DBG_LVL_INFO, slp_dump_header(slp_buf->data, 0));
+	CHECK(PI_DBG_SLP, PI_DBG_LVL_DEBUG, slp_dump(slp_buf->data));
+
+	if (pi_buffer_append (buf, &slp_buf->data[PI_SLP_HEADER_LEN], packet_len) == NULL) {
+		errno = ENOMEM;
+		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 	}
+	return packet_len;
 }
 
 /***********************************************************************
@@ -443,11 +440,11 @@ slp_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = protocol_queue_find(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SLP);
+	next = protocol_queue_find_next(ps, PI_LEVEL_SLP);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -472,7 +469,7 @@ slp_getsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	struct 	pi_slp_data *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = protocol_queue_find(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -562,7 +559,7 @@ slp_setsockopt(pi_socket_t *ps, int level, int option_name,
 	pi_protocol_t *prot;
 	struct 	pi_slp_data *data;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SLP);
+	prot = protocol_queue_find(ps, PI_LEVEL_SLP);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 	data = (struct pi_slp_data *)prot->data;
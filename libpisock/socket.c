@@ -62,17 +62,14 @@
 /* Declare function prototypes */
 static pi_socket_list_t *ps_list_append (pi_socket_list_t *list,
 	pi_socket_t *ps);
-static pi_socket_t *ps_list_find (pi_socket_list_t *list,
-	int pi_sd);
-static pi_socket_list_t *ps_list_remove (pi_socket_list_t *list,
-	int pi_sd);
-static pi_socket_list_t *ps_list_copy (pi_socket_list_t *list);
 static void ps_list_free (pi_socket_list_t *list);
 
+static int ps_table_set (int pi_sd, pi_socket_t *ps);
+
 static void protocol_queue_add (pi_socket_t *ps, pi_protocol_t *prot);
 static void protocol_cmd_queue_add (pi_socket_t *ps, pi_protocol_t *prot);
-static pi_protocol_t *protocol_queue_find (pi_socket_t *ps, int level);
-static pi_protocol_t *protocol_queue_find_next (pi_socket_t *ps, int level);
+static void protocol_queue_link (pi_protocol_t **queue, int len,
+	pi_protocol_t **levels);
 
 int pi_socket_init(pi_socket_t *ps);
 
@@ -80,14 +77,28 @@ static int is_connected (pi_socket_t *ps);
 static int is_listener (pi_socket_t *ps);
 
 /* GLOBALS */
-static PI_MUTEX_DEFINE(psl_mutex);
-static pi_socket_list_t *psl = NULL;
 
-static PI_MUTEX_DEFINE(watch_list_mutex);
-static pi_socket_list_t *watch_list = NULL;
+/* Open sockets, indexed by socket descriptor. find_pi_socket() reads the
+   table without locking: writers hold psl_mutex, fill a slot or a grown
+   copy of the table completely before publishing it, and never free a
+   table that a reader could still be looking at. */
+typedef struct pi_socket_table
+{
+	int size;
+	struct pi_socket_table *prev;	/* smaller table this one replaced */
+	pi_socket_t * volatile slot[1];
+} pi_socket_table_t;
 
-/* Automated tickling interval */
-static unsigned int interval = 0;
+#define PS_TABLE_MIN_SIZE	64
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define ps_table_barrier()	__sync_synchronize()
+#else
+#define ps_table_barrier()
+#endif
+
+static PI_MUTEX_DEFINE(psl_mutex);
+static pi_socket_table_t * volatile ps_table = NULL;
 
 /* Indicates that the exit function has already been installed. Made non-static
  * so that library users can choose to not have an exit function installed */
@@ -156,105 +167,6 @@ ps_list_append (pi_socket_list_t *list, pi_socket_t *ps)
 }
 
 
-/***********************************************************************
- *
- * Function:    ps_list_find
- *
- * Summary:     traverse a (possibly empty) pi_socket_list and find
- *		the first list element whose pi_socket_t* member points
- *		to a pi_socket matching the given socket descriptor
- *
- * Parameters:	pi_socket_list_t *, socket descriptor
- *
- * Returns:     pi_socket_t *, or NULL if no match
- *
- * NOTE:	ps_list_find returns a pointer which points directly to
- *		the socket (pi_socket_t *) whereas ps_find_elem returns a
- *		pointer to the list element (pi_socket_list_t *) which
- *		_contains_ a pointer to the socket
- *
- ***********************************************************************/
-static pi_socket_t *
-ps_list_find (pi_socket_list_t *list, int pi_sd) 
-{
-	pi_socket_list_t *elem;
-	
-	for (elem = list; elem != NULL; elem = elem->next)
-		if (elem->ps != NULL && elem->ps->sd == pi_sd)
-			return elem->ps;
-
-	return NULL;
-}
-
-
-/***********************************************************************
- *
- * Function:    ps_list_remove
- *
- * Summary:     remove first pi_socket_list element pointing to a pi_socket
- *		member matching socket descriptor
- *
- * Parameters:	pi_socket_list_t *, socket descriptor
- *
- * Returns:     the (possibly NULL) head pi_socket_list_t *
- *
- * NOTE:	only the pi_socket_list element is freed,
- *		_not_ the pi_socket.  Consequently, this function
- *		makes the (risky) assumption that the pi_socket will
- *		be freed elsewhere.
- *
- ***********************************************************************/
-static pi_socket_list_t *
-ps_list_remove (pi_socket_list_t *list, int pi_sd)
-{
-	pi_socket_list_t *elem,
-		*new_list = list,
-		*prev_elem = NULL;
-
-	for (elem = list; elem != NULL; elem = elem->next) {
-		if (elem->ps == NULL)
-			continue;
-		else if (elem->ps->sd == pi_sd) {
-			if (prev_elem == NULL)
-				new_list = elem->next;
-			else
-				prev_elem->next = elem->next;
-			free(elem);
-			break;
-		}
-		prev_elem = elem;
-	}
-
-	return new_list;
-}
-
-
-/***********************************************************************
- *
- * Function:    ps_list_copy
- *
- * Summary:     copy pi_socket_list
- *
- * Parameters:	pi_socket_list_t *
- *
- * Returns:     pi_socket_list_t* (new list head)
- *
- * NOTE:	pi_list_copy does _not_ copy the pi_socket member, it
- *		copies only the list elements
- *
- ***********************************************************************/
-static pi_socket_list_t *
-ps_list_copy (pi_socket_list_t *list)
-{
-	pi_socket_list_t *l, *new_list = NULL;
-
-	for (l = list; l != NULL; l = l->next)
-		new_list = ps_list_append (new_list, l->ps);
-
-	return new_list;
-}
-
-
 /***********************************************************************
  *
  * Function:    ps_list_free
@@ -287,6 +199,65 @@ ps_list_free (pi_socket_list_t *list)
 	} while (l != NULL);
 }
 
+/* Socket Table */
+/***********************************************************************
+ *
+ * Function:    ps_table_set
+ *
+ * Summary:     stores a pi_socket in the socket table slot of a socket
+ *		descriptor (or clears it when ps is NULL), growing the
+ *		table as needed. Caller must hold psl_mutex.
+ *
+ * Parameters:	socket descriptor, pi_socket_t* or NULL
+ *
+ * Returns:     0 for success, -1 if out of memory
+ *
+ * NOTE:	tables that have been replaced are kept around because
+ *		a reader may still be using them. Since the table doubles
+ *		each time, they never add up to more than the live table.
+ *
+ ***********************************************************************/
+static int
+ps_table_set (int pi_sd, pi_socket_t *ps)
+{
+	pi_socket_table_t *table = ps_table,
+		*grown;
+	int 	size,
+		i;
+
+	if (pi_sd < 0)
+		return -1;
+
+	if (table == NULL || pi_sd >= table->size) {
+		if (ps == NULL)
+			return 0;
+
+		size = table ? table->size * 2 : PS_TABLE_MIN_SIZE;
+		while (size <= pi_sd)
+			size *= 2;
+
+		grown = calloc(1, sizeof(pi_socket_table_t)
+			+ (size - 1) * sizeof(pi_socket_t *));
+		if (grown == NULL)
+			return -1;
+
+		grown->size = size;
+		grown->prev = table;
+		if (table != NULL)
+			for (i = 0; i < table->size; i++)
+				grown->slot[i] = table->slot[i];
+
+		ps_table_barrier();
+		ps_table = table = grown;
+	}
+
+	ps_table_barrier();
+	table->slot[pi_sd] = ps;
+
+	return 0;
+}
+
+
 /* Protocol Queue */
 /***********************************************************************
  *
@@ -340,35 +311,57 @@ protocol_cmd_queue_add (pi_socket_t *ps, pi_protocol_t *prot)
 }
 
 
+/***********************************************************************
+ *
+ * Function:    protocol_queue_link
+ *
+ * Summary:     links each entry of a protocol queue to its neighbours
+ *		and indexes the entries by level
+ *
+ * Parameters:	protocol queue, queue length, level index
+ *
+ * Returns:     void
+ *
+ ***********************************************************************/
+static void
+protocol_queue_link (pi_protocol_t **queue, int len, pi_protocol_t **levels)
+{
+	int 	i;
+
+	memset(levels, 0, sizeof(pi_protocol_t *) * (PI_LEVEL_SOCK + 1));
+
+	for (i = 0; i < len; i++) {
+		queue[i]->prev = i > 0 ? queue[i - 1] : NULL;
+		queue[i]->next = i < len - 1 ? queue[i + 1] : NULL;
+
+		/* protocol_queue_find() used to return the first match */
+		if (queue[i]->level >= 0 && queue[i]->level <= PI_LEVEL_SOCK
+		    && levels[queue[i]->level] == NULL)
+			levels[queue[i]->level] = queue[i];
+	}
+}
+
+
 /***********************************************************************
  *
  * Function:    protocol_queue_find
  *
- * Summary:     find queue entry
+ * Summary:     find queue entry. Protocol layers call this directly
+ *		with the socket they were handed instead of going through
+ *		pi_protocol().
  *
  * Parameters:	pi_socket_t*, level
  *
  * Returns:     pi_protocol*, or NULL if queue entry not found
  *
  ***********************************************************************/
-static pi_protocol_t*
+pi_protocol_t*
 protocol_queue_find (pi_socket_t *ps, int level)
 {
-	int 	i;
-
-	if (ps->command) {
-		for (i = 0; i < ps->cmd_len; i++) {
-			if (ps->cmd_queue[i]->level == level)
-				return ps->cmd_queue[i];
-		}
-	} else {
-		for (i = 0; i < ps->queue_len; i++) {
-			if (ps->protocol_queue[i]->level == level)
-				return ps->protocol_queue[i];
-		}
-	}
+	if (level < 0 || level > PI_LEVEL_SOCK)
+		return NULL;
 
-	return NULL;
+	return ps->command ? ps->cmd_level[level] : ps->queue_level[level];
 }
 
 
@@ -383,10 +376,10 @@ protocol_queue_find (pi_socket_t *ps, int level)
  * Returns:     pi_protocol_t* or NULL if next queue entry not found
  *
  ***********************************************************************/
-static pi_protocol_t*
+pi_protocol_t*
 protocol_queue_find_next (pi_socket_t *ps, int level)
 {
-	int 	i;
+	pi_protocol_t *prot;
 
 	if (ps->command && ps->cmd_len == 0)
 		return NULL;
@@ -400,19 +393,9 @@ protocol_queue_find_next (pi_socket_t *ps, int level)
 	if (!ps->command && level == 0)
 		return ps->protocol_queue[0];
 
-	if (ps->command) {
-		for (i = 0; i < ps->cmd_len - 1; i++) {
-			if (ps->cmd_queue[i]->level == level)
-				return ps->cmd_queue[i + 1];
-		}
-	} else {
-		for (i = 0; i < ps->queue_len - 1; i++) {
-			if (ps->protocol_queue[i]->level == level)
-				return ps->protocol_queue[i + 1];
-		}
-	}
+	prot = protocol_queue_find (ps, level);
 
-	return NULL;
+	return prot ? prot->next : NULL;
 }
 
 
@@ -447,6 +430,10 @@ protocol_queue_build (pi_socket_t *ps, int autodetect)
 		LOG((PI_DBG_SOCK,PI_DBG_LVL_DEBUG, "RAW mode, no protocol\n",ps->sd,autodetect));
 		protocol_queue_add (ps, dev_prot);
 		protocol_cmd_queue_add (ps, dev_cmd_prot);
+		protocol_queue_link (ps->protocol_queue, ps->queue_len,
+			ps->queue_level);
+		protocol_queue_link (ps->cmd_queue, ps->cmd_len,
+			ps->cmd_level);
 		return;
 	}
 
@@ -614,6 +601,10 @@ protocol_queue_build (pi_socket_t *ps, int autodetect)
 
 	protocol_queue_add (ps, dev_prot);
   	protocol_cmd_queue_add (ps, dev_cmd_prot);
+
+	protocol_queue_link (ps->protocol_queue, ps->queue_len,
+		ps->queue_level);
+	protocol_queue_link (ps->cmd_queue, ps->cmd_len, ps->cmd_level);
 }
 
 
@@ -641,6 +632,9 @@ protocol_queue_destroy (pi_socket_t *ps)
 		free(ps->protocol_queue);
 	if (ps->cmd_len > 0)
 		free(ps->cmd_queue);
+
+	memset(ps->queue_level, 0, sizeof(ps->queue_level));
+	memset(ps->cmd_level, 0, sizeof(ps->cmd_level));
 }
 
 
@@ -813,37 +807,6 @@ is_listener (pi_socket_t *ps)
 	return (ps->state == PI_SOCK_LISTEN) ? 1 : 0;
 }
 
-/* Alarm Handling Code */
-static RETSIGTYPE
-onalarm(int signo)
-{
-	pi_socket_list_t *l;
-
-	signal(signo, onalarm);
-
-	pi_mutex_lock(&watch_list_mutex);
-
-	for (l = watch_list; l != NULL; l = l->next) {
-		pi_socket_t *ps = l->ps;
-
-		if (!is_connected(ps))
-			continue;
-
-		if (pi_tickle(ps->sd) < 0) {
-			LOG((PI_DBG_SOCK, PI_DBG_LVL_INFO,
-				"SOCKET Socket %d is busy during tickle\n",
-				ps->sd));
-			alarm(1);
-		} else {
-			LOG((PI_DBG_SOCK, PI_DBG_LVL_INFO,
-			    "SOCKET Tickling socket %d\n", ps->sd));
-			alarm(interval);
-		}
-	}
-
-	pi_mutex_unlock(&watch_list_mutex);
-}
-
 /* Exit Handling Code */
 /***********************************************************************
  *
@@ -861,10 +824,15 @@ static void
 onexit(void)
 {
 	pi_socket_list_t *l,
-			 *list;
+			 *list = NULL;
+	pi_socket_table_t *table;
+	int	i;
 
 	pi_mutex_lock(&psl_mutex);
-	list = ps_list_copy (psl);
+	table = ps_table;
+	for (i = 0; table != NULL && i < table->size; i++)
+		if (table->slot[i] != NULL)
+			list = ps_list_append (list, table->slot[i]);
 	pi_mutex_unlock(&psl_mutex);
 
 	for (l = list; l != NULL; l = l->next)
@@ -898,8 +866,6 @@ int
 pi_socket(int domain, int type, int protocol)
 {
 	pi_socket_t *ps;
-	pi_socket_list_t *list;
-
 	env_dbgcheck ();
 
 	if (protocol == 0) {
@@ -931,10 +897,10 @@ pi_socket(int domain, int type, int protocol)
 	ps->state       = PI_SOCK_CLOSE;
 	ps->honor_rx_to	= 1;
 	ps->command 	= 1;
+	ps->dlp_pipeline = 1;
 
-	/* post the new socket to the list */
-	list = pi_socket_recognize(ps);
-	if (list == NULL) {
+	/* post the new socket to the table */
+	if (pi_socket_recognize(ps) < 0) {
 		close (ps->sd);
 		free(ps);
 		errno = ENOMEM;
@@ -948,6 +914,8 @@ pi_socket(int domain, int type, int protocol)
 int
 pi_socket_setsd(pi_socket_t *ps, int pi_sd)
 {
+	int	old_sd = ps->sd;
+
 #ifdef HAVE_DUP2
 	ps->sd = dup2(pi_sd, ps->sd);
 #else
@@ -958,6 +926,19 @@ pi_socket_setsd(pi_socket_t *ps, int pi_sd)
 		ps->sd = dup(pi_sd);
 	#endif
 #endif
+	if (ps->sd != old_sd) {
+		/* the socket table is indexed by descriptor */
+		pi_mutex_lock(&psl_mutex);
+		ps_table_set (old_sd, NULL);
+		if (ps->sd != -1 && ps_table_set (ps->sd, ps) < 0) {
+			pi_mutex_unlock(&psl_mutex);
+			close(ps->sd);
+			ps->sd = -1;
+			errno = ENOMEM;
+			return -1;
+		}
+		pi_mutex_unlock(&psl_mutex);
+	}
     if (ps->sd == -1)
         return pi_set_error(ps->sd, PI_ERR_GENERIC_SYSTEM);
     if (ps->sd != pi_sd)
@@ -989,20 +970,22 @@ pi_socket_init(pi_socket_t *ps)
  *
  * Function:    pi_socket_recognize
  *
- * Summary:     appends the pi_socket to global list
+ * Summary:     adds the pi_socket to the global socket table
  *
  * Parameters:  pi_socket*
  *
- * Returns:     pi_socket_list_t *
+ * Returns:     0 for success, -1 if out of memory
  *
  ***********************************************************************/
-pi_socket_list_t *
+int
 pi_socket_recognize(pi_socket_t *ps)
 {
+	int	result;
+
 	pi_mutex_lock(&psl_mutex);
-	psl = ps_list_append(psl, ps);
+	result = ps_table_set (ps->sd, ps);
 	pi_mutex_unlock(&psl_mutex);
-	return psl;
+	return result;
 }
 
 /***********************************************************************
@@ -1147,6 +1130,73 @@ pi_accept_to(int pi_sd, struct sockaddr *addr, size_t *addrlen, int timeout)
 	return result;
 }
 
+/***********************************************************************
+ *
+ * Function:    pi_accept_new
+ *
+ * Summary:     accept a connection on a new socket, leaving the
+ *		listening socket open
+ *
+ * Parameters:  listening socket descriptor, remote address and length
+ *
+ * Returns:     the new socket descriptor, or negative on error
+ *
+ ***********************************************************************/
+int
+pi_accept_new(int pi_sd, struct sockaddr *addr, size_t *addrlen)
+{
+	int	new_sd,
+		sd,
+		result;
+	pi_socket_t *ps,
+		*new_ps;
+
+	if (!(ps = find_pi_socket(pi_sd))) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
+	}
+
+	if (!is_listener (ps))
+		return PI_ERR_SOCK_LISTENER;
+
+	/* serial, USB and Bluetooth ports carry a single connection */
+	if (ps->device->dup == NULL) {
+		errno = EOPNOTSUPP;
+		return pi_set_error(pi_sd, PI_ERR_SOCK_LISTENER);
+	}
+
+	new_sd = pi_socket(PI_AF_PILOT, ps->type, ps->protocol);
+	if (new_sd < 0)
+		return pi_set_error(pi_sd, PI_ERR_GENERIC_MEMORY);
+	new_ps = find_pi_socket(new_sd);
+
+	new_ps->device = ps->device->dup(ps->device);
+	if (new_ps->device == NULL) {
+		pi_close(new_sd);
+		return pi_set_error(pi_sd, PI_ERR_GENERIC_MEMORY);
+	}
+
+	/* The new socket accepts on a duplicate of the listening
+	   descriptor, which the device then replaces with the
+	   connection. The listener itself is never touched. */
+	if ((sd = dup(ps->sd)) < 0 || pi_socket_setsd(new_ps, sd) < 0) {
+		pi_close(new_sd);
+		return pi_set_error(pi_sd, PI_ERR_GENERIC_SYSTEM);
+	}
+	new_ps->state = PI_SOCK_LISTEN;
+
+	result = new_ps->device->accept(new_ps, addr, addrlen);
+	if (result < 0) {
+		LOG((PI_DBG_SOCK, PI_DBG_LVL_DEBUG,
+			"pi_accept_new: ps->device->accept returned %d\n",
+			result));
+		pi_close(new_sd);
+		return pi_set_error(pi_sd, result);
+	}
+
+	return new_sd;
+}
+
 int
 pi_getsockopt(int pi_sd, int level, int option_name,
 	      void *option_value, size_t *option_len)
@@ -1173,6 +1223,15 @@ pi_getsockopt(int pi_sd, int level, int option_name,
 					goto argerr;
 				memcpy (option_value, &ps->honor_rx_to, sizeof (ps->honor_rx_to));
 				break;
+
+			case PI_SOCK_DLP_PIPELINE: {
+				/* serial protocols can't queue requests */
+				int depth = (ps->cmd == PI_CMD_NET) ? ps->dlp_pipeline : 1;
+				if (*option_len != sizeof (depth))
+					goto argerr;
+				memcpy (option_value, &depth, sizeof (depth));
+				break;
+			}
 			
 			default:
 				goto argerr;
@@ -1222,6 +1281,17 @@ pi_setsockopt(int pi_sd, int level, int option_name,
 				memcpy (&ps->honor_rx_to, option_value, sizeof (ps->honor_rx_to));
 				break;
 
+			case PI_SOCK_DLP_PIPELINE: {
+				int depth;
+				if (*option_len != sizeof (depth))
+					goto argerr;
+				memcpy (&depth, option_value, sizeof (depth));
+				if (depth < 1 || depth > PI_DLP_MAX_PIPELINE)
+					goto argerr;
+				ps->dlp_pipeline = depth;
+				break;
+			}
+
 			default:
 				goto argerr;
 		}
@@ -1257,7 +1327,9 @@ argerr:
 int
 pi_send(int pi_sd, const void *msg, size_t len, int flags)
 {
+	int	result;
 	pi_socket_t *ps;
+	struct pi_keepalive *keepalive;
 
 	if (!(ps = find_pi_socket(pi_sd))) {
 		errno = ESRCH;
@@ -1267,10 +1339,15 @@ pi_send(int pi_sd, const void *msg, size_t len, int flags)
 	if (!is_connected (ps))
 		return PI_ERR_SOCK_DISCONNECTED;
 
-	if (interval)
-		alarm(interval);
+	if (ps->keepalive == NULL)
+		return ps->protocol_queue[0]->write (ps, (void *)msg, len, flags);
+
+	keepalive = ps->keepalive;
+	pi_keepalive_io_begin (keepalive);
+	result = ps->protocol_queue[0]->write (ps, (void *)msg, len, flags);
+	pi_keepalive_io_end (keepalive);
 
-	return ps->protocol_queue[0]->write (ps, (void *)msg, len, flags);
+	return result;
 }
 
 /***********************************************************************
@@ -1287,7 +1364,9 @@ pi_send(int pi_sd, const void *msg, size_t len, int flags)
 ssize_t
 pi_recv(int pi_sd, pi_buffer_t *msg, size_t len, int flags)
 {
+	ssize_t	result;
 	pi_socket_t *ps;
+	struct pi_keepalive *keepalive;
 
 	if (!(ps = find_pi_socket(pi_sd))) {
 		errno = ESRCH;
@@ -1297,7 +1376,15 @@ pi_recv(int pi_sd, pi_buffer_t *msg, size_t len, int flags)
 	if (!is_connected (ps))
 		return PI_ERR_SOCK_DISCONNECTED;
 
-	return ps->protocol_queue[0]->read (ps, msg, len, flags);
+	if (ps->keepalive == NULL)
+		return ps->protocol_queue[0]->read (ps, msg, len, flags);
+
+	keepalive = ps->keepalive;
+	pi_keepalive_io_begin (keepalive);
+	result = ps->protocol_queue[0]->read (ps, msg, len, flags);
+	pi_keepalive_io_end (keepalive);
+
+	return result;
 }
 
 /***********************************************************************
@@ -1437,12 +1524,10 @@ pi_close(int pi_sd)
 		/* we need to remove the entry from the list prior to
 		 * closing it, because closing it will reset the pi_sd */
 		pi_mutex_lock(&psl_mutex);
-		psl = ps_list_remove (psl, pi_sd);
+		ps_table_set (pi_sd, NULL);
 		pi_mutex_unlock(&psl_mutex);
 
-		pi_mutex_lock(&watch_list_mutex);
-		watch_list = ps_list_remove (watch_list, pi_sd);
-		pi_mutex_unlock(&watch_list_mutex);
+		pi_keepalive_cancel (ps);
 
 		if (ps->device != NULL)
 			result = ps->device->close (ps);
@@ -1452,6 +1537,11 @@ pi_close(int pi_sd)
 		if (ps->device != NULL)
 		    ps->device->free(ps->device);
 
+		if (ps->dlp_rxbuf != NULL)
+			pi_buffer_free (ps->dlp_rxbuf);
+		if (ps->sys_buf != NULL)
+			pi_buffer_free (ps->sys_buf);
+
 		if (ps->sd > 0)
 		    close(ps->sd);
 		free(ps);
@@ -1569,44 +1659,23 @@ pi_maxrecsize(int pi_sd)
  *
  * Function:    find_pi_socket
  *
- * Summary:     Thread-safe wrapper for ps_list_find
+ * Summary:     looks up a socket descriptor in the socket table.
+ *		Does not lock, see ps_table.
  *
- * Parameters:  None
+ * Parameters:  socket descriptor
  *
- * Returns:     Nothing
+ * Returns:     pi_socket_t*, or NULL if no match
  *
  ***********************************************************************/
 pi_socket_t *
 find_pi_socket(int pi_sd)
 {
-	pi_socket_t *result;
-
-	pi_mutex_lock(&psl_mutex);
-	result = ps_list_find (psl, pi_sd);
-	pi_mutex_unlock(&psl_mutex);
-
-	return result;
-}
+	pi_socket_table_t *table = ps_table;
 
-int
-pi_watchdog(int pi_sd, int newinterval)
-{
-	pi_socket_t *ps;
-
-	if (!(ps = find_pi_socket(pi_sd))) {
-		errno = ESRCH;
-		return PI_ERR_SOCK_INVALID;
-	}
-
-	pi_mutex_lock(&watch_list_mutex);
-	watch_list = ps_list_append (watch_list, ps);
-	pi_mutex_unlock(&watch_list_mutex);
-
-	signal(SIGALRM, onalarm);
-	interval = newinterval;
-	alarm(interval);
+	if (table == NULL || pi_sd < 0 || pi_sd >= table->size)
+		return NULL;
 
-	return 0;
+	return table->slot[pi_sd];
 }
 
 int
@@ -81,6 +81,7 @@ sys_protocol_dup (pi_protocol_t *prot)
 		new_prot->flush = prot->flush;
 		new_prot->getsockopt	= prot->getsockopt;
 		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->writev 	= prot->writev;
 
 		data 	= (pi_sys_data_t *)prot->data;
 		new_data->txid 	= data->txid;
@@ -150,6 +151,7 @@ sys_protocol (void)
 		prot->flush	= sys_flush;
 		prot->getsockopt = sys_getsockopt;
 		prot->setsockopt = sys_setsockopt;
+		prot->writev = NULL;
 
 		data->txid 	= 0x00;
 		prot->data 	= data;
@@ -183,13 +185,13 @@ sys_tx(pi_socket_t *ps, const unsigned char *buf, size_t len, int flags)
 
 	size_t	size;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SYS);
+	prot = protocol_queue_find(ps, PI_LEVEL_SYS);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_sys_data_t *)prot->data;
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SYS);
+	next = protocol_queue_find_next(ps, PI_LEVEL_SYS);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -244,12 +246,12 @@ sys_rx(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	pi_sys_data_t *data;
 	size_t 	data_len;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SYS);
+	prot = protocol_queue_find(ps, PI_LEVEL_SYS);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
 	data = (pi_sys_data_t *)prot->data;
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SYS);
+	next = protocol_queue_find_next(ps, PI_LEVEL_SYS);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
@@ -278,11 +280,11 @@ sys_flush(pi_socket_t *ps, int flags)
 	pi_protocol_t	*prot,
 			*next;
 
-	prot = pi_protocol(ps->sd, PI_LEVEL_SYS);
+	prot = protocol_queue_find(ps, PI_LEVEL_SYS);
 	if (prot == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
-	next = pi_protocol_next(ps->sd, PI_LEVEL_SYS);
+	next = protocol_queue_find_next(ps, PI_LEVEL_SYS);
 	if (next == NULL)
 		return pi_set_error(ps->sd, PI_ERR_SOCK_INVALID);
 
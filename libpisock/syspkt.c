@@ -434,65 +434,122 @@ sys_QueryState(int sd)
 
 /***********************************************************************
  *
- * Function:    sys_ReadMemory
+ * Function:    sys_transfer
  *
- * Summary:     Read memory (0x01, 0x81)
+ * Summary:     Read or write memory, PI_SYS_MEM_CHUNK bytes per packet,
+ *		with up to depth packets awaiting their reply
  *
- * Parameters:  None
+ * Parameters:  sd, write flag, address, length, data, depth
  *
- * Returns:     Nothing
+ * Returns:     Number of bytes transferred, negative if none could be
  *
  ***********************************************************************/
-int
-sys_ReadMemory(int sd, unsigned long addr, unsigned long len, void *dest)
+static int
+sys_transfer(int sd, int write, unsigned long addr, unsigned long len,
+	unsigned char *data, int depth)
 {
-	int 	result;
-	unsigned long todo, done;
+	int 	result,
+		inflight = 0;
+	unsigned long todo,
+		sent = 0,
+		done = 0;
+	pi_socket_t *ps;
 	pi_buffer_t *buf;
 
-	buf = pi_buffer_new (0xFFFF);
-	if (buf == NULL) {
-		errno = ENOMEM;
-		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+	if ((ps = find_pi_socket(sd)) == NULL) {
+		errno = ESRCH;
+		return PI_ERR_SOCK_INVALID;
 	}
 
-	done = 0;
-	do {
-		todo 	= len;
-		if (todo > 256)
-			todo = 256;
-
-		buf->data[0] = 0;
-		buf->data[1] = 0;
-		buf->data[2] = 0;
-		buf->data[3] = 0;
-		buf->data[4] = 0x01;
-		buf->data[5] = 0;	/* gapfill */
+	if (depth < 1)
+		depth = 1;
+	else if (depth > PI_SYS_MAX_PIPELINE)
+		depth = PI_SYS_MAX_PIPELINE;
+
+	/* one buffer per socket serves every call */
+	if (ps->sys_buf == NULL) {
+		ps->sys_buf = pi_buffer_new (PI_SYS_MEM_CHUNK + 12);
+		if (ps->sys_buf == NULL) {
+			errno = ENOMEM;
+			return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
+		}
+	}
+	buf = ps->sys_buf;
+
+	while (done < len) {
+		/* the debugger answers in order, keep it busy */
+		while (inflight < depth && sent < len) {
+			todo = len - sent;
+			if (todo > PI_SYS_MEM_CHUNK)
+				todo = PI_SYS_MEM_CHUNK;
+
+			buf->data[0] = 0;
+			buf->data[1] = 0;
+			buf->data[2] = 0;
+			buf->data[3] = 0;
+			buf->data[4] = write ? 0x02 : 0x01;
+			buf->data[5] = 0;	/* gapfill */
+
+			set_long(buf->data + 6, addr + sent);
+			set_short(buf->data + 10, todo);
+			if (write)
+				memcpy(buf->data + 12, data + sent, todo);
+
+			if ((result = pi_write(sd, buf->data,
+					12 + (write ? todo : 0))) < 0)
+				goto fail;
+			sent += todo;
+			inflight++;
+		}
 
-		set_long(buf->data + 6, addr + done);
-		set_short(buf->data + 10, todo);
+		todo = len - done;
+		if (todo > PI_SYS_MEM_CHUNK)
+			todo = PI_SYS_MEM_CHUNK;
+
+		/* the protocol appends, don't let the reply land after
+		   the request still in the buffer */
+		pi_buffer_clear(buf);
+		result = pi_read(sd, buf, write ? 6 : todo + 6);
+		inflight--;
+		if (result < 0)
+			goto fail;
+		if (result < 6
+		    || buf->data[4] != (write ? 0x82 : 0x81)
+		    || (!write && (unsigned long) result != todo + 6)) {
+			result = pi_set_error(sd, PI_ERR_PROT_BADPACKET);
+			goto fail;
+		}
 
-		pi_write(sd, buf->data, 12);
+		if (!write)
+			memcpy(data + done, buf->data + 6, todo);
+		done += todo;
+	}
 
-		result = pi_read(sd, buf, todo + 6);
+	return done;
 
-		if (result < 0) {
-			pi_buffer_free (buf);
-			return done;
-		}
+fail:
+	/* replies still on their way would be taken for the next call's */
+	if (inflight > 0)
+		pi_flush(sd, PI_FLUSH_INPUT);
+	return done > 0 ? (int) done : result;
+}
 
-		if ((buf->data[4] == 0x81)
-		    && ((unsigned int) result == todo + 6)) {
-			memcpy(((char *) dest) + done, buf->data + 6, todo);
-			done += todo;
-		} else {
-			pi_buffer_free (buf);
-			return done;
-		}
-	} while (done < len);
 
-	pi_buffer_free (buf);
-	return done;
+/***********************************************************************
+ *
+ * Function:    sys_ReadMemory
+ *
+ * Summary:     Read memory (0x01, 0x81)
+ *
+ * Parameters:  sd, address, length, destination buffer
+ *
+ * Returns:     Number of bytes read
+ *
+ ***********************************************************************/
+int
+sys_ReadMemory(int sd, unsigned long addr, unsigned long len, void *dest)
+{
+	return sys_transfer(sd, 0, addr, len, (unsigned char *) dest, 1);
 }
 
 
@@ -502,61 +559,53 @@ sys_ReadMemory(int sd, unsigned long addr, unsigned long len, void *dest)
  *
  * Summary:     Write memory (0x02, 0x82)
  *
- * Parameters:  None
+ * Parameters:  sd, address, length, source buffer
  *
- * Returns:     Nothing
+ * Returns:     Number of bytes written
  *
  ***********************************************************************/
 int
 sys_WriteMemory(int sd, unsigned long addr, unsigned long len, void *src)
 {
-	int 	result;
-	unsigned long todo, done;
-	pi_buffer_t *buf;
-
-	buf = pi_buffer_new (0xFFFF);
-	if (buf == NULL) {
-		errno = ENOMEM;
-		return pi_set_error(sd, PI_ERR_GENERIC_MEMORY);
-	}
-
-	done = 0;
-	do {
-		todo = len;
-		if (todo > 256)
-			todo = 256;
-
-		buf->data[0] = 0;
-		buf->data[1] = 0;
-		buf->data[2] = 0;
-		buf->data[3] = 0;
-		buf->data[4] = 0x02;
-		buf->data[5] = 0;	/* gapfill */
-
-		set_long(buf->data + 6, addr);
-		set_short(buf->data + 10, len);
-		memcpy(buf->data + 12, (char *)src + done, todo);
-
-		pi_write(sd, buf->data, len + 12);
+	return sys_transfer(sd, 1, addr, len, (unsigned char *) src, 1);
+}
 
-		result = pi_read(sd, buf, 6);
 
-		if (result < 0) {
-			pi_buffer_free (buf);
-			return done;
-		}
+/***********************************************************************
+ *
+ * Function:    sys_ReadMemoryPipelined
+ *
+ * Summary:     Read memory with several requests outstanding
+ *
+ * Parameters:  sd, address, length, destination buffer, depth
+ *
+ * Returns:     Number of bytes read
+ *
+ ***********************************************************************/
+int
+sys_ReadMemoryPipelined(int sd, unsigned long addr, unsigned long len,
+	void *dest, int depth)
+{
+	return sys_transfer(sd, 0, addr, len, (unsigned char *) dest, depth);
+}
 
-		if ((buf->data[4] == (unsigned char)0x82)
-		    && ((unsigned long) result == todo + 6)) {
-			;
-		} else {
-			pi_buffer_free (buf);
-			return done;
-		}
-	} while (done < len);
 
-	pi_buffer_free (buf);
-	return done;
+/***********************************************************************
+ *
+ * Function:    sys_WriteMemoryPipelined
+ *
+ * Summary:     Write memory with several requests outstanding
+ *
+ * Parameters:  sd, address, length, source buffer, depth
+ *
+ * Returns:     Number of bytes written
+ *
+ ***********************************************************************/
+int
+sys_WriteMemoryPipelined(int sd, unsigned long addr, unsigned long len,
+	void *src, int depth)
+{
+	return sys_transfer(sd, 1, addr, len, (unsigned char *) src, depth);
 }
 
 
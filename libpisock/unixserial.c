@@ -278,6 +278,10 @@ s_poll(pi_socket_t *ps, int timeout)
 	struct 	timeval t;
 	fd_set 	ready;
 
+	/* bytes already read ahead count as available */
+	if (data->buf_size > 0)
+		return 0;
+
 	FD_ZERO(&ready);
 	FD_SET(ps->sd, &ready);
 
@@ -372,32 +376,39 @@ s_write(pi_socket_t *ps, const unsigned char *buf, size_t len,
  *
  * Function:    s_read_buf
  *
- * Summary:     read from data buffer
+ * Summary:     read from the read-ahead ring
  *
- * Parameters:	pi_socket_t*, pi_buffer_t* to buf, length to get
+ * Parameters:	pi_socket_t*, pi_buffer_t* to buf, length to get, flags
  *
  * Returns:     number of bytes read
  *
  ***********************************************************************/
-static size_t
+static ssize_t
 s_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags) 
 {
 	struct 	pi_serial_data *data =
 		(struct pi_serial_data *)ps->device->data;
-	size_t	rbuf = data->buf_size;
+	size_t	rbuf = data->buf_size,
+		first;
 
 	if (rbuf > len)
 		rbuf = len;
 
-	if (pi_buffer_append (buf, data->buf, rbuf) == NULL) {
+	/* the bytes may wrap around the end of the ring */
+	first = PI_SERIAL_RING - data->buf_start;
+	if (first > rbuf)
+		first = rbuf;
+
+	if (pi_buffer_append (buf, data->buf + data->buf_start, first) == NULL
+	    || pi_buffer_append (buf, data->buf, rbuf - first) == NULL) {
 		errno = ENOMEM;
 		return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 	}
 
 	if (flags != PI_MSG_PEEK) {
 		data->buf_size -= rbuf;
-		if (data->buf_size > 0)
-			memmove(data->buf, &data->buf[rbuf], data->buf_size);
+		data->buf_start = (data->buf_size == 0) ? 0 :
+			(data->buf_start + rbuf) & (PI_SERIAL_RING - 1);
 	}
 
 	LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
@@ -406,6 +417,55 @@ s_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 	return rbuf;
 }
 
+/***********************************************************************
+ *
+ * Function:    s_fill_buf
+ *
+ * Summary:     read whatever the port has available into the free part
+ *		of the read-ahead ring, with a single system call
+ *
+ * Parameters:	pi_socket_t*
+ *
+ * Returns:     number of bytes read, 0 at end of file, or negative on
+ *		error
+ *
+ ***********************************************************************/
+static ssize_t
+s_fill_buf (pi_socket_t *ps)
+{
+	struct 	pi_serial_data *data =
+		(struct pi_serial_data *)ps->device->data;
+	struct 	iovec iov[2];
+	size_t	tail = (data->buf_start + data->buf_size) & (PI_SERIAL_RING - 1),
+		room = PI_SERIAL_RING - data->buf_size;
+	int	iovcnt = 1;
+	ssize_t	bytes;
+
+	if (room == 0)
+		return 0;
+
+	iov[0].iov_base = data->buf + tail;
+	iov[0].iov_len 	= PI_SERIAL_RING - tail;
+	if (iov[0].iov_len > room)
+		iov[0].iov_len = room;
+	if (room > iov[0].iov_len) {
+		iov[1].iov_base = data->buf;
+		iov[1].iov_len 	= room - iov[0].iov_len;
+		iovcnt = 2;
+	}
+
+	bytes = readv(ps->sd, iov, iovcnt);
+	if (bytes > 0) {
+		data->buf_size += bytes;
+		data->rx_bytes += bytes;
+
+		LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
+			"DEV RX unixserial read %d bytes\n", bytes));
+	}
+
+	return bytes;
+}
+
 /***********************************************************************
  *
  * Function:    s_read
@@ -414,77 +474,54 @@ s_read_buf (pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
  *
  * Parameters:	pi_socket_t*, pi_buffer_t* to buf, expect length, flags
  *
- * Returns:     number of bytes read or negative on error
+ * Returns:     number of bytes read or negative on error. Fewer bytes
+ *		than expected are returned when the read-ahead ring
+ *		runs dry, the caller loops for the rest.
  *
  ***********************************************************************/
 static ssize_t
 s_read(pi_socket_t *ps, pi_buffer_t *buf, size_t len, int flags)
 {
-	ssize_t rbuf = 0,
-		bytes;
+	ssize_t bytes;
 	struct 	pi_serial_data *data =
 		(struct pi_serial_data *)ps->device->data;
 	struct 	timeval t;
 	fd_set 	ready;
 
-	/* check whether we have at least partial data in store */
-	if (data->buf_size) {
-		rbuf = s_read_buf(ps, buf, len, flags);
-		if (rbuf < 0)
-			return rbuf;
-		len -= rbuf;
-		if (len == 0)
-			return rbuf;
-	}
+	/* Only go to the port when the ring can't satisfy the read. A
+	   peek must see the whole length, as it doesn't consume. */
+	if (data->buf_size == 0
+	    || (flags == PI_MSG_PEEK && data->buf_size < len)) {
+		/* If timeout == 0, wait forever for packet, otherwise wait
+		   till timeout milliseconds */
+		FD_ZERO(&ready);
+		FD_SET(ps->sd, &ready);
+		if (data->timeout == 0)
+			select(ps->sd + 1, &ready, 0, 0, 0);
+		else {
+			t.tv_sec 	= data->timeout / 1000;
+			t.tv_usec 	= (data->timeout % 1000) * 1000;
+			if (select(ps->sd + 1, &ready, 0, 0, &t) == 0)
+				FD_ZERO(&ready);
+		}
 
-	/* If timeout == 0, wait forever for packet, otherwise wait till
-	   timeout milliseconds */
-	FD_ZERO(&ready);
-	FD_SET(ps->sd, &ready);
-	if (data->timeout == 0)
-		select(ps->sd + 1, &ready, 0, 0, 0);
-	else {
-		t.tv_sec 	= data->timeout / 1000;
-		t.tv_usec 	= (data->timeout % 1000) * 1000;
-		if (select(ps->sd + 1, &ready, 0, 0, &t) == 0)
+		if (!FD_ISSET(ps->sd, &ready)) {
+			LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
+				"DEV RX unixserial timeout\n"));
+			data->rx_errors++;
+			errno = ETIMEDOUT;
 			return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
-	}
-
-	/* If data is available in time, read it */
-	if (FD_ISSET(ps->sd, &ready)) {
-		if (flags == PI_MSG_PEEK && len > 256)
-			len = 256;
-
-		if (pi_buffer_expect (buf, len) == NULL) {
-			errno = ENOMEM;
-			return pi_set_error(ps->sd, PI_ERR_GENERIC_MEMORY);
 		}
 
-		bytes = read(ps->sd, &buf->data[buf->used], len);
-
-		if (bytes > 0) {
-			if (flags == PI_MSG_PEEK) {
-				memcpy(data->buf + data->buf_size, buf->data + buf->used, bytes);
-				data->buf_size += bytes;
-			}
-			buf->used += bytes;
-			data->rx_bytes += bytes;
-			rbuf += bytes;
-
-			LOG((PI_DBG_DEV, PI_DBG_LVL_DEBUG,
-				"DEV RX unixserial read %d bytes\n", bytes));
-		} else if (bytes < 0) {
-			rbuf = bytes;
-		}
-	} else {
-		LOG((PI_DBG_DEV, PI_DBG_LVL_WARN,
-			"DEV RX unixserial timeout\n"));
-		data->rx_errors++;
-		errno = ETIMEDOUT;
-		return pi_set_error(ps->sd, PI_ERR_SOCK_TIMEOUT);
+		/* If data is available in time, read it */
+		bytes = s_fill_buf(ps);
+		if (bytes < 0)
+			return bytes;
+		if (bytes == 0 && data->buf_size == 0)
+			return 0;
 	}
 
-	return rbuf;
+	return s_read_buf(ps, buf, len, flags);
 }
 
 /***********************************************************************
@@ -513,6 +550,7 @@ s_flush(pi_socket_t *ps, int flags)
 
 	if (flags & PI_FLUSH_INPUT) {
 		/* clear internal buffer */
+		data->buf_start = 0;
 		data->buf_size = 0;
 
 		/* flush pending data (we assume the socket is in blocking mode) */
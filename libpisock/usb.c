@@ -97,6 +97,7 @@ pi_usb_protocol_dup (pi_protocol_t *prot)
 		new_prot->flush		= prot->flush;
 		new_prot->getsockopt 	= prot->getsockopt;
 		new_prot->setsockopt 	= prot->setsockopt;
+		new_prot->writev 	= prot->writev;
 		new_prot->data 		= NULL;
 	}
 
@@ -157,6 +158,7 @@ pi_usb_protocol (pi_device_t *dev)
 		prot->flush		= data->impl.flush;
 		prot->getsockopt 	= pi_usb_getsockopt;
 		prot->setsockopt 	= pi_usb_setsockopt;
+		prot->writev 		= NULL;
 		prot->data 		= NULL;
 	}
 
@@ -219,11 +221,14 @@ pi_usb_device (int type)
 			dev->accept 		= pi_usb_accept;
 			dev->connect 		= pi_usb_connect;
 			dev->close 		= pi_usb_close;
+			dev->dup 		= NULL;
+			dev->pending 		= NULL;
 
 			memset(data, 0, sizeof(struct pi_usb_data));
 			data->rate 		= -1;
 			data->establishrate 	= -1;
 			data->establishhighrate = 0;
+			data->urbs		= PI_USB_DEFAULT_URBS;
 			pi_usb_impl_init (&data->impl);
 
 			dev->data 		= data;
@@ -539,6 +544,13 @@ pi_usb_getsockopt(pi_socket_t *ps, int level, int option_name,
 			memcpy (option_value, &data->timeout,
 				sizeof (data->timeout));
 			break;
+
+		case PI_DEV_URBS:
+			if (*option_len != sizeof (data->urbs))
+				goto fail;
+			memcpy (option_value, &data->urbs,
+				sizeof (data->urbs));
+			break;
 	}
 
 	return 0;
@@ -586,6 +598,15 @@ pi_usb_setsockopt(pi_socket_t *ps, int level, int option_name,
 			memcpy (&data->timeout, option_value,
 				sizeof (data->timeout));
 			break;
+
+		case PI_DEV_URBS:
+			if (*option_len != sizeof (data->urbs))
+			 	goto fail;
+			memcpy (&data->urbs, option_value,
+				sizeof (data->urbs));
+			if (data->urbs < 0)
+				data->urbs = 0;
+			break;
 	}
 
 	return 0;
@@ -1148,6 +1148,7 @@ static int proc_updatedisplay(ClientData clientData, Tcl_Interp * interp,
 
 #define DB 0xFFFF0000
 #define LSSA 0xFA00  
+#define DISPLAY_PIPELINE 4	/* screen reads outstanding at once */
 
 static int proc_getdisplay(ClientData clientData, Tcl_Interp * interp, int argc,
 			   char *argv[])
@@ -1178,12 +1179,13 @@ static int proc_getdisplay(ClientData clientData, Tcl_Interp * interp, int argc,
         if (debugger) {
                 l = sys_ReadMemory(port, DB + LSSA, 4, buffer);
                 addr = get_long(buffer);
-                l = sys_ReadMemory(port, addr, 160 * 160 / 8, buffer);
+                l = sys_ReadMemoryPipelined(port, addr, 160 * 160 / 8,
+                        buffer, DISPLAY_PIPELINE);
         } else {
                 PackRPC(&p, 0xA026, RPC_IntReply, RPC_LongPtr(&addr),
                         RPC_Long(DB + LSSA), RPC_Long(4), RPC_End);
                 e1 = DbgRPC(&p, &e2);
-                for (l = 0; l < 160 * 160 / 8; l += 64) {
+                for (l = 0; l < 160 * 160 / 8; l += 128) {
                         PackRPC(&p, 0xA026, RPC_IntReply,
                                 RPC_Ptr(buffer + l, 128),
                                 RPC_Long(addr + l), RPC_Long(128),
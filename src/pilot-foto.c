@@ -342,6 +342,7 @@ int do_delete(int sd, const char **delete_files, int all)
     }
 
     dlp_ResetSyncFlags(sd, db);
+    plu_note_flags_reset(sd);
     dlp_CleanUpDatabase(sd, db);
 
     dlp_CloseDB(sd, db);
@@ -514,6 +515,7 @@ int install_tux_with_name(int sd, char *name, int width, int height,
     }
 
     dlp_ResetSyncFlags(sd, db);
+    plu_note_flags_reset(sd);
     dlp_CleanUpDatabase(sd, db);
 
     dlp_CloseDB(sd, db);
@@ -30,6 +30,7 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -83,10 +84,257 @@ static int check_romversion(int sd, plu_romversion_t *version)
 	return 0;
 }
 
+/* Memory is read with MemMove (trap 0xA026) calls into the reply
+ * arguments. Several calls are kept in flight when the connection
+ * allows it (see PI_SOCK_DLP_PIPELINE); the pipeline is drained every
+ * DUMP_CHECK bytes to check for a cancel on the handheld and update its
+ * display.
+ */
+
+#define DUMP_CHUNK	256		/* largest read an RPC argument can carry */
+#define DUMP_BLOCK	65536		/* the file is written this much at a time */
+#define DUMP_CHECK	32768		/* bytes read between cancel checks */
+#define DUMP_TICK	250000		/* usecs between progress lines */
+
+struct dump_chunk {
+	struct 	RPC_params p;
+	unsigned long offset;
+	int	len;
+	unsigned char data[DUMP_CHUNK];
+};
+
+struct dump_ticker {
+	struct timeval last;
+	unsigned long length;
+};
+
+static int read_memory(int sd, unsigned long addr, void *buffer, int len)
+{
+	struct 	RPC_params p;
+
+	PackRPC(&p, 0xA026, RPC_IntReply, RPC_Ptr(buffer, len),
+		RPC_Long(addr), RPC_Long(len), RPC_End);
+	return dlp_RPC(sd, &p, 0);
+}
+
+static void draw_string(int sd, const char *print, int x, int y)
+{
+	struct 	RPC_params p;
+
+	PackRPC(&p, 0xA220, RPC_IntReply, RPC_Ptr(print, strlen(print)),
+		RPC_Short(strlen(print)), RPC_Short(x), RPC_Short(y),
+		RPC_End);
+	/* err = */ dlp_RPC(sd, &p, 0);
+}
+
+/* The argument header only has a byte for the size, so a full 256 byte
+ * read relies on the handheld taking 0 to mean 256. Check it does by
+ * comparing with two halves before using it.
+ */
+static int pick_chunk_size(int sd, unsigned long start)
+{
+	unsigned char whole[DUMP_CHUNK],
+		halves[DUMP_CHUNK];
+
+	if (read_memory(sd, start, whole, DUMP_CHUNK) < 0
+	    || read_memory(sd, start, halves, DUMP_CHUNK / 2) < 0
+	    || read_memory(sd, start + DUMP_CHUNK / 2, halves + DUMP_CHUNK / 2,
+			DUMP_CHUNK / 2) < 0
+	    || memcmp(whole, halves, DUMP_CHUNK) != 0)
+		return DUMP_CHUNK - 2;
+	return DUMP_CHUNK;
+}
+
+static void ticker_update(struct dump_ticker *t, unsigned long offset, int force)
+{
+	struct 	timeval now;
+
+	if (plu_quiet)
+		return;
+
+	gettimeofday(&now, NULL);
+	if (!force && (now.tv_sec - t->last.tv_sec) * 1000000
+		+ (now.tv_usec - t->last.tv_usec) < DUMP_TICK)
+		return;
+	t->last = now;
+
+	printf("\r   %lu of %lu bytes (%.2f%%)", offset, t->length,
+		((double) offset / t->length) * 100.0);
+	fflush(stdout);
+}
+
+static int is_zero(const unsigned char *data, size_t len)
+{
+	while (len--)
+		if (*data++)
+			return 0;
+	return 1;
+}
+
+/* Write a block, leaving holes where it only holds zeros. */
+static int write_block(int file, const unsigned char *block, size_t len,
+	unsigned long offset)
+{
+	size_t	i,
+		j,
+		n;
+
+	for (i = 0; i < len; i = j) {
+		for (; i < len; i += n) {
+			n = (len - i > 512) ? 512 : len - i;
+			if (!is_zero(block + i, n))
+				break;
+		}
+		for (j = i; j < len; j += n) {
+			n = (len - j > 512) ? 512 : len - j;
+			if (is_zero(block + j, n))
+				break;
+		}
+		if (j > i && pwrite(file, block + i, j - i, (off_t)(offset + i))
+				!= (ssize_t)(j - i))
+			return -1;
+	}
+	return 0;
+}
+
+/***********************************************************************
+ *
+ * Function:    dump_memory
+ *
+ * Summary:     Read a memory range from the handheld into a file,
+ *		resuming at offset
+ *
+ * Parameters:  socket, file, what ("ROM" or "RAM"), address, length,
+ *		offset to start at
+ *
+ * Returns:     0 when all was read, -1 if cancelled or on error
+ *
+ ***********************************************************************/
+static int dump_memory(int sd, int file, const char *what,
+	unsigned long start, unsigned long length, unsigned long offset)
+{
+	struct 	dump_chunk *chunks = NULL,
+		*ch;
+	struct 	dump_ticker ticker;
+	unsigned char *block = NULL;
+	unsigned long next = offset,
+		block_offset = offset,
+		check_at;
+	size_t	block_used = 0,
+		size = sizeof(int);
+	int	chunk,
+		depth = PI_DLP_MAX_PIPELINE,
+		head = 0,
+		inflight = 0,
+		result = -1;
+	char 	print[256];
+
+	/* the depth only goes up on NET connections, read back what we got */
+	pi_setsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_DLP_PIPELINE, &depth, &size);
+	size = sizeof(int);
+	if (pi_getsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_DLP_PIPELINE, &depth, &size) < 0
+	    || depth < 1)
+		depth = 1;
+
+	chunks = malloc(depth * sizeof(struct dump_chunk));
+	block = malloc(DUMP_BLOCK);
+	if (chunks == NULL || block == NULL) {
+		fprintf(stderr, "\n   ERROR: Out of memory.\n");
+		goto done;
+	}
+
+	chunk = pick_chunk_size(sd, start);
+	if (!plu_quiet)
+		printf("   Reading %d bytes at a time, %d request%s in flight\n",
+			chunk, depth, depth > 1 ? "s" : "");
+
+	memset(&ticker, 0, sizeof(ticker));
+	ticker.length = length;
+	check_at = offset + DUMP_CHECK;
+
+	signal(SIGINT, sighandler);
+	while (offset < length) {
+		while (inflight < depth && next < length && next < check_at
+		       && !cancel) {
+			ch = &chunks[(head + inflight) % depth];
+			ch->offset = next;
+			ch->len = (length - next > (unsigned long) chunk)
+				? chunk : (int) (length - next);
+			PackRPC(&ch->p, 0xA026, RPC_IntReply,
+				RPC_Ptr(ch->data, ch->len),
+				RPC_Long(start + next), RPC_Long(ch->len),
+				RPC_End);
+			if (dlp_RPCSubmit(sd, &ch->p) < 0)
+				goto failed;
+			inflight++;
+			next += ch->len;
+		}
+
+		ch = &chunks[head];
+		head = (head + 1) % depth;
+		inflight--;
+		if (dlp_RPCComplete(sd, &ch->p, 0) < 0)
+			goto failed;
+
+		if (block_used + ch->len > DUMP_BLOCK) {
+			if (write_block(file, block, block_used, block_offset) < 0)
+				goto write_failed;
+			block_offset += block_used;
+			block_used = 0;
+		}
+		memcpy(block + block_used, ch->data, ch->len);
+		block_used += ch->len;
+		offset += ch->len;
+
+		ticker_update(&ticker, offset, 0);
+
+		if (inflight == 0 && (offset >= check_at || cancel)) {
+			if (cancel || (dlp_OpenConduit(sd) < 0)) {
+				printf("\n   Operation cancelled!\n");
+				snprintf(print, sizeof(print),
+					"\npilot-getrom ended unexpectedly.\n"
+					"Entire %s was not fetched.\n", what);
+				dlp_AddSyncLogEntry(sd, print);
+				goto done;
+			}
+			sprintf(print, "%ld", offset);
+			draw_string(sd, print, 92, 28);
+			check_at = offset + DUMP_CHECK;
+		}
+	}
+	ticker_update(&ticker, offset, 1);
+	result = 0;
+	goto done;
+
+failed:
+	fprintf(stderr, "\n   ERROR: Reading %s failed at byte %lu.\n", what, offset);
+	/* collect what is still on its way, the socket is not usable
+	   until then */
+	while (inflight-- > 0) {
+		dlp_RPCComplete(sd, &chunks[head].p, 0);
+		head = (head + 1) % depth;
+	}
+	goto done;
+
+write_failed:
+	fprintf(stderr, "\n   ERROR: Writing the %s image failed.\n", what);
+	block_used = 0;
+
+done:
+	/* keep what was read, so that the next run resumes after it */
+	if (block_used && write_block(file, block, block_used, block_offset) < 0)
+		fprintf(stderr, "\n   ERROR: Writing the %s image failed.\n", what);
+	else if (ftruncate(file, (off_t) (block_offset + block_used)) < 0)
+		fprintf(stderr, "\n   ERROR: Writing the %s image failed.\n", what);
+
+	free(block);
+	free(chunks);
+	return result;
+}
+
 int do_get_rom(int sd,const char *filename)
 {
-	int	i,
-		file = -1,
+	int	file = -1,
 		timespent = 0;
 
 	struct 	RPC_params p;
@@ -95,7 +343,6 @@ int do_get_rom(int sd,const char *filename)
 	unsigned long ROMstart;
 	unsigned long ROMlength;
 	unsigned long offset;
-	unsigned long left;
 
 	char 	name[256],
 		print[256];
@@ -131,69 +378,22 @@ int do_get_rom(int sd,const char *filename)
 	}
 
 	file = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (file < 0) {
+		fprintf(stderr, "   ERROR: Unable to open %s.\n", name);
+		return -1;
+	}
 
 	offset = lseek(file, 0, SEEK_END);
 	offset &= ~255;
-	lseek(file, offset, SEEK_SET);
 
 	PackRPC(&p, 0xA164, RPC_IntReply, RPC_Byte(1), RPC_End);
 	/* err = */ dlp_RPC(sd, &p, 0);
 
 	sprintf(print, "Downloading byte %ld", offset);
-	PackRPC(&p, 0xA220, RPC_IntReply, RPC_Ptr(print, strlen(print)),
-		RPC_Short(strlen(print)), RPC_Short(0), RPC_Short(28),
-		RPC_End);
-	/* err = */ dlp_RPC(sd, &p, 0);
-
-	signal(SIGINT, sighandler);
-	left = ROMlength - offset;
-	i = offset;
-	while (left > 0) {
-		int 	len = left,
-			j;
-		char 	buffer[256];
-		double 	perc = ((double) offset / ROMlength) * 100.0;
-
-		if (len > 256)
-			len = 256;
-
-		if (!plu_quiet) {
-			printf("\r   %ld of %ld bytes (%.2f%%)", offset, ROMlength, perc);
-		}
+	draw_string(sd, print, 0, 28);
 
-		fflush(stdout);
-		PackRPC(&p, 0xA026, RPC_IntReply, RPC_Ptr(buffer, len),
-			RPC_Long(offset + ROMstart), RPC_Long(len),
-			RPC_End);
-		/* err = */ dlp_RPC(sd, &p, 0);
-		left -= len;
-
-		/* If the buffer only contains zeros, skip instead of
-		   writing, so that the file will be holey. */
-		for (j = 0; j < len; j++)
-			if (buffer[j])
-				break;
-		if (j == len)
-			lseek(file, len, SEEK_CUR);
-		else
-			write(file, buffer, len);
-		offset += len;
-		if (cancel || !(i++ % 8))
-			if (cancel || (dlp_OpenConduit(sd) < 0)) {
-				printf("\n   Operation cancelled!\n");
-				dlp_AddSyncLogEntry(sd, "\npilot-getrom ended unexpectedly.\n"
-							"Entire ROM was not fetched.\n");
-				goto cancel;
-			}
-		if (!(i % 16)) {
-			sprintf(print, "%ld", offset);
-			PackRPC(&p, 0xA220, RPC_IntReply,
-				RPC_Ptr(print, strlen(print)),
-				RPC_Short(strlen(print)), RPC_Short(92),
-				RPC_Short(28), RPC_End);
-			/* err = */ dlp_RPC(sd, &p, 0);
-		}
-	}
+	if (dump_memory(sd, file, "ROM", ROMstart, ROMlength, offset) < 0)
+		goto cancel;
 
 	end = time(NULL);
 	timespent = (end-start);
@@ -220,11 +420,9 @@ int do_get_ram(int sd, const char *filename)
 	struct 	RPC_params p;
 	plu_romversion_t version;
 
-	unsigned long SRAMstart, SRAMlength, offset, left;
+	unsigned long SRAMstart, SRAMlength, offset;
 
-	int	i,
-		file = -1,
-		j,
+	int	file = -1,
 		timespent	= 0;
 
 	/* Tell user (via Palm) that we are starting things up */
@@ -248,19 +446,19 @@ int do_get_ram(int sd, const char *filename)
 	}
 
 	file = open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (file < 0) {
+		fprintf(stderr, "   ERROR: Unable to open %s.\n", name);
+		return 1;
+	}
 
 	offset = lseek(file, 0, SEEK_END);
 	offset &= ~255;
-	lseek(file, offset, SEEK_SET);
 
 	PackRPC(&p, 0xA164, RPC_IntReply, RPC_Byte(1), RPC_End);
 	/* err = */ dlp_RPC(sd, &p, 0);
 
 	sprintf(print, "Downloading byte %ld", offset);
-	PackRPC(&p, 0xA220, RPC_IntReply, RPC_Ptr(print, strlen(print)),
-		RPC_Short(strlen(print)), RPC_Short(0), RPC_Short(28),
-		RPC_End);
-	/* err = */ dlp_RPC(sd, &p, 0);
+	draw_string(sd, print, 0, 28);
 
 #if 0
 	PackRPC(&p, 0xA026, RPC_IntReply, RPC_LongPtr(&penPtr),
@@ -275,59 +473,13 @@ int do_get_ram(int sd, const char *filename)
 	pi_dumpdata(print, 8);
 #endif
 
-	signal(SIGINT, sighandler);
-	left 	= SRAMlength - offset;
-	i 	= offset;
-	while (left > 0) {
-		int 	len 	= left;
-		char 	buffer[256];
-		double 	perc 	= ((double) offset / SRAMlength) * 100.0;
-
-		if (len > 256)
-			len = 256;
-
-		if (!plu_quiet) {
-                	printf("\r   %ld of %ld bytes (%.2f%%)", offset, SRAMlength, perc);
-		}
-		fflush(stdout);
-		PackRPC(&p, 0xA026, RPC_IntReply, RPC_Ptr(buffer, len),
-			RPC_Long(offset + SRAMstart), RPC_Long(len),
-			RPC_End);
-		/* err = */ dlp_RPC(sd, &p, 0);
-		left -= len;
-
-		/* If the buffer only contains zeros, skip instead of
-		   writing, so that the file will be holey. */
-		for (j = 0; j < len; j++)
-			if (buffer[j])
-				break;
-		if (j == len)
-			lseek(file, len, SEEK_CUR);
-		else
-			write(file, buffer, len);
-
-		offset += len;
-		if (cancel || !(i++ % 4))
-			if (cancel || (dlp_OpenConduit(sd) < 0)) {
-				printf("\n   Operation cancelled!\n");
-				dlp_AddSyncLogEntry(sd, "\npilot-getrom ended unexpectedly.\n"
-							"Entire RAM was not fetched.\n");
-				goto cancel;
-			}
-		if (!(i % 8)) {
-			sprintf(print, "%ld", offset);
-			PackRPC(&p, 0xA220, RPC_IntReply,
-				RPC_Ptr(print, strlen(print)),
-				RPC_Short(strlen(print)), RPC_Short(92),
-				RPC_Short(28), RPC_End);
-			/* err = */ dlp_RPC(sd, &p, 0);
-		}
-	}
+	if (dump_memory(sd, file, "RAM", SRAMstart, SRAMlength, offset) < 0)
+		goto cancel;
 
 	end = time(NULL);
         timespent = (end-start);
 	if (!plu_quiet) {
-		printf("   RAM fetch complete\n");
+		printf("\n   RAM fetch complete\n");
 		printf("   RAM fetched in: %d:%02d:%02d\n",timespent/3600, (timespent/60)%60, timespent%60);
 	}
 
@@ -338,7 +490,6 @@ cancel:
 	return 0;
 }
 
-
 int do_get_token(int sd, const char *token)
 {
 	unsigned long t = 0;
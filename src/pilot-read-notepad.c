@@ -47,6 +47,17 @@ const char *progname;
 void write_png( FILE *f, struct NotePad *n );
 #endif
 
+/* One note's record, fetched for the decoding threads */
+struct note_job
+{
+   pi_buffer_t *buffer;
+   struct NotePad n;
+   const struct NotePadAppInfo *nai;
+   int category,
+     action,
+     type;
+};
+
 
 
 
@@ -384,13 +395,75 @@ cleanup:
 }
 
 
+/***********************************************************************
+ *
+ * Function:    decode_note
+ *
+ * Summary:     Unpack a fetched note; runs on a decoding thread
+ *
+ * Parameters:  None
+ *
+ * Return:      1 always
+ *
+ ***********************************************************************/
+static int decode_note( void *item )
+{
+   struct note_job *job = (struct note_job *) item;
+
+   unpack_NotePad( &job->n, job->buffer->data, job->buffer->used );
+   pi_buffer_free( job->buffer );
+   job->buffer = NULL;
+
+   return 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    write_note
+ *
+ * Summary:     List a note or write its picture, in record order
+ *
+ * Parameters:  None
+ *
+ * Return:      Nothing
+ *
+ ***********************************************************************/
+static void write_note( void *item, int decoded )
+{
+   struct note_job *job = (struct note_job *) item;
+
+   switch( job->action )
+     {
+      case NOTEPAD_ACTION_LIST:
+	print_note_info( job->n, *job->nai, job->category );
+	printf( "\n" );
+	free_NotePad( &job->n );
+	break;
+
+      case NOTEPAD_ACTION_OUTPUT:
+	if (!plu_quiet) {
+	   print_note_info( job->n, *job->nai, job->category );
+	}
+	output_picture( job->type, job->n );
+	if (!plu_quiet) {
+	   printf( "\n" );
+	}
+	break;
+     }
+
+   free( job );
+}
+
+
 int main(int argc, const char *argv[])
 {
    int	c,	/* switch */
      db,
      i,
      sd	= -1,
-     action 	= NOTEPAD_ACTION_OUTPUT;
+     action 	= NOTEPAD_ACTION_OUTPUT,
+     jobs	= 1;
 
    int type = NOTE_OUT_PPM;
 
@@ -406,6 +479,7 @@ int main(int argc, const char *argv[])
    struct 	PilotUser User;
    struct 	NotePadAppInfo nai;
    pi_buffer_t *buffer;
+   plu_pipeline_t *pipeline;
 
    poptContext pc;
 
@@ -413,6 +487,7 @@ int main(int argc, const char *argv[])
    	USERLAND_RESERVED_OPTIONS
         {"list", 'l', POPT_ARG_VAL, &action, NOTEPAD_ACTION_LIST, "List Notes on device", NULL},
         {"type", 't', POPT_ARG_STRING, &typename, 0, "Specify picture output type, either \"ppm\" or \"png\"", "type"},
+        {"jobs", 'j', POPT_ARG_INT, &jobs, 0, "Decode up to <jobs> notes at once (0 for one per processor)", "jobs"},
         POPT_TABLEEND
    };
 
@@ -474,13 +549,17 @@ int main(int argc, const char *argv[])
    dlp_ReadAppBlock(sd, db, 0, 0xffff, buffer);
    unpack_NotePadAppInfo( &nai, buffer->data, buffer->used);
 
+   pipeline = plu_pipeline_new( jobs, decode_note, write_note );
+   if( pipeline == NULL )
+     goto error_close;
+
    for (i = 0;; i++)
      {
 	int 	attr,
 		category,
 		len = 0;
 
-	struct 	NotePad n;
+	struct 	note_job *job;
 
 	if( sd )
 	  {
@@ -497,27 +576,25 @@ int main(int argc, const char *argv[])
 	if ((attr & dlpRecAttrDeleted) || (attr & dlpRecAttrArchived))
 	  continue;
 
-	unpack_NotePad( &n, buffer->data, buffer->used);
-
-	switch( action )
+	job = calloc( 1, sizeof( struct note_job ));
+	if( job == NULL )
+	  break;
+	job->buffer = pi_buffer_new( buffer->used );
+	if( job->buffer == NULL )
 	  {
-	   case NOTEPAD_ACTION_LIST:
-	     print_note_info( n, nai, category );
-	     printf( "\n" );
-	     break;
-
-	   case NOTEPAD_ACTION_OUTPUT:
-	     if (!plu_quiet) {
-	        print_note_info( n, nai, category );
-	     }
-	     output_picture( type, n );
-	     if (!plu_quiet) {
-	        printf( "\n" );
-	     }
+	     free( job );
 	     break;
 	  }
+	pi_buffer_append( job->buffer, buffer->data, buffer->used );
+	job->nai = &nai;
+	job->category = category;
+	job->action = action;
+	job->type = type;
+
+	plu_pipeline_submit( pipeline, job );
      }
 
+   plu_pipeline_finish( pipeline );
 
    if( sd ) {
 	/* Close the database */
@@ -103,6 +103,7 @@ struct PalmPixState_pi_socket
 	struct PalmPixState state;
 	int 	sd,
 		db;
+	pi_buffer_t *buffer;
 };
 
 
@@ -120,20 +121,59 @@ struct PalmPixState_pi_socket
 static int getrecord_pi_socket (struct PalmPixState *vstate, int recno,
 	void **buf, size_t *bufsize)
 {
-
-	static char buffer[65536];
-    static pi_buffer_t fakebuf;
-
 	struct PalmPixState_pi_socket *state =
 		(struct PalmPixState_pi_socket *) vstate;
 
-	*buf = buffer;
-    fakebuf.data = buffer;
-    fakebuf.allocated = 0;
-    fakebuf.used = 0;
+	if (dlp_ReadRecordByIndex (state->sd, state->db, recno, state->buffer,
+		NULL, NULL, NULL) < 0)
+		return -1;
 
-	return dlp_ReadRecordByIndex (state->sd, state->db, recno, &fakebuf,
-		NULL, NULL, NULL) < 0 ? 1 : 0;
+	*buf = state->buffer->data;
+	*bufsize = state->buffer->used;
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    PalmPixJob
+ *
+ * Summary:     One picture's records, fetched for the decoding threads
+ *
+ ***********************************************************************/
+struct PalmPixJob
+{
+	struct PalmPixState state;
+	struct PalmPixHeader header;
+	int 	first,
+		count;
+	pi_buffer_t **records;
+};
+
+
+/***********************************************************************
+ *
+ * Function:    getrecord_job
+ *
+ * Summary:     Serve a record from those fetched for the job
+ *
+ * Parameters:  None
+ *
+ * Returns:     0 when the record was fetched, -1 otherwise
+ *
+ ***********************************************************************/
+static int getrecord_job (struct PalmPixState *vstate, int recno,
+	void **buf, size_t *bufsize)
+{
+	struct PalmPixJob *job = (struct PalmPixJob *) vstate;
+
+	recno -= job->first;
+	if (recno < 0 || recno >= job->count || job->records[recno] == NULL)
+		return -1;
+
+	*buf = job->records[recno]->data;
+	*bufsize = job->records[recno]->used;
+	return 0;
 }
 
 
@@ -301,39 +341,137 @@ static int write_one (const struct PalmPixHeader *header,
 
 /***********************************************************************
  *
- * Function:    write_all
+ * Function:    fetch_job
  *
- * Summary:
+ * Summary:     Copy the records of the picture whose header is record
+ *		RECNO, so that it can be decoded away from the source
+ *
+ * Parameters:  None
+ *
+ * Returns:     The job, or NULL if out of memory
+ *
+ ***********************************************************************/
+static struct PalmPixJob *fetch_job (const struct PalmPixHeader *header,
+	struct PalmPixState *state, int recno)
+{
+	struct PalmPixJob *job;
+	int i;
+
+	job = calloc (1, sizeof (struct PalmPixJob));
+	if (job == NULL)
+		return NULL;
+
+	job->header = *header;
+	job->first = recno;
+	job->count = 4 + header->numRec;
+	job->records = calloc ((size_t) job->count, sizeof (pi_buffer_t *));
+	if (job->records == NULL) {
+		free (job);
+		return NULL;
+	}
+
+	for (i = 0; i < job->count; i++) {
+		void *buffer;
+		size_t bufsize;
+
+		/* a missing record makes the decoder give up on the picture */
+		if (state->getrecord (state, recno + i, &buffer, &bufsize) != 0)
+			continue;
+		job->records[i] = pi_buffer_new (bufsize);
+		if (job->records[i] != NULL)
+			pi_buffer_append (job->records[i], buffer, bufsize);
+	}
+
+	job->state.getrecord = getrecord_job;
+	job->state.output_type = state->output_type;
+	job->state.bias = state->bias;
+	job->state.flags = state->flags;
+
+	return job;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    free_job
+ *
+ * Summary:     Release the records fetched for a job
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void free_job_records (struct PalmPixJob *job)
+{
+	int i;
+
+	if (job->records == NULL)
+		return;
+	for (i = 0; i < job->count; i++)
+		if (job->records[i] != NULL)
+			pi_buffer_free (job->records[i]);
+	free (job->records);
+	job->records = NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    decode_job
+ *
+ * Summary:     Decode a fetched picture; runs on a decoding thread
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nonzero when the picture was decoded
+ *
+ ***********************************************************************/
+static int decode_job (void *item)
+{
+	struct PalmPixJob *job = (struct PalmPixJob *) item;
+	int decoded;
+
+	init_for_ppm (&job->state);
+	decoded = unpack_PalmPix (&job->state, &job->header, job->first,
+		pixName | pixPixmap);
+	free_job_records (job);
+
+	return decoded;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    write_job
+ *
+ * Summary:     Write a decoded picture to <pixname>_pp.ppm or .png
  *
  * Parameters:  None
  *
  * Returns:     Nothing
  *
  ***********************************************************************/
-static int write_all (const struct PalmPixHeader *header,
-	struct PalmPixState *state, int recno, const char *ignored)
+static void write_job (void *item, int decoded)
 {
+	struct PalmPixJob *job = (struct PalmPixJob *) item;
+	struct PalmPixState *state = &job->state;
+	const struct PalmPixHeader *header = &job->header;
 	char fname[FILENAME_MAX], ext[10];
 	FILE *f;
 
-	init_for_ppm (state);
-	if (!unpack_PalmPix (state, header, recno, pixName | pixPixmap)) {
-		/* bail */
-		return recno;
-	}
-
+	if (!decoded)
+		goto done;
 
 	sprintf( fname, "%s", state->pixname );
 
-	if( state->output_type == PALMPIX_OUT_PPM )
+	if( state->output_type == PALMPIX_OUT_PNG )
+		sprintf( ext, "_pp.png" );
+	else
 		sprintf( ext, "_pp.ppm" );
 
-	else if( state->output_type == PALMPIX_OUT_PNG )
-		sprintf( ext, "_pp.png" );
-
-	if (plu_protect_files( fname, ext, sizeof(fname) ) < 1) {
-		return recno;
-	}
+	if (plu_protect_files( fname, ext, sizeof(fname) ) < 1)
+		goto cleanup;
 
 	printf ("Generating %s...\n", fname);
 
@@ -354,12 +492,14 @@ static int write_all (const struct PalmPixHeader *header,
 			fclose (f);
 
                         /* Keep file date the same date as the photo */
+			memset (&timeptr, 0, sizeof (timeptr));
                         timeptr.tm_year = header->year - 1900;
                         timeptr.tm_mon  = header->month -1;
                         timeptr.tm_mday = header->day;
                         timeptr.tm_hour = header->hour;
                         timeptr.tm_min  = header->min;
                         timeptr.tm_sec  = header->sec;
+			timeptr.tm_isdst = -1;
                         timep.actime    = timep.modtime = mktime(&timeptr);
 
                         utime (fname,&timep);
@@ -368,10 +508,56 @@ static int write_all (const struct PalmPixHeader *header,
 			progname, fname);
 	}
 
-		free_PalmPix_data (state);
-		recno = state->highest_recno;
+cleanup:
+	free_PalmPix_data (state);
+done:
+	free_job_records (job);
+	free (job);
+}
 
-	return recno;
+
+/***********************************************************************
+ *
+ * Function:    write_all
+ *
+ * Summary:     Fetch every picture in the database and hand it to a
+ *		pipeline which decodes and writes it
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void write_all (struct PalmPixState *state, int n, int jobs)
+{
+	plu_pipeline_t *pipeline;
+	int i;
+
+	pipeline = plu_pipeline_new (jobs, decode_job, write_job);
+	if (pipeline == NULL) {
+		fprintf (stderr, "%s: out of memory\n", progname);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		void *buffer;
+		size_t bufsize;
+		struct PalmPixHeader header;
+		struct PalmPixJob *job;
+
+		if (state->getrecord (state, i, &buffer, &bufsize) != 0
+			|| unpack_PalmPixHeader (&header, buffer, bufsize) == 0)
+			continue;
+
+		job = fetch_job (&header, state, i);
+		if (job == NULL)
+			break;
+		plu_pipeline_submit (pipeline, job);
+
+		i += 3 + header.numRec;
+	}
+
+	plu_pipeline_finish (pipeline);
 }
 
 
@@ -441,10 +627,12 @@ int main (int argc, const char **argv) {
 	sd	= -1,
 	output_type = PALMPIX_OUT_PPM,
 	bias = 50,
-	flags = 0;
+	flags = 0,
+	jobs = 1;
 
+	/* NULL converts every picture */
 	int (*action) (const struct PalmPixHeader *, struct PalmPixState *,
-		int, const char *) = write_all;
+		int, const char *) = NULL;
 
 	const 	char *pixname 	= NULL;
 	const char
@@ -462,6 +650,7 @@ int main (int argc, const char **argv) {
 		{"bias", 'b', POPT_ARG_INT,    &bias,      0 , "lighten or darken the image (0..49 darken, 51..100 lighten)", "bias"},
 		{"list", 'l', POPT_ARG_NONE,   NULL,      'l', "List picture information instead of converting", NULL},
 		{"name", 'n', POPT_ARG_STRING, &pixname,  'n', "Convert only <name>, and output to STDOUT as type", "name"},
+		{"jobs", 'j', POPT_ARG_INT,    &jobs,      0 , "Decode up to <jobs> pictures at once (0 for one per processor)", "jobs"},
 		POPT_TABLEEND
 	};
 
@@ -527,17 +716,22 @@ int main (int argc, const char **argv) {
 					printf ("%s:\n", file_arg);
 
 				pi_file_get_info (f, &info);
-                if (info.flags & dlpDBFlagResource) {
+				if (!(info.flags & dlpDBFlagResource)) {
 
 				struct PalmPixState_pi_file s;
 				int n = 0;
 
 				s.state.output_type = output_type;
+				s.state.bias = bias;
+				s.state.flags = flags;
 
 				pi_file_get_entries (f, &n);
 				s.state.getrecord = getrecord_pi_file;
 				s.f = f;
-				read_db (&s.state, n, action, pixname);
+				if (action == NULL)
+					write_all (&s.state, n, jobs);
+				else
+					read_db (&s.state, n, action, pixname);
 				} else {
 				fprintf (stderr,
 					"   ERROR: %s is not a valid record database\n",
@@ -575,7 +769,12 @@ int main (int argc, const char **argv) {
 			s.state.getrecord = getrecord_pi_socket;
 			s.sd = sd;
 			s.db = db;
-			read_db (&s.state, n, action, pixname);
+			s.buffer = pi_buffer_new (65536);
+			if (action == NULL)
+				write_all (&s.state, n, jobs);
+			else
+				read_db (&s.state, n, action, pixname);
+			pi_buffer_free (s.buffer);
 			dlp_CloseDB (sd, db);
 
 			dlp_AddSyncLogEntry (sd,
@@ -54,6 +54,16 @@ struct ss_state {
 	unsigned char *pix_map;
 };
 
+/* One screenshot's records, fetched for the decoding threads */
+struct ss_job {
+	struct ss_state state;
+	pi_buffer_t *pixelBuf;
+	unsigned long clut[256];
+	int mask,
+	  recs,
+	  type;
+};
+
 
 
 #define max(a,b) (( a > b ) ? a : b )
@@ -173,31 +183,166 @@ void write_ppm ( char *fname, struct ss_state *state)
 
 /***********************************************************************
  *
- * Function:	 WritePictures
+ * Function:	 DecodePicture
  *
- * Summary:	FIXME
+ * Summary:	Convert a fetched screenshot to RGB; runs on a decoding
+ *		thread
  *
- * Parameters:
+ * Parameters:	the fetched screenshot
  *
- * Returns:
+ * Returns:	1 success, 0 out of memory
  *
  ***********************************************************************/
-void WritePictures (int sd, int db, int type )
+static int DecodePicture (void *item)
 {
+	struct ss_job *job = (struct ss_job *) item;
+	struct ss_state *state = &job->state;
+	unsigned char *data = job->pixelBuf->data;
+	int i, j, k, val, mask = job->mask;
+
+	state->pix_map = malloc( state->h * state->w * 3 );
+	if( !state->pix_map )
+		return 0;
+
+	switch( state->depth )
+	{
+		case 1:
+		case 2:
+		case 4:
+			for( i = 0; i < state->h*state->w/(8/state->depth); i++)
+			{
+				for( j=(8/state->depth-1), k=0; j >= 0; j--, k++ )
+				{
+					/* get right bits */
+					val = ((data[i] >> (j * state->depth)) & mask);
+					/* invert */
+					val = mask - val;
+					/* stretch */
+					val *= (255/mask);
+
+					state->pix_map[3*(i*(8/state->depth)+k)] = val;
+					state->pix_map[3*(i*(8/state->depth)+k)+1] = val;
+					state->pix_map[3*(i*(8/state->depth)+k)+2] = val;
+				}
+ 			}
+	 	break;
+
+		case 8:
+			for( i = 0; i < state->h*state->w; i++)
+			{
+				state->pix_map[3*i] =
+				*(1 + (char *)&job->clut[data[i]]);
+				state->pix_map[3*i+1] =
+				*(2 + (char *)&job->clut[data[i]]);
+				state->pix_map[3*i+2] =
+				*(3 + (char *)&job->clut[data[i]]);
+			}
+		break;
+
+		case 16:
+			for( i = 0; i < state->h*state->w; i++)
+			{
+				state->pix_map[i*3] = data[i*2] & 0xF8;
+				state->pix_map[i*3+1] = ((data[i*2] & 0x07 ) << 5)
+				+ (( data[i*2+1] & 0xE0 ) >> 3 );
+				state->pix_map[i*3+2] = ( data[i*2+1] & 0x1F ) << 3;
+			}
+			break;
+
+		default:
+			fprintf( stderr, "I'm out of my depth :)\n" );
+		break;
+	}
+
+	pi_buffer_free (job->pixelBuf);
+	job->pixelBuf = NULL;
+
+	return 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:	 WritePicture
+ *
+ * Summary:	Write a converted screenshot to ScreenShot<n>.ppm or .png
+ *
+ * Parameters:	the converted screenshot, whether it could be converted
+ *
+ * Returns:	Nothing
+ *
+ ***********************************************************************/
+static void WritePicture (void *item, int decoded)
+{
+	struct ss_job *job = (struct ss_job *) item;
+	static int imgNum = 0;
 	char fname[FILENAME_MAX];
 	char extension[8];
-	int i, len, idx = 0, recs, imgNum = 0;
-//	unsigned char inBuf[61440], *pixelBuf;
-	pi_buffer_t *inBuf, *pixelBuf;
-	unsigned long clut[256], magic;
-	int attr, category, val, mask, j, k;
-	struct ss_state state;
 
-	if( type == OUT_PPM )
-		sprintf (extension, ".ppm");
-	else if( type == OUT_PNG )
+	if( !decoded )
+	{
+		fprintf( stderr, "Memory Allocation failed\n" );
+		goto cleanup;
+	}
+
+	if( job->type == OUT_PNG )
 		sprintf (extension, ".png");
 	else
+		sprintf (extension, ".ppm");
+
+	sprintf (fname, "ScreenShot%d", ++imgNum );
+
+	if (plu_protect_files (fname, extension, sizeof(fname)) < 1) {
+		goto cleanup;
+	}
+
+	printf ("Generating %s...\n", fname);
+	fprintf( stderr, "height: %d width: %d records: %d bit depth: %d\n"
+		, job->state.h, job->state.w, job->recs, job->state.depth );
+
+	if( job->type == OUT_PPM )
+		write_ppm( fname, &job->state );
+	#ifdef HAVE_PNG
+	else
+		write_png( fname, &job->state );
+	#endif
+
+cleanup:
+	if (job->pixelBuf)
+		pi_buffer_free (job->pixelBuf);
+	free( job->state.pix_map );
+	free( job );
+}
+
+
+/***********************************************************************
+ *
+ * Function:	 WritePictures
+ *
+ * Summary:	Fetch every screenshot in the database and hand it to a
+ *		pipeline which converts and writes it
+ *
+ * Parameters:	the open database, the output type, the number of
+ *		screenshots to convert at once
+ *
+ * Returns:	Nothing
+ *
+ ***********************************************************************/
+void WritePictures (int sd, int db, int type, int jobs )
+{
+	int i, len, idx = 0, recs;
+	pi_buffer_t *inBuf;
+	unsigned long magic;
+	int attr, category;
+	struct ss_job *job;
+	struct ss_state *state;
+	plu_pipeline_t *pipeline;
+
+	if( type != OUT_PPM && type != OUT_PNG )
+		return;
+
+	pipeline = plu_pipeline_new( jobs, DecodePicture, WritePicture );
+	if( !pipeline )
 		return;
 
 	inBuf = pi_buffer_new (61440);
@@ -215,10 +360,19 @@ void WritePictures (int sd, int db, int type )
 			}
 
 			idx++;
-			state.w = ( inBuf->data[4] << 8 )+ inBuf->data[5];
-			state.h = ( inBuf->data[6] << 8 ) + inBuf->data[7];
+			job = calloc( 1, sizeof( struct ss_job ));
+			if( !job )
+			{
+				fprintf( stderr, "Memory Allocation failed\n" );
+				break;
+			}
+			job->type = type;
+			state = &job->state;
+
+			state->w = ( inBuf->data[4] << 8 )+ inBuf->data[5];
+			state->h = ( inBuf->data[6] << 8 ) + inBuf->data[7];
 			recs = inBuf->data[9];
-			state.depth = inBuf->data[8];
+			state->depth = inBuf->data[8];
 			magic = ((unsigned long *)inBuf->data)[0];
 
 			if(  magic != 0xBECEDEFE && magic != 0xDEDEFEFE )
@@ -226,148 +380,75 @@ void WritePictures (int sd, int db, int type )
 				 /* no magic must version 1 db */
 	//			 fprintf( stderr, "No Magic !\n" );
 
-				 state.w = 160;
-				 state.h = 160;
+				 state->w = 160;
+				 state->h = 160;
 				 recs = 1;
 
 				switch( len )
 				{
 				case 3200:
-					state.depth = 1;
-					mask = 1;
+					state->depth = 1;
+					job->mask = 1;
 					break;
 
 				case 6400:
-					state.depth = 2;
-					mask = 3;
+					state->depth = 2;
+					job->mask = 3;
 					break;
 
 				case 12800:
-					state.depth = 4;
-					mask = 0x0f;
+					state->depth = 4;
+					job->mask = 0x0f;
 					break;
 
 				case 26624:
-					state.depth = 8;
+					state->depth = 8;
 					break;
 
 				case 51200:
-					state.depth = 16;
+					state->depth = 16;
 					break;
 
 				default:
 					/* unknown record */
 					/* get next */
 					fprintf( stderr, "Unknown record" );
+					free( job );
 					continue;
 				}
 			}
 
-			pixelBuf
-			= pi_buffer_new (state.h * state.w * state.depth / 8 + 10 + 1024);
+			job->pixelBuf
+			= pi_buffer_new (state->h * state->w * state->depth / 8 + 10 + 1024);
 
-	//		pixelBuf = malloc( state.h * state.w * state.depth / 8 + 10 + 1024 );
-			state.pix_map = malloc( state.h * state.w * 3 );
-
-			if( !pixelBuf || !state.pix_map )
+			if( !job->pixelBuf )
 			{
 				fprintf( stderr, "Memory Allocation failed\n" );
-				return;
+				free( job );
+				break;
 			}
 
 			if( magic == 0xBECEDEFE || magic == 0xDEDEFEFE )
-				memcpy( pixelBuf->data, &inBuf->data[10], len - 10 );
+				memcpy( job->pixelBuf->data, &inBuf->data[10], len - 10 );
 			else
-				memcpy( pixelBuf->data, inBuf->data, len );
+				memcpy( job->pixelBuf->data, inBuf->data, len );
 
 			for( i=1; i< recs; i++ )
 			{
 				len =
 				dlp_ReadRecordByIndex (sd, db, idx, inBuf, 0, &attr, &category);
-				memcpy( &pixelBuf->data[i*61440-10], inBuf->data, len );
+				memcpy( &job->pixelBuf->data[i*61440-10], inBuf->data, len );
 				idx++;
 			}
 
-			sprintf (fname, "ScreenShot%d", ++imgNum );
-
-			if (plu_protect_files (fname, extension, sizeof(fname)) < 1) {
-				goto cleanup;
-			}
-
-			printf ("Generating %s...\n", fname);
-			fprintf( stderr, "height: %d width: %d records: %d bit depth: %d\n"
-				, state.h, state.w, recs, state.depth );
-
-			if( state.depth == 8 )
-			memcpy( clut, &inBuf->data[len-1024], 1024 );
-
-			switch( state.depth )
-			{
-				case 1:
-				case 2:
-				case 4:
-					for( i = 0; i < state.h*state.w/(8/state.depth); i++)
-					{
-						for( j=(8/state.depth-1), k=0; j >= 0; j--, k++ )
-						{
-							/* get right bits */
-							val = ((pixelBuf->data[i] >> (j * state.depth)) & mask);
-							/* invert */
-							val = mask - val;
-							/* stretch */
-							val *= (255/mask);
-
-							state.pix_map[3*(i*(8/state.depth)+k)] = val;
-							state.pix_map[3*(i*(8/state.depth)+k)+1] = val;
-							state.pix_map[3*(i*(8/state.depth)+k)+2] = val;
-						}
-		 			}
-			 	break;
-
-				case 8:
-					for( i = 0; i < state.h*state.w; i++)
-					{
-						state.pix_map[3*i] =
-						*(1 + (char *)&clut[pixelBuf->data[i]]);
-						state.pix_map[3*i+1] =
-						*(2 + (char *)&clut[pixelBuf->data[i]]);
-						state.pix_map[3*i+2] =
-						*(3 + (char *)&clut[pixelBuf->data[i]]);
-					}
-				break;
-
-				case 16:
-					for( i = 0; i < state.h*state.w; i++)
-					{
-						state.pix_map[i*3] = pixelBuf->data[i*2] & 0xF8;
-						state.pix_map[i*3+1] = ((pixelBuf->data[i*2] & 0x07 ) << 5)
-						+ (( pixelBuf->data[i*2+1] & 0xE0 ) >> 3 );
-						state.pix_map[i*3+2] = ( pixelBuf->data[i*2+1] & 0x1F ) << 3;
-					}
-					break;
+			job->recs = recs;
+			if( state->depth == 8 )
+			memcpy( job->clut, &inBuf->data[len-1024], 1024 );
 
-				default:
-					fprintf( stderr, "I'm out of my depth :)\n" );
-				break;
-			}
-
-			if( type == OUT_PPM )
-				write_ppm( fname, &state );
-			#ifdef HAVE_PNG
-			else
-				write_png( fname, &state );
-			#endif
-
-cleanup:
-			pi_buffer_free (pixelBuf);
-			//	  free( pixelBuf );
-			free( state.pix_map );
-
-			//	  fclose (f);
+			plu_pipeline_submit( pipeline, job );
 		}
-	else
-		return;
 
+	plu_pipeline_finish( pipeline );
 	pi_buffer_free (inBuf);
 }
 
@@ -377,10 +458,11 @@ int main (int argc, const char *argv[])
 	 db,
 	 sd = -1,
 	 dbcount = 0,
-	  type = OUT_PPM;
+	  type = OUT_PPM,
+	  jobs = 1;
 
 	const char
-                *pformat;
+                *pformat = "ppm";
 
 	struct PilotUser User;
 
@@ -389,6 +471,7 @@ int main (int argc, const char *argv[])
 	struct poptOption options[] = {
 		USERLAND_RESERVED_OPTIONS
 		{"format", 	'f', POPT_ARG_STRING, &pformat, 0, "Specify picture output type (ppm or png)"},
+		{"jobs", 	'j', POPT_ARG_INT, &jobs, 0, "Convert up to <jobs> screenshots at once (0 for one per processor)", "jobs"},
 		POPT_TABLEEND
 	};
 
@@ -441,7 +524,7 @@ int main (int argc, const char *argv[])
 		goto error_close;
 	}
 
-	WritePictures (sd, db, type );
+	WritePictures (sd, db, type, jobs );
 
 	if (sd)
 	{
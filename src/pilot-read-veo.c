@@ -48,10 +48,22 @@
 #define VEO_COLOUR_CORRECT 0x01
 #define VEO_BIAS           0x12
 
-uint8_t redLUT[256], greenLUT[256], blueLUT[256];
-
 double bias_factor = 0.50;
 
+/* One picture's records, fetched for the decoding threads */
+struct VeoJob {
+	struct Veo v;
+	long	flags;
+	int	type,
+		nrecs;
+	pi_buffer_t **records;		/* record 0 is the header */
+	unsigned char *bayer,		/* every row of bayer data */
+		*pixmap;		/* the RGB picture */
+	uint8_t redLUT[256],
+		greenLUT[256],
+		blueLUT[256];
+};
+
 
 /***********************************************************************
  *
@@ -386,43 +398,49 @@ int Decode (unsigned char *inP, unsigned char *outP, short w)
 
 /***********************************************************************
  *
- * Function:	GetPicData
+ * Function:	DecodeRecords
  *
- * Summary:     Requests one record of bayer data from the palm
- *              and then decodes it.
+ * Summary:     Decode every record of bayer data fetched for the picture
  *
- * Parameters:  r - the row we are looking for
- *              v - veo record
- *              row - the bayer data containg our row
+ * Parameters:  job - the fetched picture
  *
- * Returns:     the size of the encoded record
+ * Returns:     1 success
+ *              0 out of memory
  *
  ***********************************************************************/
-static int
-  GetPicData (uint32_t flags, int r, struct Veo *v, unsigned char *row)
+static int DecodeRecords (struct VeoJob *job)
 {
-   int attr, category, len;
-   pi_buffer_t *tmpRow;
-
-   if (!v->sd)
-	 return (-1);
+   int i, blocks;
 
    /* Each record contains four rows of bayer data */
-   /* The compressed record can be upto twice as large as the
-    * uncompressed record ??? */
-   tmpRow = pi_buffer_new (5120);
-
-   len = dlp_ReadRecordByIndex (v->sd, v->db, 1 + r / 4, tmpRow, 0,
-								&attr, &category);
-
-   if (len < 0)
+   blocks = (job->v.height + 3) / 4;
+   job->bayer = calloc ((size_t) blocks * 4, job->v.width);
+   if (job->bayer == NULL)
 	 return 0;
 
-   Decode (tmpRow->data, row, v->width);
+   for (i = 0; i < blocks && 1 + i < job->nrecs; i++)
+	 if (job->records[1 + i] != NULL)
+	   Decode (job->records[1 + i]->data,
+			   job->bayer + i * 4 * job->v.width, job->v.width);
 
-   pi_buffer_free(tmpRow);
+   return 1;
+}
 
-   return (len);
+/***********************************************************************
+ *
+ * Function:	GetPicData
+ *
+ * Summary:     Find the decoded record of bayer data holding a row
+ *
+ * Parameters:  r - the row we are looking for
+ *              job - the decoded picture
+ *
+ * Returns:     the first of the four rows in the record
+ *
+ ***********************************************************************/
+static unsigned char *GetPicData (int r, struct VeoJob *job)
+{
+   return job->bayer + (r / 4) * 4 * job->v.width;
 }
 
 #define max(a,b) (( a > b ) ? a : b )
@@ -457,8 +475,9 @@ static void Bias( double bias, int width, int height, uint8_t *data )
      }
 }
 
-int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, long flags )
+int ColourCorrect (struct VeoJob *job, uint8_t *red, uint8_t *green, uint8_t *blue, long flags )
 {
+	struct Veo *v = &job->v;
 	uint8_t *tmpRow;
 	uint8_t gMin, gMax, rMin, rMax, bMin, bMax;
 	float gInc, rInc, bInc, gCur, rCur, bCur;
@@ -477,9 +496,7 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
 	gMin = rMin = bMin = 255;
 	gMax = rMax = bMax = 0;
 
-	tmpRow = malloc( 2560 );
-
-	GetPicData( 0, 0, v, tmpRow );
+	tmpRow = GetPicData( 0, job );
 
 	for( i=0; i<width; i += 2 )
 	{
@@ -519,7 +536,7 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
 		}
 	}
 
-	GetPicData( 0, height/2, v, tmpRow );
+	tmpRow = GetPicData( height/2, job );
 
 	for( i=0; i<width; i += 2 )
 	{
@@ -558,7 +575,7 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
 		}
 	}
 
-	GetPicData( 0, height-1, v, tmpRow );
+	tmpRow = GetPicData( height-1, job );
 
 	for( i=0; i<width; i += 2 )
 	{
@@ -651,8 +668,6 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
 		}
 	 }
 
-	free( tmpRow );
-
 	return( 1 );
 }
 
@@ -660,72 +675,30 @@ int ColourCorrect (struct Veo *v, uint8_t *red, uint8_t *green, uint8_t *blue, l
  *
  * Function:	Gen24bitRow
  *
- * Summary:     It requests some decoded bayer pattern data from the palm
- *              and then interpolates one RGB row from that data.
+ * Summary:     Interpolates one RGB row from the decoded bayer pattern
+ *              data of the rows around it.
  *
  * Parameters:  r - the row to be interpolated
- *              v - veo record
+ *              job - the decoded picture
  *              row - the returned RGB data
  * Returns:     1 success
- *              -1 failure
  *
  ***********************************************************************/
-int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
+int Gen24bitRow (struct VeoJob *job, int r, unsigned char *row)
 {
-   int i, rawW, rawH, modR = r % 4;
+   struct Veo *v = &job->v;
+   long flags = job->flags;
+   int i, rawW;
 
-   unsigned char rowA[2560], rowB[2560];
    unsigned char *rAP, *rBP, *rCP;
 
    rawW = v->width / 2;
-   rawH = v->height / 2;
-
-   if (r == 0)
-	 {
-		if (-1 == GetPicData (flags, r, v, rowB))
-		  return (-1);
-		rAP = rBP = rowB;
-		rCP = rowB + v->width;
-
-	 }
-   else if (r == (v->height - 1))
-	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * 2;
-		rCP = rBP = rowA + v->width * 3;
 
-	 }
-   else if (modR == 0)
-	 {
-		if (-1 == GetPicData (flags, r - 1, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * 3;
-		if (-1 == GetPicData (flags, r, v, rowB))
-		  return (-1);
-		rBP = rowB;
-		rCP = rowB + v->width;
-
-	 }
-   else if (modR == 3)
-	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * 2;
-		rBP = rowA + v->width * 3;
-		if (-1 == GetPicData (flags, r + 1, v, rowB))
-		  return (-1);
-		rCP = rowB;
-
-	 }
-   else
-	 {
-		if (-1 == GetPicData (flags, r, v, rowA))
-		  return (-1);
-		rAP = rowA + v->width * (modR - 1);
-		rBP = rowA + v->width * modR;
-		rCP = rowA + v->width * (modR + 1);
-	 }
+   /* The rows above and below; the first and last rows are their
+    * own neighbours on the outside */
+   rAP = job->bayer + (r > 0 ? r - 1 : 0) * v->width;
+   rBP = job->bayer + r * v->width;
+   rCP = job->bayer + (r < v->height - 1 ? r + 1 : r) * v->width;
 
    /* Bayer Pattern
     * GBGB
@@ -820,9 +793,9 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
 	 {
 		for (i = 0; i < v->width * 3; i += 3)
 		  {
-			 row[i] = redLUT[row[i]];
-			 row[i + 1] = greenLUT[row[i + 1]];
-			 row[i + 2] = blueLUT[row[i + 2]];
+			 row[i] = job->redLUT[row[i]];
+			 row[i + 1] = job->greenLUT[row[i + 1]];
+			 row[i + 2] = job->blueLUT[row[i + 2]];
 		  }
 	 }
 
@@ -844,9 +817,9 @@ int Gen24bitRow (long flags, int r, struct Veo *v, unsigned char *row)
  *
  ***********************************************************************/
 #ifdef HAVE_PNG
-void write_png (FILE * f, struct Veo *v, long flags)
+void write_png (FILE * f, struct VeoJob *job)
 {
-   unsigned char outBuf[2560];
+   struct Veo *v = &job->v;
    int i;
    png_structp png_ptr;
    png_infop info_ptr;
@@ -868,7 +841,6 @@ void write_png (FILE * f, struct Veo *v, long flags)
    if (setjmp (png_jmpbuf (png_ptr)))
 	 {
 		png_destroy_write_struct (&png_ptr, &info_ptr);
-		fclose (f);
 		return;
 	 }
 
@@ -881,11 +853,7 @@ void write_png (FILE * f, struct Veo *v, long flags)
    png_write_info (png_ptr, info_ptr);
 
    for (i = 0; i < v->height; i++)
-	 {
-		Gen24bitRow (flags, i, v, outBuf);
-		png_write_row (png_ptr, outBuf);
-		png_write_flush (png_ptr);
-	 }
+	 png_write_row (png_ptr, job->pixmap + i * v->width * 3);
 
    png_write_end (png_ptr, info_ptr);
    png_destroy_write_struct (&png_ptr, &info_ptr);
@@ -904,10 +872,9 @@ void write_png (FILE * f, struct Veo *v, long flags)
  * Returns:     Nothing
  *
  ***********************************************************************/
-void write_ppm (FILE * f, struct Veo *v, long flags)
+void write_ppm (FILE * f, struct VeoJob *job)
 {
-   unsigned char outBuf[2560];
-   int i;
+   struct Veo *v = &job->v;
 
    fprintf (f, "P6\n# ");
 
@@ -916,46 +883,162 @@ void write_ppm (FILE * f, struct Veo *v, long flags)
 
    fprintf (f, "%d %d\n255\n", v->width, v->height);
 
-   for (i = 0; i < v->height; i++)
-	 {
-		Gen24bitRow (flags, i, v, outBuf);
+   fwrite (job->pixmap, (size_t) v->width * 3, v->height, f);
+}
+
+/***********************************************************************
+ *
+ * Function:    FreeRecords
+ *
+ * Summary:     Release the records fetched for a picture
+ *
+ * Parameters:  job - the fetched picture
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void FreeRecords (struct VeoJob *job)
+{
+   int i;
 
-		fwrite (outBuf, v->width * 3, 1, f);
+   if (job->records == NULL)
+	 return;
+
+   for (i = 0; i < job->nrecs; i++)
+	 if (job->records[i] != NULL)
+	   pi_buffer_free (job->records[i]);
+   free (job->records);
+   job->records = NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    FetchPicture
+ *
+ * Summary:     Read all the records of an open Veo database
+ *
+ * Parameters:  sd, db - the open database
+ *              name - the database name, which names the picture
+ *
+ * Returns:     the fetched picture, or NULL on error
+ *
+ ***********************************************************************/
+static struct VeoJob *FetchPicture (int sd, int db, const char *name,
+	int type, long flags)
+{
+   struct VeoJob *job;
+   int i, attr, category;
+
+   job = calloc (1, sizeof (struct VeoJob));
+   if (job == NULL)
+	 return NULL;
+
+   strncpy (job->v.name, name, sizeof (job->v.name) - 1);
+   job->v.sd = sd;
+   job->v.db = db;
+   job->type = type;
+   job->flags = flags;
+
+   if (dlp_ReadOpenDBInfo (sd, db, &job->nrecs) < 0 || job->nrecs < 1)
+	 goto fail;
+   job->records = calloc ((size_t) job->nrecs, sizeof (pi_buffer_t *));
+   if (job->records == NULL)
+	 goto fail;
+
+   /* The compressed record can be upto twice as large as the
+    * uncompressed record ??? */
+   for (i = 0; i < job->nrecs; i++)
+	 {
+		job->records[i] = pi_buffer_new (5120);
+		if (job->records[i] == NULL
+			|| dlp_ReadRecordByIndex (sd, db, i, job->records[i], 0,
+				&attr, &category) < 0)
+		  goto fail;
 	 }
+
+   unpack_Veo (&job->v, job->records[0]->data, job->records[0]->used);
+   return job;
+
+ fail:
+   FreeRecords (job);
+   free (job);
+   return NULL;
+}
+
+/***********************************************************************
+ *
+ * Function:    DecodePicture
+ *
+ * Summary:     Decode and colour correct a fetched picture; runs on a
+ *              decoding thread
+ *
+ * Parameters:  item - the fetched picture
+ *
+ * Returns:     1 success
+ *              0 failure
+ *
+ ***********************************************************************/
+static int DecodePicture (void *item)
+{
+   struct VeoJob *job = (struct VeoJob *) item;
+   int i, decoded = 0;
+
+   if (job->v.width == 0 || !DecodeRecords (job))
+	 goto done;
+
+   job->pixmap = malloc ((size_t) job->v.width * job->v.height * 3);
+   if (job->pixmap == NULL)
+	 goto done;
+
+   ColourCorrect (job, job->redLUT, job->greenLUT, job->blueLUT,
+				  job->flags);
+
+   for (i = 0; i < job->v.height; i++)
+	 Gen24bitRow (job, i, job->pixmap + i * job->v.width * 3);
+   decoded = 1;
+
+ done:
+   free (job->bayer);
+   job->bayer = NULL;
+   FreeRecords (job);
+   return decoded;
 }
 
 /***********************************************************************
  *
  * Function:    WritePicture
  *
- * Summary:	FIXME
+ * Summary:	Write a decoded picture to <name>.ppm or <name>.png
  *
- * Parameters:
+ * Parameters:  item - the decoded picture
+ *              decoded - whether it could be decoded
  *
- * Returns:
+ * Returns:     Nothing
  *
  ***********************************************************************/
-void WritePicture (int sd, int db, int type, char *name, const char *progname, long flags)
+void WritePicture (void *item, int decoded)
 {
+   struct VeoJob *job = (struct VeoJob *) item;
    char fname[FILENAME_MAX];
    FILE *f;
    char extension[8];
-   static int len;
-   struct Veo v;
-   pi_buffer_t *inBuf;
-   int attr, category;
 
-   if (type == VEO_OUT_PNG)
+   if (!decoded)
+	 {
+		fprintf (stderr, "read-veo: can't decode %s\n", job->v.name);
+		goto done;
+	 }
+
+   if (job->type == VEO_OUT_PNG)
 	 sprintf (extension, ".png");
-   else if (type == VEO_OUT_PPM)
+   else
 	 sprintf (extension, ".ppm");
 
-   sprintf (fname, "%s", name);
-   strcpy (v.name, name);
+   sprintf (fname, "%s", job->v.name);
 
 	if (plu_protect_files (fname, extension, sizeof(fname) ) < 1) {
 		/* no suitable filename could be found. */
-		return;
+		goto done;
 	}
 
    printf ("Generating %s...\n", fname);
@@ -964,35 +1047,24 @@ void WritePicture (int sd, int db, int type, char *name, const char *progname, l
 
    if (f)
 	 {
-		if (sd)
-		  {
-             inBuf = pi_buffer_new (2560);
-			 len =
-			   dlp_ReadRecordByIndex (sd, db, 0, inBuf, 0, &attr, &category);
-			 unpack_Veo (&v, inBuf->data, inBuf->used);
-             pi_buffer_free (inBuf);
-			 v.sd = sd;
-			 v.db = db;
-		  }
-		else
-		  return;
-
-		ColourCorrect (&v, redLUT, greenLUT, blueLUT, flags);
-
-		if (type == VEO_OUT_PPM)
-		  write_ppm (f, &v, flags);
+		if (job->type == VEO_OUT_PPM)
+		  write_ppm (f, job);
 #ifdef HAVE_PNG
-		else if (type == VEO_OUT_PNG)
-		  write_png (f, &v, flags);
+		else if (job->type == VEO_OUT_PNG)
+		  write_png (f, job);
 #endif
 
 		fclose (f);
 	 }
    else
 	 {
-		fprintf (stderr, "%s: can't write to %s\n", progname, fname);
+		fprintf (stderr, "read-veo: can't write to %s\n", fname);
 	 }
 
+ done:
+   FreeRecords (job);
+   free (job->pixmap);
+   free (job);
 }
 
 int main (int argc, const char *argv[])
@@ -1004,10 +1076,13 @@ int main (int argc, const char *argv[])
 	action = VEO_ACTION_OUTPUT,
 	dbcount = 0,
 	type = VEO_OUT_PPM,
-	bias = 50;
+	bias = 50,
+	jobs = 1;
 	long flags = 0;
 	struct DBInfo info;
 	pi_buffer_t *buf;
+	plu_pipeline_t *pipeline = NULL;
+	struct VeoJob *job;
 
 	const char
                 *picname = NULL;
@@ -1031,6 +1106,8 @@ int main (int argc, const char *argv[])
 		 "colour correct the output colours", NULL},
 		{"type", 't', POPT_ARG_STRING, &imgtype, 't',
 		 "Specify picture output type (ppm or png)", "[ppm|png]"},
+		{"jobs", 'j', POPT_ARG_INT, &jobs, 0,
+		 "Decode up to <jobs> photos at once (0 for one per processor)", "jobs"},
 		POPT_TABLEEND
 	};
 
@@ -1089,6 +1166,10 @@ int main (int argc, const char *argv[])
    if (dlp_ReadUserInfo (sd, &User) < 0)
 	 goto error_close;
 
+   pipeline = plu_pipeline_new (jobs, DecodePicture, WritePicture);
+   if (pipeline == NULL)
+	 goto error_close;
+
    buf = pi_buffer_new (sizeof (struct DBInfo));
 	for (;;) {
 		if (dlp_ReadDBList (sd, 0, 0x80, i, buf) < 0)
@@ -1114,19 +1195,25 @@ int main (int argc, const char *argv[])
 					   goto error_close;
 					}
 
-				  WritePicture(sd, db, type, info.name, "read-veo", flags);
-
+				  job = FetchPicture (sd, db, info.name, type, flags);
 
 				if (sd) {
 					   /* Close the database */
 					   dlp_CloseDB (sd, db);
 					}
 
+				  if (job != NULL)
+					plu_pipeline_submit (pipeline, job);
+				  else
+					fprintf (stderr, "   ERROR: Unable to read %s\n",
+						info.name);
+
 				  break;
 			   }
 		  }
 	 }
     pi_buffer_free(buf);
+	plu_pipeline_finish (pipeline);
 	if (sd) {
 		dlp_AddSyncLogEntry (sd,
 							 "Successfully read Veo photos from Palm.\n"
@@ -1142,6 +1229,8 @@ int main (int argc, const char *argv[])
    return 0;
 
   error_close:
+   if (pipeline != NULL)
+	 plu_pipeline_finish (pipeline);
    pi_close (sd);
 
   error:
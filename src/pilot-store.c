@@ -0,0 +1,270 @@
+/*
+ * $Id$
+ *
+ * pilot-store.c - Manage the deduplicated backup store of pilot-xfer
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pi-source.h"
+#include "pi-file.h"
+#include "pi-userland.h"
+
+/***********************************************************************
+ *
+ * Function:    list_snapshots
+ *
+ * Summary:     Print the snapshots found under a directory of the store
+ *
+ * Parameters:  store directory, snapshot directory ("" at the top)
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+list_snapshots(const char *store_dir, const char *group)
+{
+	DIR	*dir;
+	struct dirent *dirent;
+	struct stat sbuf;
+	plu_store_t *store;
+	char	*path,
+		*snapshot;
+
+	path = malloc(strlen(store_dir) + strlen(group) + 12);
+	if (path == NULL)
+		return;
+	sprintf(path, "%s/snapshots/%s", store_dir, group);
+	dir = opendir(path);
+	free(path);
+	if (dir == NULL)
+		return;
+
+	while ((dirent = readdir(dir)) != NULL) {
+		if (dirent->d_name[0] == '.')
+			continue;
+		snapshot = malloc(strlen(group) + strlen(dirent->d_name) + 2);
+		path = malloc(strlen(store_dir) + strlen(group)
+			+ strlen(dirent->d_name) + 13);
+		if (snapshot == NULL || path == NULL) {
+			free(snapshot);
+			free(path);
+			break;
+		}
+		sprintf(snapshot, "%s%s%s", group, *group ? "/" : "",
+			dirent->d_name);
+		sprintf(path, "%s/snapshots/%s", store_dir, snapshot);
+
+		/* snapshots may be grouped in directories, by user */
+		if (stat(path, &sbuf) == 0 && S_ISDIR(sbuf.st_mode)) {
+			list_snapshots(store_dir, snapshot);
+		} else if ((store = plu_store_open(store_dir, snapshot, 0))
+				!= NULL) {
+			printf("   %s (%d databases)\n", snapshot,
+				store->count);
+			plu_store_close(store);
+		}
+		free(path);
+		free(snapshot);
+	}
+	closedir(dir);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    extract_snapshot
+ *
+ * Summary:     Rebuild databases of a snapshot
+ *
+ * Parameters:  store, output directory, names of the databases (all of
+ *		them if NULL)
+ *
+ * Returns:     number of databases that could not be rebuilt
+ *
+ ***********************************************************************/
+static int
+extract_snapshot(plu_store_t *store, const char *outdir, const char **names)
+{
+	const char *name;
+	char	*path;
+	int	i,
+		failed	= 0;
+
+	for (i = 0; names ? names[i] != NULL : i < store->count; i++) {
+		name = names ? names[i] : store->entries[i].name;
+
+		path = malloc(strlen(outdir) + strlen(name) + 2);
+		if (path == NULL)
+			return failed + 1;
+		sprintf(path, "%s/%s", outdir, name);
+		if (plu_store_extract(store, name, path) < 0) {
+			fprintf(stderr, "   ERROR: unable to rebuild '%s'\n",
+				name);
+			failed++;
+		} else if (!plu_quiet) {
+			printf("   Rebuilt '%s'\n", path);
+		}
+		free(path);
+	}
+	return failed;
+}
+
+
+int main(int argc, const char **argv)
+{
+	int 	c,		/* switch */
+		lflag		= 0,
+		failed		= 0;
+	const char *store_dir	= NULL,
+		*add		= NULL,
+		*extract	= NULL,
+		*outdir		= ".",
+		**rargv;
+	plu_store_t *store;
+	pi_file_t *pf;
+
+	poptContext po;
+
+	struct poptOption options[] = {
+		USERLAND_RESERVED_OPTIONS
+		{"store",	's', POPT_ARG_STRING, &store_dir, 0, "Use the store in <dir>", "dir"},
+		{"list",	'l', POPT_ARG_NONE, &lflag, 0, "List the snapshots, or the databases of the snapshots given"},
+		{"add",		'a', POPT_ARG_STRING, &add, 0, "Add the PRC/PDB files given to <snapshot>", "snapshot"},
+		{"extract",	'x', POPT_ARG_STRING, &extract, 0, "Rebuild the databases of <snapshot>, or those given", "snapshot"},
+		{"output",	'o', POPT_ARG_STRING, &outdir, 0, "Modifies -x to write to <dir> instead of the current directory", "dir"},
+		POPT_TABLEEND
+	};
+
+	po = poptGetContext("pilot-store", argc, argv, options, 0);
+	poptSetOtherOptionHelp(po,"[<snapshot>|<filename>] ...\n\n"
+	"   Manage the deduplicated backup store kept by pilot-xfer --store\n\n"
+	"   Example arguments:\n"
+	"      -s store -l\n"
+	"      -s store -x Jane-3141/20070101-120000 -o restore\n"
+	"      -s store -a Jane-3141/old backup/*.pdb backup/*.prc\n\n");
+
+	if (argc < 2) {
+		poptPrintUsage(po,stderr,0);
+		return 1;
+	}
+
+	while ((c = poptGetNextOpt(po)) >= 0) {
+		fprintf(stderr,"   ERROR: Unhandled option %d.\n",c);
+		return 1;
+	}
+
+	if (c < -1) {
+		plu_badoption(po,c);
+	}
+
+	if (store_dir == NULL) {
+		fprintf(stderr,"   ERROR: Must give the store directory with -s.\n");
+		return 1;
+	}
+	if (lflag + (add != NULL) + (extract != NULL) != 1) {
+		fprintf(stderr,"   ERROR: specify exactly one of -lax.\n");
+		return 1;
+	}
+
+	rargv = poptGetArgs(po);
+
+	if (lflag) {
+		if (rargv == NULL) {
+			list_snapshots(store_dir, "");
+			return 0;
+		}
+		for (; *rargv; rargv++) {
+			if ((store = plu_store_open(store_dir, *rargv, 0)) == NULL) {
+				fprintf(stderr,"   ERROR: no snapshot '%s' in '%s'.\n",
+					*rargv, store_dir);
+				failed++;
+				continue;
+			}
+			printf("   %s:\n", store->snapshot);
+			for (c = 0; c < store->count; c++)
+				printf("      %s\n", store->entries[c].name);
+			plu_store_close(store);
+		}
+		return failed ? 1 : 0;
+	}
+
+	if (extract) {
+		if ((store = plu_store_open(store_dir, extract, 0)) == NULL) {
+			fprintf(stderr,"   ERROR: no snapshot '%s' in '%s'.\n",
+				extract, store_dir);
+			return 1;
+		}
+		if (mkdir(outdir, 0700) < 0 && errno != EEXIST) {
+			fprintf(stderr,"   ERROR: unable to create '%s': %s\n",
+				outdir, strerror(errno));
+			return 1;
+		}
+		failed = extract_snapshot(store, outdir, rargv);
+		plu_store_close(store);
+		return failed ? 1 : 0;
+	}
+
+	if (!rargv || !rargv[0]) {
+		fprintf(stderr,"   ERROR: Must provide one or more filenames.\n");
+		return 1;
+	}
+	if ((store = plu_store_open(store_dir, add, 1)) == NULL) {
+		fprintf(stderr,"   ERROR: unable to create snapshot '%s' in '%s': %s\n",
+			add, store_dir, strerror(errno));
+		return 1;
+	}
+	for (; *rargv; rargv++) {
+		const char *base = strrchr(*rargv, '/');
+
+		if ((pf = pi_file_open(*rargv)) == NULL) {
+			fprintf(stderr, "   ERROR: Can't open '%s' Does '%s' exist?\n\n",
+				*rargv, *rargv);
+			failed++;
+			continue;
+		}
+		if (plu_store_add(store, pf, base ? base + 1 : *rargv) < 0) {
+			fprintf(stderr, "   ERROR: unable to add '%s'\n", *rargv);
+			failed++;
+		}
+		pi_file_close(pf);
+	}
+	if (plu_store_commit(store) < 0) {
+		fprintf(stderr,"   ERROR: unable to write snapshot '%s'.\n", add);
+		failed++;
+	} else if (!plu_quiet) {
+		printf("   %lu new blocks (%lu KiB), %lu already stored (%lu KiB)\n",
+			store->blobs, store->bytes / 1024, store->shared,
+			store->shared_bytes / 1024);
+	}
+	plu_store_close(store);
+	return failed ? 1 : 0;
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -27,7 +27,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <time.h>
 #include <locale.h>
@@ -37,6 +40,7 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 
 #include "pi-debug.h"
@@ -87,6 +91,18 @@ typedef enum {
 	palm_op_cardinfo
 } palm_op_t;
 
+/* What to do with each handheld that connects */
+typedef struct {
+	palm_op_t	op;
+	unsigned long int flags;
+	int		unsaved,
+			pipeline;
+	const char	*dirname,
+			*archive_dir,
+			*store,
+			**rargv;
+} palm_job_t;
+
 /* Flags specifying various bits of behavior. Should be
    different from the palm_ops and non-ASCII if they can
    be set explicitly from the command-line. */
@@ -103,6 +119,25 @@ typedef enum {
 
 #define MIXIN_MASK  (0xf000)
 #define PURGE       (0x1000)
+#define INCREMENTAL (0x2000)
+
+#define DAEMON_MAX_PORTS 8
+#define DAEMON_RETRY     5	/* seconds before a failing port is retried */
+
+typedef struct {
+	const char	*name;
+	int		listener,	/* bound NET socket, or -1 */
+			jobs;		/* handhelds being served */
+	pid_t		acceptor;	/* child waiting for a handheld, or 0 */
+	time_t		retry;
+} daemon_port_t;
+
+typedef struct {
+	pid_t	pid;			/* 0 for a free slot */
+	int	port,
+		accepted;
+	time_t	start;
+} daemon_child_t;
 
 int	sd	= -1;
 char    *vfsdir = NULL;
@@ -111,8 +146,12 @@ char    *vfsdir = NULL;
 char	*exclude[MAXEXCLUDE];
 int		numexclude = 0;
 
+static int	metrics_fd	= -1;
+static volatile sig_atomic_t daemon_stop = 0;
+
 static int findVFSPath(const char *path, long *volume, char *rpath,
 		int *rpathlen);
+static void palm_catalog_invalidate(void);
 
 const char
 *media_name(int m)
@@ -236,6 +275,42 @@ protect_name(char *d, const char *s)
 }
 
 
+/***********************************************************************
+ *
+ * Function:    user_dirname
+ *
+ * Summary:     Name the directory of a handheld in a shared backup
+ *		directory or store, after its user
+ *
+ * Parameters:  buffer of 3 * sizeof(username) + 24 bytes, user info
+ *
+ * Return:      Nothing
+ *
+ ***********************************************************************/
+static void
+user_dirname(char *d, const struct PilotUser *User)
+{
+	const char *s = User->username;
+
+	if (*s == '\0') {
+		sprintf(d, "user-%lu", User->userID);
+		return;
+	}
+
+	/* the name comes from the handheld: "." or ".." must not name
+	   the directory above, nor a leading dot hide it */
+	if (*s == '.') {
+		strcpy(d, "=2E");
+		d += 3;
+		s++;
+	}
+	protect_name(d, s);
+
+	/* handhelds of the same name are told apart by their user ID */
+	sprintf(d + strlen(d), "-%lu", User->userID);
+}
+
+
 /***********************************************************************
  *
  * Function:    list_remove
@@ -305,6 +380,113 @@ static int palm_creator(unsigned long creator)
 }
 
 
+/* The database list, read once and shared by the operations of a
+   session until one of them adds or deletes databases */
+static plu_catalog_t	*catalog	= NULL;
+static int		catalog_flags	= 0;
+
+/***********************************************************************
+ *
+ * Function:    palm_catalog
+ *
+ * Summary:     Return the catalogue of the databases in RAM and/or ROM,
+ *		reading it from the Palm if needed
+ *
+ * Parameters:  dlpDBListRAM and/or dlpDBListROM
+ *
+ * Returns:     The catalogue, or NULL on error
+ *
+ ***********************************************************************/
+static plu_catalog_t *
+palm_catalog(int flags)
+{
+	if (catalog != NULL && catalog_flags != flags)
+		palm_catalog_invalidate();
+
+	if (catalog == NULL)
+	{
+		catalog = plu_catalog_read(sd, 0, flags);
+		catalog_flags = flags;
+	}
+	return catalog;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    palm_catalog_invalidate
+ *
+ * Summary:     Forget the catalogue after databases were added or
+ *		deleted
+ *
+ * Parameters:  None
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+palm_catalog_invalidate(void)
+{
+	plu_catalog_free(catalog);
+	catalog = NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    palm_store_open
+ *
+ * Summary:     Start a snapshot of the handheld in a backup store,
+ *		named after its user and the time
+ *
+ * Parameters:  store directory
+ *
+ * Returns:     the store, or NULL on error
+ *
+ ***********************************************************************/
+static plu_store_t *
+palm_store_open(const char *store_dir)
+{
+	char	snapshot[3 * sizeof(((struct PilotUser *) 0)->username) + 56];
+	time_t	now	= time(NULL);
+	struct PilotUser User;
+
+	if (dlp_ReadUserInfo(sd, &User) < 0)
+		memset(&User, 0, sizeof(User));
+	user_dirname(snapshot, &User);
+	strftime(snapshot + strlen(snapshot), 32, "/%Y%m%d-%H%M%S",
+		localtime(&now));
+
+	return plu_store_open(store_dir, snapshot, 1);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    palm_store_add
+ *
+ * Summary:     Add a backed up database to the snapshot
+ *
+ * Parameters:  store, backup file
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+palm_store_add(plu_store_t *store, const char *name)
+{
+	const char	*base	= strrchr(name, '/');
+	pi_file_t	*pf;
+
+	if ((pf = pi_file_open(name)) == NULL
+	    || plu_store_add(store, pf, base ? base + 1 : name) < 0)
+		printf("   [-][stor] Unable to add '%s' to the snapshot\n",
+			name);
+	if (pf)
+		pi_file_close(pf);
+}
+
+
 /***********************************************************************
  *
  * Function:    palm_backup
@@ -318,7 +500,7 @@ static int palm_creator(unsigned long creator)
  ***********************************************************************/
 static void
 palm_backup(const char *dirname, unsigned long int flags, int unsaved,
-		const char *archive_dir)
+		const char *archive_dir, const char *store_dir)
 {
 
 	int		i		= 0,
@@ -336,7 +518,10 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 
 	const char	*synctext       = (flags & UPDATE) ? "Synchronizing" : "Backing up";
 	DIR		*dir;
-	pi_buffer_t	*buffer;
+	plu_catalog_t	*cat;
+	struct PilotUser User;
+	time_t		last_sync	= 0;
+	plu_store_t	*store		= NULL;
 
 	/* Check if the directory exists before writing to it. If it doesn't
 	   exist as a directory, and it isn't a file, create it. */
@@ -391,16 +576,48 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 		}
 	}
 
-	buffer = pi_buffer_new (sizeof(struct DBInfo));
+	/* A HotSync with another desktop resets the dirty flags that
+	   --incremental relies on; it also sets the last sync date. Each
+	   backup keeps the date it was made under as its backup date,
+	   and a copy made under another one must be fetched in full. */
+	if (flags & INCREMENTAL)
+	{
+		if ((flags & UPDATE) && dlp_ReadUserInfo(sd, &User) >= 0)
+			last_sync = User.lastSyncDate;
+		else
+			flags &= ~INCREMENTAL;
+	}
+
+	cat = palm_catalog((flags & MEDIA_MASK) ? dlpDBListROM : dlpDBListRAM);
+	if (cat == NULL)
+	{
+		printf("\n   Unable to read the list of databases - Exiting."
+				" No data was backed up\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (store_dir)
+	{
+		store = palm_store_open(store_dir);
+		if (store == NULL)
+		{
+			fprintf(stderr, "   ERROR: unable to create a snapshot in"
+					" '%s'.\n", store_dir);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	name = (char *)malloc(strlen(dirname) + 1 + 256);
 
-	for (;;)
+	for (i = 0; i < cat->count; i++)
 	{
 		struct DBInfo	info;
-		struct pi_file	*f;
+		struct pi_file	*f,
+				*old	= NULL;
 		struct utimbuf	times;
 		int				skip	= 0;
 		int				excl	= 0;
+		int				fetched;
 		struct stat		sbuf;
 		char			crid[5];
 
@@ -410,12 +627,7 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 			exit(EXIT_FAILURE);
 		}
 
-		if (dlp_ReadDBList(sd, 0, ((flags & MEDIA_MASK)
-						? dlpDBListROM : dlpDBListRAM), i, buffer) < 0)
-			break;
-
-		memcpy(&info, buffer->data, sizeof(struct DBInfo));
-		i = info.index + 1;
+		info = cat->info[i];
 
 		pi_untag(crid,info.creator);
 
@@ -485,13 +697,31 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 			{
 				printf("   [-][unch] Unchanged, skipping %s\n",
 						name);
+				if (store)
+					palm_store_add(store, name);
 				continue;
 			}
+
+			if ((flags & INCREMENTAL)
+				&& (old = pi_file_open(name)) != NULL)
+			{
+				struct DBInfo	oinfo;
+
+				pi_file_get_info(old, &oinfo);
+				if (oinfo.backupDate != last_sync)
+				{
+					pi_file_close(old);
+					old = NULL;
+				}
+			}
 		}
 
 		/* Ensure that DB-open and DB-ReadOnly flags are not kept */
 		info.flags &= ~(dlpDBFlagOpen | dlpDBFlagReadOnly);
 
+		if (flags & INCREMENTAL)
+			info.backupDate = last_sync;
+
 		printf("   [+][%-4d]", filecount);
 		printf("[%s] %s '%s'", crid, synctext, info.name);
 		fflush(NULL);
@@ -503,8 +733,12 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 		if (f == 0)
 		{
 			printf("\nFailed, unable to create file.\n");
+			if (old)
+				pi_file_close(old);
 			break;
-		} else if (pi_file_retrieve(f, sd, 0, NULL) < 0)
+		} else if ((fetched = old
+				? pi_file_retrieve_update(f, old, sd, 0, NULL)
+				: pi_file_retrieve(f, sd, 0, NULL)) < 0)
 		{
 			printf("\n   [-][fail][%s] Failed, unable to retrieve '%s' from the Palm.",
 				crid, info.name);
@@ -513,12 +747,16 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 			unlink(name);
 		} else {
 			pi_file_close(f);		/* writes the file to disk so we can stat() it */
+			if (old)
+				printf(", %d records fetched", fetched);
 			stat(name, &sbuf);
 			totalsize += sbuf.st_size;
 			printf(", %ld bytes, %ld KiB... ",
 					(long)sbuf.st_size, (long)totalsize/1024);
 			fflush(NULL);
 		}
+		if (old)
+			pi_file_close(old);
 
 		filecount++;
 
@@ -527,8 +765,10 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 		times.actime	= info.createDate;
 		times.modtime	= info.modifyDate;
 		utime(name, &times);
+
+		if (store && access(name, F_OK) == 0)
+			palm_store_add(store, name);
 	}
-	pi_buffer_free(buffer);
 
 	if (orig_files)
 	{
@@ -566,6 +806,19 @@ palm_backup(const char *dirname, unsigned long int flags, int unsaved,
 
 	free(name);
 
+	if (store)
+	{
+		if (plu_store_commit(store) < 0)
+			printf("\n   Unable to write snapshot '%s'.",
+					store->snapshot);
+		else
+			printf("\n   Snapshot '%s': %lu new blocks (%lu KiB),"
+					" %lu already stored (%lu KiB).",
+					store->snapshot, store->blobs,
+					store->bytes / 1024, store->shared,
+					store->shared_bytes / 1024);
+		plu_store_close(store);
+	}
 
 	printf("\n   %s backup complete.", media_name(flags & MEDIA_MASK));
 
@@ -631,10 +884,12 @@ static int fetch_progress(int sd, pi_progress_t *progress)
 static void
 palm_fetch_internal(const char *dbname)
 {
-	struct DBInfo	info;
+	struct DBInfo	info,
+					*dbinfo	= NULL;
 	char			name[256],
 					synclog[512];
 	struct pi_file	*f;
+	plu_catalog_t	*cat;
 
 	if (access(dbname, F_OK) == 0 && access(dbname, R_OK|W_OK) != 0)
 	{
@@ -645,7 +900,9 @@ palm_fetch_internal(const char *dbname)
 
 	printf("   Parsing list of files from handheld... ");
 	fflush(stdout);
-	if (dlp_FindDBInfo(sd, 0, 0, dbname, 0, 0, &info) < 0)
+	if ((cat = palm_catalog(dlpDBListRAM | dlpDBListROM)) != NULL)
+		dbinfo = plu_catalog_find(cat, dbname);
+	if (dbinfo == NULL)
 	{
 		printf("\n   Unable to locate app/database '%s', ",
 				dbname);
@@ -654,6 +911,7 @@ palm_fetch_internal(const char *dbname)
 	} else {
 		printf("done.\n");
 	}
+	info = *dbinfo;
 
 	protect_name(name, dbname);
 
@@ -903,14 +1161,16 @@ palm_fetch(unsigned long int flags,const char *dbname)
  ***********************************************************************/
 static void palm_delete(const char *dbname)
 {
-	struct DBInfo	info;
+	struct DBInfo	*info	= NULL;
+	plu_catalog_t	*cat;
 
-	dlp_FindDBInfo(sd, 0, 0, dbname, 0, 0, &info);
+	if ((cat = palm_catalog(dlpDBListRAM | dlpDBListROM)) != NULL)
+		info = plu_catalog_find(cat, dbname);
 
 	printf("Deleting '%s'... ", dbname);
 	if (dlp_DeleteDB(sd, 0, dbname) >= 0)
 	{
-		if (info.type == pi_mktag('b', 'o', 'o', 't'))
+		if (info && info->type == pi_mktag('b', 'o', 'o', 't'))
 		{
 			printf(" (rebooting afterwards) ");
 		}
@@ -925,24 +1185,125 @@ static void palm_delete(const char *dbname)
 
 struct db {
 	int				flags,
-					maxblock;
+					maxblock,
+					groupblock;	/* largest of its creator */
 	char			name[256];
 	unsigned long	creator, type;
+	size_t			size;
+	pi_file_t		*pf;
 };
 
 static int
-compare(struct db *d1, struct db *d2)
+compare_creator(const void *l, const void *r)
 {
-	/* types of 'appl' sort later then other types */
-	if (d1->creator == d2->creator)
-		if (d1->type != d2->type)
-		{
-			if (d1->type == pi_mktag('a', 'p', 'p', 'l'))
-				return 1;
-			if (d2->type == pi_mktag('a', 'p', 'p', 'l'))
-				return -1;
-		}
-	return d1->maxblock < d2->maxblock;
+	const struct db *d1 = *(const struct db *const *) l,
+		*d2 = *(const struct db *const *) r;
+
+	if (d1->creator != d2->creator)
+		return d1->creator < d2->creator ? -1 : 1;
+	return 0;
+}
+
+static int
+compare(const void *l, const void *r)
+{
+	const struct db *d1 = *(const struct db *const *) l,
+		*d2 = *(const struct db *const *) r;
+	int	a1, a2;
+
+	/* databases with the largest blocks go first, while the heap
+	   is least fragmented; those of one creator stay together so
+	   that the application ('appl') can follow its data */
+	if (d1->groupblock != d2->groupblock)
+		return d1->groupblock > d2->groupblock ? -1 : 1;
+	if (d1->creator != d2->creator)
+		return d1->creator < d2->creator ? -1 : 1;
+
+	a1 = d1->type == pi_mktag('a', 'p', 'p', 'l');
+	a2 = d2->type == pi_mktag('a', 'p', 'p', 'l');
+	if (a1 != a2)
+		return a1 - a2;
+	if (d1->maxblock != d2->maxblock)
+		return d1->maxblock > d2->maxblock ? -1 : 1;
+	return strcmp(d1->name, d2->name);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    restore_prefetch
+ *
+ * Summary:     Open and read a database to be restored ahead of its
+ *		install
+ *
+ * Parameters:  struct db of the database
+ *
+ * Returns:     0, or -1 if it can't be opened or one of its entries
+ *		is damaged
+ *
+ ***********************************************************************/
+static int
+restore_prefetch(void *item)
+{
+	struct db	*db	= (struct db *) item;
+	int				i,
+					max;
+	size_t			size,
+					j;
+	void			*buffer;
+	volatile unsigned char sum = 0;
+
+	/* opened only now, so that no more files are resident than the
+	   pipeline has slots */
+	if ((db->pf = pi_file_open_mapped(db->name)) == NULL)
+		return -1;
+
+	/* the entries point into the mapped file; touching a byte of
+	   each page brings them in from the disk now rather than while
+	   the handheld waits for them */
+	pi_file_get_entries(db->pf, &max);
+	for (i = 0; i < max; i++) {
+		if ((db->flags & dlpDBFlagResource
+			? pi_file_read_resource(db->pf, i, &buffer, &size, 0, 0)
+			: pi_file_read_record(db->pf, i, &buffer, &size, 0, 0, 0))
+				< 0)
+			return -1;
+		for (j = 0; j < size; j += 4096)
+			sum += ((unsigned char *) buffer)[j];
+	}
+	return 0;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    restore_install
+ *
+ * Summary:     Install a prefetched database and dispose of it
+ *
+ * Parameters:  struct db of the database, result of restore_prefetch()
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+restore_install(void *item, int prefetched)
+{
+	struct db	*db	= (struct db *) item;
+
+	printf("Restoring %s... ", db->name);
+	fflush(stdout);
+
+	if (prefetched < 0 || pi_file_install(db->pf, sd, 0, NULL) < 0)
+	{
+		printf("failed.\n");
+	} else {
+		printf("OK\n");
+	}
+
+	if (db->pf != NULL)
+		pi_file_close(db->pf);
+	db->pf = NULL;
 }
 
 
@@ -961,17 +1322,21 @@ static void
 palm_restore(const char *dirname)
 {
 	int				dbcount		= 0,
+					allocated	= 0,
 					i,
 					j,
 					max,
 					save_errno	= errno;
-	size_t			size;
+	size_t			size,
+					largest		= 0;
+	unsigned long	total		= 0;
 	DIR				*dir;
 	struct dirent	*dirent;
 	struct DBInfo	info;
-	struct db		**db		= NULL;
+	struct db		**db		= NULL,
+					**grow;
 	struct pi_file	*f;
-	struct stat		sbuf;
+	plu_pipeline_t	*pipeline;
 
 	struct  CardInfo Card;
 
@@ -989,49 +1354,61 @@ palm_restore(const char *dirname)
 		exit(EXIT_FAILURE);
 	}
 
-	/* Find out how many directory entries exist, so that we can
-	   allocate the buffer.  We avoid scandir() for maximum portability.
-
-	   The count is a bit conservative, as it includes . and .. entries.
-	 */
-	while (readdir(dir))
-		dbcount++;
-
-	db = (struct db **) calloc(dbcount, sizeof(struct db *));
-
-	if (!db)
-	{
-		printf("Unable to allocate memory for directory entry table\n");
-		exit(EXIT_FAILURE);
-	}
-
-	dbcount = 0;
-	rewinddir(dir);
-
+	/* One pass over the directory, keeping what the install order
+	   needs from each file's header and entry table; restore_prefetch()
+	   opens the file again when its turn comes. */
 	while ((dirent = readdir(dir)) != NULL)
 	{
 		if (dirent->d_name[0] == '.')
 			continue;
 
+		if (dbcount == allocated)
+		{
+			allocated = allocated ? allocated * 2 : 64;
+			grow = (struct db **) realloc(db,
+				allocated * sizeof(struct db *));
+			if (grow == NULL)
+			{
+				printf("Unable to allocate memory for directory entry table\n");
+				exit(EXIT_FAILURE);
+			}
+			db = grow;
+		}
+
 		db[dbcount] = (struct db *) malloc(sizeof(struct db));
+		if (db[dbcount] == NULL)
+		{
+			printf("Unable to allocate memory for directory entry table\n");
+			exit(EXIT_FAILURE);
+		}
 
-		sprintf(db[dbcount]->name, "%s/%s", dirname,
-			dirent->d_name);
+		if (snprintf(db[dbcount]->name, sizeof(db[dbcount]->name),
+				"%s/%s", dirname, dirent->d_name)
+			>= (int) sizeof(db[dbcount]->name))
+		{
+			printf("Skipping '%s', its path is too long\n",
+				   dirent->d_name);
+			free(db[dbcount]);
+			continue;
+		}
 
-		f = pi_file_open(db[dbcount]->name);
+		f = pi_file_open_mapped(db[dbcount]->name);
 		if (f == 0)
 		{
 			printf("Unable to open '%s'!\n",
 				   db[dbcount]->name);
-			break;
+			free(db[dbcount]);
+			continue;
 		}
 
 		pi_file_get_info(f, &info);
 
+		db[dbcount]->pf			= NULL;
 		db[dbcount]->creator	= info.creator;
 		db[dbcount]->type		= info.type;
 		db[dbcount]->flags		= info.flags;
 		db[dbcount]->maxblock	= 0;
+		db[dbcount]->size		= f->map_size;
 
 		pi_file_get_entries(f, &max);
 
@@ -1047,64 +1424,68 @@ palm_restore(const char *dirname)
 			if (size > db[dbcount]->maxblock)
 				db[dbcount]->maxblock = size;
 		}
-
 		pi_file_close(f);
+
+		total += db[dbcount]->size;
+		if (db[dbcount]->size > largest)
+			largest = db[dbcount]->size;
 		dbcount++;
 	}
 
 	closedir(dir);
 
-	for (i = 0; i < dbcount; i++)
+	/* give every database the largest block of its creator, so that
+	   compare() can keep a creator's databases together */
+	if (dbcount > 1)
+		qsort(db, (size_t) dbcount, sizeof(struct db *),
+			compare_creator);
+	for (i = 0; i < dbcount; i = j)
 	{
-		for (j = i + 1; j < dbcount; j++)
-		{
-			if (compare(db[i], db[j]) > 0)
-			{
-				struct db *temp = db[i];
-
-				db[i] = db[j];
-				db[j] = temp;
-			}
-		}
+		max = 0;
+		for (j = i; j < dbcount && db[j]->creator == db[i]->creator; j++)
+			if (db[j]->maxblock > max)
+				max = db[j]->maxblock;
+		while (i < j)
+			db[i++]->groupblock = max;
 	}
+	if (dbcount > 1)
+		qsort(db, (size_t) dbcount, sizeof(struct db *), compare);
 
-	for (i = 0; i < dbcount; i++)
+	while (Card.more)
 	{
-
-		f = pi_file_open(db[i]->name);
-		if (f == 0) {
-			printf("Unable to open '%s'!\n", db[i]->name);
+		if (dlp_ReadStorageInfo(sd, Card.card + 1, &Card) < 0)
 			break;
-		}
-		printf("Restoring %s... ", db[i]->name);
-		fflush(stdout);
-
-		stat(db[i]->name, &sbuf);
-
-		while (Card.more)
-		{
-			if (dlp_ReadStorageInfo(sd, Card.card + 1, &Card) < 0)
-				break;
-		}
-
-		if ((unsigned long)sbuf.st_size > Card.ramFree)
-		{
-			fprintf(stderr, "\n\n");
-			fprintf(stderr, "   Insufficient space to install this file on your Palm.\n");
-			fprintf(stderr, "   We needed %lu and only had %lu available..\n\n",
-				(unsigned long)sbuf.st_size, Card.ramFree);
-			exit(EXIT_FAILURE);
-		}
+	}
 
-		if (pi_file_install(f, sd, 0, NULL) < 0)
-		{
-			printf("failed.\n");
-		} else {
-			printf("OK\n");
-		}
+	if (Card.card >= 0 && (unsigned long) largest > Card.ramFree)
+	{
+		fprintf(stderr, "\n\n");
+		fprintf(stderr, "   Insufficient space to install this file on your Palm.\n");
+		fprintf(stderr, "   We needed %lu and only had %lu available..\n\n",
+			(unsigned long) largest, Card.ramFree);
+		exit(EXIT_FAILURE);
+	}
+	if (Card.card >= 0 && total > Card.ramFree)
+	{
+		/* databases replaced on the handheld give their space back,
+		   so this may still fit */
+		fprintf(stderr, "   WARNING: restoring %lu bytes with only %lu free,"
+			" some databases may not fit.\n", total, Card.ramFree);
+	}
 
-		pi_file_close(f);
+	/* the next databases are read while the current one installs.
+	   A pipeline of one job runs serially, so this starts two reader
+	   threads and the installing one; the link is the slow part, and
+	   the pipeline's slots bound how many files are read ahead */
+	pipeline = plu_pipeline_new(2, restore_prefetch, restore_install);
+	if (pipeline == NULL)
+	{
+		printf("Unable to allocate memory for directory entry table\n");
+		exit(EXIT_FAILURE);
 	}
+	for (i = 0; i < dbcount; i++)
+		plu_pipeline_submit(pipeline, db[i]);
+	plu_pipeline_finish(pipeline);
 
 	for (i = 0; i < dbcount; i++)
 	{
@@ -1627,35 +2008,23 @@ palm_merge(const char *filename)
 static void
 palm_list_internal(unsigned long int flags)
 {
-	int				i		= 0,
-					j,
+	int				i,
 					dbcount	= 0;
-	struct DBInfo	info;
 	char			synclog[68];
-	pi_buffer_t		*buffer;
+	plu_catalog_t	*cat;
 
 	printf("   Reading list of databases in RAM%s...\n",
 			(flags & MEDIA_MASK) ? " and ROM" : "");
 
-	buffer = pi_buffer_new(sizeof(struct DBInfo));
-
-	for (;;)
+	cat = palm_catalog(((flags & MEDIA_MASK) ? dlpDBListROM : 0)
+			| dlpDBListRAM);
+	if (cat != NULL)
 	{
-		if (dlp_ReadDBList
-				(sd, 0, ((flags & MEDIA_MASK) ? 0x40 : 0) | 0x80 |
-				 dlpDBListMultiple, i, buffer) < 0)
-			break;
-		for (j=0; j < (buffer->used / sizeof(struct DBInfo)); j++)
-		{
-			memcpy(&info, buffer->data + j * sizeof(struct DBInfo),
-					sizeof(struct DBInfo));
-			dbcount++;
-			i = info.index + 1;
-			printf("   %s\n", info.name);
-		}
-		fflush(stdout);
+		for (i = 0; i < cat->count; i++)
+			printf("   %s\n", cat->info[i].name);
+		dbcount = cat->count;
 	}
-	pi_buffer_free(buffer);
+	fflush(stdout);
 
 	printf("\n   List complete. %d files found.\n\n", dbcount);
 	sprintf(synclog, "List complete. %d files found..\n\nThank you for using pilot-link.",
@@ -2251,34 +2620,36 @@ palm_list(unsigned long int flags)
 static void
 palm_purge(void)
 {
-	int				i	= 0,
-					h;
-	struct DBInfo	info;
-	pi_buffer_t		*buffer;
+	int				i,
+					h,
+					reset		= 0;
+	struct DBInfo	*info;
+	plu_catalog_t	*cat;
 
 	printf("Reading list of databases to purge...\n");
 
-	buffer = pi_buffer_new(sizeof(struct DBInfo));
-
-	for (;;)
+	if ((cat = palm_catalog(dlpDBListRAM)) == NULL)
 	{
-		if (dlp_ReadDBList(sd, 0, 0x80, i, buffer) < 0)
-			break;
+		printf("Unable to read the list of databases.\n");
+		return;
+	}
 
-		memcpy (&info, buffer->data, sizeof(struct DBInfo));
-		i = info.index + 1;
+	for (i = 0; i < cat->count; i++)
+	{
+		info = &cat->info[i];
 
-		if (info.flags & 1)
+		if (info->flags & 1)
 			continue;	/* skip resource databases */
 
-		printf("Purging deleted records from '%s'... ", info.name);
+		printf("Purging deleted records from '%s'... ", info->name);
 
 		h = 0;
-		if ((dlp_OpenDB(sd, 0, 0x40 | 0x80, info.name, &h) >= 0)
+		if ((dlp_OpenDB(sd, 0, 0x40 | 0x80, info->name, &h) >= 0)
 				&& (dlp_CleanUpDatabase(sd, h) >= 0)
 				&& (dlp_ResetSyncFlags(sd, h) >= 0))
 		{
 			printf("OK\n");
+			reset++;
 		} else {
 			printf("Failed\n");
 		}
@@ -2287,20 +2658,457 @@ palm_purge(void)
 			dlp_CloseDB(sd, h);
 	}
 
-	pi_buffer_free (buffer);
+	/* the modified flags are gone: the next --incremental must not
+	   trust the backups made so far */
+	if (reset && plu_note_flags_reset(sd) < 0)
+		printf("Unable to update the last sync date, the next"
+			" --incremental backup may miss changes.\n");
 
 	printf("Purge complete.\n");
 }
 
 
+/***********************************************************************
+ *
+ * Function:    palm_run
+ *
+ * Summary:     Carry out the requested operation on the connected
+ *		handheld
+ *
+ * Parameters:  the job
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+palm_run(const palm_job_t *job)
+{
+	unsigned long int	sync_flags	= job->flags;
+	int			pipeline	= job->pipeline;
+	const char		**rargv		= job->rargv;
+
+	if (pipeline > 1)
+	{
+		size_t	size	= sizeof(pipeline);
+
+		if (pi_setsockopt(sd, PI_LEVEL_SOCK, PI_SOCK_DLP_PIPELINE,
+				&pipeline, &size) < 0)
+			fprintf(stderr,"   WARNING: invalid --pipeline depth %d, ignored.\n", pipeline);
+	}
+
+	switch(job->op)
+	{
+		case palm_op_noop: /* handled by the caller */
+			exit(1);
+			break;
+		case palm_op_backup:
+		case palm_op_update:
+		case palm_op_sync:
+			if (palm_op_backup == job->op)
+				sync_flags |= BACKUP;
+			if (palm_op_update == job->op)
+				sync_flags |= UPDATE;
+			if (palm_op_sync == job->op)
+				sync_flags |= UPDATE | SYNC;
+			palm_backup(job->dirname, sync_flags, job->unsaved,
+				job->archive_dir, job->store);
+			break;
+		case palm_op_restore:
+			palm_restore(job->dirname);
+			palm_catalog_invalidate();
+			break;
+		case palm_op_merge:
+		case palm_op_install:
+		case palm_op_fetch:
+		case palm_op_delete:
+			while (rargv && *rargv)
+			{
+				switch(job->op)
+				{
+					case palm_op_merge:
+						palm_merge(*rargv);
+						break;
+					case palm_op_fetch:
+						palm_fetch(sync_flags,*rargv);
+						break;
+					case palm_op_delete:
+						palm_delete(*rargv);
+						break;
+					case palm_op_install:
+						palm_install(sync_flags,*rargv);
+						break;
+					default:
+						/* impossible */
+						break;
+				}
+				rargv++;
+			}
+			if (job->op != palm_op_fetch)
+				palm_catalog_invalidate();
+			break;
+		case palm_op_list:
+			palm_list(sync_flags);
+			break;
+		case palm_op_cardinfo:
+			palm_cardinfo();
+			break;
+	}
+
+	if (sync_flags & PURGE)
+		palm_purge();
+	palm_catalog_invalidate();
+}
+
+
+/***********************************************************************
+ *
+ * Function:    daemon_log
+ *
+ * Summary:     Append one event to the metrics feed
+ *
+ * Parameters:  printf-style format of the event's fields
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+daemon_log(const char *format, ...)
+{
+	char	line[512];
+	int	len;
+	va_list	ap;
+
+	if (metrics_fd < 0)
+		return;
+
+	len = snprintf(line, sizeof(line), "time=%ld pid=%ld ",
+		(long) time(NULL), (long) getpid());
+	va_start(ap, format);
+	len += vsnprintf(line + len, sizeof(line) - len - 1, format, ap);
+	va_end(ap);
+	if (len > (int) sizeof(line) - 2)
+		len = sizeof(line) - 2;
+	line[len++] = '\n';
+
+	/* every process appends whole lines with a single write(), which
+	   O_APPEND keeps from interleaving */
+	if (write(metrics_fd, line, (size_t) len) < 0)
+		return;
+}
+
+
+static void
+daemon_signal(int signum)
+{
+	daemon_stop = 1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    daemon_serve
+ *
+ * Summary:     Wait for a handheld on a port and run the job on it;
+ *		runs in a child process of the daemon
+ *
+ * Parameters:  the port, its index, write end of the notify pipe, job
+ *
+ * Returns:     Does not return
+ *
+ ***********************************************************************/
+static void
+daemon_serve(daemon_port_t *port, int index, int notify,
+	const palm_job_t *job)
+{
+	char		*userdir	= NULL;
+	int		fd;
+	unsigned char	c		= (unsigned char) index;
+	struct flock	lock;
+	palm_job_t	device		= *job;
+	struct SysInfo	sys_info;
+	struct PilotUser User;
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+
+	if (port->listener >= 0) {
+		sd = pi_accept_new(port->listener, NULL, NULL);
+		if (sd >= 0 && dlp_ReadSysInfo(sd, &sys_info) < 0) {
+			pi_close(sd);
+			sd = -1;
+		}
+		if (sd >= 0)
+			dlp_OpenConduit(sd);
+	} else {
+		plu_port = (char *) port->name;
+		sd = plu_connect();
+	}
+	if (sd < 0) {
+		fprintf(stderr, "   ERROR: could not accept a connection on %s\n",
+			port->name);
+		exit(EXIT_FAILURE);
+	}
+
+	/* from here on this process is a job, and the port may serve the
+	   next handheld */
+	if (write(notify, &c, 1) < 0)
+		exit(EXIT_FAILURE);
+	close(notify);
+
+	if (dlp_ReadUserInfo(sd, &User) < 0)
+		memset(&User, 0, sizeof(User));
+
+	/* jobs share one backup store, with a directory per handheld */
+	if (job->dirname != NULL) {
+		userdir = malloc(strlen(job->dirname) + 3 * sizeof(User.username) + 32);
+		if (userdir == NULL)
+			exit(EXIT_FAILURE);
+		sprintf(userdir, "%s/", job->dirname);
+		user_dirname(userdir + strlen(userdir), &User);
+		device.dirname = userdir;
+		if (job->op != palm_op_restore)
+			mkdir(job->dirname, 0700);
+
+		/* two handhelds that still share a directory, such as two
+		   unnamed ones, must not back up and -s delete in it at the
+		   same time; the lock goes away with the job */
+		strcat(userdir, ".lock");
+		lock.l_type	= F_WRLCK;
+		lock.l_whence	= SEEK_SET;
+		lock.l_start	= 0;
+		lock.l_len	= 0;
+		if ((fd = open(userdir, O_RDWR | O_CREAT, 0600)) < 0) {
+			fprintf(stderr, "   ERROR: unable to create '%s': %s\n",
+				userdir, strerror(errno));
+			pi_close(sd);
+			exit(EXIT_FAILURE);
+		}
+		if (fcntl(fd, F_SETLK, &lock) < 0) {
+			userdir[strlen(userdir) - 5] = '\0';
+			fprintf(stderr, "   ERROR: '%s' is in use by another job\n",
+				userdir);
+			daemon_log("event=busy port=%s user=\"%s\" dir=\"%s\"",
+				port->name, User.username, userdir);
+			pi_close(sd);
+			exit(EXIT_FAILURE);
+		}
+		userdir[strlen(userdir) - 5] = '\0';
+	}
+
+	printf("   Connection on %s from '%s'\n", port->name, User.username);
+	daemon_log("event=start port=%s user=\"%s\" dir=\"%s\"", port->name,
+		User.username, userdir ? userdir : "");
+
+	palm_run(&device);
+
+	pi_close(sd);
+	free(userdir);
+	exit(EXIT_SUCCESS);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    daemon_notified
+ *
+ * Summary:     Turn the acceptors that reported a connection into jobs
+ *
+ * Parameters:  read end of the notify pipe, ports, number of ports,
+ *		children, size of the pool
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+static void
+daemon_notified(int notify, daemon_port_t *ports, int count,
+	daemon_child_t *children, int workers)
+{
+	unsigned char	buf[DAEMON_MAX_PORTS];
+	ssize_t		len;
+	int		i,
+			n;
+
+	while ((len = read(notify, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < len; i++) {
+			if (buf[i] >= count || ports[buf[i]].acceptor == 0)
+				continue;
+			for (n = 0; n < workers
+				    && children[n].pid != ports[buf[i]].acceptor; n++)
+				;
+			if (n == workers)
+				continue;
+			children[n].accepted	= 1;
+			children[n].start	= time(NULL);
+			ports[buf[i]].acceptor	= 0;
+			ports[buf[i]].jobs++;
+			daemon_log("event=accepted port=%s job=%ld",
+				ports[buf[i]].name, (long) children[n].pid);
+		}
+	}
+}
+
+
+/***********************************************************************
+ *
+ * Function:    palm_daemon
+ *
+ * Summary:     Serve handhelds on several ports until interrupted
+ *
+ * Parameters:  ports, number of ports, most connections served at a
+ *		time, the job to run on each handheld
+ *
+ * Returns:     exit status
+ *
+ ***********************************************************************/
+static int
+palm_daemon(const char **names, int count, int workers,
+	const palm_job_t *job)
+{
+	daemon_port_t	ports[DAEMON_MAX_PORTS];
+	daemon_child_t	*children;
+	int		i,
+			n,
+			status,
+			running		= 0,
+			notify[2];
+	pid_t		pid;
+	time_t		now;
+	fd_set		readfds;
+	struct timeval	tv;
+
+	children = calloc((size_t) workers, sizeof(daemon_child_t));
+	if (children == NULL || pipe(notify) < 0
+	    || fcntl(notify[0], F_SETFL, O_NONBLOCK) < 0) {
+		fprintf(stderr, "   ERROR: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* a NET port takes any number of connections, so it is bound once
+	   here and every acceptor takes the next connection from it;
+	   serial, USB and Bluetooth ports are opened by their acceptor */
+	memset(ports, 0, sizeof(ports));
+	for (i = 0; i < count; i++) {
+		ports[i].name		= names[i];
+		ports[i].listener	= -1;
+		if (strncmp(names[i], "net:", 4) != 0)
+			continue;
+		if ((ports[i].listener = pi_socket(PI_AF_PILOT,
+				PI_SOCK_STREAM, PI_PF_DLP)) < 0
+		    || pi_bind(ports[i].listener, names[i]) < 0
+		    || pi_listen(ports[i].listener, workers) < 0) {
+			fprintf(stderr, "   ERROR: unable to listen on %s\n",
+				names[i]);
+			return 1;
+		}
+	}
+
+	signal(SIGTERM, daemon_signal);
+	signal(SIGINT, daemon_signal);
+	daemon_log("event=daemon ports=%d workers=%d", count, workers);
+
+	while (!daemon_stop || running > 0) {
+		now = time(NULL);
+
+		/* keep one acceptor waiting on each free port, as long as
+		   the pool has room for the connection it will bring */
+		for (i = 0; i < count && !daemon_stop; i++) {
+			if (ports[i].acceptor != 0 || ports[i].retry > now
+			    || running >= workers
+			    || (ports[i].listener < 0 && ports[i].jobs > 0))
+				continue;
+
+			for (n = 0; children[n].pid != 0; n++)
+				;
+			fflush(stdout);
+			fflush(stderr);
+			if ((pid = fork()) < 0) {
+				ports[i].retry = now + DAEMON_RETRY;
+				continue;
+			}
+			if (pid == 0) {
+				close(notify[0]);
+				daemon_serve(&ports[i], i, notify[1], job);
+			}
+			children[n].pid		= pid;
+			children[n].port	= i;
+			children[n].accepted	= 0;
+			ports[i].acceptor	= pid;
+			running++;
+		}
+
+		FD_ZERO(&readfds);
+		FD_SET(notify[0], &readfds);
+		tv.tv_sec	= 1;
+		tv.tv_usec	= 0;
+		select(notify[0] + 1, &readfds, NULL, NULL, &tv);
+		daemon_notified(notify[0], ports, count, children, workers);
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			for (n = 0; n < workers && children[n].pid != pid; n++)
+				;
+			if (n == workers)
+				continue;
+			/* it may have accepted just before it exited */
+			daemon_notified(notify[0], ports, count, children,
+				workers);
+			i = children[n].port;
+			if (children[n].accepted) {
+				ports[i].jobs--;
+				daemon_log("event=%s port=%s job=%ld status=%d seconds=%ld",
+					WIFEXITED(status) && WEXITSTATUS(status) == 0
+						? "done" : "failed",
+					ports[i].name, (long) pid,
+					WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+					(long) (time(NULL) - children[n].start));
+			} else {
+				/* the acceptor gave up, or was stopped; do
+				   not spin on a port that keeps failing */
+				ports[i].acceptor = 0;
+				if (!daemon_stop) {
+					ports[i].retry = time(NULL) + DAEMON_RETRY;
+					daemon_log("event=accept-failed port=%s",
+						ports[i].name);
+				}
+			}
+			children[n].pid = 0;
+			running--;
+		}
+
+		/* on shutdown, jobs run to completion but nobody waits
+		   for new handhelds */
+		if (daemon_stop)
+			for (i = 0; i < count; i++)
+				if (ports[i].acceptor != 0)
+					kill(ports[i].acceptor, SIGTERM);
+	}
+
+	daemon_log("event=shutdown");
+	for (i = 0; i < count; i++)
+		if (ports[i].listener >= 0)
+			pi_close(ports[i].listener);
+	close(notify[0]);
+	close(notify[1]);
+	free(children);
+	return 0;
+}
+
+
 
 int
 main(int argc, const char *argv[])
 {
 	int			optc,		/* switch */
-				unsaved		= 0;
+				unsaved		= 0,
+				pipeline	= 1,
+				daemon_mode	= 0,
+				workers		= 0,
+				nports		= 0;
 	const char		*archive_dir    = NULL,
-		                *dirname        = NULL;
+		                *dirname        = NULL,
+				*metrics	= NULL,
+				*store		= NULL,
+				*ports[DAEMON_MAX_PORTS];
+	palm_job_t		job;
 	unsigned long int	sync_flags	= 0;
 	palm_op_t		palm_operation	= palm_op_noop;
 	const char		*gracias	= "\n   Thank you for using pilot-link.\n";
@@ -2339,9 +3147,18 @@ main(int argc, const char *argv[])
 		{"rom",       0 , POPT_ARG_NONE, NULL, MEDIA_FLASH, "Modifies -b, -u, and -s, to back up non-OS dbs from Flash ROM", NULL},
 		{"with-os",   0 , POPT_ARG_NONE, NULL, MEDIA_ROM, "Modifies -b, -u, and -s, to back up OS dbs from Flash ROM", NULL},
 		{"illegal",   0 , POPT_ARG_NONE, &unsaved, 0, "Modifies -b, -u, and -s, to back up the illegal database Unsaved Preferences.prc (normally skipped)", NULL},
+		{"pipeline",  0 , POPT_ARG_INT, &pipeline, 0, "Modifies -b, -u, -s and -f to keep up to <n> requests in flight on NET/USB connections", "n"},
+		{"incremental", 0, POPT_BIT_SET, &sync_flags, INCREMENTAL, "Modifies -u and -s to fetch only the records modified since the last update (--purge and pilot-foto move the Palm's last sync date to force a full fetch)", NULL},
+		{"store",     0 , POPT_ARG_STRING, &store, 0, "Modifies -b, -u and -s to also keep a deduplicated snapshot in store <dir>", "dir"},
 
 		/* misc */
 		{"exec",     'x', POPT_ARG_STRING, NULL, 'x', "Execute a shell command for intermediate processing", "command"},
+
+		/* serving several handhelds */
+		{"daemon",    0 , POPT_ARG_NONE, &daemon_mode, 0, "Keep serving handhelds, running the operation on each one that connects", NULL},
+		{"listen",    0 , POPT_ARG_STRING, NULL, 'N', "Modifies --daemon to accept handhelds on <port>; may be repeated", "port"},
+		{"workers",   0 , POPT_ARG_INT, &workers, 0, "Modifies --daemon to serve at most <n> handhelds at a time", "n"},
+		{"metrics",   0 , POPT_ARG_STRING, &metrics, 0, "Modifies --daemon to append connection and job events to <file>", "file"},
 		POPT_TABLEEND
 	};
 
@@ -2414,6 +3231,14 @@ main(int argc, const char *argv[])
 			case 'e':
 				make_excludelist(poptGetOptArg(pc));
 				break;
+			case 'N':
+				if (nports == DAEMON_MAX_PORTS)
+				{
+					fprintf(stderr,"   ERROR: at most %d ports may be given with --listen.\n", DAEMON_MAX_PORTS);
+					return 1;
+				}
+				ports[nports++] = poptGetOptArg(pc);
+				break;
 			case 'x':
 				if (system(poptGetOptArg(pc)))
 				{
@@ -2515,69 +3340,48 @@ main(int argc, const char *argv[])
 			break;
 	}
 
-	/* plu_connect() prints diagnostics as needed, returns -1 on
-	failure so just bail in that case. */
-	sd = plu_connect();
-	if (sd < 0)
-		return 1;
+	job.op		= palm_operation;
+	job.flags	= sync_flags;
+	job.unsaved	= unsaved;
+	job.pipeline	= pipeline;
+	job.dirname	= dirname;
+	job.archive_dir	= archive_dir;
+	job.store	= store;
+	job.rargv	= rargv;
 
-	/* actual operation */
-	switch(palm_operation)
+	if (daemon_mode)
 	{
-		case palm_op_noop: /* handled above */
-			exit(1);
-			break;
-		case palm_op_backup:
-		case palm_op_update:
-		case palm_op_sync:
-			if (palm_op_backup == palm_operation)
-				sync_flags |= BACKUP;
-			if (palm_op_update == palm_operation)
-				sync_flags |= UPDATE;
-			if (palm_op_sync == palm_operation)
-				sync_flags |= UPDATE | SYNC;
-			palm_backup(dirname, sync_flags, unsaved, archive_dir);
-			break;
-		case palm_op_restore:
-			palm_restore(dirname);
-			break;
-		case palm_op_merge:
-		case palm_op_install:
-		case palm_op_fetch:
-		case palm_op_delete:
-			while (rargv && *rargv)
+		if (nports == 0)
+		{
+			if (plu_port == NULL)
+				plu_port = getenv("PILOTPORT");
+			if (plu_port == NULL)
 			{
-				switch(palm_operation)
-				{
-					case palm_op_merge:
-						palm_merge(*rargv);
-						break;
-					case palm_op_fetch:
-						palm_fetch(sync_flags,*rargv);
-						break;
-					case palm_op_delete:
-						palm_delete(*rargv);
-						break;
-					case palm_op_install:
-						palm_install(sync_flags,*rargv);
-						break;
-					default:
-						/* impossible */
-						break;
-				}
-				rargv++;
+				fprintf(stderr,"   ERROR: --daemon needs a port, from -p or --listen.\n");
+				return 1;
 			}
-			break;
-		case palm_op_list:
-			palm_list(sync_flags);
-			break;
-		case palm_op_cardinfo:
-			palm_cardinfo();
-			break;
+			ports[nports++] = plu_port;
+		}
+		if (workers <= 0)
+			workers = nports > 4 ? nports : 4;
+		if (metrics != NULL
+		    && (metrics_fd = open(metrics,
+				O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+		{
+			fprintf(stderr,"   ERROR: cannot open '%s': %s\n",
+				metrics, strerror(errno));
+			return 1;
+		}
+		return palm_daemon(ports, nports, workers, &job);
 	}
 
-	if (sync_flags & PURGE)
-		palm_purge();
+	/* plu_connect() prints diagnostics as needed, returns -1 on
+	failure so just bail in that case. */
+	sd = plu_connect();
+	if (sd < 0)
+		return 1;
+
+	palm_run(&job);
 
 	pi_close(sd);
 	puts(gracias);
@@ -0,0 +1,266 @@
+/*
+ * $Id$
+ *
+ * plu_catalog.c: in-memory catalogue of the databases on the handheld
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-dlp.h"
+#include "pi-socket.h"
+#include "pi-userland.h"
+
+/* Ties keep the order in which the handheld listed the databases */
+#define plu_catalog_tie(a, b) \
+	((*(a) > *(b)) - (*(a) < *(b)))
+
+static int
+plu_catalog_by_name(const void *l, const void *r)
+{
+	const struct DBInfo *const *a = l, *const *b = r;
+	int	c;
+
+	if ((c = strcmp((*a)->name, (*b)->name)) != 0)
+		return c;
+	return plu_catalog_tie(a, b);
+}
+
+static int
+plu_catalog_by_creator(const void *l, const void *r)
+{
+	const struct DBInfo *const *a = l, *const *b = r;
+
+	if ((*a)->creator != (*b)->creator)
+		return (*a)->creator < (*b)->creator ? -1 : 1;
+	if ((*a)->type != (*b)->type)
+		return (*a)->type < (*b)->type ? -1 : 1;
+	return plu_catalog_by_name(l, r);
+}
+
+static int
+plu_catalog_by_modnum(const void *l, const void *r)
+{
+	const struct DBInfo *const *a = l, *const *b = r;
+
+	if ((*a)->modnum != (*b)->modnum)
+		return (*a)->modnum < (*b)->modnum ? -1 : 1;
+	return plu_catalog_tie(a, b);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_catalog_read
+ *
+ * Summary:     Read the database list of a card into a catalogue
+ *
+ * Parameters:  socket, card number, dlpDBListRAM and/or dlpDBListROM
+ *
+ * Returns:     the catalogue, or NULL on error
+ *
+ ***********************************************************************/
+plu_catalog_t *
+plu_catalog_read(int sd, int cardno, int flags)
+{
+	plu_catalog_t *cat;
+	pi_buffer_t *buffer,
+		*list;
+	struct DBInfo *info;
+	int	i,
+		n,
+		start = 0,
+		result;
+
+	cat = calloc(1, sizeof(plu_catalog_t));
+	buffer = pi_buffer_new(sizeof(struct DBInfo));
+	list = pi_buffer_new(32 * sizeof(struct DBInfo));
+	if (cat == NULL || buffer == NULL || list == NULL)
+		goto fail;
+
+	/* Each request returns as many entries as fit in one response on
+	   DLP 1.2 and later, a single one before; the list ends with a
+	   dlpErrNotFound answer, as the "more" flag is not to be trusted
+	   on every device */
+	for (;;) {
+		result = dlp_ReadDBList(sd, cardno, flags | dlpDBListMultiple,
+			start, buffer);
+		if (result < 0) {
+			if (result == PI_ERR_DLP_PALMOS
+			    && pi_palmos_error(sd) == dlpErrNotFound)
+				break;
+			goto fail;
+		}
+		cat->exchanges++;
+
+		n = buffer->used / sizeof(struct DBInfo);
+		if (n == 0)
+			break;
+		if (pi_buffer_append_buffer(list, buffer) == NULL)
+			goto fail;
+
+		info = (struct DBInfo *) buffer->data + n - 1;
+		start = info->index + 1;
+	}
+
+	cat->count = list->used / sizeof(struct DBInfo);
+	if (cat->count > 0) {
+		cat->info = malloc(list->used);
+		cat->by_name = malloc(cat->count * sizeof(struct DBInfo *));
+		cat->by_creator = malloc(cat->count * sizeof(struct DBInfo *));
+		cat->by_modnum = malloc(cat->count * sizeof(struct DBInfo *));
+		if (cat->info == NULL || cat->by_name == NULL
+		    || cat->by_creator == NULL || cat->by_modnum == NULL)
+			goto fail;
+		memcpy(cat->info, list->data, list->used);
+	}
+
+	for (i = 0; i < cat->count; i++)
+		cat->by_name[i] = cat->by_creator[i] = cat->by_modnum[i]
+			= &cat->info[i];
+	if (cat->count > 1) {
+		qsort(cat->by_name, (size_t) cat->count,
+			sizeof(struct DBInfo *), plu_catalog_by_name);
+		qsort(cat->by_creator, (size_t) cat->count,
+			sizeof(struct DBInfo *), plu_catalog_by_creator);
+		qsort(cat->by_modnum, (size_t) cat->count,
+			sizeof(struct DBInfo *), plu_catalog_by_modnum);
+	}
+
+	pi_buffer_free(list);
+	pi_buffer_free(buffer);
+	return cat;
+
+fail:
+	if (list != NULL)
+		pi_buffer_free(list);
+	if (buffer != NULL)
+		pi_buffer_free(buffer);
+	plu_catalog_free(cat);
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_catalog_find
+ *
+ * Summary:     Look a database up by name
+ *
+ * Parameters:  catalogue, database name
+ *
+ * Returns:     the first database listed with that name, or NULL
+ *
+ ***********************************************************************/
+struct DBInfo *
+plu_catalog_find(const plu_catalog_t *cat, const char *name)
+{
+	int	lo = 0,
+		hi = cat->count,
+		mid;
+
+	/* lower bound, so that the first one listed is found */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp(cat->by_name[mid]->name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < cat->count && strcmp(cat->by_name[lo]->name, name) == 0)
+		return cat->by_name[lo];
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_catalog_find_creator
+ *
+ * Summary:     Look databases up by creator and type
+ *
+ * Parameters:  catalogue, creator, type or 0 for any type, number of
+ *		matches (set on return)
+ *
+ * Returns:     index in by_creator of the first match, or -1
+ *
+ ***********************************************************************/
+int
+plu_catalog_find_creator(const plu_catalog_t *cat, unsigned long creator,
+	unsigned long type, int *count)
+{
+	int	lo = 0,
+		hi = cat->count,
+		mid,
+		first;
+	const struct DBInfo *info;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		info = cat->by_creator[mid];
+		if (info->creator < creator
+		    || (info->creator == creator && info->type < type))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	first = lo;
+	while (lo < cat->count && cat->by_creator[lo]->creator == creator
+	       && (type == 0 || cat->by_creator[lo]->type == type))
+		lo++;
+
+	if (count)
+		*count = lo - first;
+	return lo > first ? first : -1;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_catalog_free
+ *
+ * Summary:     Dispose of a catalogue
+ *
+ * Parameters:  catalogue or NULL
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+plu_catalog_free(plu_catalog_t *cat)
+{
+	if (cat == NULL)
+		return;
+	free(cat->by_modnum);
+	free(cat->by_creator);
+	free(cat->by_name);
+	free(cat->info);
+	free(cat);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
@@ -0,0 +1,301 @@
+/*
+ * $Id$
+ *
+ * plu_pipeline.c: fetch/decode/write pipeline for batch extraction
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pi-userland.h"
+
+/* Items queued per decoding thread; each may hold a whole picture */
+#define PLU_PIPELINE_DEPTH	2
+
+#define PLU_PIPELINE_MAX_JOBS	64
+
+struct plu_slot {
+	void	*item;
+	int	result,
+		decoded;
+};
+
+struct plu_pipeline {
+	plu_decode_t decode;
+	plu_write_t write;
+	int	threads;	/* decoding threads running, 0 when serial */
+
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t	work,	/* an item is waiting to be decoded */
+			done,	/* the oldest item may have been decoded */
+			space;	/* the oldest item has been written */
+	pthread_t	writer,
+			workers[PLU_PIPELINE_MAX_JOBS];
+
+	struct plu_slot *slots;
+	int	size;
+	unsigned long	head,	/* next item to write */
+			next,	/* next item to decode */
+			tail;	/* next free slot */
+	int	finishing;
+#endif
+};
+
+
+#if HAVE_PTHREAD
+/***********************************************************************
+ *
+ * Function:    plu_pipeline_worker
+ *
+ * Summary:     Decode queued items until the pipeline finishes
+ *
+ * Parameters:  the pipeline
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *
+plu_pipeline_worker(void *arg)
+{
+	plu_pipeline_t *p = (plu_pipeline_t *) arg;
+	struct plu_slot *slot;
+	int	result;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (p->next == p->tail && !p->finishing)
+			pthread_cond_wait(&p->work, &p->lock);
+		if (p->next == p->tail)
+			break;
+
+		slot = &p->slots[p->next++ % p->size];
+		pthread_mutex_unlock(&p->lock);
+
+		result = p->decode(slot->item);
+
+		pthread_mutex_lock(&p->lock);
+		slot->result 	= result;
+		slot->decoded 	= 1;
+		pthread_cond_broadcast(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_pipeline_writer
+ *
+ * Summary:     Write decoded items in the order they were submitted
+ *
+ * Parameters:  the pipeline
+ *
+ * Returns:     NULL
+ *
+ ***********************************************************************/
+static void *
+plu_pipeline_writer(void *arg)
+{
+	plu_pipeline_t *p = (plu_pipeline_t *) arg;
+	struct plu_slot *slot;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		slot = &p->slots[p->head % p->size];
+		while (!(p->head != p->tail && slot->decoded)
+		       && !(p->head == p->tail && p->finishing))
+			pthread_cond_wait(&p->done, &p->lock);
+		if (p->head == p->tail)
+			break;
+		pthread_mutex_unlock(&p->lock);
+
+		p->write(slot->item, slot->result);
+
+		pthread_mutex_lock(&p->lock);
+		slot->item 	= NULL;
+		slot->decoded 	= 0;
+		p->head++;
+		pthread_cond_signal(&p->space);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+#endif
+
+
+/***********************************************************************
+ *
+ * Function:    plu_pipeline_new
+ *
+ * Summary:     Start the decoding and writing threads
+ *
+ * Parameters:  number of decoding threads, decode and write callbacks
+ *
+ * Returns:     the pipeline, or NULL if out of memory
+ *
+ ***********************************************************************/
+plu_pipeline_t *
+plu_pipeline_new(int jobs, plu_decode_t decode, plu_write_t write)
+{
+	plu_pipeline_t *p;
+
+	p = calloc(1, sizeof(plu_pipeline_t));
+	if (p == NULL)
+		return NULL;
+	p->decode 	= decode;
+	p->write 	= write;
+
+#if HAVE_PTHREAD
+#ifdef _SC_NPROCESSORS_ONLN
+	if (jobs <= 0)
+		jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (jobs > PLU_PIPELINE_MAX_JOBS)
+		jobs = PLU_PIPELINE_MAX_JOBS;
+	if (jobs <= 1)
+		return p;
+
+	p->size = jobs * PLU_PIPELINE_DEPTH + 1;
+	p->slots = calloc((size_t) p->size, sizeof(struct plu_slot));
+	if (p->slots == NULL)
+		return p;
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+	pthread_cond_init(&p->space, NULL);
+
+	if (pthread_create(&p->writer, NULL, plu_pipeline_writer, p) != 0)
+		goto serial;
+	while (p->threads < jobs
+	       && pthread_create(&p->workers[p->threads], NULL,
+			plu_pipeline_worker, p) == 0)
+		p->threads++;
+	if (p->threads > 0)
+		return p;
+
+	/* no decoding thread would start, stop the writer again */
+	pthread_mutex_lock(&p->lock);
+	p->finishing = 1;
+	pthread_cond_broadcast(&p->done);
+	pthread_mutex_unlock(&p->lock);
+	pthread_join(p->writer, NULL);
+
+serial:
+	pthread_cond_destroy(&p->space);
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+	free(p->slots);
+	p->slots = NULL;
+#endif
+
+	return p;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_pipeline_submit
+ *
+ * Summary:     Queue one fetched item for decoding and writing
+ *
+ * Parameters:  the pipeline, the item
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+plu_pipeline_submit(plu_pipeline_t *p, void *item)
+{
+#if HAVE_PTHREAD
+	struct plu_slot *slot;
+
+	if (p->threads > 0) {
+		pthread_mutex_lock(&p->lock);
+		while (p->tail - p->head == (unsigned long) p->size)
+			pthread_cond_wait(&p->space, &p->lock);
+		slot = &p->slots[p->tail++ % p->size];
+		slot->item 	= item;
+		slot->decoded 	= 0;
+		pthread_cond_signal(&p->work);
+		pthread_mutex_unlock(&p->lock);
+		return;
+	}
+#endif
+
+	p->write(item, p->decode(item));
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_pipeline_finish
+ *
+ * Summary:     Drain the pipeline and stop its threads
+ *
+ * Parameters:  the pipeline
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+plu_pipeline_finish(plu_pipeline_t *p)
+{
+#if HAVE_PTHREAD
+	int	i;
+
+	if (p->threads > 0) {
+		pthread_mutex_lock(&p->lock);
+		p->finishing = 1;
+		pthread_cond_broadcast(&p->work);
+		pthread_cond_broadcast(&p->done);
+		pthread_mutex_unlock(&p->lock);
+
+		for (i = 0; i < p->threads; i++)
+			pthread_join(p->workers[i], NULL);
+		pthread_join(p->writer, NULL);
+
+		pthread_cond_destroy(&p->space);
+		pthread_cond_destroy(&p->done);
+		pthread_cond_destroy(&p->work);
+		pthread_mutex_destroy(&p->lock);
+		free(p->slots);
+	}
+#endif
+	free(p);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
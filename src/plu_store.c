@@ -0,0 +1,788 @@
+/*
+ * $Id$
+ *
+ * plu_store.c: content-addressed store of database snapshots
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pi-buffer.h"
+#include "pi-file.h"
+#include "pi-md5.h"
+#include "pi-userland.h"
+
+/*
+ * A store directory holds
+ *
+ *   blobs/xx/yyyy...	blocks named after the MD5 of their contents,
+ *			xx being its first two hex digits
+ *   snapshots/<name>	one index per snapshot
+ *
+ * A snapshot index lists, for each database, the block holding its
+ * manifest. A manifest is text: the database header, the appInfo and
+ * sortInfo blocks, then a line per record or resource. Most records are
+ * far smaller than what the file system spends on a file, so the data of
+ * consecutive records is kept together in chunks, each following the
+ * lines of its records. A chunk ends after a record whose contents hash
+ * to a multiple of PLU_STORE_CHUNK_AVG, so that changing, adding or
+ * deleting a record only changes the chunk it is in. Blocks of up to
+ * PLU_STORE_INLINE bytes are kept in the manifest itself.
+ *
+ * Manifests and snapshot indexes are small, and a manifest is itself a
+ * block, so that a database which has not changed since the last
+ * snapshot costs one line in the next one.
+ */
+#define PLU_STORE_MAGIC		"pilot-link store 1"
+
+#define PLU_STORE_HASH_LEN	32	/* hex digits of an MD5 */
+#define PLU_STORE_INLINE	64
+#define PLU_STORE_LINE		(2 * PLU_STORE_INLINE + 128)
+
+#define PLU_STORE_CHUNK_AVG	16	/* entries */
+#define PLU_STORE_CHUNK_MAX	256	/* entries */
+#define PLU_STORE_CHUNK_SIZE	65536	/* bytes, unless one entry is larger */
+
+struct plu_store_pending {
+	unsigned long	a,		/* attributes, or resource type */
+			b;		/* unique ID, or resource ID */
+	int		category;
+	size_t		size;
+};
+
+static void
+plu_store_hash(const void *data, size_t size, char *hex)
+{
+	struct MD5Context ctx;
+	unsigned char digest[16];
+	int	i;
+
+	MD5Init(&ctx);
+	MD5Update(&ctx, (UINT8 const *) data, (unsigned) size);
+	MD5Final(digest, &ctx);
+	for (i = 0; i < 16; i++)
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+}
+
+
+/* Whether a chunk ends after this entry (FNV-1a of its contents) */
+static int
+plu_store_cut(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	unsigned long h = 2166136261UL;
+	size_t	i;
+
+	for (i = 0; i < size; i++)
+		h = ((h ^ p[i]) * 16777619UL) & 0xffffffffUL;
+	return h % PLU_STORE_CHUNK_AVG == 0;
+}
+
+
+/* Create every missing directory along path, like mkdir -p */
+static int
+plu_store_mkdirs(char *path)
+{
+	char	*p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+	return 0;
+}
+
+
+/* Write a file aside and rename it into place, so that a store shared
+   by several backups never shows a partial one */
+static int
+plu_store_write(const char *path, const void *data, size_t size)
+{
+	const char *base = strrchr(path, '/') + 1;
+	char	*tmp;
+	int	fd,
+		result = -1;
+
+	/* hidden, so that listings skip it */
+	if ((tmp = malloc(strlen(path) + 16)) == NULL)
+		return -1;
+	sprintf(tmp, "%.*s.%s.XXXXXX", (int) (base - path), path, base);
+	if ((fd = mkstemp(tmp)) < 0) {
+		free(tmp);
+		return -1;
+	}
+	if ((size == 0 || write(fd, data, size) == (ssize_t) size)
+	    && close(fd) == 0)
+		result = rename(tmp, path);
+	else
+		close(fd);
+	if (result < 0)
+		unlink(tmp);
+	free(tmp);
+	return result;
+}
+
+
+static void
+plu_store_printf(pi_buffer_t *buf, const char *format, ...)
+{
+	char	line[PLU_STORE_LINE];
+	int	len;
+	va_list	ap;
+
+	va_start(ap, format);
+	len = vsnprintf(line, sizeof(line), format, ap);
+	va_end(ap);
+	if (len >= (int) sizeof(line))
+		len = sizeof(line) - 1;
+	pi_buffer_append(buf, line, (size_t) len);
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_store_put
+ *
+ * Summary:     Store a block unless the store has it already
+ *
+ * Parameters:  store, block, its size, buffer for the hash (33 chars)
+ *
+ * Returns:     0, or -1 if the block could not be written
+ *
+ ***********************************************************************/
+static int
+plu_store_put(plu_store_t *store, const void *data, size_t size, char *hex)
+{
+	char	*path;
+	int	result;
+
+	plu_store_hash(data, size, hex);
+
+	path = malloc(strlen(store->dir) + PLU_STORE_HASH_LEN + 16);
+	if (path == NULL)
+		return -1;
+	sprintf(path, "%s/blobs/%.2s/%s", store->dir, hex, hex + 2);
+
+	if (access(path, F_OK) == 0) {
+		store->shared++;
+		store->shared_bytes += size;
+		free(path);
+		return 0;
+	}
+
+	path[strlen(store->dir) + 9] = '\0';
+	if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+		free(path);
+		return -1;
+	}
+	path[strlen(store->dir) + 9] = '/';
+
+	result = plu_store_write(path, data, size);
+	if (result == 0) {
+		store->blobs++;
+		store->bytes += size;
+	}
+	free(path);
+	return result;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_store_get
+ *
+ * Summary:     Read a block back from the store
+ *
+ * Parameters:  store, hash, expected size, buffer to fill
+ *
+ * Returns:     0, or -1 if the block is missing or damaged
+ *
+ ***********************************************************************/
+static int
+plu_store_get(const plu_store_t *store, const char *hex, size_t size,
+	pi_buffer_t *buf)
+{
+	char	*path,
+		check[PLU_STORE_HASH_LEN + 1];
+	FILE	*f;
+	int	result = -1;
+
+	if (strlen(hex) != PLU_STORE_HASH_LEN
+	    || pi_buffer_expect(buf, size) == NULL)
+		return -1;
+
+	path = malloc(strlen(store->dir) + PLU_STORE_HASH_LEN + 16);
+	if (path == NULL)
+		return -1;
+	sprintf(path, "%s/blobs/%.2s/%s", store->dir, hex, hex + 2);
+	if ((f = fopen(path, "rb")) != NULL) {
+		if (fread(buf->data, 1, size, f) == size && getc(f) == EOF) {
+			plu_store_hash(buf->data, size, check);
+			if (strcmp(check, hex) == 0) {
+				buf->used = size;
+				result = 0;
+			}
+		}
+		fclose(f);
+	}
+	free(path);
+	return result;
+}
+
+
+/* Add a block to a manifest line, inline or as a reference */
+static int
+plu_store_block(plu_store_t *store, pi_buffer_t *manifest, const void *data,
+	size_t size)
+{
+	char	hex[PLU_STORE_HASH_LEN + 1];
+	size_t	i;
+
+	if (size > PLU_STORE_INLINE) {
+		if (plu_store_put(store, data, size, hex) < 0)
+			return -1;
+		plu_store_printf(manifest, " %lu %s\n", (unsigned long) size,
+			hex);
+		return 0;
+	}
+
+	plu_store_printf(manifest, " %lu =", (unsigned long) size);
+	for (i = 0; i < size; i++)
+		plu_store_printf(manifest, "%02x",
+			((const unsigned char *) data)[i]);
+	pi_buffer_append(manifest, "\n", 1);
+	return 0;
+}
+
+
+/* Read a block named on a manifest line back */
+static int
+plu_store_unblock(plu_store_t *store, const char *size_ref, pi_buffer_t *buf)
+{
+	unsigned long size;
+	unsigned int byte;
+	char	ref[2 * PLU_STORE_INLINE + 2];
+	size_t	i;
+
+	if (sscanf(size_ref, "%lu %129s", &size, ref) != 2)
+		return -1;
+	if (ref[0] != '=')
+		return plu_store_get(store, ref, (size_t) size, buf);
+
+	if (size > PLU_STORE_INLINE || strlen(ref + 1) != 2 * size
+	    || pi_buffer_expect(buf, (size_t) size) == NULL)
+		return -1;
+	for (i = 0; i < size; i++) {
+		if (sscanf(ref + 1 + 2 * i, "%2x", &byte) != 1)
+			return -1;
+		buf->data[i] = (unsigned char) byte;
+	}
+	buf->used = size;
+	return 0;
+}
+
+
+static plu_store_entry_t *
+plu_store_find(const plu_store_t *store, const char *name)
+{
+	int	i;
+
+	for (i = 0; i < store->count; i++)
+		if (strcmp(store->entries[i].name, name) == 0)
+			return &store->entries[i];
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_store_open
+ *
+ * Summary:     Open a snapshot in a store
+ *
+ * Parameters:  store directory, snapshot name (may contain '/'),
+ *		non-zero to create a new snapshot or add to it
+ *
+ * Returns:     the store, or NULL if the snapshot does not exist or
+ *		cannot be created
+ *
+ ***********************************************************************/
+plu_store_t *
+plu_store_open(const char *dir, const char *snapshot, int create)
+{
+	plu_store_t *store;
+	plu_store_entry_t *entries;
+	char	line[PLU_STORE_LINE],
+		hex[PLU_STORE_HASH_LEN + 1],
+		*blobs;
+	unsigned long size;
+	int	offset;
+	char	*nl;
+	FILE	*f;
+	const char *part;
+
+	/* no part of the name may be empty or start with a dot, which
+	   keeps "." and ".." from leaving snapshots/ */
+	for (part = snapshot; ; part++) {
+		if (*part == '\0' || *part == '/' || *part == '.') {
+			errno = EINVAL;
+			return NULL;
+		}
+		if ((part = strchr(part, '/')) == NULL)
+			break;
+	}
+
+	if ((store = calloc(1, sizeof(plu_store_t))) == NULL)
+		return NULL;
+	store->dir = strdup(dir);
+	store->snapshot = strdup(snapshot);
+	store->index = malloc(strlen(dir) + strlen(snapshot) + 12);
+	if (store->dir == NULL || store->snapshot == NULL
+	    || store->index == NULL)
+		goto fail;
+	sprintf(store->index, "%s/snapshots/%s", dir, snapshot);
+
+	if ((f = fopen(store->index, "r")) == NULL) {
+		if (!create || errno != ENOENT)
+			goto fail;
+		if ((blobs = malloc(strlen(dir) + 8)) == NULL)
+			goto fail;
+		sprintf(blobs, "%s/blobs/", dir);
+		if (plu_store_mkdirs(blobs) < 0
+		    || plu_store_mkdirs(store->index) < 0) {
+			free(blobs);
+			goto fail;
+		}
+		free(blobs);
+		return store;
+	}
+
+	if (fgets(line, sizeof(line), f) == NULL
+	    || strcmp(line, PLU_STORE_MAGIC "\n") != 0) {
+		fclose(f);
+		goto fail;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((nl = strchr(line, '\n')) != NULL)
+			*nl = '\0';
+		if (sscanf(line, "%32s %lu %n", hex, &size, &offset) != 2
+		    || line[offset] == '\0')
+			continue;
+		if (store->count == store->allocated) {
+			entries = realloc(store->entries,
+				(store->allocated + 64)
+				* sizeof(plu_store_entry_t));
+			if (entries == NULL)
+				break;
+			store->entries = entries;
+			store->allocated += 64;
+		}
+		if ((store->entries[store->count].name
+			    = strdup(line + offset)) == NULL)
+			break;
+		strcpy(store->entries[store->count].hash, hex);
+		store->entries[store->count].size = (size_t) size;
+		store->count++;
+	}
+	fclose(f);
+	return store;
+
+fail:
+	plu_store_close(store);
+	return NULL;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_store_add
+ *
+ * Summary:     Add a database to the snapshot
+ *
+ * Parameters:  store, database opened with pi_file_open(), name to
+ *		keep it under (the file name it is backed up as)
+ *
+ * Returns:     0, or -1 on error
+ *
+ ***********************************************************************/
+int
+plu_store_add(plu_store_t *store, pi_file_t *pf, const char *name)
+{
+	struct DBInfo info;
+	pi_buffer_t *manifest,
+		*chunk;
+	plu_store_entry_t *entry,
+		*entries;
+	char	hex[PLU_STORE_HASH_LEN + 1];
+	void	*data;
+	size_t	size;
+	unsigned long type;
+	int	i,
+		n,
+		count,
+		id,
+		attr,
+		category,
+		result = -1;
+	recordid_t uid;
+
+	if (*name == '\0' || strchr(name, '\n') != NULL)
+		return -1;
+	manifest = pi_buffer_new(4096);
+	chunk = pi_buffer_new(PLU_STORE_CHUNK_SIZE);
+	if (manifest == NULL || chunk == NULL)
+		goto done;
+
+	pi_file_get_info(pf, &info);
+	plu_store_printf(manifest, "%s\n", PLU_STORE_MAGIC);
+	plu_store_printf(manifest, "name %.32s\n", info.name);
+	plu_store_printf(manifest, "flags 0x%04x\n", info.flags);
+	plu_store_printf(manifest, "version %d\n", info.version);
+	plu_store_printf(manifest, "type 0x%08lx\n", info.type);
+	plu_store_printf(manifest, "creator 0x%08lx\n", info.creator);
+	plu_store_printf(manifest, "modnum %lu\n", info.modnum);
+	plu_store_printf(manifest, "created %ld\n", (long) info.createDate);
+	plu_store_printf(manifest, "modified %ld\n", (long) info.modifyDate);
+	plu_store_printf(manifest, "backup %ld\n", (long) info.backupDate);
+	plu_store_printf(manifest, "seed 0x%08lx\n", pf->unique_id_seed);
+
+	pi_file_get_app_info(pf, &data, &size);
+	if (size > 0) {
+		plu_store_printf(manifest, "appinfo");
+		if (plu_store_block(store, manifest, data, size) < 0)
+			goto done;
+	}
+	pi_file_get_sort_info(pf, &data, &size);
+	if (size > 0) {
+		plu_store_printf(manifest, "sortinfo");
+		if (plu_store_block(store, manifest, data, size) < 0)
+			goto done;
+	}
+
+	pi_file_get_entries(pf, &n);
+	for (i = 0, count = 0; i < n; i++) {
+		if (info.flags & dlpDBFlagResource) {
+			if (pi_file_read_resource(pf, i, &data, &size, &type,
+					&id) < 0)
+				goto done;
+			plu_store_printf(manifest, "resource 0x%08lx %d %lu\n",
+				type, id, (unsigned long) size);
+		} else {
+			if (pi_file_read_record(pf, i, &data, &size, &attr,
+					&category, &uid) < 0)
+				goto done;
+			plu_store_printf(manifest, "record 0x%02x %d %lu %lu\n",
+				attr, category, (unsigned long) uid,
+				(unsigned long) size);
+		}
+		if (pi_buffer_append(chunk, data, size) == NULL)
+			goto done;
+		count++;
+
+		if (i + 1 < n && count < PLU_STORE_CHUNK_MAX
+		    && chunk->used < PLU_STORE_CHUNK_SIZE
+		    && !plu_store_cut(data, size))
+			continue;
+		plu_store_printf(manifest, "chunk");
+		if (plu_store_block(store, manifest, chunk->data,
+				chunk->used) < 0)
+			goto done;
+		pi_buffer_clear(chunk);
+		count = 0;
+	}
+
+	if (manifest->used == 0
+	    || plu_store_put(store, manifest->data, manifest->used, hex) < 0)
+		goto done;
+
+	if ((entry = plu_store_find(store, name)) == NULL) {
+		if (store->count == store->allocated) {
+			entries = realloc(store->entries,
+				(store->allocated + 64)
+				* sizeof(plu_store_entry_t));
+			if (entries == NULL)
+				goto done;
+			store->entries = entries;
+			store->allocated += 64;
+		}
+		entry = &store->entries[store->count];
+		if ((entry->name = strdup(name)) == NULL)
+			goto done;
+		store->count++;
+	}
+	strcpy(entry->hash, hex);
+	entry->size = manifest->used;
+	store->dirty = 1;
+	result = 0;
+
+done:
+	if (chunk != NULL)
+		pi_buffer_free(chunk);
+	if (manifest != NULL)
+		pi_buffer_free(manifest);
+	return result;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_store_commit
+ *
+ * Summary:     Write the snapshot index
+ *
+ * Parameters:  store
+ *
+ * Returns:     0, or -1 on error
+ *
+ ***********************************************************************/
+int
+plu_store_commit(plu_store_t *store)
+{
+	pi_buffer_t *index;
+	int	i,
+		result;
+
+	if (!store->dirty)
+		return 0;
+	if ((index = pi_buffer_new(64 * (size_t) (store->count + 1))) == NULL)
+		return -1;
+	plu_store_printf(index, "%s\n", PLU_STORE_MAGIC);
+	for (i = 0; i < store->count; i++) {
+		plu_store_printf(index, "%s %lu ", store->entries[i].hash,
+			(unsigned long) store->entries[i].size);
+		pi_buffer_append(index, store->entries[i].name,
+			strlen(store->entries[i].name));
+		pi_buffer_append(index, "\n", 1);
+	}
+	result = plu_store_write(store->index, index->data, index->used);
+	if (result == 0)
+		store->dirty = 0;
+	pi_buffer_free(index);
+	return result;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_store_extract
+ *
+ * Summary:     Rebuild a database of the snapshot
+ *
+ * Parameters:  store, name it is kept under, file to write
+ *
+ * Returns:     0, or -1 if the database is not in the snapshot or one
+ *		of its blocks is missing or damaged
+ *
+ ***********************************************************************/
+int
+plu_store_extract(plu_store_t *store, const char *name, const char *filename)
+{
+	struct DBInfo info;
+	plu_store_entry_t *entry;
+	pi_file_t *pf	= NULL;
+	pi_buffer_t *manifest,
+		*block;
+	char	line[PLU_STORE_LINE],
+		word[16],
+		*p,
+		*end,
+		*nl;
+	unsigned long a,
+		b,
+		seed	= 0;
+	long	l;
+	struct plu_store_pending pending[PLU_STORE_CHUNK_MAX];
+	size_t	len,
+		pos;
+	int	id,
+		k,
+		npending = 0,
+		offset,
+		result	= -1;
+
+	if ((entry = plu_store_find(store, name)) == NULL)
+		return -1;
+	manifest = pi_buffer_new(entry->size);
+	block = pi_buffer_new(PLU_STORE_INLINE);
+	if (manifest == NULL || block == NULL
+	    || plu_store_get(store, entry->hash, entry->size, manifest) < 0)
+		goto done;
+
+	p = (char *) manifest->data;
+	end = p + manifest->used;
+	memset(&info, 0, sizeof(info));
+	for (; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', (size_t) (end - p))) == NULL
+		    || (len = (size_t) (nl - p)) >= sizeof(line))
+			goto done;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		if (p == (char *) manifest->data) {
+			if (strcmp(line, PLU_STORE_MAGIC) != 0)
+				goto done;
+			continue;
+		}
+		if (sscanf(line, "%15s %n", word, &offset) != 1)
+			goto done;
+
+		/* the header comes first, up to the seed, then the blocks */
+		if (strcmp(word, "name") == 0) {
+			strncpy(info.name, line + 5, sizeof(info.name) - 1);
+		} else if (strcmp(word, "flags") == 0
+		    && sscanf(line + offset, "%lx", &a) == 1) {
+			info.flags = (int) a;
+		} else if (strcmp(word, "version") == 0
+		    && sscanf(line + offset, "%d", &info.version) == 1) {
+		} else if (strcmp(word, "type") == 0
+		    && sscanf(line + offset, "%lx", &info.type) == 1) {
+		} else if (strcmp(word, "creator") == 0
+		    && sscanf(line + offset, "%lx", &info.creator) == 1) {
+		} else if (strcmp(word, "modnum") == 0
+		    && sscanf(line + offset, "%lu", &info.modnum) == 1) {
+		} else if (strcmp(word, "created") == 0
+		    && sscanf(line + offset, "%ld", &l) == 1) {
+			info.createDate = (time_t) l;
+		} else if (strcmp(word, "modified") == 0
+		    && sscanf(line + offset, "%ld", &l) == 1) {
+			info.modifyDate = (time_t) l;
+		} else if (strcmp(word, "backup") == 0
+		    && sscanf(line + offset, "%ld", &l) == 1) {
+			info.backupDate = (time_t) l;
+		} else if (strcmp(word, "seed") == 0 && pf == NULL
+		    && sscanf(line + offset, "%lx", &seed) == 1) {
+			if ((pf = pi_file_create(filename, &info)) == NULL)
+				goto done;
+			pf->unique_id_seed = seed;
+		} else if (pf == NULL) {
+			goto done;
+		} else if (strcmp(word, "appinfo") == 0) {
+			if (plu_store_unblock(store, line + offset, block) < 0
+			    || pi_file_set_app_info(pf, block->data,
+					block->used) < 0)
+				goto done;
+		} else if (strcmp(word, "sortinfo") == 0) {
+			if (plu_store_unblock(store, line + offset, block) < 0
+			    || pi_file_set_sort_info(pf, block->data,
+					block->used) < 0)
+				goto done;
+		} else if (strcmp(word, "resource") == 0
+		    && npending < PLU_STORE_CHUNK_MAX
+		    && sscanf(line + offset, "%lx %d %lu", &pending[npending].a,
+				&id, &b) == 3) {
+			pending[npending].b = (unsigned long) id;
+			pending[npending++].size = (size_t) b;
+		} else if (strcmp(word, "record") == 0
+		    && npending < PLU_STORE_CHUNK_MAX
+		    && sscanf(line + offset, "%lx %d %lu %lu",
+				&pending[npending].a,
+				&pending[npending].category,
+				&pending[npending].b, &b) == 4) {
+			pending[npending++].size = (size_t) b;
+		} else if (strcmp(word, "chunk") == 0) {
+			if (plu_store_unblock(store, line + offset, block) < 0)
+				goto done;
+			for (k = 0, pos = 0; k < npending; k++) {
+				if (pending[k].size > block->used - pos)
+					goto done;
+				if (info.flags & dlpDBFlagResource)
+					id = pi_file_append_resource(pf,
+						block->data + pos,
+						pending[k].size, pending[k].a,
+						(int) pending[k].b);
+				else
+					id = pi_file_append_record(pf,
+						block->data + pos,
+						pending[k].size,
+						(int) pending[k].a,
+						pending[k].category,
+						(recordid_t) pending[k].b);
+				if (id < 0)
+					goto done;
+				pos += pending[k].size;
+			}
+			if (pos != block->used)
+				goto done;
+			npending = 0;
+		} else {
+			goto done;
+		}
+	}
+	if (pf != NULL && npending == 0)
+		result = 0;
+
+done:
+	if (manifest != NULL)
+		pi_buffer_free(manifest);
+	if (block != NULL)
+		pi_buffer_free(block);
+	if (pf != NULL && pi_file_close(pf) < 0)
+		result = -1;
+	if (result < 0 && pf != NULL)
+		unlink(filename);
+	return result;
+}
+
+
+/***********************************************************************
+ *
+ * Function:    plu_store_close
+ *
+ * Summary:     Dispose of a store, without writing the snapshot index
+ *
+ * Parameters:  store or NULL
+ *
+ * Returns:     Nothing
+ *
+ ***********************************************************************/
+void
+plu_store_close(plu_store_t *store)
+{
+	int	i;
+
+	if (store == NULL)
+		return;
+	for (i = 0; i < store->count; i++)
+		free(store->entries[i].name);
+	free(store->entries);
+	free(store->index);
+	free(store->snapshot);
+	free(store->dir);
+	free(store);
+}
+
+/* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
+/* Local Variables: */
+/* indent-tabs-mode: t */
+/* c-basic-offset: 8 */
+/* End: */
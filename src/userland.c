@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "pi-header.h"
 #include "pi-socket.h"
@@ -222,6 +223,20 @@ int plu_getromversion(int sd, plu_romversion_t *d)
 	return 0;
 }
 
+int plu_note_flags_reset(int sd)
+{
+	struct PilotUser User;
+
+	/* pilot-xfer --incremental trusts the modified flags only for
+	   backups made under the current last sync date */
+	if (dlp_ReadUserInfo(sd, &User) < 0)
+		return -1;
+	User.lastSyncDate = time(NULL);
+	if (dlp_WriteUserInfo(sd, &User) < 0)
+		return -1;
+	return 0;
+}
+
 /* vi: set ts=8 sw=4 sts=4 noexpandtab: cin */
 /* ex: set tabstop=4 expandtab: */
 /* Local Variables: */
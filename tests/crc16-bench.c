@@ -0,0 +1,110 @@
+/* crc16-bench.c:  Check and time the SLP CRC16 implementation
+ *
+ * Compares the table driven crc16() in libpisock against the original
+ * bitwise routine over packet sizes seen on serial links: a bare SLP
+ * ack, a full PADP fragment and a maximum sized SLP packet.
+ *
+ * Usage: crc16-bench [iterations]
+ *
+ * This is free software, licensed under the GNU Public License V2.
+ * See the file COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-slp.h"
+#include "pi-padp.h"
+
+static int
+crc16_bitwise(unsigned char *ptr, int count)
+{
+	int	crc,
+		i;
+
+	crc = 0;
+	while (--count >= 0) {
+		crc = crc ^ (int) *ptr++ << 8;
+		for (i = 0; i < 8; ++i)
+			if (crc & 0x8000)
+				crc = crc << 1 ^ 0x1021;
+			else
+				crc = crc << 1;
+	}
+	return (crc & 0xFFFF);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static unsigned char buf[PI_SLP_MTU];
+	int	sizes[] = { PI_SLP_HEADER_LEN + 2,
+			    PI_SLP_HEADER_LEN + PI_PADP_HEADER_LEN + 1024,
+			    PI_SLP_MTU },
+		iterations = 200,
+		errors = 0,
+		i,
+		j,
+		n;
+	volatile int sink = 0;
+	struct timeval start;
+	double	bitwise,
+		table;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	srand(1);
+	for (i = 0; i < PI_SLP_MTU; i++)
+		buf[i] = rand() & 0xff;
+
+	/* every length up to a few slices, at every alignment */
+	for (i = 0; i < 8; i++)
+		for (n = 0; n < 64; n++)
+			if (crc16(buf + i, n) != crc16_bitwise(buf + i, n)) {
+				printf("crc16 mismatch: offset %d, length %d\n",
+					i, n);
+				errors++;
+			}
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+		n = sizes[i];
+		if (crc16(buf, n) != crc16_bitwise(buf, n)) {
+			printf("crc16 mismatch: length %d\n", n);
+			errors++;
+		}
+
+		/* scale so every size hashes about the same amount of data */
+		j = (int)((double) iterations * PI_SLP_MTU / n);
+
+		gettimeofday(&start, NULL);
+		while (j-- > 0)
+			sink += crc16_bitwise(buf, n);
+		bitwise = elapsed(&start);
+
+		j = (int)((double) iterations * PI_SLP_MTU / n);
+		gettimeofday(&start, NULL);
+		while (j-- > 0)
+			sink += crc16(buf, n);
+		table = elapsed(&start);
+
+		printf("%6d bytes: bitwise %7.1f MB/s, table %7.1f MB/s\n",
+			n,
+			(double) iterations * PI_SLP_MTU / 1e6 / (bitwise > 0 ? bitwise : 1e-9),
+			(double) iterations * PI_SLP_MTU / 1e6 / (table > 0 ? table : 1e-9));
+	}
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,238 @@
+/* palmpix-bench.c:  Check and time the PalmPix decoder
+ *
+ * Decodes a synthetic 640x480 picture with every combination of colour
+ * correction, histogram stretch and bias, checks the result against the
+ * output of the original per-pixel implementation and reports how many
+ * pictures a second each combination decodes. The picture is made of
+ * pseudo-random compressed data, which decodes to noise but exercises
+ * the same code as a real one.
+ *
+ * Any ArchImage databases named on the command line are decoded too,
+ * which times the decoder on real pictures.
+ *
+ * Usage: palmpix-bench [iterations] [ArchImage.pdb ...]
+ *
+ * This is free software, licensed under the GNU Public License V2.
+ * See the file COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pi-file.h"
+#include "pi-palmpix.h"
+
+#define SYNTH_WIDTH	640
+#define SYNTH_HEIGHT	480
+#define SYNTH_CHANNEL	65000		/* compressed bytes per channel */
+#define SYNTH_RECORD	4000		/* bytes per channel record */
+
+struct synth_state {
+	struct PalmPixState state;
+	unsigned char *data;
+	int	records;
+};
+
+struct file_state {
+	struct PalmPixState state;
+	pi_file_t *f;
+};
+
+static const struct {
+	int	flags,
+		bias;
+	unsigned long hash;	/* interior pixels, original implementation */
+} checks[] = {
+	{ 0,							50, 0xe9e7781cUL },
+	{ PALMPIX_COLOUR_CORRECTION,				50, 0xafe837a3UL },
+	{ PALMPIX_HISTOGRAM_STRETCH,				50, 0xa1ad089aUL },
+	{ PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH,	50, 0x556e4643UL },
+	{ 0,							70, 0x891f486dUL },
+	{ PALMPIX_COLOUR_CORRECTION,				30, 0x25db69baUL },
+	{ PALMPIX_COLOUR_CORRECTION | PALMPIX_HISTOGRAM_STRETCH,	70, 0x42b9a95aUL }
+};
+
+static int
+getrecord_synth(struct PalmPixState *vstate, int recno, void **buf,
+	size_t *bufsize)
+{
+	struct synth_state *s = (struct synth_state *) vstate;
+
+	/* channel records follow the header and three more records */
+	recno -= 4;
+	if (recno < 0 || recno >= s->records)
+		return -1;
+	*buf = s->data + recno * SYNTH_RECORD;
+	*bufsize = SYNTH_RECORD;
+	return 0;
+}
+
+static int
+getrecord_file(struct PalmPixState *vstate, int recno, void **buf,
+	size_t *bufsize)
+{
+	struct file_state *s = (struct file_state *) vstate;
+
+	return pi_file_read_record(s->f, recno, buf, bufsize, NULL,
+		NULL, NULL) < 0 ? -1 : 0;
+}
+
+/* The decoder leaves the outermost pixels alone, only hash the rest */
+static unsigned long
+hash_interior(const struct PalmPixHeader *h, const unsigned char *pixmap)
+{
+	unsigned long hash = 2166136261UL;
+	int	x,
+		y;
+
+	for (y = 1; y < h->h - 1; y++)
+		for (x = 2 * 3; x < (h->w - 2) * 3; x++) {
+			hash ^= pixmap[y * h->w * 3 + x];
+			hash = (hash * 16777619UL) & 0xffffffffUL;
+		}
+	return hash;
+}
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+static void
+init_state(struct PalmPixState *state, int flags, int bias)
+{
+	state->offset_r	= 0;
+	state->offset_g	= 1;
+	state->offset_b	= 2;
+	state->pixmap	= NULL;
+	state->flags	= flags;
+	state->bias	= bias;
+}
+
+static int
+bench_file(const char *name, int iterations)
+{
+	struct file_state s;
+	struct PalmPixHeader h;
+	struct timeval start;
+	void	*buffer;
+	size_t	bufsize;
+	int	i,
+		n,
+		recno,
+		pictures = 0,
+		pixels = 0;
+	double	t;
+
+	if ((s.f = pi_file_open(name)) == NULL) {
+		printf("%s: unable to open\n", name);
+		return 1;
+	}
+	pi_file_get_entries(s.f, &n);
+
+	memset(&s.state, 0, sizeof(s.state));
+	s.state.getrecord = getrecord_file;
+	init_state(&s.state, PALMPIX_COLOUR_CORRECTION
+		| PALMPIX_HISTOGRAM_STRETCH, 50);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++)
+		for (recno = 0; recno < n; recno++) {
+			if (getrecord_file(&s.state, recno, &buffer, &bufsize) != 0
+			    || unpack_PalmPixHeader(&h, buffer, (int) bufsize) == 0)
+				continue;
+			if (unpack_PalmPix(&s.state, &h, recno, pixPixmap)) {
+				free_PalmPix_data(&s.state);
+				pictures++;
+				pixels += h.w * h.h;
+			}
+			recno = s.state.highest_recno;
+		}
+	t = elapsed(&start);
+	pi_file_close(s.f);
+
+	printf("%s: %d pictures, %.1f Mpixel/s\n", name, pictures,
+		pixels / 1e6 / (t > 0 ? t : 1e-9));
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct synth_state s;
+	struct PalmPixHeader h;
+	struct timeval start;
+	unsigned long seed = 1,
+		hash;
+	int	iterations = 10,
+		errors = 0,
+		i,
+		j;
+	double	t;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	/* each channel starts in a record of its own */
+	s.records = 4 * ((SYNTH_CHANNEL + SYNTH_RECORD - 1) / SYNTH_RECORD);
+	s.data = malloc((size_t) s.records * SYNTH_RECORD);
+	if (s.data == NULL)
+		return 1;
+	for (i = 0; i < s.records * SYNTH_RECORD; i++) {
+		seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+		s.data[i] = (unsigned char) (seed >> 16);
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.w = SYNTH_WIDTH;
+	h.h = SYNTH_HEIGHT;
+	h.numRec = s.records;
+	for (i = 0; i < 4; i++)
+		h.chansize[i] = SYNTH_CHANNEL;
+
+	memset(&s.state, 0, sizeof(s.state));
+	s.state.getrecord = getrecord_synth;
+
+	for (i = 0; i < (int) (sizeof(checks) / sizeof(checks[0])); i++) {
+		init_state(&s.state, checks[i].flags, checks[i].bias);
+
+		if (!unpack_PalmPix(&s.state, &h, 0, pixPixmap)) {
+			printf("flags %d, bias %d: decoding failed\n",
+				checks[i].flags, checks[i].bias);
+			errors++;
+			continue;
+		}
+		hash = hash_interior(&h, s.state.pixmap);
+		free_PalmPix_data(&s.state);
+		if (hash != checks[i].hash) {
+			printf("flags %d, bias %d: got %08lx, expected %08lx\n",
+				checks[i].flags, checks[i].bias, hash,
+				checks[i].hash);
+			errors++;
+		}
+
+		gettimeofday(&start, NULL);
+		for (j = 0; j < iterations; j++) {
+			unpack_PalmPix(&s.state, &h, 0, pixPixmap);
+			free_PalmPix_data(&s.state);
+		}
+		t = elapsed(&start);
+
+		printf("flags %d, bias %d: %6.1f pictures/s\n",
+			checks[i].flags, checks[i].bias,
+			iterations / (t > 0 ? t : 1e-9));
+	}
+
+	for (i = 2; i < argc; i++)
+		errors += bench_file(argv[i], iterations);
+
+	free(s.data);
+	return errors ? 1 : 0;
+}
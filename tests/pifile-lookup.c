@@ -0,0 +1,186 @@
+/* pifile-lookup.c:  Check and time pi_file lookups by unique ID and type
+ *
+ * Builds a record database and a resource database with many entries,
+ * some of them sharing a key, then looks every key up in the files
+ * while they are being written, after pi_file_open() and after
+ * pi_file_open_mapped(). Each lookup must find the first entry with the
+ * key, as a scan of the entries would.
+ *
+ * Usage: pifile-lookup [entries]
+ *
+ * This is free software, licensed under the GNU Public License V2.
+ * See the file COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "pi-source.h"
+#include "pi-file.h"
+
+#define RESTYPE(i)	(0x74737430UL + (unsigned long) ((i) % 7))
+#define RESID(i)	((i) / 7)
+
+static double
+elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/* Unique IDs are spread out; every tenth record has none */
+static recordid_t
+uid_of(int i)
+{
+	return i % 10 == 9 ? 0 : (recordid_t) (i * 37 + 1) & 0xffffff;
+}
+
+static int
+check_records(pi_file_t *pf, int n, const char *what)
+{
+	void	*buf;
+	size_t	size;
+	int	errors = 0,
+		i,
+		idx;
+
+	for (i = 0; i < n; i++) {
+		if (uid_of(i) == 0)
+			continue;
+		idx = -1;
+		if (pi_file_read_record_by_id(pf, uid_of(i), &buf, &size,
+				&idx, NULL, NULL) < 0
+		    || idx != i || size != sizeof(int)
+		    || memcmp(buf, &i, sizeof(int)) != 0) {
+			printf("%s: record %d not found (got %d)\n", what, i,
+				idx);
+			errors++;
+		}
+	}
+	if (pi_file_id_used(pf, 0xfffffe) || !pi_file_id_used(pf, uid_of(0))) {
+		printf("%s: pi_file_id_used wrong\n", what);
+		errors++;
+	}
+	/* the first record without an ID */
+	idx = -1;
+	if (pi_file_read_record_by_id(pf, 0, &buf, &size, &idx, NULL,
+			NULL) < 0 || idx != 9) {
+		printf("%s: record with no ID found at %d\n", what, idx);
+		errors++;
+	}
+	return errors;
+}
+
+static int
+check_resources(pi_file_t *pf, int n, int writing, const char *what)
+{
+	void	*buf;
+	size_t	size;
+	int	errors = 0,
+		i,
+		idx;
+
+	for (i = 0; i < n; i++) {
+		/* only the lookup itself works on a file being written */
+		idx = writing ? i : -1;
+		if ((writing ? !pi_file_type_id_used(pf, RESTYPE(i), RESID(i))
+		     : pi_file_read_resource_by_type_id(pf, RESTYPE(i),
+				RESID(i), &buf, &size, &idx) < 0)
+		    || idx != i) {
+			printf("%s: resource %d not found (got %d)\n", what, i,
+				idx);
+			errors++;
+		}
+	}
+	if (pi_file_type_id_used(pf, RESTYPE(0), n)
+	    || !pi_file_type_id_used(pf, RESTYPE(n - 1), RESID(n - 1))) {
+		printf("%s: pi_file_type_id_used wrong\n", what);
+		errors++;
+	}
+	return errors;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct DBInfo info;
+	struct timeval start;
+	pi_file_t *pf;
+	char	recname[] = "/tmp/pifile-lookupXXXXXX",
+		resname[] = "/tmp/pifile-lookupXXXXXX";
+	int	n = 30000,
+		errors = 0,
+		fd,
+		i;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if ((fd = mkstemp(recname)) < 0)
+		return 1;
+	close(fd);
+	if ((fd = mkstemp(resname)) < 0)
+		return 1;
+	close(fd);
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, "LookupTest");
+
+	gettimeofday(&start, NULL);
+	pf = pi_file_create(recname, &info);
+	for (i = 0; i < n; i++)
+		if (pi_file_append_record(pf, &i, sizeof(int), 0, 0,
+				uid_of(i)) < 0) {
+			printf("append of record %d failed\n", i);
+			errors++;
+		}
+	/* a second record with the same ID is refused */
+	if (pi_file_append_record(pf, &i, sizeof(int), 0, 0, uid_of(0)) >= 0) {
+		printf("duplicate record ID accepted\n");
+		errors++;
+	}
+	pi_file_close(pf);
+	printf("%d records appended in %.3fs\n", n, elapsed(&start));
+
+	info.flags = dlpDBFlagResource;
+	pf = pi_file_create(resname, &info);
+	for (i = 0; i < n; i++)
+		pi_file_append_resource(pf, &i, sizeof(int), RESTYPE(i),
+			RESID(i));
+	errors += check_resources(pf, n, 1, "resources while writing");
+	if (pi_file_append_resource(pf, &i, sizeof(int), RESTYPE(3),
+			RESID(3)) >= 0) {
+		printf("duplicate resource accepted\n");
+		errors++;
+	}
+	pi_file_close(pf);
+
+	gettimeofday(&start, NULL);
+	if ((pf = pi_file_open(recname)) == NULL)
+		return 1;
+	errors += check_records(pf, n, "records");
+	pi_file_close(pf);
+	if ((pf = pi_file_open_mapped(recname)) == NULL)
+		return 1;
+	errors += check_records(pf, n, "mapped records");
+	pi_file_close(pf);
+
+	if ((pf = pi_file_open(resname)) == NULL)
+		return 1;
+	errors += check_resources(pf, n, 0, "resources");
+	pi_file_close(pf);
+	if ((pf = pi_file_open_mapped(resname)) == NULL)
+		return 1;
+	errors += check_resources(pf, n, 0, "mapped resources");
+	pi_file_close(pf);
+	printf("%d lookups in %.3fs\n", 4 * n, elapsed(&start));
+
+	unlink(recname);
+	unlink(resname);
+	return errors ? 1 : 0;
+}
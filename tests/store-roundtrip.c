@@ -0,0 +1,229 @@
+/* store-roundtrip.c:  Check that the backup store gives databases back
+ *
+ * Writes record and resource databases, some empty and some with
+ * entries of every size from none to past the inline limit, adds them
+ * to a snapshot of a new store, and extracts them again: each must come
+ * back byte for byte. A second snapshot of the same databases must not
+ * write any new block.
+ *
+ * This is free software, licensed under the GNU Public License V2.
+ * See the file COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "pi-source.h"
+#include "pi-file.h"
+#include "pi-util.h"
+#include "pi-userland.h"
+
+#define NDBS	5
+
+static const char *dbs[NDBS] = {
+	"Empty.pdb", "EmptyRes.prc", "Records.pdb", "Resources.prc",
+	"Small.pdb"
+};
+
+static unsigned char data[6000];
+
+/* sizes cycle through 0 to 70 bytes, with a larger one now and then */
+static size_t
+size_of(int i)
+{
+	return i % 37 == 36 ? 1000 + (size_t) i * 10 : (size_t) (i % 71);
+}
+
+static int
+make_db(const char *dir, int which)
+{
+	struct DBInfo info;
+	pi_file_t *pf;
+	char	path[256];
+	int	i;
+
+	memset(&info, 0, sizeof(info));
+	strcpy(info.name, dbs[which]);
+	info.type = pi_mktag('D', 'A', 'T', 'A');
+	info.creator = pi_mktag('t', 'e', 's', 't');
+	info.version = 1;
+	info.modnum = (unsigned long) which;
+	info.createDate = 1000000000 + which;
+	info.modifyDate = 1100000000 + which;
+	info.backupDate = 1200000000 + which;
+	if (strstr(dbs[which], ".prc") != NULL)
+		info.flags = dlpDBFlagResource;
+
+	sprintf(path, "%s/%s", dir, dbs[which]);
+	if ((pf = pi_file_create(path, &info)) == NULL)
+		return -1;
+
+	switch (which) {
+	case 2:
+		pi_file_set_app_info(pf, data + 1, 40);
+		pi_file_set_sort_info(pf, data + 2, 300);
+		for (i = 0; i < 400; i++)
+			if (pi_file_append_record(pf, data + i, size_of(i),
+					i & 0x10, i % 16, (recordid_t) i + 1)
+			    < 0)
+				return -1;
+		break;
+	case 3:
+		pi_file_set_app_info(pf, data + 3, 64);
+		for (i = 0; i < 300; i++)
+			if (pi_file_append_resource(pf, data + i, size_of(i),
+					pi_mktag('t', 's', 't', 'a' + i % 5),
+					i) < 0)
+				return -1;
+		break;
+	case 4:
+		pi_file_append_record(pf, data, 0, 0, 0, 1);
+		pi_file_append_record(pf, data + 5, 64, 0, 1, 2);
+		break;
+	}
+	return pi_file_close(pf);
+}
+
+static int
+same_file(const char *a, const char *b)
+{
+	FILE	*fa,
+		*fb;
+	int	ca,
+		cb;
+
+	if ((fa = fopen(a, "rb")) == NULL)
+		return 0;
+	if ((fb = fopen(b, "rb")) == NULL) {
+		fclose(fa);
+		return 0;
+	}
+	do {
+		ca = getc(fa);
+		cb = getc(fb);
+	} while (ca == cb && ca != EOF);
+	fclose(fa);
+	fclose(fb);
+	return ca == cb;
+}
+
+static int
+snapshot(const char *dir, const char *name)
+{
+	plu_store_t *store;
+	pi_file_t *pf;
+	char	path[256];
+	int	i;
+
+	sprintf(path, "%s/store", dir);
+	if ((store = plu_store_open(path, name, 1)) == NULL) {
+		printf("%s: unable to open the store\n", name);
+		return -1;
+	}
+	for (i = 0; i < NDBS; i++) {
+		sprintf(path, "%s/%s", dir, dbs[i]);
+		if ((pf = pi_file_open(path)) == NULL
+		    || plu_store_add(store, pf, dbs[i]) < 0) {
+			printf("%s: unable to add %s\n", name, dbs[i]);
+			plu_store_close(store);
+			return -1;
+		}
+		pi_file_close(pf);
+	}
+	if (plu_store_commit(store) < 0) {
+		printf("%s: unable to commit\n", name);
+		plu_store_close(store);
+		return -1;
+	}
+	printf("%s: %lu new blocks, %lu shared\n", name, store->blobs,
+		store->shared);
+	i = (int) store->blobs;
+	plu_store_close(store);
+	return i;
+}
+
+static void
+remove_tree(const char *path)
+{
+	DIR	*dir;
+	struct dirent *dirent;
+	char	*sub;
+
+	if ((dir = opendir(path)) != NULL) {
+		while ((dirent = readdir(dir)) != NULL) {
+			if (strcmp(dirent->d_name, ".") == 0
+			    || strcmp(dirent->d_name, "..") == 0)
+				continue;
+			sub = malloc(strlen(path) + strlen(dirent->d_name) + 2);
+			sprintf(sub, "%s/%s", path, dirent->d_name);
+			remove_tree(sub);
+			free(sub);
+		}
+		closedir(dir);
+		rmdir(path);
+	} else {
+		unlink(path);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	plu_store_t *store;
+	char	dir[] = "/tmp/store-roundtripXXXXXX",
+		path[256],
+		copy[256];
+	int	errors = 0,
+		i;
+
+	for (i = 0; i < (int) sizeof(data); i++)
+		data[i] = (unsigned char) (i * 31 + (i >> 7));
+	if (mkdtemp(dir) == NULL)
+		return 1;
+
+	for (i = 0; i < NDBS; i++)
+		if (make_db(dir, i) < 0) {
+			printf("unable to write %s\n", dbs[i]);
+			errors++;
+		}
+	if (errors || snapshot(dir, "a") <= 0) {
+		errors++;
+		goto done;
+	}
+
+	sprintf(path, "%s/store", dir);
+	if ((store = plu_store_open(path, "a", 0)) == NULL) {
+		printf("unable to reopen snapshot a\n");
+		errors++;
+		goto done;
+	}
+	for (i = 0; i < NDBS; i++) {
+		sprintf(path, "%s/%s", dir, dbs[i]);
+		sprintf(copy, "%s/copy-%s", dir, dbs[i]);
+		if (plu_store_extract(store, dbs[i], copy) < 0) {
+			printf("unable to extract %s\n", dbs[i]);
+			errors++;
+		} else if (!same_file(path, copy)) {
+			printf("%s differs once extracted\n", dbs[i]);
+			errors++;
+		}
+	}
+	plu_store_close(store);
+
+	/* nothing changed, every block is there already */
+	if (snapshot(dir, "b") != 0) {
+		printf("second snapshot wrote new blocks\n");
+		errors++;
+	}
+
+done:
+	remove_tree(dir);
+	if (errors)
+		return 1;
+	printf("store round trip OK\n");
+	return 0;
+}
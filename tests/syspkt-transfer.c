@@ -0,0 +1,166 @@
+/* syspkt-transfer.c:  Check sys_ReadMemory() and sys_WriteMemory()
+ *
+ * Puts a fake debugger protocol under a socket and moves blocks of
+ * several packets through it, plain and pipelined, twice on the same
+ * socket. Like SLP, the fake protocol appends each reply to the buffer
+ * it is given.
+ *
+ * This is free software, licensed under the GNU Public License V2.
+ * See the file COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pi-source.h"
+#include "pi-syspkt.h"
+
+#define MEM_SIZE	4096
+#define MAX_QUEUED	(PI_SYS_MAX_PIPELINE + 1)
+
+static unsigned char memory[MEM_SIZE];
+
+/* requests written and not read back yet */
+static unsigned char queue[MAX_QUEUED][12];
+static int	queued,
+		requests;
+
+static ssize_t
+fake_write(pi_socket_t *ps, PI_CONST unsigned char *buf, size_t len,
+	int flags)
+{
+	unsigned long addr = get_long(buf + 6);
+	size_t	count = get_short(buf + 10);
+
+	if (queued == MAX_QUEUED || len < 12 || addr + count > MEM_SIZE)
+		return -1;
+	if (buf[4] == 0x02) {
+		if (len != 12 + count)
+			return -1;
+		memcpy(memory + addr, buf + 12, count);
+	}
+	memcpy(queue[queued++], buf, 12);
+	requests++;
+	return len;
+}
+
+static ssize_t
+fake_read(pi_socket_t *ps, pi_buffer_t *buf, size_t expect, int flags)
+{
+	unsigned char reply[6];
+	size_t	count = get_short(queue[0] + 10);
+	int	reading = queue[0][4] == 0x01;
+
+	if (queued == 0)
+		return -1;
+
+	memset(reply, 0, sizeof(reply));
+	reply[4] = queue[0][4] | 0x80;
+	pi_buffer_append(buf, reply, sizeof(reply));
+	if (reading)
+		pi_buffer_append(buf, memory + get_long(queue[0] + 6), count);
+
+	memmove(queue[0], queue[1], (size_t) --queued * 12);
+	return reading ? 6 + count : 6;
+}
+
+static int
+fake_flush(pi_socket_t *ps, int flags)
+{
+	queued = 0;
+	return 0;
+}
+
+static void
+fake_free(pi_protocol_t *prot)
+{
+}
+
+static pi_protocol_t fake = {
+	0, NULL, fake_free, fake_read, fake_write, fake_flush
+};
+
+static int
+check_read(int sd, unsigned long addr, unsigned long len, int depth)
+{
+	static unsigned char buf[MEM_SIZE];
+	int	result;
+
+	memset(buf, 0, len);
+	requests = 0;
+	result = depth > 1
+		? sys_ReadMemoryPipelined(sd, addr, len, buf, depth)
+		: sys_ReadMemory(sd, addr, len, buf);
+	if (result != (int) len || memcmp(buf, memory + addr, len) != 0
+	    || requests != (int) ((len + PI_SYS_MEM_CHUNK - 1)
+			/ PI_SYS_MEM_CHUNK)) {
+		printf("read of %lu at %lu, depth %d: got %d in %d requests\n",
+			len, addr, depth, result, requests);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+check_write(int sd, unsigned long addr, unsigned long len, int depth)
+{
+	static unsigned char buf[MEM_SIZE];
+	unsigned long i;
+	int	result;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char) (i * 7 + depth);
+	result = depth > 1
+		? sys_WriteMemoryPipelined(sd, addr, len, buf, depth)
+		: sys_WriteMemory(sd, addr, len, buf);
+	if (result != (int) len || memcmp(buf, memory + addr, len) != 0) {
+		printf("write of %lu at %lu, depth %d: got %d\n", len, addr,
+			depth, result);
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int	errors = 0,
+		i,
+		sd;
+	pi_socket_t *ps;
+
+	for (i = 0; i < MEM_SIZE; i++)
+		memory[i] = (unsigned char) (i * 13 + (i >> 8));
+
+	sd = pi_socket(PI_AF_PILOT, PI_SOCK_RAW, PI_PF_DEV);
+	if (sd < 0 || (ps = find_pi_socket(sd)) == NULL) {
+		printf("pi_socket failed\n");
+		return 1;
+	}
+	ps->protocol_queue = malloc(sizeof(pi_protocol_t *));
+	ps->protocol_queue[0] = &fake;
+	ps->queue_len = 1;
+	ps->state = PI_SOCK_CONN_INIT;
+
+	/* each call twice, the socket's buffer carries over */
+	for (i = 0; i < 2; i++) {
+		errors += check_read(sd, 0, 3200, 1);
+		errors += check_read(sd, 17, 1000, 4);
+		errors += check_read(sd, 100, PI_SYS_MEM_CHUNK, 1);
+		errors += check_write(sd, 300, 1500, 1);
+		errors += check_read(sd, 300, 1500, 1);
+		errors += check_write(sd, 5, 2000, PI_SYS_MAX_PIPELINE);
+		errors += check_read(sd, 5, 2000, PI_SYS_MAX_PIPELINE);
+	}
+
+	ps->state = PI_SOCK_CLOSE;
+	pi_close(sd);
+
+	if (errors) {
+		printf("%d transfers failed\n", errors);
+		return 1;
+	}
+	printf("sys transfers OK\n");
+	return 0;
+}